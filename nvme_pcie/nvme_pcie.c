@@ -28,9 +28,9 @@ static void NVMEPCIECompleteAsyncCommand(NVMEPCIEQueueInfo *qinfo,
                                          NVMEPCIECmdInfo *cmdInfo);
 static void NVMEPCIECompleteSyncCommand(NVMEPCIEQueueInfo *qinfo,
                                         NVMEPCIECmdInfo *cmdInfo);
-static vmk_NvmeStatus NVMEPCIEIssueCommandToHw(NVMEPCIEQueueInfo *qinfo,
-                                               NVMEPCIECmdInfo *cmdInfo,
-                                               NVMEPCIECompleteCommandCb cb);
+static NVME_PCIE_ALWAYS_INLINE vmk_NvmeStatus
+IssueCommandToHwVariant(NVMEPCIEQueueInfo *qinfo, NVMEPCIECmdInfo *cmdInfo,
+                        NVMEPCIECompleteCommandCb cb, const vmk_uint32 flags);
 static NVMEPCIECmdInfo* NVMEPCIEGetCmdInfo(NVMEPCIEQueueInfo *qinfo,
                                            vmk_uint16 cid);
 static NVMEPCIECmdInfo* NVMEPCIEGetCmdInfoLegacy(NVMEPCIEQueueInfo *qinfo);
@@ -386,7 +386,7 @@ CmdInfoListConstruct(NVMEPCIEQueueInfo *qinfo, int qsize)
    int i, idCount;
 
    ctrlr = qinfo->ctrlr;
-   idCount = qsize * 2 + NVME_PCIE_SYNC_CMD_NUM;
+   idCount = qsize * 2 + nvmePCIESyncCmdNum;
 
    /** Allocate cmdInfoList struct */
    cmdList = NVMEPCIEAlloc(sizeof(*cmdList), 0);
@@ -411,13 +411,39 @@ CmdInfoListConstruct(NVMEPCIEQueueInfo *qinfo, int qsize)
       goto free_cmdlist;
    }
 
+   /** Create sync command pool lock */
+   vmk_StringFormat(lockName, sizeof(lockName), NULL,
+                    "syncLock-%s-%d",
+                     NVMEPCIEGetCtrlrName(ctrlr), qinfo->cqInfo->id);
+
+   vmkStatus = NVMEPCIELockCreate(ctrlr->osRes.lockDomain,
+                                  NVME_LOCK_RANK_HIGHEST,
+                                  lockName, &cmdList->syncPool.lock);
+   if (vmkStatus != VMK_OK) {
+      EPRINT(ctrlr, "Failed to create sync pool lock for queue %d, 0x%x.",
+             qinfo->id, vmkStatus);
+      goto free_lock;
+   }
+   cmdList->syncPool.size = nvmePCIESyncCmdNum;
+   vmk_ListInit(&cmdList->syncPool.waiters);
+
    /** Allocate cmd info array */
    cmdInfo = NVMEPCIEAlloc(idCount * sizeof(*cmdInfo), 0);
    if (cmdInfo == NULL) {
       EPRINT(ctrlr, "Failed to allocate cmd info array for queue %d.", qinfo->id);
       vmkStatus = VMK_NO_MEMORY;
-      goto free_lock;
+      goto free_synclock;
+   }
+
+#if NVME_PCIE_STORAGE_POLL
+   cmdList->issueRing = NVMEPCIEAlloc(idCount * sizeof(vmk_uint16), 0);
+   if (cmdList->issueRing == NULL) {
+      EPRINT(ctrlr, "Failed to allocate issue ring for queue %d.", qinfo->id);
+      NVMEPCIEFree(cmdInfo);
+      vmkStatus = VMK_NO_MEMORY;
+      goto free_synclock;
    }
+#endif
 
    cmdList->list = cmdInfo;
    cmdList->idCount = idCount;
@@ -430,6 +456,9 @@ CmdInfoListConstruct(NVMEPCIEQueueInfo *qinfo, int qsize)
             qinfo->id, cmdList, cmdList->list, cmdList->idCount);
    return VMK_OK;
 
+free_synclock:
+   NVMEPCIELockDestroy(&cmdList->syncPool.lock);
+
 free_lock:
    NVMEPCIELockDestroy(&cmdList->lock);
 
@@ -460,6 +489,13 @@ CmdInfoListDestroy(NVMEPCIEQueueInfo *qinfo)
    NVMEPCIEFree(cmdList->list);
    cmdList->list = NULL;
    DPRINT_Q(ctrlr, "Free cmd info array for queue %d.", qinfo->id);
+#if NVME_PCIE_STORAGE_POLL
+   NVMEPCIEFree(cmdList->issueRing);
+   cmdList->issueRing = NULL;
+#endif
+
+   VMK_ASSERT(vmk_ListIsEmpty(&cmdList->syncPool.waiters));
+   NVMEPCIELockDestroy(&cmdList->syncPool.lock);
 
    NVMEPCIELockDestroy(&cmdList->lock);
    DPRINT_Q(ctrlr, "Free cmdList lock for queue %d.", qinfo->id);
@@ -483,6 +519,8 @@ static VMK_ReturnStatus
 QueueStatsContruct(NVMEPCIEQueueInfo *qinfo)
 {
    NVMEPCIEController *ctrlr = qinfo->ctrlr;
+   NVMEPCIECpuStats *cpuStats;
+
    qinfo->stats = NVMEPCIEAlloc(sizeof(NVMEPCIEQueueStats), 0);
    if (NULL == qinfo->stats) {
       EPRINT(ctrlr, "Failed to allocate stats for queue %d", qinfo->id);
@@ -491,12 +529,29 @@ QueueStatsContruct(NVMEPCIEQueueInfo *qinfo)
    qinfo->stats->cqHead = 0;
    qinfo->stats->cqePhase = 1;
    qinfo->stats->intrCount = 0;
+
+   cpuStats = &qinfo->stats->cpuStats;
+   cpuStats->numCpus = vmk_NumPCPUs();
+   if (cpuStats->numCpus == 0 || cpuStats->numCpus > NVME_PCIE_CPU_STATS_MAX) {
+      cpuStats->numCpus = NVME_PCIE_CPU_STATS_MAX;
+   }
+   cpuStats->submits = NVMEPCIEAlloc(cpuStats->numCpus * sizeof(vmk_uint64),
+                                     0);
+   if (cpuStats->submits == NULL) {
+      EPRINT(ctrlr, "Failed to allocate cpu stats for queue %d", qinfo->id);
+      NVMEPCIEFree(qinfo->stats);
+      qinfo->stats = NULL;
+      return VMK_NO_MEMORY;
+   }
    return VMK_OK;
 }
 
 static VMK_ReturnStatus
 QueueStatsDestroy(NVMEPCIEQueueInfo *qinfo)
 {
+   if (qinfo->stats != NULL) {
+      NVMEPCIEFree(qinfo->stats->cpuStats.submits);
+   }
    NVMEPCIEFree(qinfo->stats);
    qinfo->stats = NULL;
    DPRINT_Q(qinfo->ctrlr, "Free stats for queue %d", qinfo->id);
@@ -506,6 +561,9 @@ QueueStatsDestroy(NVMEPCIEQueueInfo *qinfo)
 /**
  * Walk through CQ, collect nvme-stats.
  *
+ * With statistics sampling the walk is skipped, completion processing
+ * stamps the sampled commands of a batch instead.
+ *
  * @param[in] qinfo      Queue instance
  * @param[in] countIntr  Whether to count interrupts
  */
@@ -526,6 +584,18 @@ NVMEPCIEStatsWalkThrough(NVMEPCIEQueueInfo *qinfo, vmk_Bool countIntr)
       return;
    }
    stats = qinfo->stats;
+
+   // In interruption mode, count interrupts while not in polling mode
+   if (countIntr) {
+      stats->intrCount ++;
+   }
+
+   if (ctrlr->statsSampleMask != 0) {
+      // Resume from the current CQ head once sampling is off
+      stats->cqHead = cqInfo->head;
+      stats->cqePhase = cqInfo->phase;
+      return;
+   }
    cmdList = qinfo->cmdList;
    /**
     * Walk through CQ, collect time stamp of arrival of entries.
@@ -537,11 +607,6 @@ NVMEPCIEStatsWalkThrough(NVMEPCIEQueueInfo *qinfo, vmk_Bool countIntr)
    phase = stats->cqePhase;
    ts = vmk_GetTimerCycles();
 
-   // In interruption mode, count interrupts while not in polling mode
-   if (countIntr) {
-      stats->intrCount ++;
-   }
-
    while (1) {
       cqEntry = &cqInfo->compq[head];
       if (cqEntry->dw3.p != phase) {
@@ -569,6 +634,27 @@ NVMEPCIEStatsWalkThrough(NVMEPCIEQueueInfo *qinfo, vmk_Bool countIntr)
 }
 #endif
 
+/**
+ * Sum the references of a queue held on all PCPUs
+ *
+ * Only called on queue state transitions, never on the I/O path.
+ *
+ * @param[in] qinfo  Queue instance
+ *
+ * @return Number of references currently held
+ */
+static vmk_uint32
+QueueRefSum(NVMEPCIEQueueInfo *qinfo)
+{
+   vmk_uint32 i, sum = 0;
+
+   vmk_CPUMemFenceReadWrite();
+   for (i = 0; i < NVME_PCIE_QUEUE_REF_SLOTS; i++) {
+      sum += vmk_AtomicRead32(&qinfo->refs[i].count);
+   }
+   return sum;
+}
+
 /**
  * Allocate queue resources
  *
@@ -593,7 +679,6 @@ QueueConstruct(NVMEPCIEController *ctrlr, NVMEPCIEQueueInfo *qinfo,
    qinfo->id = qid;
 
    vmk_AtomicWrite32(&qinfo->state, NVME_PCIE_QUEUE_SUSPENDED);
-   vmk_AtomicWrite32(&qinfo->refCount, 0);
 
    vmkStatus = CompQueueConstruct(qinfo, qid, cqsize, intrIndex);
    if (vmkStatus != VMK_OK) {
@@ -661,7 +746,7 @@ QueueDestroy(NVMEPCIEQueueInfo *qinfo)
    NVMEPCIEController *ctrlr = qinfo->ctrlr;
 
    vmk_AtomicWrite32(&qinfo->state, NVME_PCIE_QUEUE_NON_EXIST);
-   while(vmk_AtomicRead32(&qinfo->refCount) != 0) {
+   while(QueueRefSum(qinfo) != 0) {
       WPRINT(ctrlr, "Wait for queue %d refcount to be zero", qinfo->id);
       vmk_WorldSleep(1000);
    }
@@ -717,9 +802,9 @@ NVMEPCIECtrlMsiHandler(void *handlerData, vmk_IntrCookie intrCookie)
 
    for (i = 1; i <= ctrlr->numIoQueues; i++) {
       qinfo = &ctrlr->queueList[i];
-      vmk_SpinlockLock(qinfo->cqInfo->lock);
+      NVME_PCIE_QUEUE_LOCK(qinfo->cqInfo);
       NVMEPCIEProcessCq(qinfo);
-      vmk_SpinlockUnlock(qinfo->cqInfo->lock);
+      NVME_PCIE_QUEUE_UNLOCK(qinfo->cqInfo);
    }
 }
 
@@ -758,6 +843,8 @@ NVMEPCIEQueueIntrHandler(void *handlerData, vmk_IntrCookie intrCookie)
    vmk_StoragePollState pollState = VMK_STORAGEPOLL_DISABLED;
 #endif
 
+   qinfo->counters.event.intrs++;
+
 #if NVME_PCIE_STORAGE_POLL
    /**
     * To avoid the following unnecessary process when interrupt has been
@@ -772,17 +859,18 @@ NVMEPCIEQueueIntrHandler(void *handlerData, vmk_IntrCookie intrCookie)
       if (VMK_LIKELY(pollState != VMK_STORAGEPOLL_DISABLED)) {
          // Do not synchronize interrupt here to avoid endless waiting
          NVMEPCIEDisableIntr(qinfo, VMK_FALSE);
+         NVMEPCIEStoragePollSetMode(qinfo, NVME_PCIE_POLL_MODE_POLL);
          vmk_StoragePollActivate(qinfo->pollHandler);
       }
    } else {
-      vmk_SpinlockLock(qinfo->cqInfo->lock);
+      NVME_PCIE_QUEUE_LOCK(qinfo->cqInfo);
       NVMEPCIEProcessCq(qinfo);
-      vmk_SpinlockUnlock(qinfo->cqInfo->lock);
+      NVME_PCIE_QUEUE_UNLOCK(qinfo->cqInfo);
    }
 #else
-   vmk_SpinlockLock(qinfo->cqInfo->lock);
+   NVME_PCIE_QUEUE_LOCK(qinfo->cqInfo);
    NVMEPCIEProcessCq(qinfo);
-   vmk_SpinlockUnlock(qinfo->cqInfo->lock);
+   NVME_PCIE_QUEUE_UNLOCK(qinfo->cqInfo);
 #endif
 }
 
@@ -810,27 +898,10 @@ NVMEPCIEGetCmdInfo(NVMEPCIEQueueInfo *qinfo, vmk_uint16 cid)
    NVMEPCIECmdInfo *cmdInfo = NULL;
    NVMEPCIEController *ctrlr = qinfo->ctrlr;
    NVMEPCIECmdInfoList *cmdList = qinfo->cmdList;
-   int i;
 
-   if (VMK_LIKELY(cid != NVME_PCIE_SYNC_CMD_ID)) {
-      cmdInfo = &cmdList->list[cid];
-      VMK_ASSERT(vmk_AtomicRead32(&cmdInfo->atomicStatus) == NVME_PCIE_CMD_STATUS_FREE);
-      vmk_AtomicWrite32(&cmdInfo->atomicStatus, NVME_PCIE_CMD_STATUS_ACTIVE);
-   } else {
-      for (i = cmdList->idCount; i > cmdList->idCount - NVME_PCIE_SYNC_CMD_NUM; i--) {
-         cmdInfo = &cmdList->list[i-1];
-         if (vmk_AtomicReadIfEqualWrite32(&cmdInfo->atomicStatus,
-                                          NVME_PCIE_CMD_STATUS_FREE,
-                                          NVME_PCIE_CMD_STATUS_ACTIVE)
-                                       == NVME_PCIE_CMD_STATUS_FREE) {
-            break;
-         }
-      }
-      if (i == cmdList->idCount - NVME_PCIE_SYNC_CMD_NUM) {
-         WPRINT(ctrlr, "Failed to get free command info.");
-         return NULL;
-      }
-   }
+   cmdInfo = &cmdList->list[cid];
+   VMK_ASSERT(vmk_AtomicRead32(&cmdInfo->atomicStatus) == NVME_PCIE_CMD_STATUS_FREE);
+   vmk_AtomicWrite32(&cmdInfo->atomicStatus, NVME_PCIE_CMD_STATUS_ACTIVE);
 
    vmk_AtomicInc32(&qinfo->cmdList->nrAct);
 
@@ -864,7 +935,7 @@ NVMEPCIEGetCmdInfoLegacy(NVMEPCIEQueueInfo *qinfo)
    NVMEPCIEController *ctrlr = qinfo->ctrlr;
    NVMEPCIECmdInfoList *cmdList = qinfo->cmdList;
 
-   vmk_SpinlockLock(cmdList->lock);
+   NVME_PCIE_QUEUE_LOCK(cmdList);
 
    if (VMK_UNLIKELY(cmdList->freeCmdList == 0)) {
       cmdList->freeCmdList = NVMEPCIEFlushFreeCmdInfo(qinfo);
@@ -875,7 +946,7 @@ NVMEPCIEGetCmdInfoLegacy(NVMEPCIEQueueInfo *qinfo)
           */
          WPRINT(ctrlr, "Queue[%d] command list empty. %d", qinfo->id,
                 vmk_AtomicRead32(&cmdList->nrAct));
-         vmk_SpinlockUnlock(cmdList->lock);
+         NVME_PCIE_QUEUE_UNLOCK(cmdList);
          return NULL;
       }
    }
@@ -885,7 +956,7 @@ NVMEPCIEGetCmdInfoLegacy(NVMEPCIEQueueInfo *qinfo)
    vmk_AtomicInc32(&cmdList->nrAct);
    vmk_AtomicWrite32(&cmdInfo->atomicStatus, NVME_PCIE_CMD_STATUS_ACTIVE);
 
-   vmk_SpinlockUnlock(cmdList->lock);
+   NVME_PCIE_QUEUE_UNLOCK(cmdList);
 #ifdef NVME_STATS
    cmdInfo->sendToHwTs = 0;
    cmdInfo->doneByHwTs = 0;
@@ -898,6 +969,152 @@ NVMEPCIEGetCmdInfoLegacy(NVMEPCIEQueueInfo *qinfo)
    return cmdInfo;
 }
 
+/**
+ * Check whether a command info belongs to the sync command pool
+ */
+static inline vmk_Bool
+NVMEPCIEIsSyncCmdInfo(NVMEPCIECmdInfoList *cmdList, NVMEPCIECmdInfo *cmdInfo)
+{
+   return cmdInfo->cmdId > cmdList->idCount - cmdList->syncPool.size;
+}
+
+/**
+ * Get a command info from the sync command pool of a queue
+ *
+ * If the pool is empty, wait in FIFO order until a slot is released, the
+ * queue leaves active state or the timeout expires.
+ *
+ * @param[in] qinfo      Queue instance
+ * @param[in] timeoutUs  Maximum time to wait for a free slot
+ *
+ * @return pointer to the command info
+ * @return NULL if no slot became available
+ */
+static NVMEPCIECmdInfo*
+NVMEPCIEGetSyncCmdInfo(NVMEPCIEQueueInfo *qinfo, vmk_uint64 timeoutUs)
+{
+   NVMEPCIECmdInfo *cmdInfo = NULL;
+   NVMEPCIEController *ctrlr = qinfo->ctrlr;
+   NVMEPCIECmdInfoList *cmdList = qinfo->cmdList;
+   NVMEPCIESyncCmdPool *pool = &cmdList->syncPool;
+   NVMEPCIESyncCmdWaiter waiter;
+   vmk_uint64 now, deadline, sleepUs;
+   VMK_ReturnStatus vmkStatus;
+
+   vmk_SpinlockLock(pool->lock);
+   pool->allocs++;
+
+   if (VMK_LIKELY(pool->freeList != 0 && vmk_ListIsEmpty(&pool->waiters))) {
+      cmdInfo = &cmdList->list[pool->freeList - 1];
+      pool->freeList = cmdInfo->freeLink;
+      pool->numFree--;
+      vmk_SpinlockUnlock(pool->lock);
+      goto found;
+   }
+
+   waiter.cmdInfo = NULL;
+   vmk_ListInitElement(&waiter.list);
+   vmk_ListInsert(&waiter.list, vmk_ListAtRear(&pool->waiters));
+   pool->waits++;
+   if (++pool->numWaiters > pool->maxWaiters) {
+      pool->maxWaiters = pool->numWaiters;
+   }
+
+   deadline = NVMEPCIEGetTimerUs() + timeoutUs;
+   while (waiter.cmdInfo == NULL) {
+      /**
+       * Slots freed while nobody could hand them over (e.g. queue
+       * re-initialized) are picked up by the oldest waiter.
+       */
+      if (pool->freeList != 0 && vmk_ListFirst(&pool->waiters) == &waiter.list) {
+         waiter.cmdInfo = &cmdList->list[pool->freeList - 1];
+         pool->freeList = waiter.cmdInfo->freeLink;
+         pool->numFree--;
+         vmk_ListRemove(&waiter.list);
+         pool->numWaiters--;
+         break;
+      }
+      now = NVMEPCIEGetTimerUs();
+      if (now >= deadline ||
+          vmk_AtomicRead32(&qinfo->state) != NVME_PCIE_QUEUE_ACTIVE) {
+         break;
+      }
+      sleepUs = deadline - now;
+      if (sleepUs > NVME_PCIE_SYNC_CMD_WAIT_SLICE) {
+         sleepUs = NVME_PCIE_SYNC_CMD_WAIT_SLICE;
+      }
+      /** vmk_WorldWait() releases pool lock. */
+      vmkStatus = vmk_WorldWait((vmk_WorldEventID)&waiter, pool->lock,
+                                (sleepUs + 999) / 1000, __FUNCTION__);
+      vmk_SpinlockLock(pool->lock);
+      if (vmkStatus != VMK_OK && vmkStatus != VMK_TIMEOUT) {
+         break;
+      }
+   }
+
+   if (waiter.cmdInfo == NULL) {
+      vmk_ListRemove(&waiter.list);
+      pool->numWaiters--;
+      pool->timeouts++;
+      vmk_SpinlockUnlock(pool->lock);
+      WPRINT(ctrlr, "Failed to get free sync command info of queue %d.",
+             qinfo->id);
+      return NULL;
+   }
+   cmdInfo = waiter.cmdInfo;
+   vmk_SpinlockUnlock(pool->lock);
+
+found:
+   vmk_AtomicWrite32(&cmdInfo->atomicStatus, NVME_PCIE_CMD_STATUS_ACTIVE);
+   vmk_AtomicInc32(&cmdList->nrAct);
+
+#ifdef NVME_STATS
+   cmdInfo->sendToHwTs = 0;
+   cmdInfo->doneByHwTs = 0;
+   cmdInfo->statsOn = VMK_FALSE;
+#endif
+   DPRINT_CMD(ctrlr, qinfo->id, "Get sync cmdInfo [%d] %p from queue [%d], nrAct: %d.",
+              cmdInfo->cmdId, cmdInfo, qinfo->id,
+              vmk_AtomicRead32(&cmdList->nrAct));
+
+   return cmdInfo;
+}
+
+/**
+ * Return a command info to the sync command pool of a queue
+ *
+ * Hand the slot to the oldest waiter if any, otherwise link it to the free
+ * list.
+ *
+ * @param[in] qinfo    Queue instance
+ * @param[in] cmdInfo  Command info
+ */
+static void
+NVMEPCIEPutSyncCmdInfo(NVMEPCIEQueueInfo *qinfo, NVMEPCIECmdInfo *cmdInfo)
+{
+   NVMEPCIESyncCmdPool *pool = &qinfo->cmdList->syncPool;
+   NVMEPCIESyncCmdWaiter *waiter;
+   vmk_WorldEventID eventId;
+
+   vmk_SpinlockLock(pool->lock);
+   if (!vmk_ListIsEmpty(&pool->waiters)) {
+      waiter = VMK_LIST_ENTRY(vmk_ListFirst(&pool->waiters),
+                              NVMEPCIESyncCmdWaiter, list);
+      vmk_ListRemove(&waiter->list);
+      pool->numWaiters--;
+      waiter->cmdInfo = cmdInfo;
+      /** waiter may return as soon as the lock is dropped. */
+      eventId = (vmk_WorldEventID)waiter;
+      vmk_SpinlockUnlock(pool->lock);
+      vmk_WorldWakeup(eventId);
+      return;
+   }
+   cmdInfo->freeLink = pool->freeList;
+   pool->freeList = cmdInfo->cmdId;
+   pool->numFree++;
+   vmk_SpinlockUnlock(pool->lock);
+}
+
 static inline void
 NVMEPCIEPushCmdInfo(NVMEPCIEQueueInfo *qinfo, NVMEPCIECmdInfo *cmdInfo)
 {
@@ -928,11 +1145,23 @@ static void
 NVMEPCIEPutCmdInfo(NVMEPCIEQueueInfo *qinfo, NVMEPCIECmdInfo *cmdInfo)
 {
    NVMEPCIEController *ctrlr = qinfo->ctrlr;
+
+   if (cmdInfo->stallTracked) {
+      cmdInfo->stallTracked = VMK_FALSE;
+      vmk_AtomicDec32(&qinfo->stallWheel.bucket[cmdInfo->stallTick %
+                                                NVME_PCIE_STALL_WHEEL_SLOTS]);
+   }
+#if NVME_PCIE_STORAGE_POLL
+   cmdInfo->latTracked = VMK_FALSE;
+#endif
+   cmdInfo->isSmall = VMK_FALSE;
    vmk_AtomicWrite32(&cmdInfo->atomicStatus, NVME_PCIE_CMD_STATUS_FREE);
 
    vmk_AtomicDec32(&qinfo->cmdList->nrAct);
 
-   if (!ctrlr->abortEnabled) {
+   if (NVMEPCIEIsSyncCmdInfo(qinfo->cmdList, cmdInfo)) {
+      NVMEPCIEPutSyncCmdInfo(qinfo, cmdInfo);
+   } else if (!ctrlr->abortEnabled) {
       NVMEPCIEPushCmdInfo(qinfo, cmdInfo);
    }
    DPRINT_CMD(ctrlr, qinfo->id, "Put cmdInfo [%d] %p back to queue [%d], nrAct: %d.",
@@ -980,127 +1209,519 @@ NVMEPCIEGetCmdNlb(vmk_NvmeCommand *vmkCmd)
 }
 
 /**
- * Whether 'vmkCmd' is a small block size IO command.
+ * Get transfer size of an IO command.
  *
+ * nlb in LBA data size of the namespace, which is looked up from
+ * 'lbaShift' cache.
+ *
+ * @param[in] ctrlr    Controller instance
  * @param[in] qid      Queue ID
  * @param[in] vmkCmd   'vmk_NvmeCommand' type command
  *
- * @return VMK_TRUE   'vmkCmd' is a small block size IO command
- * @return VMK_FALSE  'vmkCmd' is not a small block size IO command
+ * @return    0        Not an IO command or no transfer size
+ * @return    Not 0    Transfer size in bytes
  */
-VMK_INLINE vmk_Bool
-NVMEPCIEIsSmallBsIoCmd(vmk_uint32 qid,
-                       vmk_NvmeCommand *vmkCmd)
+VMK_INLINE vmk_uint64
+NVMEPCIEGetCmdBytes(NVMEPCIEController *ctrlr,
+                    vmk_uint32 qid,
+                    vmk_NvmeCommand *vmkCmd)
 {
-   vmk_Bool ret = VMK_FALSE;
-   vmk_uint16 nlb;
+   vmk_uint32 nsid;
+   vmk_uint8 shift = 0;
 
-   if (qid > 0) {
-      nlb = NVMEPCIEGetCmdNlb(vmkCmd);
+   if (qid == 0) {
+      return 0;
+   }
 
-      if ((nlb > 0) && (nlb <= NVME_PCIE_SMALL_NLB)) {
-         ret = VMK_TRUE;
-      }
+   nsid = vmkCmd->nvmeCmd.nsid;
+   if (nsid <= NVME_PCIE_LBA_CACHE_NS) {
+      shift = ctrlr->lbaShift[nsid];
+   }
+   if (shift == 0) {
+      shift = NVME_PCIE_LBA_SHIFT_DEFAULT;
    }
 
-   return ret;
+   return (vmk_uint64)NVMEPCIEGetCmdNlb(vmkCmd) << shift;
 }
 
 /**
- * Submit a command to a queue
+ * Whether 'vmkCmd' is a small block size IO command.
  *
- * @param[in] ctrlr   Controller instance
- * @param[in] vmkCmd  NVME command
- * @param[in] qid     Queue ID
+ * The transfer size is nlb in LBA data size of the namespace, which is
+ * looked up from 'lbaShift' cache.
  *
- * @return VMK_OK Command submitted successfully
- * @return VMK_FAILURE Failed to submit command
+ * @param[in] ctrlr    Controller instance
+ * @param[in] qid      Queue ID
+ * @param[in] vmkCmd   'vmk_NvmeCommand' type command
+ *
+ * @return VMK_TRUE   'vmkCmd' is a small block size IO command
+ * @return VMK_FALSE  'vmkCmd' is not a small block size IO command
  */
-VMK_ReturnStatus
-NVMEPCIESubmitAsyncCommand(NVMEPCIEController *ctrlr,
-                           vmk_NvmeCommand *vmkCmd,
-                           vmk_uint32 qid)
+VMK_INLINE vmk_Bool
+NVMEPCIEIsSmallBsIoCmd(NVMEPCIEController *ctrlr,
+                       vmk_uint32 qid,
+                       vmk_NvmeCommand *vmkCmd)
 {
-   NVMEPCIECmdInfo *cmdInfo;
-   NVMEPCIEQueueInfo *qinfo;
-   vmk_NvmeStatus nvmeStatus;
-   vmk_uint16 cid;
+   vmk_uint64 bytes = NVMEPCIEGetCmdBytes(ctrlr, qid, vmkCmd);
 
-   qinfo = &ctrlr->queueList[qid];
-   vmk_AtomicInc32(&qinfo->refCount);
-   if (vmk_AtomicRead32(&qinfo->state) != NVME_PCIE_QUEUE_ACTIVE) {
-      vmkCmd->nvmeStatus = VMK_NVME_STATUS_VMW_IN_RESET;
-      vmk_AtomicDec32(&qinfo->refCount);
-      return VMK_FAILURE;
-   }
+   return (bytes > 0) && (bytes <= vmk_AtomicRead32(&ctrlr->smallIoBytes));
+}
 
-   if (ctrlr->abortEnabled) {
-      cid = vmkCmd->nvmeCmd.cdw0.cid;
-      VMK_ASSERT(cid < qinfo->cmdList->idCount - NVME_PCIE_SYNC_CMD_NUM);
-      if (VMK_UNLIKELY(cid >= qinfo->cmdList->idCount - NVME_PCIE_SYNC_CMD_NUM)) {
-         vmkCmd->nvmeStatus = VMK_NVME_STATUS_VMW_BAD_PARAMETER;
-         vmk_AtomicDec32(&qinfo->refCount);
-         return VMK_FAILURE;
-      }
-      cmdInfo = NVMEPCIEGetCmdInfo(qinfo, cid);
-   } else {
-      cmdInfo = NVMEPCIEGetCmdInfoLegacy(qinfo);
-   }
-   if (cmdInfo == NULL) {
-      vmkCmd->nvmeStatus = VMK_NVME_STATUS_VMW_QUEUE_FULL;
-      vmk_AtomicDec32(&qinfo->refCount);
-      return VMK_FAILURE;
+/**
+ * Driver side completion of an async admin command, before its done
+ * callback
+ *
+ * @param[in] ctrlr    Controller instance
+ * @param[in] vmkCmd   Completed admin command
+ */
+static void
+AdminCommandDone(NVMEPCIEController *ctrlr, vmk_NvmeCommand *vmkCmd)
+{
+   switch (vmkCmd->nvmeCmd.cdw0.opc) {
+      case VMK_NVME_ADMIN_CMD_IDENTIFY:
+         if (ctrlr->bringup.identifyUs != 0) {
+            NVMEPCIEBringupIdentifyDone(ctrlr);
+         }
+         break;
+      case VMK_NVME_ADMIN_CMD_FORMAT_NVM:
+         /**
+          * The cache was invalidated on submission. Refresh it whether the
+          * format succeeded or not, the namespace keeps its old format on
+          * failure.
+          */
+         NVMEPCIELbaCacheRefreshRequest(ctrlr);
+         break;
+      default:
+         break;
    }
+}
 
-#if NVME_PCIE_BLOCKSIZE_AWARE
-   if (vmk_AtomicRead8(&ctrlr->blkSizeAwarePollAct) &&
-       NVMEPCIEIsSmallBsIoCmd(qid, vmkCmd)) {
-      vmk_AtomicInc32(&qinfo->cmdList->nrActSmall);
+/**
+ * Invalidate cached LBA data size of a namespace
+ *
+ * @param[in] ctrlr    Controller instance
+ * @param[in] nsid     Namespace ID, NVME_PCIE_NSID_ALL for all
+ */
+static void
+LbaCacheInvalidate(NVMEPCIEController *ctrlr, vmk_uint32 nsid)
+{
+   if (nsid == NVME_PCIE_NSID_ALL) {
+      vmk_Memset(ctrlr->lbaShift, 0, sizeof(ctrlr->lbaShift));
+   } else if (nsid <= NVME_PCIE_LBA_CACHE_NS) {
+      ctrlr->lbaShift[nsid] = 0;
    }
-#endif
-
-   cmdInfo->vmkCmd = vmkCmd;
-   cmdInfo->type = NVME_PCIE_ASYNC_CONTEXT;
+   IPRINT(ctrlr, "LBA data size of namespace 0x%x invalidated.", nsid);
+}
 
-   nvmeStatus = NVMEPCIEIssueCommandToHw(qinfo, cmdInfo, NVMEPCIECompleteAsyncCommand);
+/**
+ * Get name of a trace event type
+ *
+ * @param[in] type  NVME_PCIE_TRACE_*
+ *
+ * @return Name of the type
+ */
+const char *
+NVMEPCIETraceTypeName(vmk_uint8 type)
+{
+   static const char *names[NVME_PCIE_TRACE_TYPE_NUM] = {
+      "none", "submit", "doorbell", "hwdone", "complete", "abort", "timeout",
+   };
 
-   if (VMK_UNLIKELY(nvmeStatus != VMK_NVME_STATUS_VMW_WOULD_BLOCK)) {
-      vmkCmd->nvmeStatus = nvmeStatus;
-      WPRINT(ctrlr, "Failed to issue command %d, 0x%x", cmdInfo->cmdId, nvmeStatus);
-#if NVME_PCIE_BLOCKSIZE_AWARE
-      if (vmk_AtomicRead8(&ctrlr->blkSizeAwarePollAct) &&
-          NVMEPCIEIsSmallBsIoCmd(qid, vmkCmd)) {
-         vmk_AtomicDec32(&qinfo->cmdList->nrActSmall);
-      }
-#endif
-      NVMEPCIEPutCmdInfo(qinfo, cmdInfo);
-      vmk_AtomicDec32(&qinfo->refCount);
-      return VMK_FAILURE;
-   }
+   return type < NVME_PCIE_TRACE_TYPE_NUM ? names[type] : "unknown";
+}
 
-   vmk_AtomicDec32(&qinfo->refCount);
-   return VMK_OK;
+/**
+ * Fill command fields of a trace event
+ *
+ * @param[in]  qinfo    Queue instance
+ * @param[in]  cmdInfo  Command info with valid 'vmkCmd'
+ * @param[in]  type     NVME_PCIE_TRACE_*
+ * @param[out] ev       Trace event
+ */
+static inline void
+TraceFill(NVMEPCIEQueueInfo *qinfo,
+          NVMEPCIECmdInfo *cmdInfo,
+          vmk_uint8 type,
+          NVMEPCIETraceEvent *ev)
+{
+   vmk_NvmeCommand *vmkCmd = cmdInfo->vmkCmd;
+   vmk_uint16 nlb = qinfo->id > 0 ? NVMEPCIEGetCmdNlb(vmkCmd) : 0;
+
+   ev->type = type;
+   ev->opc = vmkCmd->nvmeCmd.cdw0.opc;
+   ev->cid = qinfo->ctrlr->abortEnabled ? cmdInfo->cmdId - 1 : cmdInfo->cmdId;
+   ev->nsid = vmkCmd->nvmeCmd.nsid;
+   ev->slba = nlb > 0 ? ((vmk_NvmeReadCmd *)&vmkCmd->nvmeCmd)->slba : 0;
+   ev->nlb = nlb > 0 ? nlb - 1 : 0;
+   ev->aux = 0;
 }
 
-static NVMEPCIEDmaEntry*
-PrepareDmaEntry(NVMEPCIEController *ctrlr,
-                vmk_NvmeCommand *vmkCmd,
-                vmk_uint8 *buf,
-                vmk_uint32 length)
+/**
+ * Append an event to the trace ring of a queue
+ *
+ * Lock free, may be called concurrently from submission and completion.
+ *
+ * @param[in] qinfo  Queue instance
+ * @param[in] ev     Trace event, 'seq' and 'ts' are filled here
+ */
+static void
+TraceRecord(NVMEPCIEQueueInfo *qinfo, const NVMEPCIETraceEvent *ev)
 {
-   NVMEPCIEDmaEntry *dmaEntry = NULL;
-   VMK_ReturnStatus vmkStatus;
-   vmk_uint8 opcode = vmkCmd->nvmeCmd.cdw0.opc;
+   NVMEPCIETraceRing *ring = &qinfo->trace;
+   vmk_uint32 pos = vmk_AtomicReadInc32(&ring->head);
+   NVMEPCIETraceEvent *slot = &ring->events[pos &
+                                            (NVME_PCIE_TRACE_RING_SIZE - 1)];
+
+   slot->seq = 0;
+   vmk_CPUMemFenceWrite();
+   slot->type = ev->type;
+   slot->opc = ev->opc;
+   slot->cid = ev->cid;
+   slot->ts = vmk_GetTimerCycles();
+   slot->slba = ev->slba;
+   slot->nsid = ev->nsid;
+   slot->nlb = ev->nlb;
+   slot->aux = ev->aux;
+   vmk_CPUMemFenceWrite();
+   slot->seq = pos + 1;
+}
 
-   if (length == 0 || buf == NULL) {
-      return NULL;
-   }
+/**
+ * Trace an event of a command
+ *
+ * @param[in] qinfo    Queue instance
+ * @param[in] cmdInfo  Command info with valid 'vmkCmd'
+ * @param[in] type     NVME_PCIE_TRACE_*
+ * @param[in] aux      See NVMEPCIETraceEvent
+ */
+static void
+TraceCmd(NVMEPCIEQueueInfo *qinfo,
+         NVMEPCIECmdInfo *cmdInfo,
+         vmk_uint8 type,
+         vmk_uint16 aux)
+{
+   NVMEPCIETraceEvent ev;
 
-   if ((opcode & 0x3) != 0x1 && (opcode & 0x3) != 0x2) {
-      return NULL;
-   }
+   TraceFill(qinfo, cmdInfo, type, &ev);
+   ev.aux = aux;
+   TraceRecord(qinfo, &ev);
+}
 
-   dmaEntry = NVMEPCIEAlloc(sizeof(NVMEPCIEDmaEntry), 0);
+/**
+ * Trace an Abort command against the command it aborts
+ *
+ * @param[in] ctrlr   Controller instance
+ * @param[in] vmkCmd  Abort command submitted to the admin queue
+ */
+static void
+TraceAbort(NVMEPCIEController *ctrlr, vmk_NvmeCommand *vmkCmd)
+{
+   NVMEPCIETraceEvent ev;
+   vmk_uint32 cdw10 = vmkCmd->nvmeCmd.cdw10;
+   vmk_uint32 sqid = cdw10 & 0xffff;
+
+   if (sqid > ctrlr->numIoQueues) {
+      return;
+   }
+   vmk_Memset(&ev, 0, sizeof(ev));
+   ev.type = NVME_PCIE_TRACE_ABORT;
+   ev.opc = VMK_NVME_ADMIN_CMD_ABORT;
+   ev.cid = cdw10 >> 16;
+   TraceRecord(&ctrlr->queueList[sqid], &ev);
+}
+
+/**
+ * Driver side handling of an admin command before it is submitted
+ *
+ * Kept out of the hot path variants, called only for the admin queue.
+ *
+ * @param[in] ctrlr    Controller instance
+ * @param[in] vmkCmd   Admin command to submit
+ */
+void
+NVMEPCIEAdminCommandPrepare(NVMEPCIEController *ctrlr, vmk_NvmeCommand *vmkCmd)
+{
+   switch (vmkCmd->nvmeCmd.cdw0.opc) {
+      case VMK_NVME_ADMIN_CMD_IDENTIFY:
+         if (ctrlr->bringup.cur != NULL) {
+            ctrlr->bringup.identifyUs = NVMEPCIEGetTimerUs();
+         }
+         break;
+      case VMK_NVME_ADMIN_CMD_FORMAT_NVM:
+         /** LBA data size of namespace is about to change. */
+         LbaCacheInvalidate(ctrlr, vmkCmd->nvmeCmd.nsid);
+         break;
+      case VMK_NVME_ADMIN_CMD_ABORT:
+         if (vmk_AtomicRead32(&ctrlr->traceRate) != 0) {
+            TraceAbort(ctrlr, vmkCmd);
+         }
+         break;
+      default:
+         break;
+   }
+}
+
+#if NVME_PCIE_STORAGE_POLL
+/**
+ * Get opcode class of an IO command
+ *
+ * @param[in] vmkCmd   'vmk_NvmeCommand' type command
+ *
+ * @return NVME_PCIE_LAT_OPC_*
+ */
+static inline vmk_uint8
+LatModelOpcClass(vmk_NvmeCommand *vmkCmd)
+{
+   switch (vmkCmd->nvmeCmd.cdw0.opc) {
+      case VMK_NVME_NVM_CMD_READ:
+         return NVME_PCIE_LAT_OPC_READ;
+      case VMK_NVME_NVM_CMD_WRITE:
+         return NVME_PCIE_LAT_OPC_WRITE;
+      default:
+         return NVME_PCIE_LAT_OPC_OTHER;
+   }
+}
+
+/**
+ * Get latency model class of an IO command
+ *
+ * @param[in] vmkCmd   'vmk_NvmeCommand' type command
+ * @param[in] isSmall  Whether it is a small block size IO command
+ *
+ * @return Index into NVMEPCIELatModel arrays
+ */
+static inline vmk_uint8
+LatModelClass(vmk_NvmeCommand *vmkCmd, vmk_Bool isSmall)
+{
+   return LatModelOpcClass(vmkCmd) * NVME_PCIE_LAT_SIZE_NUM +
+          (isSmall ? 0 : 1);
+}
+
+/**
+ * Track an IO command in latency model, called with sq lock held
+ *
+ * 'sendToHwTs' must have been set.
+ *
+ * @param[in] qinfo    Queue instance
+ * @param[in] cmdInfo  Command being issued
+ */
+static inline void
+LatModelTrack(NVMEPCIEQueueInfo *qinfo, NVMEPCIECmdInfo *cmdInfo)
+{
+   NVMEPCIECmdInfoList *cmdList = qinfo->cmdList;
+   vmk_uint32 seq = cmdList->issueSeq;
+
+   cmdInfo->latClass = LatModelClass(cmdInfo->vmkCmd, cmdInfo->isSmall);
+   cmdInfo->latSeq = seq;
+   cmdInfo->latTracked = VMK_TRUE;
+   cmdList->issueRing[seq % cmdList->idCount] = cmdInfo - cmdList->list;
+   cmdList->issueSeq = seq + 1;
+}
+
+/**
+ * Feed the device latency of a completed command into latency model,
+ * called with cq lock held
+ *
+ * @param[in] qinfo    Queue instance
+ * @param[in] cmdInfo  Completed command
+ * @param[in] now      Completion time stamp
+ */
+static inline void
+LatModelUpdate(NVMEPCIEQueueInfo *qinfo,
+               NVMEPCIECmdInfo *cmdInfo,
+               vmk_TimerCycles now)
+{
+   NVMEPCIELatModel *model = &qinfo->latModel;
+   vmk_TimerCycles sample = now - cmdInfo->sendToHwTs;
+   vmk_TimerCycles ewma = model->ewma[cmdInfo->latClass];
+
+   if (VMK_UNLIKELY(sample <= 0)) {
+      sample = 1;
+   }
+   if (ewma == 0) {
+      ewma = sample;
+   } else {
+      ewma += (sample - ewma) >> NVME_PCIE_LAT_EWMA_SHIFT;
+   }
+   model->ewma[cmdInfo->latClass] = ewma > 0 ? ewma : 1;
+   model->samples[cmdInfo->latClass]++;
+   qinfo->pollTuner.latSum += sample;
+   qinfo->pollTuner.latCount++;
+   cmdInfo->latTracked = VMK_FALSE;
+}
+#endif
+
+#if NVME_PCIE_BLOCKSIZE_AWARE
+/**
+ * Count an IO command in the in-flight histogram of its queue
+ *
+ * @param[in] qinfo    Queue instance
+ * @param[in] cmdInfo  Command being issued
+ * @param[in] vmkCmd   'vmk_NvmeCommand' type command
+ * @param[in] bytes    Transfer size of the command
+ */
+static inline void
+CostModelTrack(NVMEPCIEQueueInfo *qinfo,
+               NVMEPCIECmdInfo *cmdInfo,
+               vmk_NvmeCommand *vmkCmd,
+               vmk_uint64 bytes)
+{
+   vmk_uint8 size = 0;
+
+   if (bytes > 0) {
+      bytes = (bytes - 1) >> NVME_PCIE_COST_SIZE_SHIFT_MIN;
+      while (bytes != 0 && size < NVME_PCIE_COST_SIZE_NUM - 1) {
+         bytes >>= 1;
+         size++;
+      }
+   }
+   cmdInfo->costOpc = LatModelOpcClass(vmkCmd);
+   cmdInfo->costSize = size;
+   cmdInfo->costCounted = VMK_TRUE;
+   vmk_AtomicInc32(&qinfo->inflightHist.count[cmdInfo->costOpc][size]);
+}
+
+/**
+ * Remove an IO command from the in-flight histogram of its queue
+ *
+ * @param[in] qinfo    Queue instance
+ * @param[in] cmdInfo  Command counted by CostModelTrack()
+ */
+static inline void
+CostModelUntrack(NVMEPCIEQueueInfo *qinfo, NVMEPCIECmdInfo *cmdInfo)
+{
+   cmdInfo->costCounted = VMK_FALSE;
+   vmk_AtomicDec32(
+      &qinfo->inflightHist.count[cmdInfo->costOpc][cmdInfo->costSize]);
+}
+#endif
+
+/**
+ * Submit a command to a queue
+ *
+ * @param[in] ctrlr   Controller instance
+ * @param[in] vmkCmd  NVME command
+ * @param[in] qid     Queue ID
+ * @param[in] flags   NVME_PCIE_HOT_PATH_* features of this variant
+ *
+ * @return VMK_OK Command submitted successfully
+ * @return VMK_FAILURE Failed to submit command
+ */
+static NVME_PCIE_ALWAYS_INLINE VMK_ReturnStatus
+SubmitAsyncCommandVariant(NVMEPCIEController *ctrlr,
+                          vmk_NvmeCommand *vmkCmd,
+                          vmk_uint32 qid,
+                          const vmk_uint32 flags)
+{
+   NVMEPCIECmdInfo *cmdInfo;
+   NVMEPCIEQueueInfo *qinfo;
+   NVMEPCIEQueueRef *ref;
+   vmk_NvmeStatus nvmeStatus;
+   vmk_uint16 cid;
+#if NVME_PCIE_BLOCKSIZE_AWARE
+   vmk_uint64 bytes = 0;
+#endif
+#ifdef NVME_STATS
+   vmk_TimerCycles entryTs = 0;
+
+   if ((flags & NVME_PCIE_HOT_PATH_STATS) &&
+       (flags & NVME_PCIE_HOT_PATH_DIAG) && qid > 0 &&
+       vmk_AtomicRead8(&ctrlr->phaseStamp)) {
+      entryTs = vmk_GetTimerCycles();
+   }
+#endif
+
+   qinfo = &ctrlr->queueList[qid];
+   ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_ACTIVE);
+   if (ref == NULL) {
+      vmkCmd->nvmeStatus = VMK_NVME_STATUS_VMW_IN_RESET;
+      return VMK_FAILURE;
+   }
+
+   if (flags & NVME_PCIE_HOT_PATH_ABORT) {
+      cid = vmkCmd->nvmeCmd.cdw0.cid;
+      VMK_ASSERT(cid < qinfo->cmdList->idCount - qinfo->cmdList->syncPool.size);
+      if (VMK_UNLIKELY(cid >= qinfo->cmdList->idCount -
+                              qinfo->cmdList->syncPool.size)) {
+         vmkCmd->nvmeStatus = VMK_NVME_STATUS_VMW_BAD_PARAMETER;
+         NVMEPCIEQueueRefPut(ref);
+         return VMK_FAILURE;
+      }
+      cmdInfo = NVMEPCIEGetCmdInfo(qinfo, cid);
+   } else {
+      cmdInfo = NVMEPCIEGetCmdInfoLegacy(qinfo);
+   }
+   if (cmdInfo == NULL) {
+      vmkCmd->nvmeStatus = VMK_NVME_STATUS_VMW_QUEUE_FULL;
+      vmk_AtomicInc64(&qinfo->counters.event.cmdFull);
+      NVMEPCIEQueueRefPut(ref);
+      return VMK_FAILURE;
+   }
+
+#if NVME_PCIE_BLOCKSIZE_AWARE
+   if (flags & (NVME_PCIE_HOT_PATH_BLKSIZE | NVME_PCIE_HOT_PATH_LATMODEL)) {
+      bytes = NVMEPCIEGetCmdBytes(ctrlr, qid, vmkCmd);
+      cmdInfo->isSmall = (bytes > 0) &&
+                         (bytes <= vmk_AtomicRead32(&ctrlr->smallIoBytes));
+   }
+   if ((flags & NVME_PCIE_HOT_PATH_BLKSIZE) && qid > 0) {
+      if (cmdInfo->isSmall) {
+         cmdInfo->smallCounted = VMK_TRUE;
+         vmk_AtomicInc32(&qinfo->cmdList->nrActSmall);
+      }
+      CostModelTrack(qinfo, cmdInfo, vmkCmd, bytes);
+   }
+#endif
+
+   cmdInfo->vmkCmd = vmkCmd;
+   cmdInfo->type = NVME_PCIE_ASYNC_CONTEXT;
+#ifdef NVME_STATS
+   cmdInfo->entryTs = entryTs;
+#endif
+
+   nvmeStatus = IssueCommandToHwVariant(qinfo, cmdInfo,
+                                        NVMEPCIECompleteAsyncCommand, flags);
+
+   if (VMK_UNLIKELY(nvmeStatus != VMK_NVME_STATUS_VMW_WOULD_BLOCK)) {
+      vmkCmd->nvmeStatus = nvmeStatus;
+      WPRINT(ctrlr, "Failed to issue command %d, 0x%x", cmdInfo->cmdId, nvmeStatus);
+#if NVME_PCIE_BLOCKSIZE_AWARE
+      if (cmdInfo->smallCounted) {
+         cmdInfo->smallCounted = VMK_FALSE;
+         vmk_AtomicDec32(&qinfo->cmdList->nrActSmall);
+      }
+      if (cmdInfo->costCounted) {
+         CostModelUntrack(qinfo, cmdInfo);
+      }
+#endif
+      NVMEPCIEPutCmdInfo(qinfo, cmdInfo);
+      NVMEPCIEQueueRefPut(ref);
+      return VMK_FAILURE;
+   }
+
+   NVMEPCIEQueueRefPut(ref);
+   return VMK_OK;
+}
+
+static NVMEPCIEDmaEntry*
+PrepareDmaEntry(NVMEPCIEController *ctrlr,
+                vmk_NvmeCommand *vmkCmd,
+                vmk_uint8 *buf,
+                vmk_uint32 length)
+{
+   NVMEPCIEDmaEntry *dmaEntry = NULL;
+   VMK_ReturnStatus vmkStatus;
+   vmk_uint8 opcode = vmkCmd->nvmeCmd.cdw0.opc;
+
+   if (length == 0 || buf == NULL) {
+      return NULL;
+   }
+
+   if ((opcode & 0x3) != 0x1 && (opcode & 0x3) != 0x2) {
+      return NULL;
+   }
+
+   dmaEntry = NVMEPCIEAlloc(sizeof(NVMEPCIEDmaEntry), 0);
    if (dmaEntry == NULL) {
       EPRINT(ctrlr, "Failed to allocate dma entry.");
       return NULL;
@@ -1150,9 +1771,11 @@ NVMEPCIESubmitSyncCommand(NVMEPCIEController *ctrlr,
    NVMEPCIEQueueInfo *qinfo;
    NVMEPCIECmdInfo *cmdInfo;
    vmk_uint64 timeout = 0;
+   vmk_uint64 now;
    vmk_NvmeStatus nvmeStatus;
    vmk_atomic32 existingStatus;
    NVMEPCIEDmaEntry *dmaEntry = NULL;
+   NVMEPCIEQueueRef *ref;
 
    /**
     * Currently there is no need to support commands which transfer
@@ -1163,22 +1786,18 @@ NVMEPCIESubmitSyncCommand(NVMEPCIEController *ctrlr,
    }
 
    qinfo = &ctrlr->queueList[qid];
-   vmk_AtomicInc32(&qinfo->refCount);
-   if (vmk_AtomicRead32(&qinfo->state) != NVME_PCIE_QUEUE_ACTIVE) {
+   ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_ACTIVE);
+   if (ref == NULL) {
       vmkCmd->nvmeStatus = VMK_NVME_STATUS_VMW_IN_RESET;
-      vmk_AtomicDec32(&qinfo->refCount);
       return VMK_FAILURE;
    }
 
-   if (ctrlr->abortEnabled) {
-      cmdInfo = NVMEPCIEGetCmdInfo(qinfo, NVME_PCIE_SYNC_CMD_ID);
-   } else {
-      cmdInfo = NVMEPCIEGetCmdInfoLegacy(qinfo);
-   }
-
+   timeout = NVMEPCIEGetTimerUs() + timeoutUs;
+   cmdInfo = NVMEPCIEGetSyncCmdInfo(qinfo, timeoutUs);
    if (cmdInfo == NULL) {
       vmkCmd->nvmeStatus = VMK_NVME_STATUS_VMW_QUEUE_FULL;
-      vmk_AtomicDec32(&qinfo->refCount);
+      vmk_AtomicInc64(&qinfo->counters.event.cmdFull);
+      NVMEPCIEQueueRefPut(ref);
       return VMK_FAILURE;
    }
 
@@ -1188,7 +1807,7 @@ NVMEPCIESubmitSyncCommand(NVMEPCIEController *ctrlr,
       if (dmaEntry == NULL) {
          vmkCmd->nvmeStatus = VMK_NVME_STATUS_VMW_NO_MEMORY;
          NVMEPCIEPutCmdInfo(qinfo, cmdInfo);
-         vmk_AtomicDec32(&qinfo->refCount);
+         NVMEPCIEQueueRefPut(ref);
          return VMK_FAILURE;
       }
       vmkCmd->nvmeCmd.dptr.prps.prp1.pbao = dmaEntry->ioa;
@@ -1199,9 +1818,12 @@ NVMEPCIESubmitSyncCommand(NVMEPCIEController *ctrlr,
 
    cmdInfo->vmkCmd = vmkCmd;
    cmdInfo->type = NVME_PCIE_SYNC_CONTEXT;
+#ifdef NVME_STATS
+   cmdInfo->entryTs = 0;
+#endif
 
-   nvmeStatus = NVMEPCIEIssueCommandToHw(qinfo, cmdInfo,
-                                         NVMEPCIECompleteSyncCommand);
+   nvmeStatus = qinfo->hotPath->issueCommand(qinfo, cmdInfo,
+                                             NVMEPCIECompleteSyncCommand);
    if (nvmeStatus != VMK_NVME_STATUS_VMW_WOULD_BLOCK) {
       vmkCmd->nvmeStatus = nvmeStatus;
       if (dmaEntry != NULL) {
@@ -1210,22 +1832,31 @@ NVMEPCIESubmitSyncCommand(NVMEPCIEController *ctrlr,
          cmdInfo->doneData = NULL;
       }
       NVMEPCIEPutCmdInfo(qinfo, cmdInfo);
-      vmk_AtomicDec32(&qinfo->refCount);
+      NVMEPCIEQueueRefPut(ref);
       return VMK_FAILURE;
    }
 
-   timeout = NVMEPCIEGetTimerUs() + timeoutUs;
+   /** 'timeout' also covers the wait for a sync slot, sleep only the rest. */
    do {
+      now = NVMEPCIEGetTimerUs();
+      if (now >= timeout) {
+         break;
+      }
       vmkStatus = vmk_WorldWait((vmk_WorldEventID)cmdInfo, VMK_LOCK_INVALID,
-                                timeoutUs / 1000, __FUNCTION__);
+                                (timeout - now + 999) / 1000, __FUNCTION__);
    } while(vmkStatus == VMK_OK &&
-           vmk_AtomicRead32(&cmdInfo->atomicStatus) == NVME_PCIE_CMD_STATUS_ACTIVE &&
-           timeout > NVMEPCIEGetTimerUs());
+           vmk_AtomicRead32(&cmdInfo->atomicStatus) == NVME_PCIE_CMD_STATUS_ACTIVE);
+
+   // 'vmkCmd' is owned by the caller, safe to trace even if completing now
+   if (vmk_AtomicRead32(&ctrlr->traceRate) != 0 &&
+       vmk_AtomicRead32(&cmdInfo->atomicStatus) == NVME_PCIE_CMD_STATUS_ACTIVE) {
+      TraceCmd(qinfo, cmdInfo, NVME_PCIE_TRACE_TIMEOUT, 0);
+   }
 
    do {
       existingStatus = vmk_AtomicRead32(&cmdInfo->atomicStatus);
       if (existingStatus == NVME_PCIE_CMD_STATUS_DONE) {
-         vmk_AtomicDec32(&qinfo->refCount);
+         NVMEPCIEQueueRefPut(ref);
          if (dmaEntry != NULL) {
             if (dmaEntry->direction == VMK_DMA_DIRECTION_TO_MEMORY) {
                vmk_Memcpy(buf, (void *)dmaEntry->va, length);
@@ -1242,7 +1873,7 @@ NVMEPCIESubmitSyncCommand(NVMEPCIEController *ctrlr,
                                         NVME_PCIE_CMD_STATUS_FREE_ON_COMPLETE)
            != existingStatus);
 
-   vmk_AtomicDec32(&qinfo->refCount);
+   NVMEPCIEQueueRefPut(ref);
    return VMK_TIMEOUT;
 }
 
@@ -1260,12 +1891,18 @@ NVMEPCIECompleteAsyncCommand(NVMEPCIEQueueInfo *qinfo,
    vmk_NvmeCommand *vmkCmd = cmdInfo->vmkCmd;
    vmk_AtomicWrite32(&cmdInfo->atomicStatus, NVME_PCIE_CMD_STATUS_DONE);
 #if NVME_PCIE_BLOCKSIZE_AWARE
-   if (vmk_AtomicRead8(&ctrlr->blkSizeAwarePollAct) &&
-       NVMEPCIEIsSmallBsIoCmd(qinfo->id, vmkCmd)) {
+   if (cmdInfo->smallCounted) {
+      cmdInfo->smallCounted = VMK_FALSE;
       vmk_AtomicDec32(&qinfo->cmdList->nrActSmall);
    }
+   if (cmdInfo->costCounted) {
+      CostModelUntrack(qinfo, cmdInfo);
+   }
 #endif
    NVMEPCIEPutCmdInfo(qinfo, cmdInfo);
+   if (VMK_UNLIKELY(qinfo->id == 0)) {
+      AdminCommandDone(ctrlr, vmkCmd);
+   }
    vmkCmd->done(vmkCmd);
 }
 
@@ -1319,22 +1956,38 @@ NVMEPCIEUpdateSubQueueHead(NVMEPCIESubQueueInfo *sqInfo)
  * @param[in] qinfo    Queue instance
  * @param[in] cmdInfo  Command info
  * @param[in] cb       Command completion callback
+ * @param[in] flags    NVME_PCIE_HOT_PATH_* features of this variant
  *
  * @return VMK_NVME_STATUS_VMW_WOULD_BLOCK Command submitted to hardware successfully.
  * @return VMK_NVME_STATUS_VMW_QFULL Failed to submit command due to queue being full.
  * @return VMK_NVME_STATUS_VMW_RESET Failed to submit command due to queue being reset.
  * @return VMK_NVME_STATUS_VMW_QUIESCED Failed to submit command due to device being removed.
  */
-static vmk_NvmeStatus
-NVMEPCIEIssueCommandToHw(NVMEPCIEQueueInfo *qinfo,
-                         NVMEPCIECmdInfo *cmdInfo,
-                         NVMEPCIECompleteCommandCb cb)
+static NVME_PCIE_ALWAYS_INLINE vmk_NvmeStatus
+IssueCommandToHwVariant(NVMEPCIEQueueInfo *qinfo,
+                        NVMEPCIECmdInfo *cmdInfo,
+                        NVMEPCIECompleteCommandCb cb,
+                        const vmk_uint32 flags)
 {
    NVMEPCIESubQueueInfo *sqInfo = qinfo->sqInfo;
    vmk_uint16 tail;
    vmk_uint16 head;
+   vmk_uint32 traceRate;
+   NVMEPCIETraceEvent traceEv;
+#ifdef NVME_STATS
+   vmk_Bool sampled;
+   vmk_Bool phaseOn;
+#endif
 
-   vmk_SpinlockLock(sqInfo->lock);
+   NVME_PCIE_QUEUE_LOCK(sqInfo);
+#ifdef NVME_STATS
+   sampled = (flags & NVME_PCIE_HOT_PATH_STATS) &&
+             (sqInfo->statsSampleSeq++ & qinfo->ctrlr->statsSampleMask) == 0;
+   phaseOn = sampled && cmdInfo->entryTs != 0;
+   if (VMK_UNLIKELY(phaseOn)) {
+      cmdInfo->lockTs = vmk_GetTimerCycles();
+   }
+#endif
    head = sqInfo->head;
    tail = sqInfo->tail;
 
@@ -1346,31 +1999,56 @@ NVMEPCIEIssueCommandToHw(NVMEPCIEQueueInfo *qinfo,
    }
 
    if (VMK_UNLIKELY((head == tail + 1) || (head == 0 && tail == sqInfo->qsize - 1))) {
-      vmk_SpinlockUnlock(sqInfo->lock);
+      qinfo->counters.sq.sqFull++;
+      NVME_PCIE_QUEUE_UNLOCK(sqInfo);
       return VMK_NVME_STATUS_VMW_QUEUE_FULL;
    }
 
    if (VMK_UNLIKELY(vmk_AtomicRead32(&qinfo->state) == NVME_PCIE_QUEUE_SUSPENDED)) {
-      vmk_SpinlockUnlock(sqInfo->lock);
+      NVME_PCIE_QUEUE_UNLOCK(sqInfo);
       return VMK_NVME_STATUS_VMW_IN_RESET;
    }
 
    if (VMK_UNLIKELY(qinfo->ctrlr->isRemoved)) {
-      vmk_SpinlockUnlock(sqInfo->lock);
+      NVME_PCIE_QUEUE_UNLOCK(sqInfo);
       return VMK_NVME_STATUS_VMW_QUIESCED;
    }
 
+   /** Account the command in stall wheel before it can be completed. */
+   if ((flags & NVME_PCIE_HOT_PATH_DIAG) && qinfo->id > 0 &&
+       vmk_AtomicRead32(&qinfo->ctrlr->stallThr) != 0) {
+      cmdInfo->stallTick = vmk_AtomicRead32(&qinfo->stallWheel.tick);
+      cmdInfo->stallOpc = cmdInfo->vmkCmd->nvmeCmd.cdw0.opc;
+      cmdInfo->stallTracked = VMK_TRUE;
+      vmk_AtomicInc32(&qinfo->stallWheel.bucket[cmdInfo->stallTick %
+                                                NVME_PCIE_STALL_WHEEL_SLOTS]);
+   }
+
+   /** Sample 1 in 'traceRate' commands, under sq lock. */
+   cmdInfo->traced = VMK_FALSE;
+   if (flags & NVME_PCIE_HOT_PATH_DIAG) {
+      traceRate = vmk_AtomicRead32(&qinfo->ctrlr->traceRate);
+      cmdInfo->traced = traceRate != 0 &&
+                        (qinfo->trace.sampleSeq++ % traceRate) == 0;
+   }
+   traceEv.type = NVME_PCIE_TRACE_NONE;
+   if (cmdInfo->traced) {
+      TraceCmd(qinfo, cmdInfo, NVME_PCIE_TRACE_SUBMIT, 0);
+   }
+
    vmk_Memcpy(&sqInfo->subq[tail], &cmdInfo->vmkCmd->nvmeCmd, VMK_NVME_SQE_SIZE);
-   DPRINT_CMD(qinfo->ctrlr, qinfo->id, "Issue cmdInfo [%d] %p vmkCmd %p to sq %d, tail %d.",
-              cmdInfo->cmdId, cmdInfo, cmdInfo->vmkCmd, qinfo->id, tail);
 #if NVME_DEBUG
-   if (((qinfo->id == 0) && (nvmePCIEDebugMask & NVME_DEBUG_ADMIN)) ||
-       ((qinfo->id > 0) &&(nvmePCIEDebugMask & NVME_DEBUG_CMD))) {
-      NVMEPCIEDumpSqe(qinfo->ctrlr, &cmdInfo->vmkCmd->nvmeCmd);
-      NVMEPCIEDumpSGL(qinfo->ctrlr, cmdInfo->vmkCmd->sgIOArray);
+   if (flags & NVME_PCIE_HOT_PATH_DEBUG) {
+      DPRINT_CMD(qinfo->ctrlr, qinfo->id, "Issue cmdInfo [%d] %p vmkCmd %p to sq %d, tail %d.",
+                 cmdInfo->cmdId, cmdInfo, cmdInfo->vmkCmd, qinfo->id, tail);
+      if (((qinfo->id == 0) && (nvmePCIEDebugMask & NVME_DEBUG_ADMIN)) ||
+          ((qinfo->id > 0) &&(nvmePCIEDebugMask & NVME_DEBUG_CMD))) {
+         NVMEPCIEDumpSqe(qinfo->ctrlr, &cmdInfo->vmkCmd->nvmeCmd);
+         NVMEPCIEDumpSGL(qinfo->ctrlr, cmdInfo->vmkCmd->sgIOArray);
+      }
    }
 #endif
-   if (!qinfo->ctrlr->abortEnabled) {
+   if (!(flags & NVME_PCIE_HOT_PATH_ABORT)) {
       sqInfo->subq[tail].cdw0.cid = cmdInfo->cmdId;
    }
 
@@ -1380,9 +2058,26 @@ NVMEPCIEIssueCommandToHw(NVMEPCIEQueueInfo *qinfo,
    }
 
 #ifdef NVME_STATS
-   if (qinfo->ctrlr->statsEnabled) {
+   if (sampled) {
       cmdInfo->sendToHwTs = vmk_GetTimerCycles();
       cmdInfo->statsOn = VMK_TRUE;
+      cmdInfo->submitCpu = vmk_PCPUGetCurrent();
+      cmdInfo->submitDepth = vmk_AtomicRead32(&qinfo->cmdList->nrAct);
+      if (VMK_LIKELY(cmdInfo->submitCpu < qinfo->stats->cpuStats.numCpus)) {
+         qinfo->stats->cpuStats.submits[cmdInfo->submitCpu] +=
+            qinfo->ctrlr->statsSampleMask + 1;
+      } else {
+         qinfo->stats->cpuStats.submits[qinfo->stats->cpuStats.numCpus - 1] +=
+            qinfo->ctrlr->statsSampleMask + 1;
+      }
+   }
+#endif
+#if NVME_PCIE_STORAGE_POLL
+   if ((flags & NVME_PCIE_HOT_PATH_LATMODEL) && qinfo->id > 0) {
+      if (!cmdInfo->statsOn) {
+         cmdInfo->sendToHwTs = vmk_GetTimerCycles();
+      }
+      LatModelTrack(qinfo, cmdInfo);
    }
 #endif
    if (VMK_UNLIKELY(cmdInfo->vmkCmd->nvmeCmd.cdw0.fuse == VMK_NVME_FUSED_OP_FIRST)) {
@@ -1397,52 +2092,171 @@ NVMEPCIEIssueCommandToHw(NVMEPCIEQueueInfo *qinfo,
        */
       VPRINT(qinfo->ctrlr, "FUSE: Issue first cmdInfo [%d] %p vmkCmd %p to sq %d, fusetag %d, tail %d.",
              cmdInfo->cmdId, cmdInfo, cmdInfo->vmkCmd, qinfo->id, cmdInfo->vmkCmd->fuseTag, tail);
+#ifdef NVME_STATS
+      if (VMK_UNLIKELY(phaseOn)) {
+         cmdInfo->doorbellTs = vmk_GetTimerCycles();
+      }
+#endif
    } else {
       if (VMK_UNLIKELY(cmdInfo->vmkCmd->nvmeCmd.cdw0.fuse == VMK_NVME_FUSED_OP_SECOND)) {
          VPRINT(qinfo->ctrlr, "FUSE: Issue second cmdInfo [%d] %p vmkCmd %p to sq %d, fusetag %d, tail %d.",
                 cmdInfo->cmdId, cmdInfo, cmdInfo->vmkCmd, qinfo->id, cmdInfo->vmkCmd->fuseTag, tail);
       }
+      // The command may complete and be freed once the doorbell is written
+      if (cmdInfo->traced) {
+         TraceFill(qinfo, cmdInfo, NVME_PCIE_TRACE_DOORBELL, &traceEv);
+      }
+#ifdef NVME_STATS
+      if (VMK_UNLIKELY(phaseOn)) {
+         cmdInfo->doorbellTs = vmk_GetTimerCycles();
+      }
+#endif
       NVMEPCIEWritel(tail, sqInfo->doorbell);
+      qinfo->counters.sq.sqDoorbells++;
+      if (traceEv.type == NVME_PCIE_TRACE_DOORBELL) {
+         TraceRecord(qinfo, &traceEv);
+      }
    }
    sqInfo->tail = tail;
-   vmk_SpinlockUnlock(sqInfo->lock);
+   qinfo->counters.sq.submits++;
+   NVME_PCIE_QUEUE_UNLOCK(sqInfo);
 
    return VMK_NVME_STATUS_VMW_WOULD_BLOCK;
 }
 
 #if NVME_PCIE_STORAGE_POLL
 /**
- * Poll routine for the IO queue defined in vmkapi_storage_poll.h.
+ * Account CPU time of a poll routine invocation for CPU budget governor
  *
- * @param[in]  driverData  NVMEPCIEQueueInfo passed to poll handler when
- *                         creating
- * @param[in]  leastPoll   Minimum number of IO commands to be processed
- *                         in this invocation.
- * @param[in]  budget      Maximum number of IO commands to be processed
- *                         in this invocation.
+ * @param[in]  qinfo        Queue instance
+ * @param[in]  startTs      Time stamp the invocation started
+ * @param[in]  sleepCycles  'pollSleepCycles' when the invocation started
+ * @param[in]  compl        Commands completed by the invocation
+ */
+static inline void
+StoragePollAccount(NVMEPCIEQueueInfo *qinfo,
+                   vmk_TimerCycles startTs,
+                   vmk_TimerCycles sleepCycles,
+                   vmk_uint32 compl)
+{
+   vmk_TimerCycles cycles = vmk_GetTimerCycles() - startTs -
+                            (qinfo->pollSleepCycles - sleepCycles);
+
+   vmk_AtomicAdd64(&qinfo->pollCpuCycles, cycles > 0 ? cycles : 0);
+   vmk_AtomicAdd64(&qinfo->pollCompl, compl);
+   qinfo->counters.event.polls++;
+   if (compl == 0) {
+      qinfo->counters.event.emptyPolls++;
+   }
+}
+
+/**
+ * Sleep in the poll routine, the time slept is not accounted as CPU time
  *
- * @return                 The number of completed IO commands.
+ * @param[in]  qinfo       Queue instance
+ * @param[in]  us          Time to sleep
  */
-vmk_uint32
-NVMEPCIEStoragePollCB(vmk_AddrCookie driverData,          // IN
-                      vmk_uint32 leastPoll,               // IN
-                      vmk_uint32 budget)                  // IN
+static void
+StoragePollSleep(NVMEPCIEQueueInfo *qinfo, vmk_uint64 us)
 {
-   vmk_StoragePollState pollState = VMK_STORAGEPOLL_DISABLED;
-   NVMEPCIEQueueInfo *qinfo = driverData.ptr;
-   vmk_StoragePoll pollHandler = qinfo->pollHandler;
-   vmk_uint32 ret = 0;
-   vmk_Bool needPoll = VMK_FALSE;
+   vmk_TimerCycles ts = vmk_GetTimerCycles();
 
-   if (VMK_LIKELY(budget != 0)) {
-      NVMEPCIEStoragePollAccumCmd(qinfo, leastPoll);
+   vmk_WorldSleep(us);
+   qinfo->pollSleepCycles += vmk_GetTimerCycles() - ts;
+}
 
-      vmk_SpinlockLock(qinfo->cqInfo->lock);
+/**
+ * Busy poll a queue
+ *
+ * Spins on the phase bit of the next completion queue entry and processes
+ * completions as they arrive, without sleeping. Returns when no command
+ * is outstanding, 'budget' commands are completed or 'pollSpinBudget' us
+ * are over.
+ *
+ * @param[in]  qinfo       Queue instance
+ * @param[in]  budget      Maximum number of IO commands to be processed
+ *
+ * @return                 Number of IO commands completed
+ */
+static vmk_uint32
+StoragePollBusySpin(NVMEPCIEQueueInfo *qinfo, vmk_uint32 budget)
+{
+   NVMEPCIECompQueueInfo *cqInfo = qinfo->cqInfo;
+   vmk_TimerCycles spinTs, spinEnd, spinCycles = 0;
+   vmk_uint32 done = 0;
+
+   spinTs = vmk_GetTimerCycles();
+   spinEnd = spinTs +
+      vmk_TimerUSToTC(vmk_AtomicRead32(&qinfo->ctrlr->pollSpinBudget));
+   vmk_AtomicInc64(&qinfo->busyRounds);
+
+   while (done < budget) {
+      if (NVMEPCIEGetHwDoneCmdNum(cqInfo, cqInfo->head, 1) > 0) {
+         spinCycles += vmk_GetTimerCycles() - spinTs;
+         NVME_PCIE_QUEUE_LOCK(cqInfo);
 #if NVME_STATS
-      NVMEPCIEStatsWalkThrough(qinfo, VMK_FALSE);
+         NVMEPCIEStatsWalkThrough(qinfo, VMK_FALSE);
+#endif
+         done += NVMEPCIEProcessCq(qinfo);
+         NVME_PCIE_QUEUE_UNLOCK(cqInfo);
+         spinTs = vmk_GetTimerCycles();
+         continue;
+      }
+      if (vmk_AtomicRead32(&qinfo->cmdList->nrAct) == 0) {
+         break;
+      }
+      if (vmk_GetTimerCycles() >= spinEnd) {
+         vmk_AtomicInc64(&qinfo->busyExpired);
+         break;
+      }
+      NVMEPCIECpuRelax();
+   }
+   spinCycles += vmk_GetTimerCycles() - spinTs;
+
+   vmk_AtomicAdd64(&qinfo->busySpinCycles, spinCycles);
+   vmk_AtomicAdd64(&qinfo->busyCompl, done);
+
+   return done;
+}
+
+/**
+ * Poll routine for the IO queue defined in vmkapi_storage_poll.h.
+ *
+ * @param[in]  driverData  NVMEPCIEQueueInfo passed to poll handler when
+ *                         creating
+ * @param[in]  leastPoll   Minimum number of IO commands to be processed
+ *                         in this invocation.
+ * @param[in]  budget      Maximum number of IO commands to be processed
+ *                         in this invocation.
+ *
+ * @return                 The number of completed IO commands.
+ */
+vmk_uint32
+NVMEPCIEStoragePollCB(vmk_AddrCookie driverData,          // IN
+                      vmk_uint32 leastPoll,               // IN
+                      vmk_uint32 budget)                  // IN
+{
+   vmk_StoragePollState pollState = VMK_STORAGEPOLL_DISABLED;
+   NVMEPCIEQueueInfo *qinfo = driverData.ptr;
+   vmk_StoragePoll pollHandler = qinfo->pollHandler;
+   vmk_uint32 ret = 0;
+   vmk_Bool needPoll = VMK_FALSE;
+   vmk_TimerCycles startTs = vmk_GetTimerCycles();
+   vmk_TimerCycles sleepCycles = qinfo->pollSleepCycles;
+
+   if (VMK_LIKELY(budget != 0)) {
+      if (vmk_AtomicRead8(&qinfo->ctrlr->pollBusy)) {
+         ret += StoragePollBusySpin(qinfo, budget);
+      } else {
+         NVMEPCIEStoragePollAccumCmd(qinfo, leastPoll);
+
+         NVME_PCIE_QUEUE_LOCK(qinfo->cqInfo);
+#if NVME_STATS
+         NVMEPCIEStatsWalkThrough(qinfo, VMK_FALSE);
 #endif
-      ret += NVMEPCIEProcessCq(qinfo);
-      vmk_SpinlockUnlock(qinfo->cqInfo->lock);
+         ret += NVMEPCIEProcessCq(qinfo);
+         NVME_PCIE_QUEUE_UNLOCK(qinfo->cqInfo);
+      }
 
       /** Check if the number of completed IO commands is valid */
       if (ret >= leastPoll && ret <= budget) {
@@ -1453,6 +2267,17 @@ NVMEPCIEStoragePollCB(vmk_AddrCookie driverData,          // IN
    vmk_StoragePollCheckState(pollHandler, &pollState);
    if ((!needPoll) &&
        VMK_LIKELY(pollState != VMK_STORAGEPOLL_DISABLED)) {
+      /**
+       * Too few completions for this round, but the load has not dropped
+       * below exit thresholds or the dwell time is not over yet: keep the
+       * queue in poll mode instead of flipping back to interrupts.
+       */
+      if (NVMEPCIEStoragePollStay(qinfo)) {
+         vmk_StoragePollActivate(pollHandler);
+         StoragePollAccount(qinfo, startTs, sleepCycles, ret);
+         return ret;
+      }
+      NVMEPCIEStoragePollSetMode(qinfo, NVME_PCIE_POLL_MODE_INTR);
       NVMEPCIEEnableIntr(qinfo);
 
       /**
@@ -1465,16 +2290,18 @@ NVMEPCIEStoragePollCB(vmk_AddrCookie driverData,          // IN
        *
        * Just invoke NVMEPCIEProcessCq() once again to avoid.
        */
-      vmk_SpinlockLock(qinfo->cqInfo->lock);
+      NVME_PCIE_QUEUE_LOCK(qinfo->cqInfo);
 #if NVME_STATS
       NVMEPCIEStatsWalkThrough(qinfo, VMK_FALSE);
 #endif
       NVMEPCIEProcessCq(qinfo);
-      vmk_SpinlockUnlock(qinfo->cqInfo->lock);
+      NVME_PCIE_QUEUE_UNLOCK(qinfo->cqInfo);
    } else if (VMK_UNLIKELY(pollState == VMK_STORAGEPOLL_DISABLED)) {
       vmk_AtomicWrite8(&qinfo->isPollHdlrEnabled, VMK_FALSE);
+      NVMEPCIEStoragePollSetMode(qinfo, NVME_PCIE_POLL_MODE_INTR);
    }
 
+   StoragePollAccount(qinfo, startTs, sleepCycles, ret);
    return ret;
 }
 
@@ -1517,6 +2344,51 @@ NVMEPCIEGetHwDoneCmdNum(NVMEPCIECompQueueInfo *cqInfo,
    return hwDoneCmd;
 }
 
+/**
+ * Predict completion time of the oldest outstanding command of a queue
+ *
+ * Called only by the poll routine of the queue, which owns 'oldestSeq'.
+ * Commands issued more than 'idCount' commands before the newest one have
+ * been overwritten in 'issueRing' and are ignored; such stragglers are
+ * reported by stall detection instead.
+ *
+ * @param[in]  qinfo    Queue instance
+ * @param[out] doneTs   Predicted completion time stamp
+ *
+ * @return VMK_TRUE if predicted, VMK_FALSE if no command is tracked or its
+ *         class has no latency sample yet
+ */
+static vmk_Bool
+LatModelPredict(NVMEPCIEQueueInfo *qinfo, vmk_TimerCycles *doneTs)
+{
+   NVMEPCIECmdInfoList *cmdList = qinfo->cmdList;
+   NVMEPCIECmdInfo *cmdInfo = NULL;
+   vmk_uint32 issueSeq = *(volatile vmk_uint32 *)&cmdList->issueSeq;
+   vmk_uint32 seq = cmdList->oldestSeq;
+   vmk_TimerCycles ewma;
+
+   if (issueSeq - seq > (vmk_uint32)cmdList->idCount) {
+      seq = issueSeq - cmdList->idCount;
+   }
+   for (; seq != issueSeq; seq++) {
+      cmdInfo = &cmdList->list[cmdList->issueRing[seq % cmdList->idCount]];
+      if (cmdInfo->latTracked && cmdInfo->latSeq == seq) {
+         break;
+      }
+   }
+   cmdList->oldestSeq = seq;
+   if (seq == issueSeq) {
+      return VMK_FALSE;
+   }
+
+   ewma = qinfo->latModel.ewma[cmdInfo->latClass];
+   if (ewma == 0) {
+      return VMK_FALSE;
+   }
+   *doneTs = cmdInfo->sendToHwTs + ewma;
+   return VMK_TRUE;
+}
+
 /**
  * Delay some time to accumulate adequate IO commands to be polled.
  *
@@ -1538,10 +2410,50 @@ NVMEPCIEStoragePollAccumCmd(NVMEPCIEQueueInfo *qinfo,   // IN
    vmk_uint32 hwDoneCmd2 = 0;
    vmk_uint32 qsize = cqInfo->qsize;
    vmk_uint64 interval;
+   vmk_TimerCycles doneTs, spinEnd, now;
+   vmk_uint64 sleepUs;
 
    /** Try to access CQE as more as possible. */
    tryLen = (tryLen > qsize) ? qsize : tryLen;
 
+   /**
+    * With latency model, sleep a part of the predicted remaining latency of
+    * the oldest outstanding command, then spin until it is predicted done,
+    * at most 'pollInterval'.
+    */
+   if ((qinfo->hotPath->flags & NVME_PCIE_HOT_PATH_LATMODEL) &&
+       LatModelPredict(qinfo, &doneTs)) {
+      now = vmk_GetTimerCycles();
+      if (doneTs <= now) {
+         return;
+      }
+      hwDoneCmd1 = NVMEPCIEGetHwDoneCmdNum(cqInfo, cqInfo->head, tryLen);
+      if (hwDoneCmd1 >= tryLen) {
+         return;
+      }
+      sleepUs = vmk_TimerUnsignedTCToUS(doneTs - now) *
+                vmk_AtomicRead32(&qinfo->ctrlr->pollSleepPct) / 100;
+      if (sleepUs > 0) {
+         StoragePollSleep(qinfo, sleepUs);
+      }
+      spinEnd = vmk_GetTimerCycles() +
+                vmk_TimerUSToTC(vmk_AtomicRead64(&qinfo->ctrlr->pollInterval));
+      if (spinEnd > doneTs) {
+         spinEnd = doneTs;
+      }
+      /** Only CQEs after the ones already seen are checked again. */
+      for (;;) {
+         hwDoneCmd1 += NVMEPCIEGetHwDoneCmdNum(cqInfo,
+                                               cqInfo->head + hwDoneCmd1,
+                                               tryLen - hwDoneCmd1);
+         if (hwDoneCmd1 >= tryLen || vmk_GetTimerCycles() >= spinEnd) {
+            break;
+         }
+         NVMEPCIECpuRelax();
+      }
+      return;
+   }
+
    while (tryPollTimes < 3) {
       /** Determine number of CQEs */
       hwDoneCmd1 += NVMEPCIEGetHwDoneCmdNum(cqInfo,
@@ -1551,7 +2463,7 @@ NVMEPCIEStoragePollAccumCmd(NVMEPCIEQueueInfo *qinfo,   // IN
       if (hwDoneCmd1 < tryLen) {
          tryPollTimes++;
 
-         vmk_WorldSleep(interval);
+         StoragePollSleep(qinfo, interval);
 
          hwDoneCmd2 = NVMEPCIEGetHwDoneCmdNum(cqInfo,
                                               cqInfo->head + hwDoneCmd1,
@@ -1567,6 +2479,173 @@ NVMEPCIEStoragePollAccumCmd(NVMEPCIEQueueInfo *qinfo,   // IN
    }
 }
 
+/**
+ * Add an IO queue to its poll group, creating the group's handler for the
+ * first member
+ *
+ * Members are consecutive ranges of queue IDs, which the core driver
+ * assigns to PCPUs in order, so queues serving PCPUs of the same NUMA
+ * node share a group when 'numPollGroups' matches the number of nodes.
+ *
+ * @param[in]  qinfo        Queue instance
+ * @param[in]  adapterName  Name of the adapter of the controller
+ */
+static void
+PollGroupJoin(NVMEPCIEQueueInfo *qinfo, const char *adapterName)
+{
+   NVMEPCIEController *ctrlr = qinfo->ctrlr;
+   NVMEPCIEPollGroup *group;
+   vmk_StoragePollProps propInit;
+   VMK_ReturnStatus status;
+   vmk_uint32 numQueues = ctrlr->maxIoQueues > 0 ? ctrlr->maxIoQueues : 1;
+
+   if (qinfo->pollGroup != NULL) {
+      return;
+   }
+
+   group = &ctrlr->pollGroups[(qinfo->id - 1) * ctrlr->numPollGroups /
+                              numQueues % ctrlr->numPollGroups];
+   if (group->handler == NULL) {
+      propInit.moduleID = vmk_ModuleCurrentID;
+      propInit.pollObjectID = NVME_PCIE_MAX_IO_QUEUES + 1 + group->id;
+      propInit.heapID = NVME_PCIE_DRIVER_RES_HEAP_ID;
+      vmk_NameInitialize(&propInit.adapterName, adapterName);
+      propInit.driverData.ptr = group;
+      propInit.pollCb = NVMEPCIEPollGroupCB;
+
+      status = vmk_StoragePollCreate(&propInit, &group->handler);
+      if (status == VMK_OK) {
+         status = vmk_StoragePollEnable(group->handler);
+         if (status != VMK_OK) {
+            vmk_StoragePollDestroy(group->handler);
+         }
+      }
+      if (status != VMK_OK) {
+         EPRINT(ctrlr, "Failed to create poll group %d for queue %d, %s!"
+                       " Return to interruption mode for this queue.",
+                group->id, qinfo->id, vmk_StatusToString(status));
+         group->handler = NULL;
+         return;
+      }
+   }
+
+   vmk_AtomicInc32(&group->numMembers);
+   qinfo->pollGroup = group;
+   qinfo->pollHandler = group->handler;
+   DPRINT_Q(ctrlr, "Queue %d joined poll group %d.", qinfo->id, group->id);
+}
+
+/**
+ * Remove an IO queue from its poll group, destroying the group's handler
+ * with the last member
+ *
+ * @param[in]  qinfo       Queue instance
+ */
+static void
+PollGroupLeave(NVMEPCIEQueueInfo *qinfo)
+{
+   NVMEPCIEPollGroup *group = qinfo->pollGroup;
+
+   qinfo->pollHandler = NULL;
+   qinfo->pollGroup = NULL;
+   vmk_AtomicWrite8(&qinfo->isPollHdlrEnabled, VMK_FALSE);
+   VMK_ASSERT(vmk_AtomicRead32(&group->numMembers) > 0);
+   if (vmk_AtomicReadDec32(&group->numMembers) == 1) {
+      vmk_StoragePollDisable(group->handler);
+      vmk_StoragePollDestroy(group->handler);
+      group->handler = NULL;
+   }
+}
+
+/**
+ * Poll routine of a poll group
+ *
+ * Visits member queues in poll mode round-robin, starting one queue later
+ * each round. A queue whose next completion queue entry is posted is
+ * processed; an idle one is returned to interrupt mode unless
+ * NVMEPCIEStoragePollStay() keeps it. The group stays active while any
+ * member is in poll mode.
+ *
+ * @param[in]  driverData  NVMEPCIEPollGroup passed to poll handler when
+ *                         creating
+ * @param[in]  leastPoll   Minimum number of IO commands to be processed
+ *                         in this invocation.
+ * @param[in]  budget      Maximum number of IO commands to be processed
+ *                         in this invocation.
+ *
+ * @return                 The number of completed IO commands.
+ */
+vmk_uint32
+NVMEPCIEPollGroupCB(vmk_AddrCookie driverData,          // IN
+                    vmk_uint32 leastPoll,               // IN
+                    vmk_uint32 budget)                  // IN
+{
+   NVMEPCIEPollGroup *group = driverData.ptr;
+   NVMEPCIEController *ctrlr = group->ctrlr;
+   NVMEPCIEQueueInfo *qinfo;
+   NVMEPCIEQueueRef *ref;
+   vmk_uint32 numQueues = vmk_AtomicRead32(&ctrlr->numIoQueues);
+   vmk_uint32 ret = 0, done, active = 0, n;
+   vmk_TimerCycles ts;
+
+   vmk_AtomicInc32(&group->inCb);
+   vmk_CPUMemFenceReadWrite();
+   vmk_AtomicInc64(&group->rounds);
+
+   for (n = 0; n < numQueues && ret < budget; n++) {
+      qinfo = &ctrlr->queueList[(group->cursor + n) % numQueues + 1];
+      if (qinfo->pollGroup != group ||
+          !vmk_AtomicRead8(&qinfo->isPollHdlrEnabled) ||
+          vmk_AtomicRead32(&qinfo->pollMode) != NVME_PCIE_POLL_MODE_POLL) {
+         continue;
+      }
+      ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_ACTIVE);
+      if (ref == NULL) {
+         continue;
+      }
+
+      ts = vmk_GetTimerCycles();
+      done = 0;
+      vmk_AtomicInc64(&group->peeks);
+      if (NVMEPCIEGetHwDoneCmdNum(qinfo->cqInfo, qinfo->cqInfo->head, 1) > 0) {
+         vmk_AtomicInc64(&group->hits);
+         NVME_PCIE_QUEUE_LOCK(qinfo->cqInfo);
+#if NVME_STATS
+         NVMEPCIEStatsWalkThrough(qinfo, VMK_FALSE);
+#endif
+         done = NVMEPCIEProcessCq(qinfo);
+         NVME_PCIE_QUEUE_UNLOCK(qinfo->cqInfo);
+         active++;
+      } else if (NVMEPCIEStoragePollStay(qinfo)) {
+         active++;
+      } else {
+         NVMEPCIEStoragePollSetMode(qinfo, NVME_PCIE_POLL_MODE_INTR);
+         NVMEPCIEEnableIntr(qinfo);
+         // Avoid Dead CQE, see NVMEPCIEStoragePollCB()
+         NVME_PCIE_QUEUE_LOCK(qinfo->cqInfo);
+#if NVME_STATS
+         NVMEPCIEStatsWalkThrough(qinfo, VMK_FALSE);
+#endif
+         done = NVMEPCIEProcessCq(qinfo);
+         NVME_PCIE_QUEUE_UNLOCK(qinfo->cqInfo);
+      }
+      StoragePollAccount(qinfo, ts, qinfo->pollSleepCycles, done);
+      ret += done;
+      NVMEPCIEQueueRefPut(ref);
+   }
+   if (numQueues > 0) {
+      group->cursor = (group->cursor + 1) % numQueues;
+   }
+
+   // Queues not visited for lack of budget are still in poll mode
+   if (active > 0 || n < numQueues) {
+      vmk_StoragePollActivate(group->handler);
+   }
+   vmk_AtomicDec32(&group->inCb);
+
+   return ret;
+}
+
 void
 NVMEPCIEStoragePollSetup(NVMEPCIEController *ctrlr)
 {
@@ -1599,6 +2678,11 @@ NVMEPCIEStoragePollCreate(NVMEPCIEQueueInfo *qinfo)
       return;
    }
 
+   if (ctrlr->numPollGroups > 0) {
+      PollGroupJoin(qinfo, adapterName);
+      return;
+   }
+
    if (qinfo->pollHandler == NULL) {
       propInit.moduleID = vmk_ModuleCurrentID;
       propInit.pollObjectID = qinfo->id;
@@ -1630,6 +2714,12 @@ NVMEPCIEStoragePollEnable(NVMEPCIEQueueInfo *qinfo)
       return;
    }
 
+   // Handler of a poll group is enabled when the group is created
+   if (qinfo->pollGroup != NULL) {
+      vmk_AtomicWrite8(&qinfo->isPollHdlrEnabled, VMK_TRUE);
+      return;
+   }
+
    if (!vmk_AtomicReadIfEqualWrite8(&qinfo->isPollHdlrEnabled, VMK_FALSE,
                                     VMK_TRUE)) {
       status = vmk_StoragePollEnable(qinfo->pollHandler);
@@ -1649,6 +2739,21 @@ NVMEPCIEStoragePollEnable(NVMEPCIEQueueInfo *qinfo)
 void
 NVMEPCIEStoragePollDisable(NVMEPCIEQueueInfo *qinfo)
 {
+   NVMEPCIEPollGroup *group = qinfo->pollGroup;
+
+   /**
+    * The queue is suspended already, so the group's poll routine does not
+    * start on it any more. Wait for the round that may be on it.
+    */
+   if (group != NULL) {
+      vmk_AtomicWrite8(&qinfo->isPollHdlrEnabled, VMK_FALSE);
+      vmk_CPUMemFenceReadWrite();
+      while (vmk_AtomicRead32(&group->inCb) != 0) {
+         vmk_WorldSleep(10);
+      }
+      return;
+   }
+
    if ((qinfo->pollHandler != NULL) &&
        (vmk_AtomicReadIfEqualWrite8(&qinfo->isPollHdlrEnabled, VMK_TRUE,
                                     VMK_FALSE))) {
@@ -1659,15 +2764,83 @@ NVMEPCIEStoragePollDisable(NVMEPCIEQueueInfo *qinfo)
 void
 NVMEPCIEStoragePollDestory(NVMEPCIEQueueInfo *qinfo)
 {
+   if (qinfo->pollGroup != NULL) {
+      PollGroupLeave(qinfo);
+      return;
+   }
+
    if (qinfo->pollHandler != NULL) {
       vmk_StoragePollDestroy(qinfo->pollHandler);
       qinfo->pollHandler = NULL;
    }
 }
 
+/**
+ * Record a transition of interrupt/poll mode of a queue
+ *
+ * @param[in]  qinfo       Queue instance
+ * @param[in]  mode        New mode
+ */
+void
+NVMEPCIEStoragePollSetMode(NVMEPCIEQueueInfo *qinfo, NVMEPCIEPollMode mode)
+{
+   NVMEPCIEQueueCounters *counters = &qinfo->counters;
+   vmk_uint64 now;
+
+   if (vmk_AtomicReadWrite32(&qinfo->pollMode, mode) == mode) {
+      return;
+   }
+   now = NVMEPCIEGetTimerUs();
+   qinfo->pollModeTs = now;
+   if (counters->event.modeTs != 0 && now > counters->event.modeTs) {
+      if (mode == NVME_PCIE_POLL_MODE_POLL) {
+         counters->event.intrModeUs += now - counters->event.modeTs;
+      } else {
+         counters->event.pollModeUs += now - counters->event.modeTs;
+      }
+   }
+   counters->event.modeTs = now;
+   if (mode == NVME_PCIE_POLL_MODE_POLL) {
+      vmk_AtomicInc64(&qinfo->pollEnters);
+   } else {
+      vmk_AtomicInc64(&qinfo->pollExits);
+   }
+}
+
+/**
+ * Snapshot the interrupt/poll mode switching thresholds of a queue
+ *
+ * @param[in]  qinfo       Queue instance
+ * @param[out] policy      Thresholds for NVMEPCIEPollPolicyEnter/Stay()
+ */
+static inline void
+StoragePollPolicyGet(NVMEPCIEQueueInfo *qinfo, NVMEPCIEPollPolicy *policy)
+{
+   NVMEPCIEController *ctrlr = qinfo->ctrlr;
+
+   // Auto tuned thresholds keep the default ratio of exit to enter
+   if (vmk_AtomicRead8(&ctrlr->pollAutoTune)) {
+      policy->oioThr = vmk_AtomicRead32(&qinfo->pollTuner.thr);
+      policy->oioExitThr = policy->oioThr / 2;
+   } else {
+      policy->oioThr = vmk_AtomicRead32(&ctrlr->pollOIOThr);
+      policy->oioExitThr = vmk_AtomicRead32(&ctrlr->pollOIOExitThr);
+   }
+   policy->dwellUs = vmk_AtomicRead64(&ctrlr->pollDwell);
+   policy->busy = vmk_AtomicRead8(&ctrlr->pollBusy);
+}
+
 /**
  * Whether to switch to polling mode determining by some strategies.
  *
+ * Called in interrupt mode. The load based decision is made by
+ * NVMEPCIEPollPolicyEnter(), and is further vetoed by the in-flight IO mix
+ * with block size aware polling or cost model, and while the queue is
+ * demoted by CPU budget governor.
+ * Leaving polling is decided by NVMEPCIEStoragePollStay() with lower
+ * thresholds, so a load hovering around one threshold does not flip the
+ * mode back and forth.
+ *
  * @param[in]  qinfo       Queue instance
  *
  * @return                 Whether to switch to polling mode
@@ -1676,101 +2849,393 @@ vmk_Bool
 NVMEPCIEStoragePollSwitch(NVMEPCIEQueueInfo *qinfo)
 {
    NVMEPCIEController *ctrlr = qinfo->ctrlr;
-   vmk_atomic32 *nrActPtr = &qinfo->cmdList->nrAct;
-   vmk_atomic32 *iopsLastSecPtr;
-   vmk_Bool doSwitch = VMK_FALSE;
+   NVMEPCIEPollPolicy policy;
+   vmk_uint32 enter;
 
-   /**
-    * If 'iopsTimer' is invalid, queue's 'iopsLastSec' will never be reset,
-    * thus, mark 'iopsLastSec' as invalid by setting 'iopsLastSecPtr' as NULL.
-    */
-   iopsLastSecPtr = (ctrlr->iopsTimer != VMK_INVALID_TIMER) ?
-                    &qinfo->iopsLastSec : NULL;
    /**
     * Just poll for IO queues if StoragePoll feature enabled and handler
     * created successfully.
     */
-   if (vmk_AtomicRead8(&ctrlr->pollAct) &&
-       VMK_LIKELY(qinfo->pollHandler != NULL)) {
-      /**
-       * Activate polling Strategy
-       *
-       * 1. If OIO is adequate, it is appropriate to replace a large quantity
-       *    of interrupts by polling
-       * 2. If IOPs is greater than 'NVME_PCIE_POLL_IOPS_THRES_PER_QUEUE',
-       *    but the OIO is low, device may have low latency feature, enable
-       *    polling as well
-       */
-      if ((vmk_AtomicRead32(nrActPtr) >=
-           vmk_AtomicRead32(&ctrlr->pollOIOThr)) ||
-          ((iopsLastSecPtr != NULL) && (vmk_AtomicRead32(iopsLastSecPtr) >=
-           NVME_PCIE_POLL_IOPS_THRES_PER_QUEUE))) {
+   if (!vmk_AtomicRead8(&ctrlr->pollAct) ||
+       VMK_UNLIKELY(qinfo->pollHandler == NULL)) {
+      return VMK_FALSE;
+   }
+
+   StoragePollPolicyGet(qinfo, &policy);
+   enter = NVMEPCIEPollPolicyEnter(&policy,
+                                   vmk_AtomicRead32(&qinfo->cmdList->nrAct),
+                                   NVMEPCIEIopsEstimate(qinfo),
+                                   NVMEPCIEGetTimerUs() - qinfo->pollModeTs);
+   if (enter == NVME_PCIE_POLL_ENTER_NO) {
+      return VMK_FALSE;
+   }
 #if NVME_PCIE_BLOCKSIZE_AWARE
-         if (NVMEPCIEStoragePollBlkSizeAwareSwitch(qinfo)) {
-            doSwitch = VMK_TRUE;
-         }
-#else
-         doSwitch = VMK_TRUE;
+   if (!NVMEPCIEStoragePollBlkSizeAwareSwitch(qinfo)) {
+      return VMK_FALSE;
+   }
 #endif
-      }
+   if (vmk_AtomicRead8(&qinfo->govDemoted)) {
+      return VMK_FALSE;
+   }
+   if (enter == NVME_PCIE_POLL_ENTER_DEFERRED) {
+      vmk_AtomicInc64(&qinfo->pollEntersDeferred);
+      return VMK_FALSE;
    }
 
-   return doSwitch;
+   return VMK_TRUE;
 }
-#endif
 
-#if NVME_PCIE_BLOCKSIZE_AWARE
 /**
- * Whether to switch to polling mode determining by Block Size Aware Polling
- * strategies.
+ * Whether to stay in polling mode after a poll round completed fewer
+ * commands than requested.
  *
- * In the context of this function, polling must have been enabled.
+ * The load based decision is made by NVMEPCIEPollPolicyStay().
+ * Deactivating 'pollAct' or demotion by CPU budget governor always leaves.
  *
  * @param[in]  qinfo       Queue instance
  *
- * @return                 Whether to switch to polling mode
+ * @return                 Whether to stay in polling mode
  */
-inline vmk_Bool
-NVMEPCIEStoragePollBlkSizeAwareSwitch(NVMEPCIEQueueInfo *qinfo)
+vmk_Bool
+NVMEPCIEStoragePollStay(NVMEPCIEQueueInfo *qinfo)
 {
    NVMEPCIEController *ctrlr = qinfo->ctrlr;
-   vmk_atomic32 *nrActPtr = &qinfo->cmdList->nrAct;
-   vmk_atomic32 *nrActSmallPtr = &qinfo->cmdList->nrActSmall;
-   vmk_Bool doSwitch = VMK_TRUE;
+   NVMEPCIEPollPolicy policy;
+   vmk_uint32 oio, iops;
+   vmk_uint64 age;
+   vmk_Bool stay;
+
+   if (!vmk_AtomicRead8(&ctrlr->pollAct) ||
+       vmk_AtomicRead8(&qinfo->govDemoted)) {
+      return VMK_FALSE;
+   }
 
-   /**
-    * Block Size Aware Polling Strategy
-    *
-    * If the number of small block size OIO is less than half of total
-    * OIO, use interruption to avoid inefficiency.
-    */
-   if (vmk_AtomicRead8(&ctrlr->blkSizeAwarePollAct) &&
-       (vmk_AtomicRead32(nrActPtr) > (vmk_AtomicRead32(nrActSmallPtr) << 1))) {
-      doSwitch = VMK_FALSE;
+   StoragePollPolicyGet(qinfo, &policy);
+   oio = vmk_AtomicRead32(&qinfo->cmdList->nrAct);
+   iops = NVMEPCIEIopsEstimate(qinfo);
+   age = NVMEPCIEGetTimerUs() - qinfo->pollModeTs;
+   stay = NVMEPCIEPollPolicyStay(&policy, oio, iops, age);
+
+   if (stay && NVMEPCIEPollPolicyExitDeferred(&policy, oio, iops, age)) {
+      vmk_AtomicInc64(&qinfo->pollExitsDeferred);
    }
 
-   return doSwitch;
+   return stay;
 }
-#endif
 
 /**
- * Enable interrupt cookie binding to a queue
+ * Restart OIO threshold search of all IO queues from 'pollOIOThr'
  *
- * @param[in]  qinfo       Queue instance
+ * Covers queues not created yet as well, so their thresholds are valid
+ * once auto tune is activated.
+ *
+ * @param[in]  ctrlr       Controller instance
  */
-inline void
-NVMEPCIEEnableIntr(NVMEPCIEQueueInfo *qinfo)
+void
+NVMEPCIEPollTuneReset(NVMEPCIEController *ctrlr)
 {
-   NVMEPCIEController *ctrlr = qinfo->ctrlr;
-   NVMEPCIECompQueueInfo *cqInfo = qinfo->cqInfo;
-   VMK_ReturnStatus status = VMK_OK;
-   vmk_atomic8 *isIntrEnPtr = &qinfo->isIntrEnabled;
+   NVMEPCIEQueueInfo *qinfo;
+   NVMEPCIEQueueRef *ref;
+   NVMEPCIEPollTuner *tuner;
+   vmk_uint32 thr = vmk_AtomicRead32(&ctrlr->pollOIOThr);
+   int i;
 
-   if (VMK_LIKELY(ctrlr->osRes.intrType == VMK_PCI_INTERRUPT_TYPE_MSIX)) {
+   if (thr < NVME_PCIE_POLL_TUNE_THR_MIN) {
+      thr = NVME_PCIE_POLL_TUNE_THR_MIN;
+   } else if (thr > NVME_PCIE_POLL_TUNE_THR_MAX) {
+      thr = NVME_PCIE_POLL_TUNE_THR_MAX;
+   }
 
-      if (!vmk_AtomicReadIfEqualWrite8(isIntrEnPtr, VMK_FALSE, VMK_TRUE)) {
-         status = vmk_IntrEnable(ctrlr->osRes.intrArray[cqInfo->intrIndex]);
-         VMK_ASSERT(VMK_OK == status);
+   for (i = 1; i <= NVME_PCIE_MAX_IO_QUEUES; i++) {
+      qinfo = &ctrlr->queueList[i];
+      tuner = &qinfo->pollTuner;
+      // Without reference the queue does not exist and completes nothing
+      ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_SUSPENDED);
+      if (ref != NULL) {
+         NVME_PCIE_QUEUE_LOCK(qinfo->cqInfo);
+      }
+      vmk_AtomicWrite32(&tuner->thr, thr);
+      tuner->dir = 1;
+      tuner->lastObj = 0;
+      tuner->bestThr = thr;
+      tuner->bestObj = 0;
+      tuner->epochs = 0;
+      tuner->lastCpuNs = 0;
+      tuner->latSum = 0;
+      tuner->latCount = 0;
+      tuner->cpuCycles = vmk_AtomicRead64(&qinfo->pollCpuCycles);
+      tuner->compl = 0;
+      if (ref != NULL) {
+         NVME_PCIE_QUEUE_UNLOCK(qinfo->cqInfo);
+         NVMEPCIEQueueRefPut(ref);
+      }
+   }
+}
+
+/**
+ * Evaluate the OIO threshold of an IO queue over the last epoch and take
+ * one hill climbing step
+ *
+ * Called every NVME_PCIE_IOPS_RECORD_FREQ by the IOPs timer. Epochs with
+ * less than NVME_PCIE_POLL_TUNE_MIN_SAMPLES latency samples are too noisy
+ * and extended to the next tick, so auto tune needs latency model to be
+ * activated.
+ *
+ * @param[in]  qinfo       Queue instance
+ * @param[in]  compl       Completions of the queue since last call
+ */
+void
+NVMEPCIEPollTuneEpoch(NVMEPCIEQueueInfo *qinfo, vmk_uint32 compl)
+{
+   NVMEPCIEPollTuner *tuner = &qinfo->pollTuner;
+   vmk_TimerCycles latSum;
+   vmk_uint64 latCount, obj, cycles, cpuPerCompl;
+   vmk_int32 thr;
+
+   if (!vmk_AtomicRead8(&qinfo->ctrlr->pollAutoTune)) {
+      return;
+   }
+   tuner->compl += compl;
+
+   NVME_PCIE_QUEUE_LOCK(qinfo->cqInfo);
+   latSum = tuner->latSum;
+   latCount = tuner->latCount;
+   if (latCount >= NVME_PCIE_POLL_TUNE_MIN_SAMPLES) {
+      tuner->latSum = 0;
+      tuner->latCount = 0;
+   }
+   NVME_PCIE_QUEUE_UNLOCK(qinfo->cqInfo);
+
+   if (latCount < NVME_PCIE_POLL_TUNE_MIN_SAMPLES) {
+      return;
+   }
+
+   // Cycles polled in the epoch, spread over all its completions
+   cycles = vmk_AtomicRead64(&qinfo->pollCpuCycles);
+   cpuPerCompl = tuner->compl == 0 ? 0 :
+                 (cycles - tuner->cpuCycles) / tuner->compl;
+   tuner->cpuCycles = cycles;
+   tuner->compl = 0;
+   tuner->lastCpuNs = cpuPerCompl * 1000000000 / vmk_TimerCyclesPerSecond();
+
+   obj = vmk_TimerUnsignedTCToUS(latSum / latCount + cpuPerCompl);
+   thr = vmk_AtomicRead32(&tuner->thr);
+   tuner->epochs++;
+   if (tuner->bestObj == 0 || obj < tuner->bestObj) {
+      tuner->bestObj = obj;
+      tuner->bestThr = thr;
+   }
+   if (tuner->lastObj != 0 && obj > tuner->lastObj) {
+      tuner->dir = -tuner->dir;
+   }
+   tuner->lastObj = obj;
+
+   thr += tuner->dir * NVME_PCIE_POLL_TUNE_STEP;
+   if (thr < NVME_PCIE_POLL_TUNE_THR_MIN) {
+      thr = NVME_PCIE_POLL_TUNE_THR_MIN;
+      tuner->dir = 1;
+   } else if (thr > NVME_PCIE_POLL_TUNE_THR_MAX) {
+      thr = NVME_PCIE_POLL_TUNE_THR_MAX;
+      tuner->dir = -1;
+   }
+   vmk_AtomicWrite32(&tuner->thr, thr);
+}
+
+/**
+ * Enforce CPU budget of polling of a controller, see NVMEPCIEPollGovernor
+ *
+ * Called every NVME_PCIE_IOPS_RECORD_FREQ by the IOPs timer.
+ *
+ * @param[in]  ctrlr       Controller instance
+ */
+void
+NVMEPCIEPollGovernorTick(NVMEPCIEController *ctrlr)
+{
+   NVMEPCIEPollGovernor *gov = &ctrlr->pollGov;
+   NVMEPCIEQueueInfo *qinfo, *worst = NULL, *demoted = NULL;
+   NVMEPCIEQueueRef *ref;
+   vmk_TimerCycles now = vmk_GetTimerCycles();
+   vmk_TimerCycles elapsed = now - gov->lastTs;
+   vmk_uint64 cycles, compl, dCycles, dCompl, total = 0, cost, worstCost = 0;
+   vmk_uint32 budget = vmk_AtomicRead32(&ctrlr->pollCpuBudget);
+   vmk_Bool first = gov->lastTs == 0;
+   vmk_uint32 i;
+
+   gov->lastTs = now;
+   for (i = 1; i <= ctrlr->numIoQueues; i++) {
+      qinfo = &ctrlr->queueList[i];
+      ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_SUSPENDED);
+      if (ref == NULL) {
+         continue;
+      }
+      cycles = vmk_AtomicRead64(&qinfo->pollCpuCycles);
+      compl = vmk_AtomicRead64(&qinfo->pollCompl);
+      dCycles = cycles - qinfo->govLastCycles;
+      dCompl = compl - qinfo->govLastCompl;
+      qinfo->govLastCycles = cycles;
+      qinfo->govLastCompl = compl;
+      if (!first && elapsed > 0) {
+         total += dCycles;
+         qinfo->govCpuPct = dCycles * 100 / elapsed;
+         qinfo->govNsPerCompl = dCompl ?
+            vmk_TimerUnsignedTCToUS(dCycles * 1000 / dCompl) : 0;
+      }
+      if (vmk_AtomicRead8(&qinfo->govDemoted)) {
+         if (budget == 0) {
+            vmk_AtomicWrite8(&qinfo->govDemoted, VMK_FALSE);
+            gov->releases++;
+         } else if (demoted == NULL) {
+            demoted = qinfo;
+         }
+      } else if (dCycles > 0 &&
+                 vmk_AtomicRead32(&qinfo->pollMode) == NVME_PCIE_POLL_MODE_POLL) {
+         cost = dCycles / (dCompl + 1);
+         if (cost >= worstCost) {
+            worstCost = cost;
+            worst = qinfo;
+         }
+      }
+      NVMEPCIEQueueRefPut(ref);
+   }
+
+   if (first || elapsed <= 0) {
+      return;
+   }
+   gov->ticks++;
+   gov->cpuPct = total * 100 / elapsed;
+   if (budget == 0) {
+      return;
+   }
+
+   if (gov->cpuPct > budget) {
+      gov->overBudget++;
+      if (worst != NULL) {
+         vmk_AtomicWrite8(&worst->govDemoted, VMK_TRUE);
+         gov->demotions++;
+         IPRINT(ctrlr, "Poll CPU usage %u%% over budget %u%%, queue %d"
+                " demoted.", gov->cpuPct, budget, worst->id);
+      }
+   } else if (demoted != NULL && gov->cpuPct * 100 <
+              budget * NVME_PCIE_POLL_CPU_RELEASE_PCT) {
+      vmk_AtomicWrite8(&demoted->govDemoted, VMK_FALSE);
+      gov->releases++;
+      DPRINT_CTRLR(ctrlr, "Poll CPU usage %u%%, queue %d released.",
+                   gov->cpuPct, demoted->id);
+   }
+}
+#endif
+
+#if NVME_PCIE_BLOCKSIZE_AWARE
+/**
+ * Whether to switch to polling mode determining by Block Size Aware Polling
+ * strategies.
+ *
+ * In the context of this function, polling must have been enabled.
+ *
+ * @param[in]  qinfo       Queue instance
+ *
+ * @return                 Whether to switch to polling mode
+ */
+inline vmk_Bool
+NVMEPCIEStoragePollBlkSizeAwareSwitch(NVMEPCIEQueueInfo *qinfo)
+{
+   NVMEPCIEController *ctrlr = qinfo->ctrlr;
+   vmk_atomic32 *nrActPtr = &qinfo->cmdList->nrAct;
+   vmk_atomic32 *nrActSmallPtr = &qinfo->cmdList->nrActSmall;
+   vmk_Bool doSwitch = VMK_TRUE;
+   vmk_uint32 numAct;
+   vmk_uint64 gap;
+
+   if (vmk_AtomicRead8(&ctrlr->pollCostModel)) {
+      gap = NVMEPCIEPollCostGap(qinfo, &numAct);
+      return (numAct > 0) &&
+             (gap <= vmk_AtomicRead32(&ctrlr->pollIntrCost) * 1000ULL);
+   }
+
+   /**
+    * Block Size Aware Polling Strategy
+    *
+    * If the number of small block size OIO is less than half of total
+    * OIO, use interruption to avoid inefficiency.
+    */
+   if (vmk_AtomicRead8(&ctrlr->blkSizeAwarePollAct) &&
+       (vmk_AtomicRead32(nrActPtr) > (vmk_AtomicRead32(nrActSmallPtr) << 1))) {
+      doSwitch = VMK_FALSE;
+   }
+
+   return doSwitch;
+}
+
+/**
+ * Expected time between completions of a queue at its in-flight IO mix
+ *
+ * By Little's law a queue with N commands in flight of mean latency L
+ * completes one command per L / N, which is what a poller spins for per
+ * completion. Latency of a histogram bucket is the latency model EWMA of
+ * its class if the model is on and has samples, otherwise
+ * NVME_PCIE_COST_BASE_LAT_US plus the transfer time of the bucket's upper
+ * size at NVME_PCIE_COST_BYTES_PER_US.
+ *
+ * @param[in]  qinfo    Queue instance
+ * @param[out] numAct   Commands counted by the in-flight histogram
+ *
+ * @return Expected completion gap in ns, 0 if nothing in flight
+ */
+vmk_uint64
+NVMEPCIEPollCostGap(NVMEPCIEQueueInfo *qinfo, vmk_uint32 *numAct)
+{
+   NVMEPCIEController *ctrlr = qinfo->ctrlr;
+   vmk_Bool useModel = vmk_AtomicRead8(&ctrlr->pollLatModel);
+   vmk_uint32 smallIoBytes = vmk_AtomicRead32(&ctrlr->smallIoBytes);
+   vmk_uint64 latSum = 0, latNs, bytes;
+   vmk_TimerCycles ewma;
+   vmk_uint32 n = 0, count;
+   int opc, size;
+
+   for (opc = 0; opc < NVME_PCIE_LAT_OPC_NUM; opc++) {
+      for (size = 0; size < NVME_PCIE_COST_SIZE_NUM; size++) {
+         count = vmk_AtomicRead32(&qinfo->inflightHist.count[opc][size]);
+         if (count == 0) {
+            continue;
+         }
+         bytes = 1ULL << (NVME_PCIE_COST_SIZE_SHIFT_MIN + size);
+         ewma = useModel ?
+                qinfo->latModel.ewma[opc * NVME_PCIE_LAT_SIZE_NUM +
+                                     (bytes <= smallIoBytes ? 0 : 1)] : 0;
+         if (ewma > 0) {
+            latNs = vmk_TimerUnsignedTCToUS(ewma * 1000);
+         } else {
+            latNs = NVME_PCIE_COST_BASE_LAT_US * 1000 +
+                    bytes * 1000 / NVME_PCIE_COST_BYTES_PER_US;
+         }
+         latSum += latNs * count;
+         n += count;
+      }
+   }
+
+   *numAct = n;
+   return n == 0 ? 0 : latSum / n / n;
+}
+#endif
+
+/**
+ * Enable interrupt cookie binding to a queue
+ *
+ * @param[in]  qinfo       Queue instance
+ */
+inline void
+NVMEPCIEEnableIntr(NVMEPCIEQueueInfo *qinfo)
+{
+   NVMEPCIEController *ctrlr = qinfo->ctrlr;
+   NVMEPCIECompQueueInfo *cqInfo = qinfo->cqInfo;
+   VMK_ReturnStatus status = VMK_OK;
+   vmk_atomic8 *isIntrEnPtr = &qinfo->isIntrEnabled;
+
+   if (VMK_LIKELY(ctrlr->osRes.intrType == VMK_PCI_INTERRUPT_TYPE_MSIX)) {
+
+      if (!vmk_AtomicReadIfEqualWrite8(isIntrEnPtr, VMK_FALSE, VMK_TRUE)) {
+         status = vmk_IntrEnable(ctrlr->osRes.intrArray[cqInfo->intrIndex]);
+         VMK_ASSERT(VMK_OK == status);
       }
    }
 }
@@ -1801,16 +3266,515 @@ NVMEPCIEDisableIntr(NVMEPCIEQueueInfo *qinfo, vmk_Bool intrSync)
    }
 }
 
+#if NVME_PCIE_STORAGE_POLL
+/**
+ * Feed a batch of completions into IOPs estimation of an IO queue, called
+ * with cq lock held
+ *
+ * Time decaying rate: a batch of 'n' completions 'dt' us after the last
+ * one moves the estimate by (n - est * dt) / window, or resets it to the
+ * batch rate if 'dt' exceeds the window.
+ *
+ * @param[in]  qinfo    Queue instance
+ * @param[in]  n        Number of completions in the batch
+ */
+static inline void
+IopsEstUpdate(NVMEPCIEQueueInfo *qinfo, vmk_uint32 n)
+{
+   vmk_uint64 window = vmk_AtomicRead64(&qinfo->ctrlr->iopsWindow);
+   vmk_uint64 now = NVMEPCIEGetTimerUs();
+   vmk_uint64 dt = now - qinfo->iopsEstTs;
+   vmk_int64 est = vmk_AtomicRead32(&qinfo->iopsEst);
+
+   if (dt >= window) {
+      est = (vmk_int64)n * VMK_USEC_PER_SEC / dt;
+   } else {
+      est += ((vmk_int64)n * VMK_USEC_PER_SEC - est * (vmk_int64)dt) /
+             (vmk_int64)window;
+      if (est < 0) {
+         est = 0;
+      }
+   }
+   vmk_AtomicWrite32(&qinfo->iopsEst, (vmk_uint32)est);
+   qinfo->iopsEstTs = now;
+}
+
+/**
+ * Get estimated IOPs of an IO queue
+ *
+ * The estimate is only updated by completions, so it decays by the time
+ * since the last completion batch once that exceeds the window. Idle
+ * queues are also reset by 'iopsTimer' every second.
+ *
+ * @param[in]  qinfo    Queue instance
+ *
+ * @return Estimated IOPs
+ */
+vmk_uint32
+NVMEPCIEIopsEstimate(NVMEPCIEQueueInfo *qinfo)
+{
+   vmk_uint64 window = vmk_AtomicRead64(&qinfo->ctrlr->iopsWindow);
+   vmk_uint64 age = NVMEPCIEGetTimerUs() - qinfo->iopsEstTs;
+   vmk_uint64 est = vmk_AtomicRead32(&qinfo->iopsEst);
+
+   if (age > window) {
+      est = est * window / age;
+   }
+   return (vmk_uint32)est;
+}
+#endif
+
+/**
+ * Set statistics sampling rate
+ *
+ * @param[in] ctrlr  Controller instance
+ * @param[in] rate   Collect statistics of 1 in 'rate' commands, rounded
+ *                   down to a power of 2
+ */
+void
+NVMEPCIEStatsSampleRateSet(NVMEPCIEController *ctrlr, vmk_uint32 rate)
+{
+   vmk_uint32 mask = 0;
+
+   if (rate > NVME_PCIE_STATS_SAMPLE_RATE_MAX) {
+      rate = NVME_PCIE_STATS_SAMPLE_RATE_MAX;
+   }
+   while ((mask + 1) * 2 <= rate) {
+      mask = mask * 2 + 1;
+   }
+   ctrlr->statsSampleMask = mask;
+}
+
+/**
+ * Set device latency threshold to capture outlier IO commands
+ *
+ * @param[in] ctrlr  Controller instance
+ * @param[in] thrUs  Threshold in microseconds, 0 to disable
+ */
+void
+NVMEPCIEOutlierThrSet(NVMEPCIEController *ctrlr, vmk_uint32 thrUs)
+{
+   if (thrUs > NVME_PCIE_OUTLIER_THR_MAX) {
+      thrUs = NVME_PCIE_OUTLIER_THR_MAX;
+   }
+   vmk_AtomicWrite32(&ctrlr->outlierThr, thrUs);
+   ctrlr->outlierThrTc = thrUs == 0 ? NVME_PCIE_OUTLIER_THR_OFF :
+                         (vmk_TimerRelCycles)vmk_TimerUSToTC(thrUs);
+}
+
+#ifdef NVME_STATS
+/**
+ * Capture an IO command whose device latency exceeded the outlier threshold
+ *
+ * Called by completion processing of the queue under cq lock, before the
+ * command is completed.
+ *
+ * @param[in] qinfo    Queue instance
+ * @param[in] cmdInfo  Command info with valid 'vmkCmd'
+ * @param[in] cqEntry  Completion queue entry of the command
+ * @param[in] latency  Device latency in timer cycles
+ */
+static void
+OutlierRecord(NVMEPCIEQueueInfo *qinfo,
+              NVMEPCIECmdInfo *cmdInfo,
+              vmk_NvmeCompletionQueueEntry *cqEntry,
+              vmk_TimerRelCycles latency)
+{
+   NVMEPCIEController *ctrlr = qinfo->ctrlr;
+   NVMEPCIEOutlierRecord *record;
+
+   vmk_SpinlockLock(ctrlr->outlierLock);
+   record = &ctrlr->outlierRecords[ctrlr->outlierRecordIdx++ %
+                                   NVME_PCIE_OUTLIER_RECORD_NUM];
+   record->timeUs = NVMEPCIEGetTimerUs();
+   record->latencyUs = vmk_TimerUnsignedTCToUS(latency);
+   record->qid = qinfo->id;
+   record->cpu = cmdInfo->submitCpu;
+   record->depth = cmdInfo->submitDepth;
+   vmk_Memcpy(&record->sqe, &cmdInfo->vmkCmd->nvmeCmd, sizeof(record->sqe));
+   record->sqe.cdw0.cid = cqEntry->dw3.cid;
+   vmk_Memcpy(&record->cqe, cqEntry, sizeof(record->cqe));
+   vmk_SpinlockUnlock(ctrlr->outlierLock);
+}
+
+/**
+ * Get latency histogram bucket of a latency
+ *
+ * @param[in] latency  Latency in timer cycles
+ *
+ * @return Bucket index, below NVME_PCIE_LAT_HIST_BUCKETS
+ */
+static inline vmk_uint32
+LatHistBucket(vmk_TimerRelCycles latency)
+{
+   vmk_uint64 v;
+   vmk_uint32 idx, msb;
+
+   v = vmk_TimerUnsignedTCToUS(latency * 1000) >>
+       NVME_PCIE_LAT_HIST_UNIT_SHIFT;
+   if (v < NVME_PCIE_LAT_HIST_SUB) {
+      return v;
+   }
+   msb = 63 - __builtin_clzll(v);
+   idx = (msb - NVME_PCIE_LAT_HIST_SUB_SHIFT + 1) * NVME_PCIE_LAT_HIST_SUB +
+         ((v >> (msb - NVME_PCIE_LAT_HIST_SUB_SHIFT)) &
+          (NVME_PCIE_LAT_HIST_SUB - 1));
+   if (idx >= NVME_PCIE_LAT_HIST_BUCKETS) {
+      idx = NVME_PCIE_LAT_HIST_BUCKETS - 1;
+   }
+   return idx;
+}
+
+/**
+ * Record device latency of a completed IO command into latency histogram
+ *
+ * Called by completion processing of the queue under cq lock.
+ *
+ * @param[in] qinfo    Queue instance
+ * @param[in] vmkCmd   Completed command
+ * @param[in] latency  Device latency in timer cycles
+ * @param[in] weight   Number of commands the sample stands for
+ */
+static inline void
+LatHistRecord(NVMEPCIEQueueInfo *qinfo,
+              vmk_NvmeCommand *vmkCmd,
+              vmk_TimerRelCycles latency,
+              vmk_uint32 weight)
+{
+   NVMEPCIELatHist *hist = &qinfo->stats->latHist;
+   vmk_uint64 bytes;
+   vmk_uint32 opc, size;
+
+   if (VMK_UNLIKELY(vmk_AtomicRead8(&hist->resetReq))) {
+      vmk_Memset(hist->count, 0, sizeof(hist->count));
+      vmk_AtomicWrite8(&hist->resetReq, 0);
+   }
+
+   switch (vmkCmd->nvmeCmd.cdw0.opc) {
+      case VMK_NVME_NVM_CMD_READ:
+         opc = NVME_PCIE_LAT_HIST_OPC_READ;
+         break;
+      case VMK_NVME_NVM_CMD_WRITE:
+         opc = NVME_PCIE_LAT_HIST_OPC_WRITE;
+         break;
+      case VMK_NVME_NVM_CMD_FLUSH:
+         opc = NVME_PCIE_LAT_HIST_OPC_FLUSH;
+         break;
+      default:
+         opc = NVME_PCIE_LAT_HIST_OPC_OTHER;
+         break;
+   }
+
+   bytes = NVMEPCIEGetCmdBytes(qinfo->ctrlr, qinfo->id, vmkCmd);
+   for (size = 0; size < NVME_PCIE_LAT_HIST_SIZE_NUM - 1; size++) {
+      if (bytes <= (4096ULL << (size * 2))) {
+         break;
+      }
+   }
+
+   hist->count[opc][size][LatHistBucket(latency)] += weight;
+}
+
+/**
+ * Record host side phases of a completed IO command into phase histograms
+ *
+ * Called by completion processing of the queue under cq lock, right before
+ * the done callback. Clears 'entryTs' of the command.
+ *
+ * @param[in] qinfo    Queue instance
+ * @param[in] cmdInfo  Command info with valid phase time stamps
+ * @param[in] cqeTs    Time stamp the CQE was observed
+ * @param[in] doneTs   Time stamp the done callback is invoked
+ * @param[in] weight   Number of commands the sample stands for
+ */
+static void
+PhaseHistRecord(NVMEPCIEQueueInfo *qinfo,
+                NVMEPCIECmdInfo *cmdInfo,
+                vmk_TimerCycles cqeTs,
+                vmk_TimerCycles doneTs,
+                vmk_uint32 weight)
+{
+   NVMEPCIEPhaseHist *hist = &qinfo->stats->phaseHist;
+   vmk_TimerCycles entryTs = cmdInfo->entryTs;
+   vmk_TimerCycles lockTs = cmdInfo->lockTs;
+   vmk_TimerCycles doorbellTs = cmdInfo->doorbellTs;
+
+   cmdInfo->entryTs = 0;
+   if (VMK_UNLIKELY(vmk_AtomicRead8(&hist->resetReq))) {
+      vmk_Memset(hist->count, 0, sizeof(hist->count));
+      vmk_AtomicWrite8(&hist->resetReq, 0);
+   }
+
+   hist->count[NVME_PCIE_PHASE_LOCK][LatHistBucket(lockTs - entryTs)] +=
+      weight;
+   hist->count[NVME_PCIE_PHASE_SUBMIT][LatHistBucket(doorbellTs - lockTs)] +=
+      weight;
+   hist->count[NVME_PCIE_PHASE_DEVICE][LatHistBucket(cqeTs - doorbellTs)] +=
+      weight;
+   hist->count[NVME_PCIE_PHASE_DISPATCH][LatHistBucket(doneTs - cqeTs)] +=
+      weight;
+}
+
+/**
+ * Get lower bound in ns of a latency histogram bucket
+ *
+ * @param[in] idx  Bucket index, up to NVME_PCIE_LAT_HIST_BUCKETS
+ *
+ * @return Lower bound in ns, which is the upper bound of bucket 'idx' - 1
+ */
+vmk_uint64
+NVMEPCIELatHistBucketNs(vmk_uint32 idx)
+{
+   vmk_uint64 v;
+
+   if (idx < NVME_PCIE_LAT_HIST_SUB) {
+      v = idx;
+   } else {
+      v = (vmk_uint64)(NVME_PCIE_LAT_HIST_SUB +
+                       idx % NVME_PCIE_LAT_HIST_SUB) <<
+          (idx / NVME_PCIE_LAT_HIST_SUB - 1);
+   }
+   return v << NVME_PCIE_LAT_HIST_UNIT_SHIFT;
+}
+
+/**
+ * Get latency at a percentile from one latency histogram
+ *
+ * @param[in] count   NVME_PCIE_LAT_HIST_BUCKETS buckets
+ * @param[in] total   Sum of 'count'
+ * @param[in] permil  Percentile in 1/1000
+ *
+ * @return Upper bound in ns of the bucket the percentile falls into
+ */
+vmk_uint64
+NVMEPCIELatHistPercentile(vmk_uint64 *count,
+                          vmk_uint64 total,
+                          vmk_uint32 permil)
+{
+   vmk_uint64 target = (total * permil + 999) / 1000;
+   vmk_uint64 sum = 0;
+   vmk_uint32 i;
+
+   for (i = 0; i < NVME_PCIE_LAT_HIST_BUCKETS - 1; i++) {
+      sum += count[i];
+      if (sum >= target) {
+         break;
+      }
+   }
+   return NVMEPCIELatHistBucketNs(i + 1);
+}
+
+/**
+ * Merge latency histograms of all IO queues
+ *
+ * Queues are read without lock, so a snapshot may miss completions being
+ * recorded concurrently.
+ *
+ * @param[in]  ctrlr   Controller instance
+ * @param[out] merged  Merged histograms, 'resetReq' is untouched
+ */
+void
+NVMEPCIELatHistMerge(NVMEPCIEController *ctrlr, NVMEPCIELatHist *merged)
+{
+   NVMEPCIEQueueInfo *qinfo;
+   NVMEPCIEQueueRef *ref;
+   vmk_uint64 *dst, *src;
+   vmk_uint32 i, j, n;
+
+   n = sizeof(merged->count) / sizeof(vmk_uint64);
+   dst = &merged->count[0][0][0];
+   vmk_Memset(dst, 0, sizeof(merged->count));
+
+   for (i = 1; i <= ctrlr->numIoQueues; i++) {
+      qinfo = &ctrlr->queueList[i];
+      ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_SUSPENDED);
+      if (ref == NULL) {
+         continue;
+      }
+      if (qinfo->stats != NULL &&
+          !vmk_AtomicRead8(&qinfo->stats->latHist.resetReq)) {
+         src = &qinfo->stats->latHist.count[0][0][0];
+         for (j = 0; j < n; j++) {
+            dst[j] += src[j];
+         }
+      }
+      NVMEPCIEQueueRefPut(ref);
+   }
+}
+
+/**
+ * Request reset of latency histograms of all IO queues
+ *
+ * @param[in] ctrlr  Controller instance
+ */
+void
+NVMEPCIELatHistReset(NVMEPCIEController *ctrlr)
+{
+   NVMEPCIEQueueInfo *qinfo;
+   NVMEPCIEQueueRef *ref;
+   vmk_uint32 i;
+
+   for (i = 1; i <= ctrlr->numIoQueues; i++) {
+      qinfo = &ctrlr->queueList[i];
+      ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_SUSPENDED);
+      if (ref == NULL) {
+         continue;
+      }
+      if (qinfo->stats != NULL) {
+         vmk_AtomicWrite8(&qinfo->stats->latHist.resetReq, 1);
+      }
+      NVMEPCIEQueueRefPut(ref);
+   }
+}
+
+/**
+ * Merge phase histograms of all IO queues
+ *
+ * @param[in]  ctrlr   Controller instance
+ * @param[out] merged  Merged histograms, 'resetReq' is not used
+ */
+void
+NVMEPCIEPhaseHistMerge(NVMEPCIEController *ctrlr, NVMEPCIEPhaseHist *merged)
+{
+   NVMEPCIEQueueInfo *qinfo;
+   NVMEPCIEQueueRef *ref;
+   vmk_uint64 *dst, *src;
+   vmk_uint32 i, j, n;
+
+   n = sizeof(merged->count) / sizeof(vmk_uint64);
+   dst = &merged->count[0][0];
+   vmk_Memset(dst, 0, sizeof(merged->count));
+
+   for (i = 1; i <= ctrlr->numIoQueues; i++) {
+      qinfo = &ctrlr->queueList[i];
+      ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_SUSPENDED);
+      if (ref == NULL) {
+         continue;
+      }
+      if (qinfo->stats != NULL &&
+          !vmk_AtomicRead8(&qinfo->stats->phaseHist.resetReq)) {
+         src = &qinfo->stats->phaseHist.count[0][0];
+         for (j = 0; j < n; j++) {
+            dst[j] += src[j];
+         }
+      }
+      NVMEPCIEQueueRefPut(ref);
+   }
+}
+
+/**
+ * Request reset of phase histograms of all IO queues
+ *
+ * @param[in] ctrlr  Controller instance
+ */
+void
+NVMEPCIEPhaseHistReset(NVMEPCIEController *ctrlr)
+{
+   NVMEPCIEQueueInfo *qinfo;
+   NVMEPCIEQueueRef *ref;
+   vmk_uint32 i;
+
+   for (i = 1; i <= ctrlr->numIoQueues; i++) {
+      qinfo = &ctrlr->queueList[i];
+      ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_SUSPENDED);
+      if (ref == NULL) {
+         continue;
+      }
+      if (qinfo->stats != NULL) {
+         vmk_AtomicWrite8(&qinfo->stats->phaseHist.resetReq, 1);
+      }
+      NVMEPCIEQueueRefPut(ref);
+   }
+}
+
+/**
+ * Clear submitter PCPU statistics of all IO queues
+ *
+ * Counters are cleared without sq or cq lock, so an update racing with the
+ * reset may survive it.
+ *
+ * @param[in] ctrlr  Controller instance
+ */
+void
+NVMEPCIECpuStatsReset(NVMEPCIEController *ctrlr)
+{
+   NVMEPCIEQueueInfo *qinfo;
+   NVMEPCIEQueueRef *ref;
+   vmk_uint32 i;
+
+   for (i = 1; i <= ctrlr->numIoQueues; i++) {
+      qinfo = &ctrlr->queueList[i];
+      ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_SUSPENDED);
+      if (ref == NULL) {
+         continue;
+      }
+      if (qinfo->stats != NULL) {
+         vmk_Memset(qinfo->stats->cpuStats.submits, 0,
+                    qinfo->stats->cpuStats.numCpus * sizeof(vmk_uint64));
+         qinfo->stats->cpuStats.completions = 0;
+         qinfo->stats->cpuStats.crossCpu = 0;
+      }
+      NVMEPCIEQueueRefPut(ref);
+   }
+}
+#endif
+
+/**
+ * Get bucket of completion batch size histogram
+ *
+ * @param[in] n  Completion queue entries processed in one round
+ *
+ * @return Index into 'batch' of NVMEPCIEQueueCounters
+ */
+static inline vmk_uint32
+CqeBatchBucket(vmk_uint32 n)
+{
+   vmk_uint32 idx = 0;
+
+   while (n != 0 && idx < NVME_PCIE_CQE_BATCH_NUM - 1) {
+      n >>= 1;
+      idx++;
+   }
+   return idx;
+}
+
+/**
+ * Clear counters of a queue
+ *
+ * Counters are written without lock, so an update racing with the reset
+ * may survive it.
+ *
+ * @param[in] qinfo  Queue instance
+ */
+void
+NVMEPCIEQueueCountersReset(NVMEPCIEQueueInfo *qinfo)
+{
+   NVMEPCIEQueueCounters *counters = &qinfo->counters;
+
+   vmk_Memset(&counters->sq, 0, sizeof(counters->sq));
+   vmk_Memset(&counters->cq, 0, sizeof(counters->cq));
+   counters->event.intrs = 0;
+   vmk_AtomicWrite64(&counters->event.cmdFull, 0);
+#if NVME_PCIE_STORAGE_POLL
+   counters->event.polls = 0;
+   counters->event.emptyPolls = 0;
+   counters->event.intrModeUs = 0;
+   counters->event.pollModeUs = 0;
+   counters->event.modeTs = NVMEPCIEGetTimerUs();
+#endif
+}
+
 /**
  * Process the commands completed by hardware in the given queue, return
  * the number of completed IO commands.
  *
  * @param[in]  qinfo    Queue instance
+ * @param[in]  flags    NVME_PCIE_HOT_PATH_* features of this variant
  *
  * @return              The number of completed IO commands.
  */
-vmk_uint32
-NVMEPCIEProcessCq(NVMEPCIEQueueInfo *qinfo)
+static NVME_PCIE_ALWAYS_INLINE vmk_uint32
+ProcessCqVariant(NVMEPCIEQueueInfo *qinfo, const vmk_uint32 flags)
 {
    NVMEPCIECompQueueInfo *cqInfo = qinfo->cqInfo;
    NVMEPCIECmdInfoList *cmdList = qinfo->cmdList;
@@ -1823,12 +3787,25 @@ NVMEPCIEProcessCq(NVMEPCIEQueueInfo *qinfo)
 #ifdef NVME_STATS
    vmk_TimerRelCycles latency = 0;
    vmk_TimerCycles lastValidTs = 0;
+   vmk_TimerCycles cqeTs = 0;
+   vmk_uint32 cpu = 0;
+   vmk_uint32 weight = 1;
+#endif
+#if NVME_PCIE_STORAGE_POLL
+   vmk_TimerCycles now = 0;
 #endif
    vmk_uint16 cid;
+   vmk_Bool traced;
+   NVMEPCIETraceEvent traceEv;
 
    head = cqInfo->head;
    phase = cqInfo->phase;
    sqHead = sqInfo->head;
+#ifdef NVME_STATS
+   if (flags & NVME_PCIE_HOT_PATH_STATS) {
+      cpu = vmk_PCPUGetCurrent();
+   }
+#endif
 
    while(1) {
       cqEntry = &cqInfo->compq[head];
@@ -1836,12 +3813,13 @@ NVMEPCIEProcessCq(NVMEPCIEQueueInfo *qinfo)
          break;
       }
 #if NVME_DEBUG
-      if (((qinfo->id == 0) && (nvmePCIEDebugMask & NVME_DEBUG_ADMIN)) ||
-          ((qinfo->id > 0) &&(nvmePCIEDebugMask & NVME_DEBUG_CMD))) {
+      if ((flags & NVME_PCIE_HOT_PATH_DEBUG) &&
+          (((qinfo->id == 0) && (nvmePCIEDebugMask & NVME_DEBUG_ADMIN)) ||
+           ((qinfo->id > 0) &&(nvmePCIEDebugMask & NVME_DEBUG_CMD)))) {
          NVMEPCIEDumpCqe(ctrlr, cqEntry);
       }
 #endif
-      cid = (ctrlr->abortEnabled) ? cqEntry->dw3.cid : cqEntry->dw3.cid - 1;
+      cid = (flags & NVME_PCIE_HOT_PATH_ABORT) ? cqEntry->dw3.cid : cqEntry->dw3.cid - 1;
       if (VMK_UNLIKELY(cid >= cmdList->idCount)) {
          EPRINT(ctrlr, "Invalid cid %d, qid: %d", cid, qinfo->id);
          VMK_ASSERT(0);
@@ -1878,10 +3856,16 @@ NVMEPCIEProcessCq(NVMEPCIEQueueInfo *qinfo)
       vmk_Memcpy(&cmdInfo->vmkCmd->cqEntry,
                  cqEntry,
                  VMK_NVME_CQE_SIZE);
-      if (!ctrlr->abortEnabled) {
+      if (!(flags & NVME_PCIE_HOT_PATH_ABORT)) {
          cmdInfo->vmkCmd->cqEntry.dw3.cid = cmdInfo->vmkCmd->nvmeCmd.cdw0.cid;
       }
       cmdInfo->vmkCmd->nvmeStatus = GetCommandStatus(cqEntry);
+      if (VMK_UNLIKELY(cmdInfo->traced)) {
+         // 'vmkCmd' may be freed by done(), keep a copy for COMPLETE
+         TraceFill(qinfo, cmdInfo, NVME_PCIE_TRACE_HW_DONE, &traceEv);
+         traceEv.aux = (cqEntry->dw3.sct << 8) | cqEntry->dw3.sc;
+         TraceRecord(qinfo, &traceEv);
+      }
 #ifdef NVME_STATS
       /**
        * For corner case where CQ entries had been written to CQ but interrupt
@@ -1892,7 +3876,10 @@ NVMEPCIEProcessCq(NVMEPCIEQueueInfo *qinfo)
        * of above stated case. Which is a simple way. Let's make a compromise on
        * preciseness.
        */
-      if (cmdInfo->statsOn) {
+      if ((flags & NVME_PCIE_HOT_PATH_STATS) && cmdInfo->statsOn) {
+         if (VMK_UNLIKELY(cmdInfo->entryTs != 0)) {
+            cqeTs = vmk_GetTimerCycles();
+         }
          if (cmdInfo->doneByHwTs) {
             latency = (cmdInfo->doneByHwTs - cmdInfo->sendToHwTs);
             if (VMK_UNLIKELY(latency <= 0)) {
@@ -1901,21 +3888,62 @@ NVMEPCIEProcessCq(NVMEPCIEQueueInfo *qinfo)
             cmdInfo->vmkCmd->deviceLatency = latency;
             lastValidTs = cmdInfo->doneByHwTs;
          } else {
+            /**
+             * Not stamped by a walk, which statistics sampling skips. The
+             * first such command stamps the batch.
+             */
+            if (lastValidTs == 0) {
+               lastValidTs = vmk_GetTimerCycles();
+            }
             latency = (lastValidTs - cmdInfo->sendToHwTs);
             if (VMK_UNLIKELY(latency <= 0)) {
                latency = 0;
             }
             cmdInfo->vmkCmd->deviceLatency = latency;
          }
+         // A sampled command stands for 'weight' commands
+         weight = ctrlr->statsSampleMask + 1;
+         qinfo->stats->cpuStats.completions += weight;
+         if (cmdInfo->submitCpu != cpu) {
+            qinfo->stats->cpuStats.crossCpu += weight;
+         }
+         if (qinfo->id > 0) {
+            LatHistRecord(qinfo, cmdInfo->vmkCmd, latency, weight);
+            if (VMK_UNLIKELY(latency > ctrlr->outlierThrTc)) {
+               OutlierRecord(qinfo, cmdInfo, cqEntry, latency);
+            }
+         }
+      } else if (flags & NVME_PCIE_HOT_PATH_STATS) {
+         // Not sampled, device latency not measured
+         cmdInfo->vmkCmd->deviceLatency = 0;
       }
 #endif
 
-      DPRINT_CMD(ctrlr, qinfo->id, "Complete cmdInfo %p, qid: %d, cid: %d, vmkCmd: %p, "
-                 "type: %d, nvmeStatus: 0x%x, cqe: %p, cqHead: %d, "
-                 "sqHead: %d, lat: %lu",
-                 cmdInfo, qinfo->id, cid, cmdInfo->vmkCmd, cmdInfo->type,
-                 cmdInfo->vmkCmd->nvmeStatus, cqEntry, head, sqHead,
-                 cmdInfo->statsOn? vmk_TimerUnsignedTCToUS(cmdInfo->vmkCmd->deviceLatency) : 0);
+      if (flags & NVME_PCIE_HOT_PATH_DEBUG) {
+         DPRINT_CMD(ctrlr, qinfo->id, "Complete cmdInfo %p, qid: %d, cid: %d, vmkCmd: %p, "
+                    "type: %d, nvmeStatus: 0x%x, cqe: %p, cqHead: %d, "
+                    "sqHead: %d, lat: %lu",
+                    cmdInfo, qinfo->id, cid, cmdInfo->vmkCmd, cmdInfo->type,
+                    cmdInfo->vmkCmd->nvmeStatus, cqEntry, head, sqHead,
+                    cmdInfo->statsOn? vmk_TimerUnsignedTCToUS(cmdInfo->vmkCmd->deviceLatency) : 0);
+      }
+#if NVME_PCIE_STORAGE_POLL
+      if ((flags & NVME_PCIE_HOT_PATH_LATMODEL) && cmdInfo->latTracked) {
+         // One time stamp is precise enough for a batch of completions
+         if (now == 0) {
+            now = vmk_GetTimerCycles();
+         }
+         LatModelUpdate(qinfo, cmdInfo, now);
+      }
+#endif
+      traced = cmdInfo->traced;
+      cmdInfo->traced = VMK_FALSE;
+#ifdef NVME_STATS
+      if ((flags & NVME_PCIE_HOT_PATH_STATS) && VMK_UNLIKELY(cqeTs != 0)) {
+         PhaseHistRecord(qinfo, cmdInfo, cqeTs, vmk_GetTimerCycles(), weight);
+         cqeTs = 0;
+      }
+#endif
       if (cmdInfo->done) {
          cmdInfo->done(qinfo, cmdInfo);
       } else {
@@ -1924,6 +3952,11 @@ NVMEPCIEProcessCq(NVMEPCIEQueueInfo *qinfo)
                 cmdInfo->type, vmk_AtomicRead32(&cmdInfo->atomicStatus));
          VMK_ASSERT(0);
       }
+      if (VMK_UNLIKELY(traced)) {
+         traceEv.type = NVME_PCIE_TRACE_COMPLETE;
+         traceEv.aux = 0;
+         TraceRecord(qinfo, &traceEv);
+      }
 
 skip_invalid_cqe:
       numCmdCompleted++;
@@ -1940,12 +3973,354 @@ skip_invalid_cqe:
       cqInfo->phase = phase;
       if (VMK_LIKELY(!ctrlr->isRemoved)) {
          NVMEPCIEWritel(head, cqInfo->doorbell);
+         qinfo->counters.cq.cqDoorbells++;
       }
    }
 
+   qinfo->counters.cq.completions += numCmdCompleted;
+   qinfo->counters.cq.batch[CqeBatchBucket(numCmdCompleted)]++;
+
+#if NVME_PCIE_STORAGE_POLL
+   // The estimate is only consumed by poll mode switching
+   if (numCmdCompleted > 0 && qinfo->id > 0 &&
+       vmk_AtomicRead8(&ctrlr->pollAct)) {
+      IopsEstUpdate(qinfo, numCmdCompleted);
+   }
+#endif
+
    return numCmdCompleted;
 }
 
+/**
+ * Instantiate hot path functions of one feature combination
+ */
+#define NVME_PCIE_HOT_PATH_DEFINE(flags)                                       \
+   static vmk_uint32                                                           \
+   ProcessCq##flags(NVMEPCIEQueueInfo *qinfo)                                  \
+   {                                                                           \
+      return ProcessCqVariant(qinfo, flags);                                   \
+   }                                                                           \
+   static VMK_ReturnStatus                                                     \
+   SubmitAsyncCommand##flags(NVMEPCIEController *ctrlr,                        \
+                             vmk_NvmeCommand *vmkCmd,                          \
+                             vmk_uint32 qid)                                   \
+   {                                                                           \
+      return SubmitAsyncCommandVariant(ctrlr, vmkCmd, qid, flags);             \
+   }                                                                           \
+   static vmk_NvmeStatus                                                       \
+   IssueCommandToHw##flags(NVMEPCIEQueueInfo *qinfo,                           \
+                           NVMEPCIECmdInfo *cmdInfo,                           \
+                           NVMEPCIECompleteCommandCb cb)                       \
+   {                                                                           \
+      return IssueCommandToHwVariant(qinfo, cmdInfo, cb, flags);               \
+   }
+
+#define NVME_PCIE_HOT_PATH_OPS(flags)                                          \
+   { flags, ProcessCq##flags, SubmitAsyncCommand##flags,                       \
+     IssueCommandToHw##flags }
+
+NVME_PCIE_HOT_PATH_DEFINE(0)
+NVME_PCIE_HOT_PATH_DEFINE(1)
+NVME_PCIE_HOT_PATH_DEFINE(2)
+NVME_PCIE_HOT_PATH_DEFINE(3)
+NVME_PCIE_HOT_PATH_DEFINE(4)
+NVME_PCIE_HOT_PATH_DEFINE(5)
+NVME_PCIE_HOT_PATH_DEFINE(6)
+NVME_PCIE_HOT_PATH_DEFINE(7)
+NVME_PCIE_HOT_PATH_DEFINE(8)
+NVME_PCIE_HOT_PATH_DEFINE(9)
+NVME_PCIE_HOT_PATH_DEFINE(10)
+NVME_PCIE_HOT_PATH_DEFINE(11)
+NVME_PCIE_HOT_PATH_DEFINE(12)
+NVME_PCIE_HOT_PATH_DEFINE(13)
+NVME_PCIE_HOT_PATH_DEFINE(14)
+NVME_PCIE_HOT_PATH_DEFINE(15)
+
+/** Indexed by NVME_PCIE_HOT_PATH_* feature bits within SPECIALIZED */
+static const NVMEPCIEHotPathOps nvmePCIEHotPaths[NVME_PCIE_HOT_PATH_SPECIALIZED + 1] = {
+   NVME_PCIE_HOT_PATH_OPS(0),
+   NVME_PCIE_HOT_PATH_OPS(1),
+   NVME_PCIE_HOT_PATH_OPS(2),
+   NVME_PCIE_HOT_PATH_OPS(3),
+   NVME_PCIE_HOT_PATH_OPS(4),
+   NVME_PCIE_HOT_PATH_OPS(5),
+   NVME_PCIE_HOT_PATH_OPS(6),
+   NVME_PCIE_HOT_PATH_OPS(7),
+   NVME_PCIE_HOT_PATH_OPS(8),
+   NVME_PCIE_HOT_PATH_OPS(9),
+   NVME_PCIE_HOT_PATH_OPS(10),
+   NVME_PCIE_HOT_PATH_OPS(11),
+   NVME_PCIE_HOT_PATH_OPS(12),
+   NVME_PCIE_HOT_PATH_OPS(13),
+   NVME_PCIE_HOT_PATH_OPS(14),
+   NVME_PCIE_HOT_PATH_OPS(15),
+};
+
+/**
+ * Hot path functions of the other feature combinations
+ *
+ * Built once with the feature bits read at runtime from the selected ops of
+ * the queue, for debug and diagnostic configurations only.
+ */
+static vmk_uint32
+ProcessCqGeneric(NVMEPCIEQueueInfo *qinfo)
+{
+   return ProcessCqVariant(qinfo, qinfo->hotPath->flags);
+}
+
+static VMK_ReturnStatus
+SubmitAsyncCommandGeneric(NVMEPCIEController *ctrlr,
+                          vmk_NvmeCommand *vmkCmd,
+                          vmk_uint32 qid)
+{
+   return SubmitAsyncCommandVariant(ctrlr, vmkCmd, qid,
+                                    ctrlr->queueList[qid].hotPath->flags);
+}
+
+static vmk_NvmeStatus
+IssueCommandToHwGeneric(NVMEPCIEQueueInfo *qinfo,
+                        NVMEPCIECmdInfo *cmdInfo,
+                        NVMEPCIECompleteCommandCb cb)
+{
+   return IssueCommandToHwVariant(qinfo, cmdInfo, cb, qinfo->hotPath->flags);
+}
+
+#define NVME_PCIE_HOT_PATH_GENERIC(flags)                                      \
+   { flags, ProcessCqGeneric, SubmitAsyncCommandGeneric,                       \
+     IssueCommandToHwGeneric }
+#define NVME_PCIE_HOT_PATH_GENERIC4(flags)                                     \
+   NVME_PCIE_HOT_PATH_GENERIC(flags), NVME_PCIE_HOT_PATH_GENERIC(flags + 1),   \
+   NVME_PCIE_HOT_PATH_GENERIC(flags + 2), NVME_PCIE_HOT_PATH_GENERIC(flags + 3)
+#define NVME_PCIE_HOT_PATH_GENERIC16(flags)                                    \
+   NVME_PCIE_HOT_PATH_GENERIC4(flags), NVME_PCIE_HOT_PATH_GENERIC4(flags + 4), \
+   NVME_PCIE_HOT_PATH_GENERIC4(flags + 8),                                     \
+   NVME_PCIE_HOT_PATH_GENERIC4(flags + 12)
+
+/** Indexed by NVME_PCIE_HOT_PATH_* feature bits, carries the bits only */
+static const NVMEPCIEHotPathOps nvmePCIEHotPathsGeneric[NVME_PCIE_HOT_PATH_NUM] = {
+   NVME_PCIE_HOT_PATH_GENERIC16(0),
+   NVME_PCIE_HOT_PATH_GENERIC16(16),
+   NVME_PCIE_HOT_PATH_GENERIC16(32),
+   NVME_PCIE_HOT_PATH_GENERIC16(48),
+};
+
+/**
+ * Select hot path variants of all queues according to current configuration
+ *
+ * Must be called whenever abortEnabled, statsEnabled, blkSizeAwarePollAct,
+ * pollCostModel, pollLatModel, stallThr, traceRate, phaseStamp or
+ * nvmePCIEDebugMask changes. A queue may run the old variant for
+ * commands already in flight, which is harmless since every variant keeps
+ * per command state (e.g. statsOn) consistent by itself.
+ *
+ * @param[in] ctrlr  Controller instance
+ */
+void
+NVMEPCIESelectHotPath(NVMEPCIEController *ctrlr)
+{
+   vmk_uint32 flags = 0, qflags;
+   int i;
+
+   if (ctrlr->abortEnabled) {
+      flags |= NVME_PCIE_HOT_PATH_ABORT;
+   }
+#ifdef NVME_STATS
+   if (ctrlr->statsEnabled) {
+      flags |= NVME_PCIE_HOT_PATH_STATS;
+   }
+#endif
+#if NVME_PCIE_BLOCKSIZE_AWARE
+   if (vmk_AtomicRead8(&ctrlr->blkSizeAwarePollAct) ||
+       vmk_AtomicRead8(&ctrlr->pollCostModel)) {
+      flags |= NVME_PCIE_HOT_PATH_BLKSIZE;
+   }
+#endif
+#if NVME_PCIE_STORAGE_POLL
+   if (vmk_AtomicRead8(&ctrlr->pollLatModel)) {
+      flags |= NVME_PCIE_HOT_PATH_LATMODEL;
+   }
+#endif
+   if (vmk_AtomicRead32(&ctrlr->stallThr) != 0 ||
+       vmk_AtomicRead32(&ctrlr->traceRate) != 0 ||
+       vmk_AtomicRead8(&ctrlr->phaseStamp)) {
+      flags |= NVME_PCIE_HOT_PATH_DIAG;
+   }
+
+   for (i = 0; i <= NVME_PCIE_MAX_IO_QUEUES; i++) {
+      qflags = flags;
+#if NVME_DEBUG
+      if (((i == 0) && (nvmePCIEDebugMask & NVME_DEBUG_ADMIN)) ||
+          ((i > 0) && (nvmePCIEDebugMask & NVME_DEBUG_CMD))) {
+         qflags |= NVME_PCIE_HOT_PATH_DEBUG;
+      }
+#endif
+      if ((qflags & ~NVME_PCIE_HOT_PATH_SPECIALIZED) == 0) {
+         ctrlr->queueList[i].hotPath = &nvmePCIEHotPaths[qflags];
+      } else {
+         ctrlr->queueList[i].hotPath = &nvmePCIEHotPathsGeneric[qflags];
+      }
+   }
+
+   DPRINT_CTRLR(ctrlr, "Hot path variant 0x%x selected.", flags);
+}
+
+/**
+ * Record commands of a stall wheel tick which are still outstanding
+ *
+ * @param[in] qinfo    Queue instance
+ * @param[in] tick     Stall wheel tick the commands were issued in
+ * @param[in] ageSec   Age of the commands in seconds
+ */
+static void
+StallWheelScan(NVMEPCIEQueueInfo *qinfo, vmk_uint32 tick, vmk_uint32 ageSec)
+{
+   NVMEPCIEController *ctrlr = qinfo->ctrlr;
+   NVMEPCIECmdInfoList *cmdList = qinfo->cmdList;
+   NVMEPCIECmdInfo *cmdInfo;
+   NVMEPCIEStallRecord *record;
+   NVMEPCIETraceEvent traceEv;
+   vmk_uint32 status, stalled = 0;
+   vmk_uint16 cid, firstCid = 0;
+   vmk_uint8 firstOpc = 0;
+   int i;
+
+   for (i = 0; i < cmdList->idCount; i++) {
+      cmdInfo = &cmdList->list[i];
+      status = vmk_AtomicRead32(&cmdInfo->atomicStatus);
+      if ((status != NVME_PCIE_CMD_STATUS_ACTIVE &&
+           status != NVME_PCIE_CMD_STATUS_FREE_ON_COMPLETE) ||
+          !cmdInfo->stallTracked || cmdInfo->stallTick != tick) {
+         continue;
+      }
+
+      cid = ctrlr->abortEnabled ? cmdInfo->cmdId - 1 : cmdInfo->cmdId;
+      vmk_AtomicInc64(&qinfo->stallWheel.stallEvents);
+      if (stalled++ == 0) {
+         firstCid = cid;
+         firstOpc = cmdInfo->stallOpc;
+      }
+      // Older records of this scan would be overwritten anyway
+      if (stalled > NVME_PCIE_STALL_RECORD_NUM) {
+         continue;
+      }
+
+      vmk_SpinlockLock(ctrlr->stallLock);
+      record = &ctrlr->stallRecords[ctrlr->stallRecordIdx++ %
+                                    NVME_PCIE_STALL_RECORD_NUM];
+      record->timeUs = NVMEPCIEGetTimerUs();
+      record->ageSec = ageSec;
+      record->qid = qinfo->id;
+      record->cid = cid;
+      record->opc = cmdInfo->stallOpc;
+      vmk_SpinlockUnlock(ctrlr->stallLock);
+
+      // 'vmkCmd' may complete concurrently, trace from cmdInfo only
+      if (vmk_AtomicRead32(&ctrlr->traceRate) != 0) {
+         vmk_Memset(&traceEv, 0, sizeof(traceEv));
+         traceEv.type = NVME_PCIE_TRACE_TIMEOUT;
+         traceEv.opc = cmdInfo->stallOpc;
+         traceEv.cid = cid;
+         traceEv.aux = ageSec > 0xffff ? 0xffff : ageSec;
+         TraceRecord(qinfo, &traceEv);
+      }
+   }
+
+   // One line per queue and tick, details are in 'stalls'
+   if (stalled != 0) {
+      WPRINT(ctrlr, "%u commands on queue %d outstanding for over %u seconds,"
+             " first cid %d opc 0x%x.", stalled, qinfo->id, ageSec,
+             firstCid, firstOpc);
+   }
+}
+
+/**
+ * Advance the stall wheel of a queue by one tick
+ *
+ * Called every NVME_PCIE_IOPS_RECORD_FREQ by the IOPs timer. Only when the
+ * bucket crossing the stall threshold is not empty, the command list is
+ * scanned.
+ *
+ * @param[in] qinfo  Queue instance
+ */
+void
+NVMEPCIEStallWheelAdvance(NVMEPCIEQueueInfo *qinfo)
+{
+   NVMEPCIEStallWheel *wheel = &qinfo->stallWheel;
+   vmk_uint32 thr = vmk_AtomicRead32(&qinfo->ctrlr->stallThr);
+   vmk_uint32 tick, agedTick;
+
+   tick = vmk_AtomicRead32(&wheel->tick) + 1;
+   vmk_AtomicWrite32(&wheel->tick, tick);
+
+   /**
+    * Commands issued in tick T are between 'thr' and 'thr + 1' seconds old
+    * at tick T + thr + 1.
+    */
+   if (thr == 0 || tick <= thr) {
+      return;
+   }
+   agedTick = tick - thr - 1;
+   if (vmk_AtomicRead32(&wheel->bucket[agedTick %
+                                       NVME_PCIE_STALL_WHEEL_SLOTS]) != 0) {
+      StallWheelScan(qinfo, agedTick, thr);
+   }
+}
+
+/**
+ * Count outstanding commands of a queue by stall wheel
+ *
+ * @param[in] qinfo   Queue instance
+ * @param[in] minAge  Minimum age in ticks of counted commands
+ *
+ * @return Number of commands issued at least 'minAge' ticks ago and less
+ *         than NVME_PCIE_STALL_WHEEL_SLOTS ticks ago
+ */
+vmk_uint32
+NVMEPCIEStallWheelCount(NVMEPCIEQueueInfo *qinfo, vmk_uint32 minAge)
+{
+   NVMEPCIEStallWheel *wheel = &qinfo->stallWheel;
+   vmk_uint32 tick = vmk_AtomicRead32(&wheel->tick);
+   vmk_uint32 age, count = 0;
+
+   for (age = minAge; age < NVME_PCIE_STALL_WHEEL_SLOTS && age <= tick; age++) {
+      count += vmk_AtomicRead32(&wheel->bucket[(tick - age) %
+                                               NVME_PCIE_STALL_WHEEL_SLOTS]);
+   }
+   return count;
+}
+
+/**
+ * Sample occupancy of a queue into its occupancy ring
+ *
+ * Called every NVME_PCIE_IOPS_RECORD_FREQ by the IOPs timer. SQ head and
+ * tail are read without sq lock, which is fine for a sample.
+ *
+ * @param[in] qinfo  Queue instance
+ * @param[in] iops   Commands completed in the last second
+ */
+void
+NVMEPCIEOccupancyRecord(NVMEPCIEQueueInfo *qinfo, vmk_uint32 iops)
+{
+   NVMEPCIESubQueueInfo *sqInfo = qinfo->sqInfo;
+   NVMEPCIEOccupancyRing *ring = &qinfo->occupancy;
+   NVMEPCIEOccupancySample *sample;
+   vmk_uint32 head, tail;
+
+   head = vmk_AtomicRead32(&sqInfo->pendingHead);
+   if (head == NVME_INVALID_SQ_HEAD) {
+      head = sqInfo->head;
+   }
+   tail = sqInfo->tail;
+
+   sample = &ring->samples[ring->idx % NVME_PCIE_OCCUPANCY_SAMPLES];
+   sample->timeUs = NVMEPCIEGetTimerUs();
+   sample->sqDepth = (tail + sqInfo->qsize - head) % sqInfo->qsize;
+   sample->outstanding = vmk_AtomicRead32(&qinfo->cmdList->nrAct);
+   sample->iops = iops;
+   vmk_CPUMemFenceWrite();
+   ring->idx++;
+}
+
 static VMK_ReturnStatus
 CreateSq(NVMEPCIEController *ctrlr, NVMEPCIEQueueInfo *qinfo)
 {
@@ -2116,13 +4491,18 @@ void NVMEPCIESuspendQueue(NVMEPCIEQueueInfo *qinfo)
 {
    NVMEPCIEController *ctrlr = qinfo->ctrlr;
    NVMEPCIEQueueState state;
+   NVMEPCIEQueueRef *ref;
 
-   vmk_AtomicInc32(&qinfo->refCount);
+   ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_ACTIVE);
+   if (ref == NULL) {
+      WPRINT(ctrlr, "Trying to suspend inactive queue %d.", qinfo->id);
+      return;
+   }
    state = vmk_AtomicReadIfEqualWrite32(&qinfo->state, NVME_PCIE_QUEUE_ACTIVE,
                                         NVME_PCIE_QUEUE_SUSPENDED);
    if (state != NVME_PCIE_QUEUE_ACTIVE) {
       WPRINT(ctrlr, "Trying to suspend inactive queue %d.", qinfo->id);
-      vmk_AtomicDec32(&qinfo->refCount);
+      NVMEPCIEQueueRefPut(ref);
       return;
    }
 
@@ -2141,7 +4521,7 @@ void NVMEPCIESuspendQueue(NVMEPCIEQueueInfo *qinfo)
 #endif
 
    NVMEPCIEDisableIntr(qinfo, VMK_TRUE);
-   vmk_AtomicDec32(&qinfo->refCount);
+   NVMEPCIEQueueRefPut(ref);
    return;
 }
 
@@ -2167,6 +4547,7 @@ NVMEPCIEResumeQueue(NVMEPCIEQueueInfo *qinfo)
 #if NVME_PCIE_STORAGE_POLL
    // Enable poll handler if StoragePoll handler created successfully
    NVMEPCIEStoragePollEnable(qinfo);
+   NVMEPCIEStoragePollSetMode(qinfo, NVME_PCIE_POLL_MODE_INTR);
 #endif
 
    NVMEPCIEEnableIntr(qinfo);
@@ -2186,43 +4567,47 @@ void
 NVMEPCIEFlushQueue(NVMEPCIEQueueInfo *qinfo, vmk_NvmeStatus status)
 {
    NVMEPCIECmdInfo *cmdInfo = NULL;
+   NVMEPCIEQueueRef *ref;
    vmk_atomic32 atomicStatus;
    int i;
 
    /** An active command may be freed in submission path. Wait for queue
-    * refCount to be zero to avoid accessing command list when I/O
+    * references to be dropped to avoid accessing command list when I/O
     * submission is in progress.
     */
-   while(vmk_AtomicRead32(&qinfo->refCount) != 0) {
+   while(QueueRefSum(qinfo) != 0) {
       IPRINT(qinfo->ctrlr, "Wait for queue %d refcount to be zero", qinfo->id);
       vmk_WorldSleep(100);
    }
 
-   vmk_AtomicInc32(&qinfo->refCount);
-   if (vmk_AtomicRead32(&qinfo->state) == NVME_PCIE_QUEUE_NON_EXIST) {
+   ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_SUSPENDED);
+   if (ref == NULL) {
       WPRINT(qinfo->ctrlr, "Trying to flush non exist queue %d.", qinfo->id);
-      vmk_AtomicDec32(&qinfo->refCount);
       return;
    }
 
    cmdInfo = qinfo->cmdList->list;
-   vmk_SpinlockLock(qinfo->cqInfo->lock);
+   NVME_PCIE_QUEUE_LOCK(qinfo->cqInfo);
    NVMEPCIEProcessCq(qinfo);
-   vmk_SpinlockUnlock(qinfo->cqInfo->lock);
+   NVME_PCIE_QUEUE_UNLOCK(qinfo->cqInfo);
 
-   vmk_SpinlockLock(qinfo->cmdList->lock);
+   NVME_PCIE_QUEUE_LOCK(qinfo->cmdList);
    for (i = 1; i <= qinfo->cmdList->idCount; i++) {
       atomicStatus = vmk_AtomicRead32(&cmdInfo->atomicStatus);
       if (atomicStatus == NVME_PCIE_CMD_STATUS_ACTIVE ||
           atomicStatus == NVME_PCIE_CMD_STATUS_FREE_ON_COMPLETE) {
          cmdInfo->vmkCmd->nvmeStatus = status;
+         if (vmk_AtomicRead32(&qinfo->ctrlr->traceRate) != 0) {
+            TraceCmd(qinfo, cmdInfo, NVME_PCIE_TRACE_ABORT, 1);
+         }
+         cmdInfo->traced = VMK_FALSE;
          VMK_ASSERT(cmdInfo->done);
          cmdInfo->done(qinfo, cmdInfo);
       }
       cmdInfo++;
    }
-   vmk_SpinlockUnlock(qinfo->cmdList->lock);
-   vmk_AtomicDec32(&qinfo->refCount);
+   NVME_PCIE_QUEUE_UNLOCK(qinfo->cmdList);
+   NVMEPCIEQueueRefPut(ref);
 }
 
 /**
@@ -2290,16 +4675,49 @@ NVMEPCIEInitQueue(NVMEPCIEQueueInfo *qinfo)
    /** Reset cmd info list */
    cmdList->nrAct = 0;
    cmdList->nrActSmall = 0;
+#if NVME_PCIE_BLOCKSIZE_AWARE
+   vmk_Memset(&qinfo->inflightHist, 0, sizeof(qinfo->inflightHist));
+#endif
    cmdList->freeCmdList = 0;
    vmk_AtomicWrite64(&cmdList->pendingFreeCmdList.atomicComposite, 0);
+   for (i = 0; i < NVME_PCIE_STALL_WHEEL_SLOTS; i++) {
+      vmk_AtomicWrite32(&qinfo->stallWheel.bucket[i], 0);
+   }
+#if NVME_PCIE_STORAGE_POLL
+   cmdList->issueSeq = 0;
+   cmdList->oldestSeq = 0;
+   if (qinfo->counters.event.modeTs == 0) {
+      qinfo->counters.event.modeTs = NVMEPCIEGetTimerUs();
+   }
+#endif
+   vmk_SpinlockLock(cmdList->syncPool.lock);
+   cmdList->syncPool.freeList = 0;
+   cmdList->syncPool.numFree = 0;
    cmdInfo = cmdList->list;
    for (i = 1; i <= cmdList->idCount; i++) {
       cmdInfo->cmdId = i;
+      cmdInfo->stallTracked = VMK_FALSE;
+      cmdInfo->traced = VMK_FALSE;
+      cmdInfo->isSmall = VMK_FALSE;
+      cmdInfo->smallCounted = VMK_FALSE;
+#if NVME_PCIE_BLOCKSIZE_AWARE
+      cmdInfo->costCounted = VMK_FALSE;
+#endif
+#if NVME_PCIE_STORAGE_POLL
+      cmdInfo->latTracked = VMK_FALSE;
+#endif
       vmk_AtomicWrite32(&cmdInfo->atomicStatus, NVME_PCIE_CMD_STATUS_FREE);
-      cmdInfo->freeLink = cmdList->freeCmdList;
-      cmdList->freeCmdList = cmdInfo->cmdId;
+      if (NVMEPCIEIsSyncCmdInfo(cmdList, cmdInfo)) {
+         cmdInfo->freeLink = cmdList->syncPool.freeList;
+         cmdList->syncPool.freeList = cmdInfo->cmdId;
+         cmdList->syncPool.numFree++;
+      } else {
+         cmdInfo->freeLink = cmdList->freeCmdList;
+         cmdList->freeCmdList = cmdInfo->cmdId;
+      }
       cmdInfo ++;
    }
+   vmk_SpinlockUnlock(cmdList->syncPool.lock);
 
    return VMK_OK;
 }
@@ -2380,3 +4798,317 @@ NVMEPCIEIdentify(NVMEPCIEController *ctrlr,
    NVMEPCIEFree(vmkCmd);
    return vmkStatus;
 }
+
+/**
+ * Fill LBA data size cache of namespaces from Identify Namespace
+ *
+ * Issues sync admin commands, so it must be called in world context with
+ * admin queue active.
+ *
+ * @param[in] ctrlr  Controller instance
+ */
+void
+NVMEPCIELbaCacheRefresh(NVMEPCIEController *ctrlr)
+{
+   const vmk_NvmeIdentifyController *identCtrlr;
+   vmk_NvmeIdentifyNamespace *identNs;
+   vmk_uint32 nsid, numNs;
+   vmk_uint8 lbads;
+
+   if (ctrlr->osRes.vmkController == NULL) {
+      return;
+   }
+   identCtrlr = vmk_NvmeGetControllerIdentifyData(ctrlr->osRes.vmkController);
+   if (identCtrlr == NULL) {
+      return;
+   }
+   numNs = identCtrlr->nn < NVME_PCIE_LBA_CACHE_NS ?
+           identCtrlr->nn : NVME_PCIE_LBA_CACHE_NS;
+
+   identNs = NVMEPCIEAlloc(VMK_PAGE_SIZE, 0);
+   if (identNs == NULL) {
+      EPRINT(ctrlr, "Failed to allocate identify namespace buffer.");
+      return;
+   }
+
+   for (nsid = 1; nsid <= numNs; nsid++) {
+      lbads = 0;
+      if (NVMEPCIEIdentify(ctrlr, VMK_NVME_CNS_IDENTIFY_NAMESPACE, nsid,
+                           (vmk_uint8 *)identNs) == VMK_OK &&
+          identNs->nsze != 0) {
+         lbads = identNs->lbaf[identNs->flbas & 0xf].lbads;
+      }
+      // LBA data size smaller than 512 bytes is not supported by spec
+      ctrlr->lbaShift[nsid] = lbads >= NVME_PCIE_LBA_SHIFT_DEFAULT ? lbads : 0;
+      DPRINT_CTRLR(ctrlr, "Namespace %d LBA data size shift %d.",
+                   nsid, ctrlr->lbaShift[nsid]);
+      vmk_Memset(identNs, 0, VMK_PAGE_SIZE);
+   }
+
+   NVMEPCIEFree(identNs);
+}
+
+#if NVME_PCIE_STORAGE_POLL
+/**
+ * Interrupt cost assumed by calibration if 'pollIntrCost' is unavailable
+ */
+#define NVME_PCIE_CALIB_INTR_COST_US 5
+// Upper bound of recommended 'smallIoBytes'
+#define NVME_PCIE_CALIB_SMALL_IO_MAX (128 * 1024)
+
+/**
+ * Time sync reads of one transfer size and fill one row of 'result'
+ *
+ * @param[in]  ctrlr    Controller instance
+ * @param[in]  qid      IO queue ID to issue reads on
+ * @param[in]  nsid     Namespace ID
+ * @param[in]  lbaShift LBA data size shift of the namespace
+ * @param[in]  nsze     Namespace size in LBAs
+ * @param[in]  buf      Data buffer of one page
+ * @param[in]  samples  Scratch of NVME_PCIE_CALIB_SAMPLES latencies
+ * @param[out] result   Calibration result
+ * @param[in]  idx      Row of 'result' to fill
+ *
+ * @return VMK_OK if all reads completed successfully
+ */
+static VMK_ReturnStatus
+PollCalibrateSize(NVMEPCIEController *ctrlr,
+                  vmk_uint32 qid,
+                  vmk_uint32 nsid,
+                  vmk_uint8 lbaShift,
+                  vmk_uint64 nsze,
+                  vmk_uint8 *buf,
+                  vmk_uint64 *samples,
+                  NVMEPCIECalibResult *result,
+                  vmk_uint32 idx)
+{
+   VMK_ReturnStatus vmkStatus;
+   vmk_NvmeCommand *vmkCmd;
+   vmk_NvmeReadCmd *readCmd;
+   vmk_TimerCycles startTs;
+   vmk_uint32 nlb = result->bytes[idx] >> lbaShift;
+   vmk_uint64 sum = 0, v;
+   vmk_uint32 i, j;
+
+   for (i = 0; i < NVME_PCIE_CALIB_SAMPLES; i++) {
+      vmkCmd = NVMEPCIEAlloc(sizeof(vmk_NvmeCommand), 0);
+      if (vmkCmd == NULL) {
+         return VMK_NO_MEMORY;
+      }
+      vmkCmd->nvmeCmd.cdw0.opc = VMK_NVME_NVM_CMD_READ;
+      vmkCmd->nvmeCmd.nsid = nsid;
+      readCmd = (vmk_NvmeReadCmd *)&vmkCmd->nvmeCmd;
+      // Spread reads over the namespace to avoid hitting one device cache line
+      readCmd->slba = ((vmk_uint64)i * 7919 * 256) % (nsze - nlb + 1);
+      readCmd->cdw12.nlb = nlb - 1;
+
+      startTs = vmk_GetTimerCycles();
+      vmkStatus = NVMEPCIESubmitSyncCommand(ctrlr, vmkCmd, qid, buf,
+                                            result->bytes[idx],
+                                            ADMIN_TIMEOUT);
+      samples[i] = vmk_TimerUnsignedTCToUS((vmk_GetTimerCycles() - startTs) *
+                                           1000);
+      if (VMK_UNLIKELY(vmkStatus == VMK_TIMEOUT)) {
+         EPRINT(ctrlr, "Calibration read timed out on queue %d.", qid);
+         return vmkStatus;
+      }
+      if (vmkStatus != VMK_OK ||
+          vmkCmd->nvmeStatus != VMK_NVME_STATUS_GC_SUCCESS) {
+         EPRINT(ctrlr, "Calibration read failed, 0x%x", vmkCmd->nvmeStatus);
+         NVMEPCIEFree(vmkCmd);
+         return VMK_FAILURE;
+      }
+      NVMEPCIEFree(vmkCmd);
+
+      // Insertion sort, the sample count is small
+      v = samples[i];
+      for (j = i; j > 0 && samples[j - 1] > v; j--) {
+         samples[j] = samples[j - 1];
+      }
+      samples[j] = v;
+      sum += v;
+   }
+
+   result->minNs[idx] = samples[0];
+   result->meanNs[idx] = sum / NVME_PCIE_CALIB_SAMPLES;
+   result->p99Ns[idx] = samples[NVME_PCIE_CALIB_SAMPLES * 99 / 100];
+   return VMK_OK;
+}
+
+/**
+ * Calibrate poll parameters by timing reads of the device
+ *
+ * Issues NVME_PCIE_CALIB_SAMPLES sync reads per transfer size from the LBA
+ * data size of namespace 'nsid' up to one page on IO queue 1, and derives
+ *  - 'pollInterval' as half of the minimum latency of the smallest reads,
+ *  - 'pollOIOThr' as the OIO at which completions of the smallest reads
+ *    arrive within the interrupt cost, 'pollOIOExitThr' as half of it,
+ *  - 'smallIoBytes' as the largest power of 2 size whose extrapolated
+ *    transfer time stays within the latency of the smallest reads.
+ * Reads are issued one at a time, so 'pollOIOThr' is extrapolated from
+ * QD1 latency assuming it holds at higher OIO; it is not measured under
+ * load. If latency does not grow with transfer size (a single size, or
+ * noise), 'smallIoBytes' is not derived and the current value is kept.
+ * Results are kept in 'pollCalib', and applied to the controller if
+ * 'apply' is set.
+ *
+ * Issues sync commands, so it must be called in world context.
+ *
+ * @param[in] ctrlr  Controller instance
+ * @param[in] nsid   Namespace ID to read from
+ * @param[in] apply  Apply recommended parameters
+ *
+ * @return VMK_OK if calibration completed
+ * @return VMK_BUSY if another calibration is running
+ */
+VMK_ReturnStatus
+NVMEPCIEPollCalibrate(NVMEPCIEController *ctrlr, vmk_uint32 nsid, vmk_Bool apply)
+{
+   VMK_ReturnStatus vmkStatus = VMK_OK;
+   NVMEPCIECalibResult *result;
+   vmk_NvmeIdentifyNamespace *identNs = NULL;
+   vmk_uint64 *samples = NULL;
+   vmk_uint8 *buf = NULL;
+   vmk_uint8 lbaShift;
+   vmk_uint64 nsze, base, slope, intrCost;
+   vmk_uint32 i, qid = 1, bytes, thr;
+
+   if (vmk_AtomicReadIfEqualWrite32(&ctrlr->pollCalibBusy, 0, 1) != 0) {
+      return VMK_BUSY;
+   }
+
+   result = NVMEPCIEAlloc(sizeof(*result), 0);
+   identNs = NVMEPCIEAlloc(VMK_PAGE_SIZE, 0);
+   samples = NVMEPCIEAlloc(sizeof(vmk_uint64) * NVME_PCIE_CALIB_SAMPLES, 0);
+   buf = NVMEPCIEAlloc(VMK_PAGE_SIZE, 0);
+   if (result == NULL || identNs == NULL || samples == NULL || buf == NULL) {
+      EPRINT(ctrlr, "Failed to allocate calibration buffers.");
+      vmkStatus = VMK_NO_MEMORY;
+      goto out;
+   }
+   result->nsid = nsid;
+   result->qid = qid;
+
+   if (vmk_AtomicRead32(&ctrlr->numIoQueues) < qid) {
+      EPRINT(ctrlr, "No IO queue to calibrate on.");
+      vmkStatus = VMK_NOT_READY;
+      goto done;
+   }
+
+   vmkStatus = NVMEPCIEIdentify(ctrlr, VMK_NVME_CNS_IDENTIFY_NAMESPACE, nsid,
+                                (vmk_uint8 *)identNs);
+   if (vmkStatus != VMK_OK || identNs->nsze == 0) {
+      EPRINT(ctrlr, "Namespace %d is not active.", nsid);
+      vmkStatus = VMK_NOT_FOUND;
+      goto done;
+   }
+   lbaShift = identNs->lbaf[identNs->flbas & 0xf].lbads;
+   nsze = identNs->nsze;
+   if (lbaShift < NVME_PCIE_LBA_SHIFT_DEFAULT ||
+       (1 << lbaShift) > VMK_PAGE_SIZE || nsze < (VMK_PAGE_SIZE >> lbaShift)) {
+      EPRINT(ctrlr, "Namespace %d LBA data size shift %d not supported.",
+             nsid, lbaShift);
+      vmkStatus = VMK_NOT_SUPPORTED;
+      goto done;
+   }
+
+   for (bytes = 1 << lbaShift;
+        bytes <= VMK_PAGE_SIZE && result->numSizes < NVME_PCIE_CALIB_SIZE_NUM;
+        bytes <<= 1) {
+      result->bytes[result->numSizes] = bytes;
+      vmkStatus = PollCalibrateSize(ctrlr, qid, nsid, lbaShift, nsze, buf,
+                                    samples, result, result->numSizes);
+      if (vmkStatus != VMK_OK) {
+         goto done;
+      }
+      result->numSizes++;
+   }
+
+   base = result->meanNs[0];
+   result->pollInterval = result->minNs[0] / 2000;
+   if (result->pollInterval == 0) {
+      result->pollInterval = 1;
+   }
+
+#if NVME_PCIE_BLOCKSIZE_AWARE
+   intrCost = vmk_AtomicRead32(&ctrlr->pollIntrCost);
+#else
+   intrCost = 0;
+#endif
+   if (intrCost == 0) {
+      intrCost = NVME_PCIE_CALIB_INTR_COST_US;
+   }
+   thr = (base + intrCost * 1000 - 1) / (intrCost * 1000);
+   if (thr == 0) {
+      thr = 1;
+   } else if (thr > NVME_PCIE_MAX_IO_QUEUE_SIZE) {
+      thr = NVME_PCIE_MAX_IO_QUEUE_SIZE;
+   }
+   result->pollOIOThr = thr;
+   result->pollOIOExitThr = thr / 2;
+
+   // Transfer time in ns per KiB between the smallest and largest reads
+   i = result->numSizes - 1;
+   slope = 0;
+   if (i > 0 && result->meanNs[i] > base) {
+      slope = (result->meanNs[i] - base) * 1024 /
+              (result->bytes[i] - result->bytes[0]);
+   }
+   if (slope == 0) {
+      // Nothing to extrapolate transfer time from
+      result->smallIoBytes = vmk_AtomicRead32(&ctrlr->smallIoBytes);
+      result->smallIoDerived = VMK_FALSE;
+   } else {
+      bytes = result->bytes[i];
+      while (bytes < NVME_PCIE_CALIB_SMALL_IO_MAX &&
+             ((vmk_uint64)bytes * 2 - result->bytes[0]) * slope / 1024 <=
+             base) {
+         bytes <<= 1;
+      }
+      result->smallIoBytes = bytes;
+      result->smallIoDerived = VMK_TRUE;
+   }
+
+   IPRINT(ctrlr, "Calibrated ns %d: pollInterval %lu pollOIOThr %d"
+          " pollOIOExitThr %d (extrapolated from QD1) smallIoBytes %d%s.",
+          nsid, result->pollInterval, result->pollOIOThr,
+          result->pollOIOExitThr, result->smallIoBytes,
+          result->smallIoDerived ? "" : " (not derived)");
+
+   if (apply) {
+      vmk_AtomicWrite64(&ctrlr->pollInterval, result->pollInterval);
+      // Lower exit threshold first to keep it within the entry threshold
+      vmk_AtomicWrite32(&ctrlr->pollOIOExitThr, 0);
+      vmk_AtomicWrite32(&ctrlr->pollOIOThr, result->pollOIOThr);
+      vmk_AtomicWrite32(&ctrlr->pollOIOExitThr, result->pollOIOExitThr);
+#if NVME_PCIE_BLOCKSIZE_AWARE
+      if (result->smallIoDerived) {
+         vmk_AtomicWrite32(&ctrlr->smallIoBytes, result->smallIoBytes);
+      }
+#endif
+      if (vmk_AtomicRead8(&ctrlr->pollAutoTune)) {
+         NVMEPCIEPollTuneReset(ctrlr);
+      }
+      result->applied = VMK_TRUE;
+   }
+
+done:
+   result->status = vmkStatus;
+   ctrlr->pollCalib = *result;
+out:
+   if (buf != NULL) {
+      NVMEPCIEFree(buf);
+   }
+   if (samples != NULL) {
+      NVMEPCIEFree(samples);
+   }
+   if (identNs != NULL) {
+      NVMEPCIEFree(identNs);
+   }
+   if (result != NULL) {
+      NVMEPCIEFree(result);
+   }
+   vmk_AtomicWrite32(&ctrlr->pollCalibBusy, 0);
+   return vmkStatus;
+}
+#endif
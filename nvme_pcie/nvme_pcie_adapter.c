@@ -21,6 +21,10 @@ static void NVMEPCIECreateIOPsTimer(NVMEPCIEController *ctrlr);
 static void NVMEPCIEStartIOPsTimer(NVMEPCIEController *ctrlr);
 static void NVMEPCIEStopIOPsTimer(NVMEPCIEController *ctrlr);
 static void NVMEPCIEDestroyIOPsTimer(NVMEPCIEController *ctrlr);
+static void BringupCcWrite(NVMEPCIEController *ctrlr, vmk_uint32 cc);
+static void BringupCstsRead(NVMEPCIEController *ctrlr, vmk_uint32 csts);
+static void BringupQueueCreated(NVMEPCIEController *ctrlr, vmk_uint32 qid,
+                                vmk_Bool created, vmk_uint64 startUs);
 
 /**
  * startAdapter callback of adapter ops
@@ -29,7 +33,13 @@ static VMK_ReturnStatus
 StartAdapter(vmk_NvmeAdapter adapter)
 {
    NVMEPCIEController *ctrlr = vmk_NvmeGetAdapterDriverData(adapter);
-   return NVMEPCIEControllerInit(ctrlr);
+   vmk_uint64 startUs = NVMEPCIEGetTimerUs();
+   VMK_ReturnStatus vmkStatus;
+
+   vmkStatus = NVMEPCIEControllerInit(ctrlr);
+   NVMEPCIEBringupPhase(&ctrlr->bringup.attach, NVME_PCIE_BRINGUP_START,
+                        startUs);
+   return vmkStatus;
 }
 
 /**
@@ -117,6 +127,8 @@ NotifyAdapterIOAllowed(vmk_NvmeAdapter adapter,
    IPRINT(ctrlr, "IOAllowed: %d.", ioAllowed);
 
    if (ioAllowed) {
+      NVMEPCIEBringupEnd(ctrlr);
+      NVMEPCIELbaCacheRefreshRequest(ctrlr);
 #if NVME_PCIE_STORAGE_POLL
       NVMEPCIEStoragePollSetup(ctrlr);
 #endif
@@ -176,6 +188,9 @@ ReadRegister32(vmk_NvmeController controller,
       return VMK_PERM_DEV_LOSS;
    }
    *regValue = NVMEPCIEReadl(ctrlr->regs + regID);
+   if (regID == VMK_NVME_REG_CSTS) {
+      BringupCstsRead(ctrlr, *regValue);
+   }
    /*do workaround for some special device.*/
    Workaround4HW(ctrlr, regID, regValue);
    DPRINT_CTRLR(ctrlr, "regID: 0x%x regValue: 0x%x", regID, *regValue);
@@ -211,6 +226,9 @@ WriteRegister32(vmk_NvmeController controller,
    if (VMK_UNLIKELY(ctrlr->isRemoved)) {
       return VMK_PERM_DEV_LOSS;
    }
+   if (regID == VMK_NVME_REG_CC) {
+      BringupCcWrite(ctrlr, regValue);
+   }
    NVMEPCIEWritel(regValue, (ctrlr->regs + regID));
    DPRINT_CTRLR(ctrlr, "regID: 0x%x regValue: 0x%x", regID, regValue);
    return VMK_OK;
@@ -225,6 +243,10 @@ NvmeCommand(vmk_NvmeController controller,
            vmk_NvmeQueueID qid)
 {
    NVMEPCIEController *ctrlr = vmk_NvmeGetControllerDriverData(controller);
+
+   if (VMK_UNLIKELY(qid == 0)) {
+      NVMEPCIEAdminCommandPrepare(ctrlr, vmkCmd);
+   }
    return NVMEPCIESubmitAsyncCommand(ctrlr, vmkCmd, qid);
 }
 
@@ -236,6 +258,7 @@ ConfigAdminQueue(vmk_NvmeController controller)
 {
    NVMEPCIEController *ctrlr = vmk_NvmeGetControllerDriverData(controller);
    NVMEPCIEQueueInfo *qinfo = &ctrlr->queueList[0];
+   vmk_uint64 startUs = NVMEPCIEGetTimerUs();
    vmk_NvmeRegAqa aqa;
 
    if (ctrlr->isRemoved) {
@@ -248,6 +271,7 @@ ConfigAdminQueue(vmk_NvmeController controller)
    NVMEPCIEWriteq(qinfo->cqInfo->compqPhy, (ctrlr->regs + VMK_NVME_REG_ACQ));
    NVMEPCIEWriteq(qinfo->sqInfo->subqPhy, (ctrlr->regs + VMK_NVME_REG_ASQ));
 
+   NVMEPCIEBringupPhase(ctrlr->bringup.cur, NVME_PCIE_BRINGUP_ADMINQ, startUs);
    return VMK_OK;
 }
 
@@ -299,6 +323,7 @@ SetNumberIOQueues(vmk_NvmeController controller,
    VMK_ReturnStatus vmkStatus;
    NVMEPCIEController *ctrlr = vmk_NvmeGetControllerDriverData(controller);
    int nrIoQueues = numQueuesDesired;
+   vmk_uint64 startUs = NVMEPCIEGetTimerUs();
    ctrlr->maxIoQueues = 0;
 
    if (nrIoQueues > NVME_PCIE_MAX_IO_QUEUES) {
@@ -322,7 +347,7 @@ SetNumberIOQueues(vmk_NvmeController controller,
          vmkStatus = ReallocIntr(ctrlr, 1 + nrIoQueues);
          if (vmkStatus != VMK_OK) {
             EPRINT(ctrlr, "Failed to re-allocate %d interrupt cookie.", 1 + nrIoQueues);
-            return vmkStatus;
+            goto out;
          }
       }
 
@@ -333,17 +358,21 @@ SetNumberIOQueues(vmk_NvmeController controller,
 
    if (nrIoQueues < 1) {
       EPRINT(ctrlr, "Failed to allocate interrupts for IO queues.");
-      return VMK_FAILURE;
+      vmkStatus = VMK_FAILURE;
+      goto out;
    }
 
    vmkStatus = RequestIoQueues(ctrlr, &nrIoQueues);
    if (vmkStatus != VMK_OK) {
       EPRINT(ctrlr, "Failed to allocate hardware IO queues.");
-      return vmkStatus;
+      goto out;
    }
    *numQueuesAllocated = nrIoQueues;
    ctrlr->maxIoQueues = nrIoQueues;
 
+out:
+   NVMEPCIEBringupPhase(ctrlr->bringup.cur, NVME_PCIE_BRINGUP_SETQUEUES,
+                        startUs);
    return vmkStatus;
 }
 
@@ -356,7 +385,12 @@ CreateIOQueue(vmk_NvmeController controller,
               vmk_uint16 qsize)
 {
    NVMEPCIEController *ctrlr = vmk_NvmeGetControllerDriverData(controller);
-   return NVMEPCIEQueueCreate(ctrlr, qid, qsize);
+   vmk_uint64 startUs = NVMEPCIEGetTimerUs();
+   VMK_ReturnStatus vmkStatus;
+
+   vmkStatus = NVMEPCIEQueueCreate(ctrlr, qid, qsize);
+   BringupQueueCreated(ctrlr, qid, vmkStatus == VMK_OK, startUs);
+   return vmkStatus;
 }
 
 /**
@@ -368,16 +402,24 @@ DeleteIOQueue(vmk_NvmeController controller,
               vmk_NvmeQueueDeleteReason reason)
 {
    NVMEPCIEController *ctrlr = vmk_NvmeGetControllerDriverData(controller);
+   vmk_uint64 startUs = NVMEPCIEGetTimerUs();
+   VMK_ReturnStatus vmkStatus;
+
    switch (reason) {
       case VMK_NVME_DELETE_QUEUE_FOR_RESET:
-         return NVMEPCIEQueueDestroy(ctrlr, qid, VMK_NVME_STATUS_VMW_IN_RESET);
+         NVMEPCIEBringupResetBegin(ctrlr, startUs);
+         vmkStatus = NVMEPCIEQueueDestroy(ctrlr, qid, VMK_NVME_STATUS_VMW_IN_RESET);
+         break;
       case VMK_NVME_DELETE_QUEUE_FOR_SHUTDOWN:
-         return NVMEPCIEQueueDestroy(ctrlr, qid, VMK_NVME_STATUS_VMW_QUIESCED);
+         vmkStatus = NVMEPCIEQueueDestroy(ctrlr, qid, VMK_NVME_STATUS_VMW_QUIESCED);
+         break;
       default:
          WPRINT(ctrlr, "unsupported queue delete reason: %d", reason);
          return VMK_BAD_PARAM;
    }
 
+   NVMEPCIEBringupPhase(ctrlr->bringup.cur, NVME_PCIE_BRINGUP_DELETEQ, startUs);
+   return vmkStatus;
 }
 
 /**
@@ -389,6 +431,9 @@ ResetAdminQueue(vmk_NvmeController controller)
    VMK_ReturnStatus status = VMK_OK;
    NVMEPCIEController *ctrlr = vmk_NvmeGetControllerDriverData(controller);
    NVMEPCIEQueueInfo *qinfo = &ctrlr->queueList[0];
+   vmk_uint64 startUs = NVMEPCIEGetTimerUs();
+
+   NVMEPCIEBringupResetBegin(ctrlr, startUs);
    NVMEPCIEStopQueue(qinfo, VMK_NVME_STATUS_VMW_IN_RESET);
 
    /** Don't start admin queue if controller has been hot removed. */
@@ -396,6 +441,7 @@ ResetAdminQueue(vmk_NvmeController controller)
       status = NVMEPCIEStartQueue(qinfo);
    }
 
+   NVMEPCIEBringupPhase(ctrlr->bringup.cur, NVME_PCIE_BRINGUP_ADMINQ, startUs);
    return status;
 }
 
@@ -411,9 +457,9 @@ PollHandler(vmk_NvmeController controller)
 
    for (i = 1; i<= ctrlr->numIoQueues; i++){
       qinfo = &ctrlr->queueList[i];
-      vmk_SpinlockLock(qinfo->cqInfo->lock);
+      NVME_PCIE_QUEUE_LOCK(qinfo->cqInfo);
       NVMEPCIEProcessCq(qinfo);
-      vmk_SpinlockUnlock(qinfo->cqInfo->lock);
+      NVME_PCIE_QUEUE_UNLOCK(qinfo->cqInfo);
    }
 
    return;
@@ -514,12 +560,27 @@ GetStatistics(vmk_NvmeController controller,
 {
    VMK_ReturnStatus vmkStatus = VMK_FAILURE;
    NVMEPCIEController *ctrlr = vmk_NvmeGetControllerDriverData(controller);
-   NVMEPCIEQueueInfo *qinfo = &ctrlr->queueList[qid];
+   NVMEPCIEQueueInfo *qinfo;
+   NVMEPCIEQueueRef *ref;
+
+   if (qid > ctrlr->numIoQueues) {
+      return VMK_BAD_PARAM;
+   }
+   qinfo = &ctrlr->queueList[qid];
+   ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_SUSPENDED);
+   if (ref == NULL) {
+      return VMK_NOT_READY;
+   }
 
-   if (VMK_NVME_STATS_CAT_PCIE) {
+   /**
+    * The PCIe category of vmk_NvmeStatistics carries the interrupt count
+    * only, the full counter set is dumped by the 'queueStats' mgmt key.
+    */
+   if (cat == VMK_NVME_STATS_CAT_PCIE && qinfo->stats != NULL) {
       stats->pcie.intrCount = qinfo->stats->intrCount;
       vmkStatus = VMK_OK;
    }
+   NVMEPCIEQueueRefPut(ref);
    return vmkStatus;
 }
 
@@ -541,6 +602,7 @@ SetStatistics(vmk_NvmeController controller,
    NVMEPCIEController *ctrlr = vmk_NvmeGetControllerDriverData(controller);
 
    ctrlr->statsEnabled = config->config.enabled;
+   NVMEPCIESelectHotPath(ctrlr);
    return vmkStatus;
 }
 
@@ -659,6 +721,7 @@ NVMEPCIEAdapterInit(NVMEPCIEController *ctrlr)
    }
 #endif
 
+   NVMEPCIESelectHotPath(ctrlr);
    ctrlr->osRes.vmkAdapter = vmkAdapter;
    return VMK_OK;
 }
@@ -689,22 +752,35 @@ NVMEPCIEIOPsTimerHandler(vmk_TimerCookie data)
 {
    NVMEPCIEController *ctrlr = (NVMEPCIEController *) data.ptr;
    NVMEPCIEQueueInfo *qinfo = NULL;
+   NVMEPCIEQueueRef *ref;
    vmk_uint32 i, numCmdComplLastSec;
 
    for (i = 1; i <= ctrlr->numIoQueues; i++) {
       qinfo = &ctrlr->queueList[i];
-      vmk_AtomicInc32(&qinfo->refCount);
-      if (VMK_LIKELY(vmk_AtomicRead32(&qinfo->state) !=
-                     NVME_PCIE_QUEUE_NON_EXIST)) {
+      ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_SUSPENDED);
+      if (VMK_LIKELY(ref != NULL)) {
          numCmdComplLastSec = vmk_AtomicReadWrite32(&qinfo->numCmdComplThisSec,
                                                     0);
          vmk_AtomicWrite32(&qinfo->iopsLastSec, numCmdComplLastSec);
+#if NVME_PCIE_STORAGE_POLL
+         // Fallback for queues without completion batch in last second
+         if (NVMEPCIEGetTimerUs() - qinfo->iopsEstTs >=
+             NVME_PCIE_IOPS_WINDOW_MAX) {
+            vmk_AtomicWrite32(&qinfo->iopsEst, numCmdComplLastSec);
+         }
+         NVMEPCIEPollTuneEpoch(qinfo, numCmdComplLastSec);
+#endif
+         NVMEPCIEStallWheelAdvance(qinfo);
+         NVMEPCIEOccupancyRecord(qinfo, numCmdComplLastSec);
+         NVMEPCIEQueueRefPut(ref);
       } else {
          IPRINT(qinfo->ctrlr, "Trying to record IOPs of non exist queue %d.",
                 qinfo->id);
       }
-      vmk_AtomicDec32(&qinfo->refCount);
    }
+#if NVME_PCIE_STORAGE_POLL
+   NVMEPCIEPollGovernorTick(ctrlr);
+#endif
 }
 
 static void
@@ -768,6 +844,90 @@ NVMEPCIEStartIOPsTimer(NVMEPCIEController *ctrlr)
    }
 }
 
+/**
+ * Body of 'lbaWorld', refreshing LBA data size cache on request
+ *
+ * Refresh issues sync Identify commands, which can neither be issued from
+ * the IOAllowed notification nor from command completion.
+ *
+ * @param[in] data  Controller instance
+ *
+ * @return VMK_OK when the world is destroyed
+ */
+static VMK_ReturnStatus
+LbaRefreshWorld(void *data)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) data;
+   VMK_ReturnStatus vmkStatus = VMK_OK;
+
+   while (vmkStatus != VMK_DEATH_PENDING) {
+      if (vmk_AtomicReadWrite32(&ctrlr->lbaRefreshReq, 0) != 0) {
+         NVMEPCIELbaCacheRefresh(ctrlr);
+         continue;
+      }
+      // Bounded, a wakeup between the check and the wait is not lost
+      vmkStatus = vmk_WorldWait((vmk_WorldEventID) &ctrlr->lbaRefreshReq,
+                                VMK_LOCK_INVALID, NVME_PCIE_LBA_REFRESH_WAIT_MS,
+                                __FUNCTION__);
+   }
+   return VMK_OK;
+}
+
+static void
+NVMEPCIECreateLbaWorld(NVMEPCIEController *ctrlr)
+{
+   VMK_ReturnStatus status;
+   vmk_WorldProps worldProps;
+   char worldName[VMK_MISC_NAME_MAX];
+
+   vmk_StringFormat(worldName, sizeof(worldName), NULL,
+                    "nvmeLbaWorld-%s", NVMEPCIEGetCtrlrName(ctrlr));
+   vmk_Memset(&worldProps, 0, sizeof(worldProps));
+   worldProps.moduleID = vmk_ModuleCurrentID;
+   worldProps.name = worldName;
+   worldProps.startFunction = LbaRefreshWorld;
+   worldProps.data = ctrlr;
+   worldProps.schedClass = VMK_WORLD_SCHED_CLASS_DEFAULT;
+   worldProps.heapID = NVME_PCIE_DRIVER_RES_HEAP_ID;
+
+   vmk_AtomicWrite32(&ctrlr->lbaRefreshReq, 0);
+   status = vmk_WorldCreate(&worldProps, &ctrlr->lbaWorld);
+   if (status != VMK_OK) {
+      EPRINT(ctrlr, "Failed to create LBA cache world! %s.",
+                    vmk_StatusToString(status));
+
+      ctrlr->lbaWorld = VMK_INVALID_WORLD_ID;
+   }
+}
+
+static void
+NVMEPCIEDestroyLbaWorld(NVMEPCIEController *ctrlr)
+{
+   if (VMK_LIKELY(ctrlr->lbaWorld != VMK_INVALID_WORLD_ID)) {
+      vmk_WorldDestroy(ctrlr->lbaWorld);
+      vmk_WorldWaitForDeath(ctrlr->lbaWorld);
+      ctrlr->lbaWorld = VMK_INVALID_WORLD_ID;
+   }
+}
+
+/**
+ * Request a refresh of LBA data size cache by 'lbaWorld'
+ *
+ * May be called from any context. Without 'lbaWorld' the cache stays
+ * empty and the default LBA data size is assumed.
+ *
+ * @param[in] ctrlr  Controller instance
+ */
+void
+NVMEPCIELbaCacheRefreshRequest(NVMEPCIEController *ctrlr)
+{
+   if (ctrlr->lbaWorld == VMK_INVALID_WORLD_ID) {
+      return;
+   }
+   vmk_AtomicWrite32(&ctrlr->lbaRefreshReq, 1);
+   vmk_WorldWakeup((vmk_WorldEventID) &ctrlr->lbaRefreshReq);
+}
+
 /**
  * Allocate and register vmk_NvmeController
  *
@@ -782,6 +942,9 @@ NVMEPCIEControllerInit(NVMEPCIEController *ctrlr)
    vmk_NvmeController vmkController;
    vmk_NvmeControllerAllocProps allocProps;
    const vmk_NvmeIdentifyController* identData;
+#if NVME_PCIE_STORAGE_POLL
+   vmk_uint32 i;
+#endif
 
    vmk_Memset(&allocProps, 0, sizeof(allocProps));
    allocProps.moduleID = vmk_ModuleCurrentID;
@@ -804,19 +967,45 @@ NVMEPCIEControllerInit(NVMEPCIEController *ctrlr)
 
    ctrlr->osRes.vmkController = vmkController;
 
+   vmk_AtomicWrite32(&ctrlr->stallThr, nvmePCIEStallThr);
+   vmk_AtomicWrite32(&ctrlr->traceRate, nvmePCIETraceRate);
+   NVMEPCIEOutlierThrSet(ctrlr, nvmePCIEOutlierThr);
+   NVMEPCIEStatsSampleRateSet(ctrlr, nvmePCIEStatsSampleRate);
+   NVMEPCIESelectHotPath(ctrlr);
+
    // Create Timer to record IOPs for this queue
    NVMEPCIECreateIOPsTimer(ctrlr);
    NVMEPCIEStartIOPsTimer(ctrlr);
+   NVMEPCIECreateLbaWorld(ctrlr);
 
    // Init StoragePoll related configs
 #if NVME_PCIE_STORAGE_POLL
    ctrlr->pollAct = nvmePCIEPollAct && (!nvmePCIEMsiEnbaled);
    ctrlr->pollOIOThr = nvmePCIEPollOIOThr;
+   ctrlr->pollOIOExitThr = nvmePCIEPollOIOExitThr;
+   ctrlr->pollDwell = nvmePCIEPollDwell;
+   ctrlr->iopsWindow = nvmePCIEIopsWindow;
+   ctrlr->pollAutoTune = ctrlr->pollAct && nvmePCIEPollAutoTune;
+   ctrlr->smallIoBytes = nvmePCIESmallIoBytes;
+   NVMEPCIEPollTuneReset(ctrlr);
    ctrlr->pollInterval = nvmePCIEPollInterval;
+   ctrlr->pollLatModel = ctrlr->pollAct && nvmePCIEPollLatModel;
+   ctrlr->pollSleepPct = nvmePCIEPollSleepPct;
+   ctrlr->pollBusy = ctrlr->pollAct && nvmePCIEPollBusy;
+   ctrlr->pollSpinBudget = nvmePCIEPollSpinBudget;
+   ctrlr->pollCpuBudget = nvmePCIEPollCpuBudget;
+   ctrlr->numPollGroups = nvmePCIEPollGroups;
+   for (i = 0; i < NVME_PCIE_POLL_GROUP_MAX; i++) {
+      ctrlr->pollGroups[i].ctrlr = ctrlr;
+      ctrlr->pollGroups[i].id = i;
+   }
 #if NVME_PCIE_BLOCKSIZE_AWARE
    ctrlr->blkSizeAwarePollAct = ctrlr->pollAct && nvmePCIEBlkSizeAwarePollAct;
+   ctrlr->pollCostModel = ctrlr->pollAct && nvmePCIEPollCostModel;
+   ctrlr->pollIntrCost = nvmePCIEPollIntrCost;
 #endif
 #endif
+   NVMEPCIESelectHotPath(ctrlr);
 
    return VMK_OK;
 }
@@ -857,6 +1046,7 @@ VMK_ReturnStatus
 NVMEPCIEControllerDestroy(NVMEPCIEController *ctrlr)
 {
    NVMEPCIEKeyValDestory(ctrlr);
+   NVMEPCIEDestroyLbaWorld(ctrlr);
    NVMEPCIEStopIOPsTimer(ctrlr);
    NVMEPCIEDestroyIOPsTimer(ctrlr);
    vmk_NvmeUnregisterController(ctrlr->osRes.vmkController);
@@ -865,6 +1055,166 @@ NVMEPCIEControllerDestroy(NVMEPCIEController *ctrlr)
    return VMK_OK;
 }
 
+/**
+ * Add the time since 'startUs' to a phase of a bring-up record
+ *
+ * @param[in] rec      Bring-up record, NULL if no bring-up in progress
+ * @param[in] phase    NVME_PCIE_BRINGUP_* phase
+ * @param[in] startUs  Time the phase was entered
+ */
+void
+NVMEPCIEBringupPhase(NVMEPCIEBringupRecord *rec,
+                     vmk_uint32 phase,
+                     vmk_uint64 startUs)
+{
+   if (rec != NULL) {
+      rec->phaseUs[phase] += NVMEPCIEGetTimerUs() - startUs;
+   }
+}
+
+/**
+ * Start timing of a controller reset, unless a bring-up is in progress
+ *
+ * @param[in] ctrlr    Controller instance
+ * @param[in] startUs  Time the reset was entered
+ */
+void
+NVMEPCIEBringupResetBegin(NVMEPCIEController *ctrlr, vmk_uint64 startUs)
+{
+   NVMEPCIEBringup *bringup = &ctrlr->bringup;
+   NVMEPCIEBringupRecord *rec;
+
+   if (bringup->cur != NULL) {
+      return;
+   }
+
+   rec = &bringup->resets[bringup->resetIdx % NVME_PCIE_BRINGUP_RECORD_NUM];
+   vmk_Memset(rec, 0, sizeof(*rec));
+   rec->startUs = startUs;
+   bringup->resetIdx++;
+   bringup->cur = rec;
+}
+
+/**
+ * Finish timing of the bring-up in progress
+ *
+ * @param[in] ctrlr  Controller instance
+ */
+void
+NVMEPCIEBringupEnd(NVMEPCIEController *ctrlr)
+{
+   NVMEPCIEBringup *bringup = &ctrlr->bringup;
+   NVMEPCIEBringupRecord *rec = bringup->cur;
+
+   if (rec == NULL) {
+      return;
+   }
+
+   rec->endUs = NVMEPCIEGetTimerUs();
+   bringup->cur = NULL;
+   bringup->ccUs = 0;
+   bringup->identifyUs = 0;
+   IPRINT(ctrlr, "%s took %lu us.",
+          rec == &bringup->attach ? "Attach" : "Reset",
+          rec->endUs - rec->startUs);
+}
+
+/**
+ * Account an Identify command issued during bring-up as completed
+ *
+ * @param[in] ctrlr  Controller instance
+ */
+void
+NVMEPCIEBringupIdentifyDone(NVMEPCIEController *ctrlr)
+{
+   NVMEPCIEBringup *bringup = &ctrlr->bringup;
+   NVMEPCIEBringupRecord *rec = bringup->cur;
+
+   if (rec != NULL) {
+      NVMEPCIEBringupPhase(rec, NVME_PCIE_BRINGUP_IDENTIFY,
+                           bringup->identifyUs);
+      rec->identifies++;
+   }
+   bringup->identifyUs = 0;
+}
+
+/**
+ * Start timing the wait for CSTS.RDY if a write changes CC.EN
+ *
+ * @param[in] ctrlr  Controller instance
+ * @param[in] cc     Value written to CC
+ */
+static void
+BringupCcWrite(NVMEPCIEController *ctrlr, vmk_uint32 cc)
+{
+   NVMEPCIEBringup *bringup = &ctrlr->bringup;
+   vmk_uint32 old;
+
+   if (bringup->cur == NULL) {
+      return;
+   }
+
+   old = NVMEPCIEReadl(ctrlr->regs + VMK_NVME_REG_CC);
+   if (((vmk_NvmeRegCc *)&old)->en != ((vmk_NvmeRegCc *)&cc)->en) {
+      bringup->ccEn = ((vmk_NvmeRegCc *)&cc)->en;
+      bringup->ccUs = NVMEPCIEGetTimerUs();
+   }
+}
+
+/**
+ * Finish timing the wait for CSTS.RDY once it follows CC.EN
+ *
+ * @param[in] ctrlr  Controller instance
+ * @param[in] csts   Value read from CSTS
+ */
+static void
+BringupCstsRead(NVMEPCIEController *ctrlr, vmk_uint32 csts)
+{
+   NVMEPCIEBringup *bringup = &ctrlr->bringup;
+
+   if (bringup->ccUs != 0 &&
+       ((vmk_NvmeRegCsts *)&csts)->rdy == bringup->ccEn) {
+      NVMEPCIEBringupPhase(bringup->cur,
+                           bringup->ccEn ? NVME_PCIE_BRINGUP_ENABLE :
+                                           NVME_PCIE_BRINGUP_DISABLE,
+                           bringup->ccUs);
+      bringup->ccUs = 0;
+   }
+}
+
+/**
+ * Account creation of an IO queue, the last one finishes the bring-up
+ *
+ * @param[in] ctrlr    Controller instance
+ * @param[in] qid      Queue ID
+ * @param[in] created  Whether the queue was created
+ * @param[in] startUs  Time the creation was entered
+ */
+static void
+BringupQueueCreated(NVMEPCIEController *ctrlr,
+                    vmk_uint32 qid,
+                    vmk_Bool created,
+                    vmk_uint64 startUs)
+{
+   NVMEPCIEBringupRecord *rec = ctrlr->bringup.cur;
+   vmk_uint32 us;
+
+   if (rec == NULL) {
+      return;
+   }
+
+   us = NVMEPCIEGetTimerUs() - startUs;
+   rec->phaseUs[NVME_PCIE_BRINGUP_CREATEQ] += us;
+   if (!created || qid > NVME_PCIE_MAX_IO_QUEUES) {
+      return;
+   }
+   rec->queueUs[qid] = us;
+   rec->queues++;
+   if (qid >= ctrlr->maxIoQueues) {
+      NVMEPCIEBringupEnd(ctrlr);
+   }
+}
+
 /**
  * Request number of queues for the controller
  *
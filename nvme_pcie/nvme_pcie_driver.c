@@ -117,6 +117,9 @@ AttachDevice(vmk_Device device)
    VMK_ReturnStatus vmkStatus;
    NVMEPCIEController *ctrlr = NULL;
    char domainName[VMK_MISC_NAME_MAX];
+   char lockName[VMK_MISC_NAME_MAX];
+   vmk_uint64 startUs = NVMEPCIEGetTimerUs();
+   int i;
 
    MOD_IPRINT("Called with %p.", device);
    /** Allocate the nvme pcie controller object */
@@ -161,18 +164,58 @@ AttachDevice(vmk_Device device)
       goto cleanup_dma;
    }
 
+   /** Initialize stall records lock */
+   vmk_StringFormat(lockName, sizeof(lockName), NULL,
+                    "stallLock-%s", NVMEPCIEGetCtrlrName(ctrlr));
+   vmkStatus = NVMEPCIELockCreate(ctrlr->osRes.lockDomain,
+                                  NVME_LOCK_RANK_LOW,
+                                  lockName, &ctrlr->stallLock);
+   if (vmkStatus != VMK_OK) {
+      EPRINT(ctrlr, "Failed to create stall lock, %s.",
+             vmk_StatusToString(vmkStatus));
+      goto cleanup_lockdomain;
+   }
+
+   /** Initialize outlier records lock */
+   vmk_StringFormat(lockName, sizeof(lockName), NULL,
+                    "outlierLock-%s", NVMEPCIEGetCtrlrName(ctrlr));
+   vmkStatus = NVMEPCIELockCreate(ctrlr->osRes.lockDomain,
+                                  NVME_LOCK_RANK_HIGHEST,
+                                  lockName, &ctrlr->outlierLock);
+   if (vmkStatus != VMK_OK) {
+      EPRINT(ctrlr, "Failed to create outlier lock, %s.",
+             vmk_StatusToString(vmkStatus));
+      goto destroy_stalllock;
+   }
+   ctrlr->outlierThrTc = NVME_PCIE_OUTLIER_THR_OFF;
+
    /** Setup queue list */
    ctrlr->queueList = NVMEPCIEAlloc(sizeof(NVMEPCIEQueueInfo) * (NVME_PCIE_MAX_IO_QUEUES + 1), 0);
    if (ctrlr->queueList == NULL) {
       EPRINT(ctrlr, "Failed to allocate queue list.");
       vmkStatus = VMK_NO_MEMORY;
-      goto cleanup_lockdomain;
+      goto destroy_outlierlock;
+   }
+
+   /** Setup reference slots of each queue */
+   ctrlr->queueRefs = NVMEPCIEAlloc(sizeof(NVMEPCIEQueueRef) *
+                                    NVME_PCIE_QUEUE_REF_SLOTS *
+                                    (NVME_PCIE_MAX_IO_QUEUES + 1),
+                                    VMK_L1_CACHELINE_SIZE);
+   if (ctrlr->queueRefs == NULL) {
+      EPRINT(ctrlr, "Failed to allocate queue reference slots.");
+      vmkStatus = VMK_NO_MEMORY;
+      goto free_queuelist;
+   }
+   for (i = 0; i <= NVME_PCIE_MAX_IO_QUEUES; i++) {
+      ctrlr->queueList[i].refs = &ctrlr->queueRefs[i * NVME_PCIE_QUEUE_REF_SLOTS];
    }
+   NVMEPCIESelectHotPath(ctrlr);
 
    /** Setup admin queue */
    vmkStatus = SetupAdminQueue(ctrlr);
    if (vmkStatus != VMK_OK) {
-      goto free_queuelist;
+      goto free_queuerefs;
    }
 
    /** Attach the controller instance to the device handle */
@@ -188,13 +231,25 @@ AttachDevice(vmk_Device device)
    vmk_ListInsert(&ctrlr->list, vmk_ListAtRear(&NVME_PCIE_DRIVER_RES_CONTROLLER_LIST));
    vmk_SpinlockUnlock(NVME_PCIE_DRIVER_RES_LOCK);
 
+   /** Time the bring-up until IO queues are created */
+   ctrlr->bringup.attach.startUs = startUs;
+   ctrlr->bringup.cur = &ctrlr->bringup.attach;
+   NVMEPCIEBringupPhase(&ctrlr->bringup.attach, NVME_PCIE_BRINGUP_ATTACH,
+                        startUs);
+
    IPRINT(ctrlr, "Device %p attached.", device);
    return VMK_OK;
 
 destroy_adminq:
    DestroyAdminQueue(ctrlr);
+free_queuerefs:
+   NVMEPCIEFree(ctrlr->queueRefs);
 free_queuelist:
    NVMEPCIEFree(ctrlr->queueList);
+destroy_outlierlock:
+   NVMEPCIELockDestroy(&ctrlr->outlierLock);
+destroy_stalllock:
+   NVMEPCIELockDestroy(&ctrlr->stallLock);
 cleanup_lockdomain:
    NVMEPCIELockDomainDestroy(ctrlr->osRes.lockDomain);
 cleanup_dma:
@@ -337,7 +392,10 @@ DetachDevice(vmk_Device device)
    VMK_ASSERT(ctrlr->numIoQueues == 0);
 
    DestroyAdminQueue(ctrlr);
+   NVMEPCIEFree(ctrlr->queueRefs);
    NVMEPCIEFree(ctrlr->queueList);
+   NVMEPCIELockDestroy(&ctrlr->outlierLock);
+   NVMEPCIELockDestroy(&ctrlr->stallLock);
    NVMEPCIELockDomainDestroy(ctrlr->osRes.lockDomain);
    DmaCleanup(ctrlr);
    PciCleanup(ctrlr);
@@ -357,6 +415,7 @@ QuiesceDevice(vmk_Device device)
    VMK_ReturnStatus vmkStatus;
    NVMEPCIEQueueInfo *qinfo;
    vmk_NvmeQueueID qid;
+   vmk_uint64 startUs = NVMEPCIEGetTimerUs();
 
    MOD_IPRINT("Called with %p", device);
    /* fix pr2314038. PSA expects there is not outgoing PSA command
@@ -385,6 +444,8 @@ QuiesceDevice(vmk_Device device)
          NVMEPCIEFlushQueue(qinfo, VMK_NVME_STATUS_VMW_QUIESCED);
       }
    }
+   NVMEPCIEBringupPhase(&ctrlr->bringup.attach, NVME_PCIE_BRINGUP_QUIESCE,
+                        startUs);
    return VMK_OK;
 }
 
@@ -30,29 +30,67 @@
 #include "nvme_pcie.h"
 #include "nvme_pcie_os.h"
 #include "nvme_pcie_debug.h"
+#include "nvme_pcie_poll_policy.h"
 
 #define NVME_ABORT 1
 #define NVME_STATS 1
 
 #define NVME_PCIE_STORAGE_POLL 1
 
+/**
+ * Profile contention of sq, cq and command list locks of each queue. Off
+ * by default, as it stamps every acquisition and release.
+ */
+#define NVME_PCIE_LOCK_STATS 0
+
 #if NVME_PCIE_STORAGE_POLL
 #define NVME_PCIE_BLOCKSIZE_AWARE 1
-// 1-based nlb
-#define NVME_PCIE_SMALL_NLB (32 << 1)
+// Default transfer size boundary of small block size IO commands
+#define NVME_PCIE_SMALL_IO_BYTES_DEFAULT (32 * 1024)
 #endif
 
+/**
+ * Namespaces whose LBA data size is cached, larger NSIDs and namespaces
+ * not identified yet are assumed as NVME_PCIE_LBA_SHIFT_DEFAULT.
+ */
+#define NVME_PCIE_LBA_CACHE_NS 64
+#define NVME_PCIE_LBA_SHIFT_DEFAULT 9
+// Longest wait in ms of 'lbaWorld' between checks for refresh requests
+#define NVME_PCIE_LBA_REFRESH_WAIT_MS 1000
+// Namespace ID that applies to all namespaces
+#define NVME_PCIE_NSID_ALL 0xffffffff
+
 #if NVME_PCIE_STORAGE_POLL
 extern int nvmePCIEPollAct;
 extern vmk_uint64 nvmePCIEPollInterval;
 extern vmk_uint32 nvmePCIEPollOIOThr;
-// IOPs threshold to enable polling per queue, currently 100k
-#define NVME_PCIE_POLL_IOPS_THRES_PER_QUEUE (100 * 1024)
+extern vmk_uint32 nvmePCIEPollOIOExitThr;
+extern vmk_uint64 nvmePCIEPollDwell;
+extern vmk_uint64 nvmePCIEIopsWindow;
+extern int nvmePCIEPollAutoTune;
+extern vmk_uint32 nvmePCIESmallIoBytes;
+// Range of IOPs estimation window in microseconds
+#define NVME_PCIE_IOPS_WINDOW_MIN 1000
+#define NVME_PCIE_IOPS_WINDOW_MAX 1000000
+#define NVME_PCIE_IOPS_WINDOW_DEFAULT 10000
 #if NVME_PCIE_BLOCKSIZE_AWARE
 extern int nvmePCIEBlkSizeAwarePollAct;
+extern int nvmePCIEPollCostModel;
+extern vmk_uint32 nvmePCIEPollIntrCost;
 #endif
+extern int nvmePCIEPollLatModel;
+extern vmk_uint32 nvmePCIEPollSleepPct;
+extern int nvmePCIEPollBusy;
+extern vmk_uint32 nvmePCIEPollCpuBudget;
+extern vmk_uint32 nvmePCIEPollGroups;
+extern vmk_uint32 nvmePCIEPollSpinBudget;
 #endif
 extern int nvmePCIEMsiEnbaled;
+extern vmk_uint32 nvmePCIESyncCmdNum;
+extern vmk_uint32 nvmePCIEStallThr;
+extern vmk_uint32 nvmePCIETraceRate;
+extern vmk_uint32 nvmePCIEOutlierThr;
+extern vmk_uint32 nvmePCIEStatsSampleRate;
 
 /**
  * Driver name. This should be the name of the SC file.
@@ -62,7 +100,7 @@ extern int nvmePCIEMsiEnbaled;
 /**
  * Driver version. This should always in sync with .sc file.
  */
-#define NVME_PCIE_DRIVER_VERSION "1.2.4.13"
+#define NVME_PCIE_DRIVER_VERSION "1.2.4.14"
 
 /**
  * Driver release number. This should always in sync with .sc file.
@@ -97,23 +135,123 @@ extern int nvmePCIEMsiEnbaled;
 
 #define NVME_PCIE_SG_MAX_ENTRIES 32
 
+// Default and maximum number of sync command slots per queue
 #define NVME_PCIE_SYNC_CMD_NUM 10
-#define NVME_PCIE_SYNC_CMD_ID 0xffff
+#define NVME_PCIE_SYNC_CMD_NUM_MAX 64
+/**
+ * Longest single sleep of a sync command slot waiter, in microseconds. The
+ * waiter rechecks queue state after each sleep.
+ */
+#define NVME_PCIE_SYNC_CMD_WAIT_SLICE (100 * 1000)
 
 // Time interval (one second) of recording IOPs for a queue
 #define NVME_PCIE_IOPS_RECORD_FREQ VMK_USEC_PER_SEC
 
+/**
+ * Number of buckets of the stall detection timer wheel. The wheel advances
+ * one bucket per NVME_PCIE_IOPS_RECORD_FREQ, so it covers 64 seconds.
+ */
+#define NVME_PCIE_STALL_WHEEL_SLOTS 64
+// Default stall threshold in seconds, 0 disables stall detection
+#define NVME_PCIE_STALL_THR_DEFAULT 0
+#define NVME_PCIE_STALL_THR_MAX (NVME_PCIE_STALL_WHEEL_SLOTS - 2)
+// Number of recent stall records kept per controller
+#define NVME_PCIE_STALL_RECORD_NUM 32
+// Events per command trace ring, power of 2
+#define NVME_PCIE_TRACE_RING_SIZE 256
+#define NVME_PCIE_TRACE_RATE_MAX 65536
+// Number of recent tail latency outliers kept per controller
+#define NVME_PCIE_OUTLIER_RECORD_NUM 16
+// Max outlier threshold in microseconds
+#define NVME_PCIE_OUTLIER_THR_MAX 10000000
+// Outlier threshold in cycles when outlier capture is disabled
+#define NVME_PCIE_OUTLIER_THR_OFF ((vmk_TimerRelCycles)0x7fffffffffffffffLL)
+// Max statistics sampling rate, power of 2
+#define NVME_PCIE_STATS_SAMPLE_RATE_MAX 1024
+// Number of recent controller resets with bring-up timing kept
+#define NVME_PCIE_BRINGUP_RECORD_NUM 8
+
 #define NVME_PCIE_KV_MGMT_VERSION (VMK_REVISION_FROM_NUMBERS(1,0,0,0))
 
 typedef struct NVMEPCIEController NVMEPCIEController;
 typedef struct NVMEPCIECmdInfo NVMEPCIECmdInfo;
 typedef struct NVMEPCIEQueueInfo NVMEPCIEQueueInfo;
 
+#if NVME_PCIE_LOCK_STATS
+/**
+ * Contention profile of a queue lock, updated with the lock held
+ */
+typedef struct NVMEPCIELockStats {
+   vmk_uint64 acquires;
+   // Acquisitions which found the lock held
+   vmk_uint64 contended;
+   vmk_uint64 spinCycles;
+   vmk_uint64 maxHoldCycles;
+   // Time stamp of the acquisition, valid while held
+   vmk_TimerCycles holdTs;
+} NVMEPCIELockStats;
+
+/**
+ * Acquire a queue lock and account contention
+ *
+ * @param[in] lock   Spinlock
+ * @param[in] stats  Contention profile of 'lock'
+ */
+static inline void
+NVMEPCIELockStatsAcquire(vmk_Lock lock, NVMEPCIELockStats *stats)
+{
+   vmk_TimerCycles start;
+
+   if (vmk_SpinlockTryLock(lock) == VMK_OK) {
+      stats->holdTs = vmk_GetTimerCycles();
+   } else {
+      start = vmk_GetTimerCycles();
+      vmk_SpinlockLock(lock);
+      stats->holdTs = vmk_GetTimerCycles();
+      stats->contended++;
+      stats->spinCycles += stats->holdTs - start;
+   }
+   stats->acquires++;
+}
+
+/**
+ * Release a queue lock and account hold time
+ *
+ * @param[in] lock   Spinlock
+ * @param[in] stats  Contention profile of 'lock'
+ */
+static inline void
+NVMEPCIELockStatsRelease(vmk_Lock lock, NVMEPCIELockStats *stats)
+{
+   vmk_TimerCycles hold = vmk_GetTimerCycles() - stats->holdTs;
+
+   if (hold > stats->maxHoldCycles) {
+      stats->maxHoldCycles = hold;
+   }
+   vmk_SpinlockUnlock(lock);
+}
+
+/**
+ * Acquire/release 'lock' of a submission queue, completion queue or
+ * command list
+ */
+#define NVME_PCIE_QUEUE_LOCK(obj) \
+   NVMEPCIELockStatsAcquire((obj)->lock, &(obj)->lockStats)
+#define NVME_PCIE_QUEUE_UNLOCK(obj) \
+   NVMEPCIELockStatsRelease((obj)->lock, &(obj)->lockStats)
+#else
+#define NVME_PCIE_QUEUE_LOCK(obj) vmk_SpinlockLock((obj)->lock)
+#define NVME_PCIE_QUEUE_UNLOCK(obj) vmk_SpinlockUnlock((obj)->lock)
+#endif
+
 /**
  * Submission queue
  */
 typedef struct NVMEPCIESubQueueInfo {
    vmk_Lock lock;
+#if NVME_PCIE_LOCK_STATS
+   NVMEPCIELockStats lockStats;
+#endif
    vmk_uint32 id;
    vmk_uint16 head;
    vmk_uint16 tail;
@@ -123,6 +261,8 @@ typedef struct NVMEPCIESubQueueInfo {
    vmk_IOA subqPhy;
    vmk_IOA doorbell;
    NVMEPCIEDmaEntry dmaEntry;
+   // Statistics sampling counter, under sq lock
+   vmk_uint32 statsSampleSeq;
 } NVMEPCIESubQueueInfo;
 
 /**
@@ -130,6 +270,9 @@ typedef struct NVMEPCIESubQueueInfo {
  */
 typedef struct NVMEPCIECompQueueInfo {
    vmk_Lock lock;
+#if NVME_PCIE_LOCK_STATS
+   NVMEPCIELockStats lockStats;
+#endif
    vmk_uint32 id;
    vmk_uint16 head;
    vmk_uint16 tail;
@@ -148,6 +291,43 @@ typedef struct NVMEPCIECompQueueInfo {
 typedef void (*NVMEPCIECompleteCommandCb)(NVMEPCIEQueueInfo *qinfo,
                                           NVMEPCIECmdInfo *cmdInfo);
 
+/**
+ * Feature bits of I/O hot path variants
+ *
+ * Each combination within NVME_PCIE_HOT_PATH_SPECIALIZED has its own copy
+ * of the hot path functions with the features compiled in or out, the
+ * others share one copy testing the bits at runtime, see
+ * NVMEPCIESelectHotPath().
+ */
+#define NVME_PCIE_HOT_PATH_ABORT    (1 << 0)  // ctrlr->abortEnabled
+#define NVME_PCIE_HOT_PATH_STATS    (1 << 1)  // ctrlr->statsEnabled
+#define NVME_PCIE_HOT_PATH_BLKSIZE  (1 << 2)  // blkSizeAwarePollAct or pollCostModel
+#define NVME_PCIE_HOT_PATH_LATMODEL (1 << 3)  // ctrlr->pollLatModel
+#define NVME_PCIE_HOT_PATH_DEBUG    (1 << 4)  // Command debug mask of the queue
+#define NVME_PCIE_HOT_PATH_DIAG     (1 << 5)  // stallThr, traceRate or phaseStamp
+#define NVME_PCIE_HOT_PATH_NUM      (1 << 6)
+// Data path features of default configurations, specialized
+#define NVME_PCIE_HOT_PATH_SPECIALIZED                                         \
+   (NVME_PCIE_HOT_PATH_ABORT | NVME_PCIE_HOT_PATH_STATS |                      \
+    NVME_PCIE_HOT_PATH_BLKSIZE | NVME_PCIE_HOT_PATH_LATMODEL)
+
+#define NVME_PCIE_ALWAYS_INLINE inline __attribute__((always_inline))
+
+/**
+ * I/O hot path functions of a queue
+ */
+typedef struct NVMEPCIEHotPathOps {
+   /** Feature bits this variant is built with */
+   vmk_uint32 flags;
+   vmk_uint32 (*processCq)(NVMEPCIEQueueInfo *qinfo);
+   VMK_ReturnStatus (*submitAsync)(NVMEPCIEController *ctrlr,
+                                   vmk_NvmeCommand *vmkCmd,
+                                   vmk_uint32 qid);
+   vmk_NvmeStatus (*issueCommand)(NVMEPCIEQueueInfo *qinfo,
+                                  NVMEPCIECmdInfo *cmdInfo,
+                                  NVMEPCIECompleteCommandCb cb);
+} NVMEPCIEHotPathOps;
+
 typedef enum NVMEPCIECmdType {
    NVME_PCIE_FREE_CONTEXT,
    NVME_PCIE_ASYNC_CONTEXT,  /** Async command */
@@ -182,11 +362,41 @@ typedef struct NVMEPCIECmdInfo {
    vmk_atomic32 atomicStatus;
    /** point to next free cmdInfo */
    vmk_uint32 freeLink;
-#ifdef NVME_STATS
+   /** Stall wheel tick when issued, valid if stallTracked */
+   vmk_uint32 stallTick;
+   vmk_Bool stallTracked;
+   vmk_uint8 stallOpc;
+   /** Small block size IO command, classified once at submission */
+   vmk_Bool isSmall;
+   /** Accounted in 'nrActSmall' */
+   vmk_Bool smallCounted;
+#if NVME_PCIE_BLOCKSIZE_AWARE
+   /** Bucket of in-flight histogram, valid if costCounted */
+   vmk_Bool costCounted;
+   vmk_uint8 costOpc;
+   vmk_uint8 costSize;
+#endif
+#if NVME_PCIE_STORAGE_POLL
+   /** Latency model class and issue sequence, valid if latTracked */
+   vmk_Bool latTracked;
+   vmk_uint8 latClass;
+   vmk_uint32 latSeq;
+#endif
+   /** Set when issued if stats or latency model is on */
    vmk_TimerCycles sendToHwTs;
+#ifdef NVME_STATS
    vmk_TimerCycles doneByHwTs;
    vmk_Bool statsOn;
+   /** PCPU and outstanding commands of the queue when issued */
+   vmk_uint16 submitCpu;
+   vmk_uint16 submitDepth;
+   /** Phase time stamps, valid if 'entryTs' is not 0 */
+   vmk_TimerCycles entryTs;
+   vmk_TimerCycles lockTs;
+   vmk_TimerCycles doorbellTs;
 #endif
+   /** Sampled into trace ring when issued */
+   vmk_Bool traced;
 } NVMEPCIECmdInfo;
 
 typedef union NVMEPCIEPendingCmdInfo {
@@ -197,11 +407,46 @@ typedef union NVMEPCIEPendingCmdInfo {
    vmk_atomic64 atomicComposite;
 } NVMEPCIEPendingCmdInfo;
 
+/**
+ * Waiter of sync command slot, lives on waiter's stack
+ */
+typedef struct NVMEPCIESyncCmdWaiter {
+   vmk_ListLinks list;
+   /** Slot handed over by NVMEPCIEPutCmdInfo(), NULL while waiting */
+   NVMEPCIECmdInfo *cmdInfo;
+} NVMEPCIESyncCmdWaiter;
+
+/**
+ * Pool of command infos reserved for internal sync commands
+ *
+ * The last 'size' entries of the command info array belong to the pool.
+ * Free slots are linked through 'freeLink'. When the pool is empty callers
+ * queue up in 'waiters' and a released slot is handed to the oldest waiter
+ * directly, so waiters are served in FIFO order.
+ */
+typedef struct NVMEPCIESyncCmdPool {
+   vmk_Lock lock;
+   vmk_uint32 size;
+   /** 1-based command ID of the first free slot, 0 if empty */
+   vmk_uint32 freeList;
+   vmk_uint32 numFree;
+   vmk_ListLinks waiters;
+   vmk_uint32 numWaiters;
+   /** Contention counters, protected by 'lock' */
+   vmk_uint64 allocs;
+   vmk_uint64 waits;
+   vmk_uint64 timeouts;
+   vmk_uint32 maxWaiters;
+} NVMEPCIESyncCmdPool;
+
 /**
  * Nvme command list
  */
 typedef struct NVMEPCIECmdInfoList {
    vmk_Lock lock;
+#if NVME_PCIE_LOCK_STATS
+   NVMEPCIELockStats lockStats;
+#endif
    /**
     * Record active commands
     *
@@ -211,7 +456,7 @@ typedef struct NVMEPCIECmdInfoList {
    /**
     * Record small block size active commands
     *
-    * If the 1-based nlb is in the range of (0, NVME_PCIE_SMALL_NLB], the
+    * If the transfer size is in the range of (0, 'smallIoBytes'], the
     * command is regarded as small block size.
     *
     * It can help StoragePoll to switch from interruption mode to poll.
@@ -221,19 +466,548 @@ typedef struct NVMEPCIECmdInfoList {
    vmk_uint32 freeCmdList;
    NVMEPCIECmdInfo *list;
    int idCount;
+   NVMEPCIESyncCmdPool syncPool;
+#if NVME_PCIE_STORAGE_POLL
+   /**
+    * Indexes into 'list' of commands tracked by latency model, in issue
+    * order. 'issueSeq' is advanced under sq lock, 'oldestSeq' only by
+    * the poll routine of the queue.
+    */
+   vmk_uint16 *issueRing;
+   vmk_uint32 issueSeq;
+   vmk_uint32 oldestSeq;
+#endif
 } NVMEPCIECmdInfoList;
 
+#if NVME_PCIE_STORAGE_POLL
+/**
+ * Completion mode of an IO queue, see NVMEPCIEStoragePollSwitch()
+ */
+typedef enum NVMEPCIEPollMode {
+   NVME_PCIE_POLL_MODE_INTR,
+   NVME_PCIE_POLL_MODE_POLL,
+} NVMEPCIEPollMode;
+#endif
+
 typedef enum NVMEPCIEQueueState {
    NVME_PCIE_QUEUE_NON_EXIST,
    NVME_PCIE_QUEUE_SUSPENDED,
    NVME_PCIE_QUEUE_ACTIVE,
 } NVMEPCIEQueueState;
 
+/**
+ * Number of reference slots of each queue
+ *
+ * Submitters running on different PCPUs take references from different
+ * slots, so the submission path does not bounce a shared cache line. PCPUs
+ * beyond this number share slots.
+ */
+#define NVME_PCIE_QUEUE_REF_SLOTS 64
+
+/**
+ * Per-CPU queue reference slot
+ */
+typedef struct NVMEPCIEQueueRef {
+   vmk_atomic32 count;
+} VMK_ATTRIBUTE_L1_ALIGNED NVMEPCIEQueueRef;
+
+/**
+ * Stall detection timer wheel
+ *
+ * Outstanding I/O commands are counted in the bucket of the tick they are
+ * issued in. When the bucket of the tick that just crossed the stall
+ * threshold is not empty, the command list is scanned for the commands
+ * of that tick only.
+ */
+typedef struct NVMEPCIEStallWheel {
+   vmk_atomic32 tick;
+   // Number of commands detected as stalled
+   vmk_atomic64 stallEvents;
+   // Written per command, kept off the line of 'tick'
+   vmk_atomic32 bucket[NVME_PCIE_STALL_WHEEL_SLOTS] VMK_ATTRIBUTE_L1_ALIGNED;
+} VMK_ATTRIBUTE_L1_ALIGNED NVMEPCIEStallWheel;
+
+// Occupancy samples kept per queue, one per NVME_PCIE_IOPS_RECORD_FREQ
+#define NVME_PCIE_OCCUPANCY_SAMPLES 128
+
+/**
+ * Queue occupancy sample
+ */
+typedef struct NVMEPCIEOccupancySample {
+   vmk_uint64 timeUs;
+   // SQ entries not yet fetched by the device as seen by the driver
+   vmk_uint16 sqDepth;
+   // Outstanding commands
+   vmk_uint16 outstanding;
+   // Commands completed in the last second
+   vmk_uint32 iops;
+} NVMEPCIEOccupancySample;
+
+/**
+ * Per queue ring of occupancy samples
+ *
+ * Written by the IOPs timer only, read without lock.
+ */
+typedef struct NVMEPCIEOccupancyRing {
+   // Number of samples taken
+   vmk_uint32 idx;
+   NVMEPCIEOccupancySample samples[NVME_PCIE_OCCUPANCY_SAMPLES];
+} NVMEPCIEOccupancyRing;
+
+// Buckets of completion batch size histogram, see NVMEPCIEQueueCounters
+#define NVME_PCIE_CQE_BATCH_NUM 8
+
+/**
+ * Per queue counters
+ *
+ * Each group is written in one context only, so plain increments suffice,
+ * and sits in its own cache line to keep submitting and completing CPUs
+ * apart. Counters survive queue resets, they are cleared by the
+ * 'queueStats' management key only.
+ */
+typedef struct NVMEPCIEQueueCounters {
+   // Under sq lock
+   struct {
+      vmk_uint64 submits;
+      vmk_uint64 sqDoorbells;
+      // Submission queue ring full
+      vmk_uint64 sqFull;
+   } VMK_ATTRIBUTE_L1_ALIGNED sq;
+   // Under cq lock
+   struct {
+      vmk_uint64 completions;
+      vmk_uint64 cqDoorbells;
+      /**
+       * Completion queue entries per completion processing, bucket 0
+       * counts rounds finding none, bucket i sizes in [1 << (i - 1), 1 << i)
+       * and the last one everything larger.
+       */
+      vmk_uint64 batch[NVME_PCIE_CQE_BATCH_NUM];
+   } VMK_ATTRIBUTE_L1_ALIGNED cq;
+   // By the interrupt handler and the poll routine of the queue
+   struct {
+      vmk_uint64 intrs;
+      // Out of command slots, updated atomically by submitters
+      vmk_atomic64 cmdFull;
+#if NVME_PCIE_STORAGE_POLL
+      vmk_uint64 polls;
+      vmk_uint64 emptyPolls;
+      // Time (us) spent in each mode up to 'modeTs', by mode transitions
+      vmk_uint64 intrModeUs;
+      vmk_uint64 pollModeUs;
+      vmk_uint64 modeTs;
+#endif
+   } VMK_ATTRIBUTE_L1_ALIGNED event;
+} NVMEPCIEQueueCounters;
+
+/**
+ * Command lifecycle trace event types
+ */
+typedef enum NVMEPCIETraceType {
+   NVME_PCIE_TRACE_NONE = 0,
+   NVME_PCIE_TRACE_SUBMIT,
+   NVME_PCIE_TRACE_DOORBELL,
+   NVME_PCIE_TRACE_HW_DONE,
+   NVME_PCIE_TRACE_COMPLETE,
+   NVME_PCIE_TRACE_ABORT,
+   NVME_PCIE_TRACE_TIMEOUT,
+   NVME_PCIE_TRACE_TYPE_NUM,
+} NVMEPCIETraceType;
+
+/**
+ * Command lifecycle trace event
+ *
+ * 'cid' is the command identifier as seen by the device. 'aux' is the
+ * completion status (SCT << 8 | SC) for HW_DONE, 0 for an Abort command
+ * and 1 for a command flushed by queue reset for ABORT, and the age in
+ * seconds of a stalled command (0 for a sync command) for TIMEOUT.
+ */
+typedef struct NVMEPCIETraceEvent {
+   // Ring position + 1 once the event is complete, 0 while being written
+   vmk_uint32 seq;
+   vmk_uint8 type;
+   vmk_uint8 opc;
+   vmk_uint16 cid;
+   vmk_TimerCycles ts;
+   vmk_uint64 slba;
+   vmk_uint32 nsid;
+   // 0's based number of logical blocks, as in the command
+   vmk_uint16 nlb;
+   vmk_uint16 aux;
+} NVMEPCIETraceEvent;
+
+/**
+ * Per queue command trace ring
+ *
+ * Writers claim positions by 'head' and never wait, so the oldest events
+ * are overwritten when the ring is not drained in time. Only commands
+ * sampled at submission, 1 in 'traceRate', are traced, except ABORT and
+ * TIMEOUT events which are always recorded while tracing is on.
+ */
+typedef struct NVMEPCIETraceRing {
+   vmk_atomic32 head;
+   // Next position to drain, owned by the 'trace' management key
+   vmk_uint32 tail;
+   // Sampling counter, under sq lock
+   vmk_uint32 sampleSeq;
+   NVMEPCIETraceEvent events[NVME_PCIE_TRACE_RING_SIZE];
+} NVMEPCIETraceRing;
+
+#if NVME_PCIE_STORAGE_POLL
+/**
+ * Latency model classes, opcode class by size class
+ */
+#define NVME_PCIE_LAT_OPC_READ   0
+#define NVME_PCIE_LAT_OPC_WRITE  1
+#define NVME_PCIE_LAT_OPC_OTHER  2
+#define NVME_PCIE_LAT_OPC_NUM    3
+#define NVME_PCIE_LAT_SIZE_NUM   2  // Small as cmdInfo->isSmall, large
+#define NVME_PCIE_LAT_CLASS_NUM  (NVME_PCIE_LAT_OPC_NUM * NVME_PCIE_LAT_SIZE_NUM)
+// Weight of a new sample is 1 / (1 << NVME_PCIE_LAT_EWMA_SHIFT)
+#define NVME_PCIE_LAT_EWMA_SHIFT 3
+#define NVME_PCIE_POLL_SLEEP_PCT_DEFAULT 50
+// Spin budget (us) of a busy poll round
+#define NVME_PCIE_POLL_SPIN_BUDGET_DEFAULT 100
+#define NVME_PCIE_POLL_SPIN_BUDGET_MAX 10000
+
+/**
+ * Per queue device latency model
+ *
+ * Updated by completion processing under cq lock.
+ */
+typedef struct NVMEPCIELatModel {
+   // EWMA of device latency in timer cycles, 0 if no sample yet
+   vmk_TimerCycles ewma[NVME_PCIE_LAT_CLASS_NUM];
+   vmk_uint64 samples[NVME_PCIE_LAT_CLASS_NUM];
+} NVMEPCIELatModel;
+#endif
+
+#if NVME_PCIE_BLOCKSIZE_AWARE
+/**
+ * Size buckets of in-flight histogram
+ *
+ * Bucket 0 holds transfer sizes up to 4 KiB, bucket i sizes in
+ * (2 KiB << i, 4 KiB << i] and the last one everything larger.
+ */
+#define NVME_PCIE_COST_SIZE_SHIFT_MIN 12
+#define NVME_PCIE_COST_SIZE_NUM 8
+// Device latency assumed for a bucket without latency model samples
+#define NVME_PCIE_COST_BASE_LAT_US 10
+#define NVME_PCIE_COST_BYTES_PER_US 2048
+#define NVME_PCIE_POLL_INTR_COST_DEFAULT 5
+#define NVME_PCIE_POLL_INTR_COST_MAX 1000
+
+/**
+ * Per queue histogram of in-flight IO commands by opcode class and size
+ *
+ * Updated at submission and completion if the BLKSIZE hot path feature is
+ * on, see NVMEPCIEPollCostGap().
+ */
+typedef struct NVMEPCIEInflightHist {
+   vmk_atomic32 count[NVME_PCIE_LAT_OPC_NUM][NVME_PCIE_COST_SIZE_NUM];
+} NVMEPCIEInflightHist;
+#endif
+
+#if NVME_PCIE_STORAGE_POLL
+// Range and step of per-queue OIO threshold searched by auto tune
+#define NVME_PCIE_POLL_TUNE_THR_MIN 1
+#define NVME_PCIE_POLL_TUNE_THR_MAX 256
+#define NVME_PCIE_POLL_TUNE_STEP 4
+// Minimum completions per epoch to evaluate a threshold
+#define NVME_PCIE_POLL_TUNE_MIN_SAMPLES 1000
+
+/**
+ * Per queue hill climbing search of OIO threshold to enter poll mode
+ *
+ * Each 'iopsTimer' tick is an epoch. The objective of the current threshold
+ * is the mean device latency observed by latency model during the epoch
+ * plus the poll routine CPU time per completion of the queue, so a lower
+ * threshold must save more latency than the CPU time it adds. The
+ * threshold keeps moving in one direction while the objective improves,
+ * and turns around when it gets worse.
+ */
+typedef struct NVMEPCIEPollTuner {
+   // Threshold in use
+   vmk_atomic32 thr;
+   // +1 or -1
+   vmk_int32 dir;
+   // Objective (us) of last epoch, 0 if none
+   vmk_uint64 lastObj;
+   vmk_uint32 bestThr;
+   vmk_uint64 bestObj;
+   vmk_uint64 epochs;
+   // Poll CPU time (ns) per completion of last epoch
+   vmk_uint64 lastCpuNs;
+   // Accumulated by completion processing under cq lock
+   vmk_TimerCycles latSum;
+   vmk_uint64 latCount;
+   // 'pollCpuCycles' of the queue when the epoch started
+   vmk_uint64 cpuCycles;
+   // Completions of the queue in the epoch, by the IOPs timer
+   vmk_uint64 compl;
+} NVMEPCIEPollTuner;
+
+// Upper bound of 'pollCpuBudget', percent of one PCPU
+#define NVME_PCIE_POLL_CPU_BUDGET_MAX 6400
+// Demoted queues are released when usage drops below this percent of budget
+#define NVME_PCIE_POLL_CPU_RELEASE_PCT 80
+
+/**
+ * Per controller CPU budget governor of polling
+ *
+ * Evaluated every 'iopsTimer' tick. While poll routines of the controller
+ * use more than 'pollCpuBudget' percent of one PCPU, the polled queue
+ * with the most CPU cycles per completion is demoted to interrupt mode
+ * each tick. Demoted queues are released one per tick once usage drops
+ * below NVME_PCIE_POLL_CPU_RELEASE_PCT percent of the budget.
+ */
+typedef struct NVMEPCIEPollGovernor {
+   vmk_TimerCycles lastTs;
+   // Poll CPU usage of last tick, percent of one PCPU
+   vmk_uint32 cpuPct;
+   vmk_uint64 ticks;
+   vmk_uint64 overBudget;
+   vmk_uint64 demotions;
+   vmk_uint64 releases;
+} NVMEPCIEPollGovernor;
+
+#define NVME_PCIE_POLL_GROUP_MAX 16
+
+/**
+ * Poll group, one StoragePoll handler servicing several IO queues
+ *
+ * IO queues of a controller are split into 'numPollGroups' groups of
+ * consecutive queue IDs. The poll routine of a group round-robins over
+ * member queues in poll mode and peeks the phase bit of their next
+ * completion queue entries, see NVMEPCIEPollGroupCB().
+ */
+typedef struct NVMEPCIEPollGroup {
+   NVMEPCIEController *ctrlr;
+   vmk_uint32 id;
+   /**
+    * Created with the first member queue, destroyed with the last one.
+    * Members join and leave from queue construction, queue destruction and
+    * the IO allowed notification, which the NVMe core runs one at a time
+    * per controller. 'numMembers' is atomic so a count is never lost even
+    * if they overlapped.
+    */
+   vmk_StoragePoll handler;
+   vmk_atomic32 numMembers;
+   // Non-zero while the poll routine runs, see NVMEPCIEStoragePollDisable()
+   vmk_atomic32 inCb;
+   // Queue to start next round with, owned by the poll routine
+   vmk_uint32 cursor;
+   vmk_atomic64 rounds;
+   vmk_atomic64 peeks;
+   vmk_atomic64 hits;
+} NVMEPCIEPollGroup;
+
+// Transfer sizes of calibration reads, 512 B << i up to one page
+#define NVME_PCIE_CALIB_SIZE_NUM 4
+// Reads per transfer size of calibration
+#define NVME_PCIE_CALIB_SAMPLES 64
+
+/**
+ * Result of poll parameter calibration, see NVMEPCIEPollCalibrate()
+ *
+ * Latencies are round trips in ns of sync reads through
+ * NVMEPCIESubmitSyncCommand(), i.e. device latency plus completion
+ * delivery to a waiting world.
+ */
+typedef struct NVMEPCIECalibResult {
+   VMK_ReturnStatus status;
+   vmk_uint32 nsid;
+   vmk_uint32 qid;
+   vmk_Bool applied;
+   vmk_uint32 numSizes;
+   vmk_uint32 bytes[NVME_PCIE_CALIB_SIZE_NUM];
+   vmk_uint64 minNs[NVME_PCIE_CALIB_SIZE_NUM];
+   vmk_uint64 meanNs[NVME_PCIE_CALIB_SIZE_NUM];
+   vmk_uint64 p99Ns[NVME_PCIE_CALIB_SIZE_NUM];
+   // Recommended parameters
+   vmk_uint64 pollInterval;
+   vmk_uint32 pollOIOThr;
+   vmk_uint32 pollOIOExitThr;
+   vmk_uint32 smallIoBytes;
+   // Current 'smallIoBytes' is reported if not derived
+   vmk_Bool smallIoDerived;
+} NVMEPCIECalibResult;
+#endif
+
+/**
+ * A command detected as stalled
+ */
+typedef struct NVMEPCIEStallRecord {
+   vmk_uint64 timeUs;
+   vmk_uint32 ageSec;
+   vmk_uint16 qid;
+   vmk_uint16 cid;
+   vmk_uint8 opc;
+} NVMEPCIEStallRecord;
+
+/**
+ * An IO command whose device latency exceeded the outlier threshold
+ *
+ * 'sqe' and 'cqe' carry the command identifier as seen by the device.
+ */
+typedef struct NVMEPCIEOutlierRecord {
+   vmk_uint64 timeUs;
+   vmk_uint64 latencyUs;
+   vmk_uint16 qid;
+   // PCPU and outstanding commands of the queue when issued
+   vmk_uint16 cpu;
+   vmk_uint16 depth;
+   vmk_NvmeSubmissionQueueEntry sqe;
+   vmk_NvmeCompletionQueueEntry cqe;
+} NVMEPCIEOutlierRecord;
+
+/**
+ * Controller bring-up phases, timed in each attach or reset
+ */
+// attachDevice callback
+#define NVME_PCIE_BRINGUP_ATTACH    0
+// startAdapter callback
+#define NVME_PCIE_BRINGUP_START     1
+// CC.EN cleared until CSTS.RDY is 0
+#define NVME_PCIE_BRINGUP_DISABLE   2
+// Admin queue reset and configuration
+#define NVME_PCIE_BRINGUP_ADMINQ    3
+// CC.EN set until CSTS.RDY is 1
+#define NVME_PCIE_BRINGUP_ENABLE    4
+// Identify commands
+#define NVME_PCIE_BRINGUP_IDENTIFY  5
+// Interrupt allocation and Set Features - Number of Queues
+#define NVME_PCIE_BRINGUP_SETQUEUES 6
+// IO queue creation
+#define NVME_PCIE_BRINGUP_CREATEQ   7
+// IO queue deletion
+#define NVME_PCIE_BRINGUP_DELETEQ   8
+// quiesceDevice callback, attach record only
+#define NVME_PCIE_BRINGUP_QUIESCE   9
+#define NVME_PCIE_BRINGUP_PHASE_NUM 10
+
+/**
+ * Timing of one attach or reset of a controller
+ *
+ * A phase entered more than once accumulates its time.
+ */
+typedef struct NVMEPCIEBringupRecord {
+   vmk_uint64 startUs;
+   // 0 while in progress
+   vmk_uint64 endUs;
+   vmk_uint32 phaseUs[NVME_PCIE_BRINGUP_PHASE_NUM];
+   vmk_uint32 identifies;
+   vmk_uint32 queues;
+   // Create latency of each IO queue
+   vmk_uint32 queueUs[NVME_PCIE_MAX_IO_QUEUES + 1];
+} NVMEPCIEBringupRecord;
+
+/**
+ * Bring-up timing of a controller
+ *
+ * Written by controller and device callbacks, which are serialized by the
+ * upper layer, and by admin completions of Identify. Read without lock.
+ */
+typedef struct NVMEPCIEBringup {
+   NVMEPCIEBringupRecord attach;
+   NVMEPCIEBringupRecord resets[NVME_PCIE_BRINGUP_RECORD_NUM];
+   // Number of resets ever recorded
+   vmk_uint32 resetIdx;
+   // Record in progress, NULL if none
+   NVMEPCIEBringupRecord *cur;
+   // CC.EN written and time of the write, 0 if not waiting for CSTS.RDY
+   vmk_uint32 ccEn;
+   vmk_uint64 ccUs;
+   // Issue time of the outstanding Identify, 0 if none
+   vmk_uint64 identifyUs;
+} NVMEPCIEBringup;
+
+/**
+ * Log-linear device latency histogram buckets
+ *
+ * Latency is counted in units of 1 << NVME_PCIE_LAT_HIST_UNIT_SHIFT ns.
+ * Values below NVME_PCIE_LAT_HIST_SUB units map linearly, larger ones
+ * into NVME_PCIE_LAT_HIST_SUB buckets per power of 2, i.e. with 12.5%
+ * relative precision. The last bucket also holds everything above ~4s.
+ */
+#define NVME_PCIE_LAT_HIST_UNIT_SHIFT 6
+#define NVME_PCIE_LAT_HIST_SUB_SHIFT 3
+#define NVME_PCIE_LAT_HIST_SUB (1 << NVME_PCIE_LAT_HIST_SUB_SHIFT)
+#define NVME_PCIE_LAT_HIST_BUCKETS 192
+// Opcode classes of latency histograms
+#define NVME_PCIE_LAT_HIST_OPC_READ  0
+#define NVME_PCIE_LAT_HIST_OPC_WRITE 1
+#define NVME_PCIE_LAT_HIST_OPC_FLUSH 2
+#define NVME_PCIE_LAT_HIST_OPC_OTHER 3
+#define NVME_PCIE_LAT_HIST_OPC_NUM   4
+/**
+ * Size classes of latency histograms, class 0 holds transfer sizes up to
+ * 4 KiB, class i sizes in (1 KiB << 2i, 4 KiB << 2i], the last one
+ * everything larger.
+ */
+#define NVME_PCIE_LAT_HIST_SIZE_NUM  4
+
+/**
+ * Per queue device latency histograms by opcode and size class
+ *
+ * 'count' is written by completion processing of the queue only, which is
+ * serialized by cq lock, and read without lock. Readers request a reset
+ * by 'resetReq', which is carried out at the next completion.
+ */
+typedef struct NVMEPCIELatHist {
+   vmk_atomic8 resetReq;
+   vmk_uint64 count[NVME_PCIE_LAT_HIST_OPC_NUM][NVME_PCIE_LAT_HIST_SIZE_NUM]
+                   [NVME_PCIE_LAT_HIST_BUCKETS];
+} NVMEPCIELatHist;
+
+/**
+ * Host side phases of an IO command, between the time stamps taken at
+ * entry to submission, sq lock acquired, doorbell written, CQE observed
+ * and done callback invoked.
+ */
+#define NVME_PCIE_PHASE_LOCK     0
+#define NVME_PCIE_PHASE_SUBMIT   1
+#define NVME_PCIE_PHASE_DEVICE   2
+#define NVME_PCIE_PHASE_DISPATCH 3
+#define NVME_PCIE_PHASE_NUM      4
+
+/**
+ * Per queue histograms of IO command phases
+ *
+ * Same buckets and reset protocol as NVMEPCIELatHist.
+ */
+typedef struct NVMEPCIEPhaseHist {
+   vmk_atomic8 resetReq;
+   vmk_uint64 count[NVME_PCIE_PHASE_NUM][NVME_PCIE_LAT_HIST_BUCKETS];
+} NVMEPCIEPhaseHist;
+
+/** PCPUs beyond this share the last submitter counter */
+#define NVME_PCIE_CPU_STATS_MAX 1024
+
+/**
+ * Per queue submitter PCPU statistics
+ *
+ * 'submits' is written under sq lock, 'completions' and 'crossCpu' under
+ * cq lock, all are read without lock.
+ */
+typedef struct NVMEPCIECpuStats {
+   // One counter per PCPU of the host, up to NVME_PCIE_CPU_STATS_MAX
+   vmk_uint64 *submits;
+   vmk_uint32 numCpus;
+   vmk_uint64 completions;
+   // Completions processed on a PCPU other than the submitter
+   vmk_uint64 crossCpu;
+} NVMEPCIECpuStats;
+
 typedef struct NVMEPCIEQueueStats {
    vmk_uint64 intrCount;
    /* Additional tracker for CQ entries. */
    vmk_uint16 cqHead;
    vmk_uint16 cqePhase;
+   // Valid for IO queues only
+   NVMEPCIELatHist latHist;
+   NVMEPCIEPhaseHist phaseHist;
+   NVMEPCIECpuStats cpuStats;
 } NVMEPCIEQueueStats;
 
 /**
@@ -242,7 +1016,20 @@ typedef struct NVMEPCIEQueueStats {
 typedef struct NVMEPCIEQueueInfo {
    int id;
    vmk_atomic32 state;
-   vmk_atomic32 refCount;
+   /**
+    * NVME_PCIE_QUEUE_REF_SLOTS reference slots, see NVMEPCIEQueueRefGet()
+    *
+    * Allocated along with the queue list and kept until the controller is
+    * detached, so it is valid even if the queue does not exist.
+    */
+   NVMEPCIEQueueRef *refs;
+   /**
+    * Hot path variant matching current configuration
+    *
+    * Valid even if the queue does not exist, swapped by
+    * NVMEPCIESelectHotPath().
+    */
+   const NVMEPCIEHotPathOps *hotPath;
    NVMEPCIEController *ctrlr;
    NVMEPCIESubQueueInfo *sqInfo;
    NVMEPCIECompQueueInfo *cqInfo;
@@ -260,6 +1047,57 @@ typedef struct NVMEPCIEQueueInfo {
    vmk_atomic8 isPollHdlrEnabled;
    // StoragePoll handler. Set as NULL, if failed to create
    vmk_StoragePoll pollHandler;
+   // Poll group the queue belongs to, 'pollHandler' is the group's then
+   NVMEPCIEPollGroup *pollGroup;
+   NVMEPCIELatModel latModel;
+   /**
+    * Interrupt/poll mode state machine
+    *
+    * 'pollMode' is changed to POLL by the interrupt handler and back to
+    * INTR by the poll routine, which never run concurrently for a queue.
+    */
+   vmk_atomic32 pollMode;
+   // Time (us) of last mode transition
+   vmk_uint64 pollModeTs;
+   vmk_atomic64 pollEnters;
+   vmk_atomic64 pollExits;
+   // Transitions held back by hysteresis
+   vmk_atomic64 pollEntersDeferred;
+   vmk_atomic64 pollExitsDeferred;
+   /**
+    * IOPs estimated over 'iopsWindow', updated per completion batch under
+    * cq lock, see NVMEPCIEIopsEstimate()
+    */
+   vmk_atomic32 iopsEst;
+   // Time (us) of last update of 'iopsEst'
+   vmk_uint64 iopsEstTs;
+   NVMEPCIEPollTuner pollTuner;
+   /**
+    * Busy poll accounting, updated by the poll routine of the queue only
+    *
+    * 'busySpinCycles' excludes time spent processing completions.
+    */
+   vmk_atomic64 busyRounds;
+   vmk_atomic64 busyExpired;
+   vmk_atomic64 busySpinCycles;
+   vmk_atomic64 busyCompl;
+   /**
+    * CPU cycles of the poll routine excluding sleep, and completions it
+    * harvested. 'pollSleepCycles' is accumulated by the poll routine only.
+    */
+   vmk_atomic64 pollCpuCycles;
+   vmk_atomic64 pollCompl;
+   vmk_TimerCycles pollSleepCycles;
+   // Governor state, owned by 'iopsTimer'
+   vmk_uint64 govLastCycles;
+   vmk_uint64 govLastCompl;
+   vmk_uint32 govCpuPct;
+   vmk_uint64 govNsPerCompl;
+   // Kept in interrupt mode by CPU budget governor
+   vmk_atomic8 govDemoted;
+#endif
+#if NVME_PCIE_BLOCKSIZE_AWARE
+   NVMEPCIEInflightHist inflightHist;
 #endif
    /**
     * Will update per second by 'iopsTimer'
@@ -269,6 +1107,12 @@ typedef struct NVMEPCIEQueueInfo {
     */
    vmk_atomic32 iopsLastSec;
    vmk_atomic32 numCmdComplThisSec;
+   // Advanced by 'iopsTimer' as well
+   NVMEPCIEStallWheel stallWheel;
+   NVMEPCIEQueueCounters counters;
+   NVMEPCIETraceRing trace;
+   // Sampled by 'iopsTimer'
+   NVMEPCIEOccupancyRing occupancy;
 } NVMEPCIEQueueInfo;
 
 /* to mark the special device needs some workaround */
@@ -289,27 +1133,107 @@ typedef struct NVMEPCIEController {
    vmk_uint32 maxIoQueues;
    NVMEPCIECtrlrOsResources osRes;
    NVMEPCIEQueueInfo *queueList;
+   // Backing storage of reference slots of all queues in 'queueList'
+   NVMEPCIEQueueRef *queueRefs;
    vmk_Bool isRemoved;
    vmk_Bool abortEnabled;
    NVMEPCIEWorkaround workaround;
    vmk_uint32 dstrd;
    vmk_Bool statsEnabled;
+   /**
+    * Stamp statistics of 1 in 'statsSampleMask' + 1 commands of each queue,
+    * picked by the submission order of the queue rather than by cid, which
+    * the LIFO free list recycles unevenly.
+    */
+   vmk_uint32 statsSampleMask;
    // Timer queue to record IOPs
    vmk_TimerQueue iopsTimerQueue;
    // Timer hanndler to record IOPs
    vmk_Timer iopsTimer;
+   // World issuing Identify Namespace for LBA cache refresh requests
+   vmk_WorldID lbaWorld;
+   vmk_atomic32 lbaRefreshReq;
+   // Stall threshold in seconds, 0 to disable stall detection
+   vmk_atomic32 stallThr;
+   // Protects 'stallRecords' and 'stallRecordIdx'
+   vmk_Lock stallLock;
+   NVMEPCIEStallRecord stallRecords[NVME_PCIE_STALL_RECORD_NUM];
+   vmk_uint32 stallRecordIdx;
+   // Trace 1 in 'traceRate' commands, 0 to disable tracing
+   vmk_atomic32 traceRate;
+   // Device latency threshold in us to capture outliers, 0 to disable
+   vmk_atomic32 outlierThr;
+   // 'outlierThr' in cycles, NVME_PCIE_OUTLIER_THR_OFF if disabled
+   vmk_TimerRelCycles outlierThrTc;
+   // Protects 'outlierRecords' and 'outlierRecordIdx'
+   vmk_Lock outlierLock;
+   NVMEPCIEOutlierRecord outlierRecords[NVME_PCIE_OUTLIER_RECORD_NUM];
+   vmk_uint32 outlierRecordIdx;
+   // Stamp phases of IO commands, valid if statistics enabled
+   vmk_atomic8 phaseStamp;
+   // Queue dumped by 'occupancy' key, 0 for summary of all IO queues
+   vmk_uint32 occupancyQid;
+   // Attach and reset phase timing
+   NVMEPCIEBringup bringup;
 #if NVME_PCIE_STORAGE_POLL
    /**
     * Always setup poll handlers, and it depends on 'pollAct' to activate
     * poll routine.
     */
    vmk_atomic8 pollAct;
+   // OIO to enter poll mode
    vmk_atomic32 pollOIOThr;
+   // OIO below which poll mode may be left
+   vmk_atomic32 pollOIOExitThr;
+   // Minimum time (us) a queue stays in a mode
+   vmk_atomic64 pollDwell;
+   // Window (us) of IOPs estimation of queues
+   vmk_atomic64 iopsWindow;
+   // Tune OIO thresholds per queue instead of 'pollOIOThr'
+   vmk_atomic8 pollAutoTune;
+   // Transfer size boundary in bytes of small block size IO commands
+   vmk_atomic32 smallIoBytes;
    vmk_atomic64 pollInterval;
+   /**
+    * Sleep 'pollSleepPct' percent of predicted remaining latency of the
+    * oldest outstanding command before spinning, if 'pollLatModel' is on.
+    */
+   vmk_atomic8 pollLatModel;
+   vmk_atomic32 pollSleepPct;
+   /**
+    * Never sleep in poll mode while commands are outstanding, spin on the
+    * completion queue for at most 'pollSpinBudget' us per round instead.
+    */
+   vmk_atomic8 pollBusy;
+   vmk_atomic32 pollSpinBudget;
+   // CPU budget of polling in percent of one PCPU, 0 for unlimited
+   vmk_atomic32 pollCpuBudget;
+   NVMEPCIEPollGovernor pollGov;
+   // Number of poll groups, 0 for one StoragePoll handler per queue
+   vmk_uint32 numPollGroups;
+   NVMEPCIEPollGroup pollGroups[NVME_PCIE_POLL_GROUP_MAX];
+   // Non-zero while a calibration runs
+   vmk_atomic32 pollCalibBusy;
+   NVMEPCIECalibResult pollCalib;
 #endif
 #if NVME_PCIE_BLOCKSIZE_AWARE
    vmk_atomic8 blkSizeAwarePollAct;
+   /**
+    * Decide polling by the cost model of in-flight IO instead of the
+    * small block size ratio. Polling pays off when the expected time
+    * between completions is within 'pollIntrCost' us.
+    */
+   vmk_atomic8 pollCostModel;
+   vmk_atomic32 pollIntrCost;
 #endif
+   /**
+    * LBA data size shift per NSID from Identify Namespace, 0 if unknown
+    *
+    * Refreshed by NVMEPCIELbaCacheRefresh(), invalidated when a Format NVM
+    * command is submitted and refreshed again by 'lbaWorld' when it
+    * completes.
+    */
+   vmk_uint8 lbaShift[NVME_PCIE_LBA_CACHE_NS + 1];
    vmk_MgmtHandle kvMgmtHandle;
    vmk_MgmtApiSignature kvMgmtSig;
 } NVMEPCIEController;
@@ -330,11 +1254,53 @@ static inline vmk_ByteCount
 NVMEPCIEQueueAllocSize(void)
 {
    vmk_uint32 numCmdInfo =
-      NVME_PCIE_MAX_IO_QUEUE_SIZE * 2 + NVME_PCIE_SYNC_CMD_NUM;
+      NVME_PCIE_MAX_IO_QUEUE_SIZE * 2 + NVME_PCIE_SYNC_CMD_NUM_MAX;
    return (sizeof(NVMEPCIEQueueInfo) + sizeof(NVMEPCIESubQueueInfo) +
            sizeof(NVMEPCIECompQueueInfo) +
            sizeof(NVMEPCIECmdInfo) * numCmdInfo +
-           vmk_SpinlockAllocSize(VMK_SPINLOCK) * 3);
+           sizeof(NVMEPCIEQueueStats) +
+#if NVME_PCIE_STORAGE_POLL
+           sizeof(vmk_uint16) * numCmdInfo +
+#endif
+           vmk_SpinlockAllocSize(VMK_SPINLOCK) * 4);
+}
+
+/**
+ * Take a reference of a queue from the slot of current PCPU
+ *
+ * The reference is taken before the queue state is checked. A state
+ * transition updates the state before summing the slots, so either the
+ * caller sees the new state here or the transition sees the reference.
+ *
+ * @param[in] qinfo     Queue instance
+ * @param[in] minState  Lowest queue state the caller can work with
+ *
+ * @return Slot holding the reference, NULL if queue state is below minState
+ */
+static inline NVMEPCIEQueueRef *
+NVMEPCIEQueueRefGet(NVMEPCIEQueueInfo *qinfo, NVMEPCIEQueueState minState)
+{
+   NVMEPCIEQueueRef *ref;
+
+   ref = &qinfo->refs[vmk_PCPUGetCurrent() % NVME_PCIE_QUEUE_REF_SLOTS];
+   vmk_AtomicInc32(&ref->count);
+   vmk_CPUMemFenceReadWrite();
+   if (VMK_UNLIKELY(vmk_AtomicRead32(&qinfo->state) < minState)) {
+      vmk_AtomicDec32(&ref->count);
+      return NULL;
+   }
+   return ref;
+}
+
+/**
+ * Drop a reference taken by NVMEPCIEQueueRefGet()
+ *
+ * @param[in] ref  Slot returned by NVMEPCIEQueueRefGet()
+ */
+static inline void
+NVMEPCIEQueueRefPut(NVMEPCIEQueueRef *ref)
+{
+   vmk_AtomicDec32(&ref->count);
 }
 
 /**
@@ -460,18 +1426,49 @@ VMK_ReturnStatus NVMEPCIEStopQueue(NVMEPCIEQueueInfo *qinfo,
                                    vmk_NvmeStatus status);
 VMK_ReturnStatus NVMEPCIEResumeQueue(NVMEPCIEQueueInfo *qinfo);
 void NVMEPCIESuspendQueue(NVMEPCIEQueueInfo *qinfo);
-vmk_uint32 NVMEPCIEProcessCq(NVMEPCIEQueueInfo *qinfo);
+void NVMEPCIESelectHotPath(NVMEPCIEController *ctrlr);
+void NVMEPCIEStallWheelAdvance(NVMEPCIEQueueInfo *qinfo);
+void NVMEPCIEOccupancyRecord(NVMEPCIEQueueInfo *qinfo, vmk_uint32 iops);
+vmk_uint32 NVMEPCIEStallWheelCount(NVMEPCIEQueueInfo *qinfo,
+                                   vmk_uint32 minAge);
+
+/**
+ * Process completion queue entries
+ *
+ * @note It is assumed that cq lock is held by caller.
+ */
+static inline vmk_uint32
+NVMEPCIEProcessCq(NVMEPCIEQueueInfo *qinfo)
+{
+   return qinfo->hotPath->processCq(qinfo);
+}
 
 /** vmk nvme adapter and controller init/cleanup functions */
 VMK_ReturnStatus NVMEPCIEAdapterInit(NVMEPCIEController *ctrlr);
 VMK_ReturnStatus NVMEPCIEAdapterDestroy(NVMEPCIEController *ctrlr);
 VMK_ReturnStatus NVMEPCIEControllerInit(NVMEPCIEController *ctrlr);
 VMK_ReturnStatus NVMEPCIEControllerDestroy(NVMEPCIEController *ctrlr);
+void NVMEPCIEBringupPhase(NVMEPCIEBringupRecord *rec,
+                          vmk_uint32 phase,
+                          vmk_uint64 startUs);
+void NVMEPCIEBringupResetBegin(NVMEPCIEController *ctrlr, vmk_uint64 startUs);
+void NVMEPCIEBringupEnd(NVMEPCIEController *ctrlr);
+void NVMEPCIEBringupIdentifyDone(NVMEPCIEController *ctrlr);
+void NVMEPCIELbaCacheRefreshRequest(NVMEPCIEController *ctrlr);
+void NVMEPCIEAdminCommandPrepare(NVMEPCIEController *ctrlr,
+                                 vmk_NvmeCommand *vmkCmd);
 
 /** IO functions */
-VMK_ReturnStatus NVMEPCIESubmitAsyncCommand(NVMEPCIEController *ctrlr,
-                                            vmk_NvmeCommand *vmkCmd,
-                                            vmk_uint32 qid);
+/**
+ * Submit a command to a queue
+ */
+static inline VMK_ReturnStatus
+NVMEPCIESubmitAsyncCommand(NVMEPCIEController *ctrlr,
+                           vmk_NvmeCommand *vmkCmd,
+                           vmk_uint32 qid)
+{
+   return ctrlr->queueList[qid].hotPath->submitAsync(ctrlr, vmkCmd, qid);
+}
 VMK_ReturnStatus NVMEPCIESubmitSyncCommand(NVMEPCIEController *ctrlr,
                                            vmk_NvmeCommand *vmkCmd,
                                            vmk_uint32 qid,
@@ -488,8 +1485,26 @@ void NVMEPCIEEnableIntr(NVMEPCIEQueueInfo *qinfo);
 void NVMEPCIEDisableIntr(NVMEPCIEQueueInfo *qinfo, vmk_Bool intrSync);
 
 vmk_uint16 NVMEPCIEGetCmdNlb(vmk_NvmeCommand *vmkCmd);
-vmk_Bool NVMEPCIEIsSmallBsIoCmd(vmk_uint32 qid,
+vmk_Bool NVMEPCIEIsSmallBsIoCmd(NVMEPCIEController *ctrlr,
+                                vmk_uint32 qid,
                                 vmk_NvmeCommand *vmkCmd);
+void NVMEPCIELbaCacheRefresh(NVMEPCIEController *ctrlr);
+void NVMEPCIEQueueCountersReset(NVMEPCIEQueueInfo *qinfo);
+const char *NVMEPCIETraceTypeName(vmk_uint8 type);
+void NVMEPCIEOutlierThrSet(NVMEPCIEController *ctrlr, vmk_uint32 thrUs);
+void NVMEPCIEStatsSampleRateSet(NVMEPCIEController *ctrlr, vmk_uint32 rate);
+#ifdef NVME_STATS
+void NVMEPCIELatHistMerge(NVMEPCIEController *ctrlr, NVMEPCIELatHist *merged);
+void NVMEPCIELatHistReset(NVMEPCIEController *ctrlr);
+void NVMEPCIEPhaseHistMerge(NVMEPCIEController *ctrlr,
+                            NVMEPCIEPhaseHist *merged);
+void NVMEPCIEPhaseHistReset(NVMEPCIEController *ctrlr);
+void NVMEPCIECpuStatsReset(NVMEPCIEController *ctrlr);
+vmk_uint64 NVMEPCIELatHistBucketNs(vmk_uint32 idx);
+vmk_uint64 NVMEPCIELatHistPercentile(vmk_uint64 *count,
+                                     vmk_uint64 total,
+                                     vmk_uint32 permil);
+#endif
 
 #if NVME_PCIE_STORAGE_POLL
 vmk_uint32 NVMEPCIEStoragePollCB(vmk_AddrCookie driverData,
@@ -512,10 +1527,25 @@ void NVMEPCIEStoragePollEnable(NVMEPCIEQueueInfo *qinfo);
 void NVMEPCIEStoragePollDisable(NVMEPCIEQueueInfo *qinfo);
 void NVMEPCIEStoragePollDestory(NVMEPCIEQueueInfo *qinfo);
 vmk_Bool NVMEPCIEStoragePollSwitch(NVMEPCIEQueueInfo *qinfo);
+vmk_Bool NVMEPCIEStoragePollStay(NVMEPCIEQueueInfo *qinfo);
+vmk_uint32 NVMEPCIEIopsEstimate(NVMEPCIEQueueInfo *qinfo);
+void NVMEPCIEPollTuneReset(NVMEPCIEController *ctrlr);
+void NVMEPCIEPollTuneEpoch(NVMEPCIEQueueInfo *qinfo, vmk_uint32 compl);
+void NVMEPCIEPollGovernorTick(NVMEPCIEController *ctrlr);
+VMK_ReturnStatus NVMEPCIEPollCalibrate(NVMEPCIEController *ctrlr,
+                                       vmk_uint32 nsid,
+                                       vmk_Bool apply);
+vmk_uint32 NVMEPCIEPollGroupCB(vmk_AddrCookie driverData,
+                               vmk_uint32 leastPoll,
+                               vmk_uint32 budget);
+void NVMEPCIEStoragePollSetMode(NVMEPCIEQueueInfo *qinfo,
+                                NVMEPCIEPollMode mode);
 #endif
 
 #if NVME_PCIE_BLOCKSIZE_AWARE
 vmk_Bool NVMEPCIEStoragePollBlkSizeAwareSwitch(NVMEPCIEQueueInfo *qinfo);
+vmk_uint64 NVMEPCIEPollCostGap(NVMEPCIEQueueInfo *qinfo,
+                               vmk_uint32 *numAct);
 #endif
 
 /** Interrupt functions */
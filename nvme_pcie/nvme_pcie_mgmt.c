@@ -15,6 +15,11 @@ NVMEPCIEKeyGetHelpPage(vmk_uint8 *buf,
                        vmk_uint32 buf_len,
                        NVMEPCIEKVMgmtData *keyList,
                        vmk_uint32 keyNum);
+static vmk_uint32
+NVMEPCIEKeyBringupRecordFormat(vmk_uint8 *buf,
+                               vmk_uint32 buf_len,
+                               const char *name,
+                               NVMEPCIEBringupRecord *rec);
 
 // Controller key ops
 #if NVME_PCIE_STORAGE_POLL
@@ -27,248 +32,3230 @@ NVMEPCIEKeyPollOIOThrGet(vmk_uint64 cookie, void *keyVal);
 static VMK_ReturnStatus
 NVMEPCIEKeyPollOIOThrSet(vmk_uint64 cookie, void *keyVal);
 static VMK_ReturnStatus
+NVMEPCIEKeyPollOIOExitThrGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyPollOIOExitThrSet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyPollDwellGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyPollDwellSet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyPollAutoTuneGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyPollAutoTuneSet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyPollTuneGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyPollTuneSet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyIopsWindowGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyIopsWindowSet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyPollModeGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyPollModeSet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
 NVMEPCIEKeyPollIntervalGet(vmk_uint64 cookie, void *keyVal);
 static VMK_ReturnStatus
 NVMEPCIEKeyPollIntervalSet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyPollLatModelGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyPollLatModelSet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyPollSleepPctGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyPollSleepPctSet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyPollLatencyGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyPollLatencySet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyPollBusyGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyPollBusySet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyPollSpinBudgetGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyPollSpinBudgetSet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyPollCpuBudgetGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyPollCpuBudgetSet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyPollGovernorGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyPollGovernorSet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyPollGroupsGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyPollGroupsSet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyBusyPollGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyBusyPollSet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyCalibrateGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyCalibrateSet(vmk_uint64 cookie, void *keyVal);
 #endif
 #if NVME_PCIE_BLOCKSIZE_AWARE
 static VMK_ReturnStatus
 NVMEPCIEKeyBlkSizeAwarePollActGet(vmk_uint64 cookie, void *keyVal);
 static VMK_ReturnStatus
 NVMEPCIEKeyBlkSizeAwarePollActSet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyPollCostModelGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyPollCostModelSet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyPollIntrCostGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyPollIntrCostSet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyPollModelGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyPollModelSet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeySmallIoBytesGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeySmallIoBytesSet(vmk_uint64 cookie, void *keyVal);
+#endif
+static VMK_ReturnStatus
+NVMEPCIEKeyLbaCacheGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyLbaCacheSet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeySyncPoolGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeySyncPoolSet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyQueueStatsGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyQueueStatsSet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyOccupancyGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyOccupancySet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyStallThrGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyStallThrSet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyStallsGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyStallsSet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyTraceRateGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyTraceRateSet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyTraceGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyTraceSet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyBringupGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyBringupSet(vmk_uint64 cookie, void *keyVal);
+#if NVME_PCIE_LOCK_STATS
+static VMK_ReturnStatus
+NVMEPCIEKeyLockStatsGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyLockStatsSet(vmk_uint64 cookie, void *keyVal);
+#endif
+#ifdef NVME_STATS
+static VMK_ReturnStatus
+NVMEPCIEKeyLatHistGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyLatHistSet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyOutlierThrGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyOutlierThrSet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyOutliersGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyOutliersSet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyPhaseStampGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyPhaseStampSet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyPhaseHistGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyPhaseHistSet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyCpuStatsGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyCpuStatsSet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyStatsSampleRateGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyStatsSampleRateSet(vmk_uint64 cookie, void *keyVal);
 #endif
 static VMK_ReturnStatus NVMEPCIEKeyHelpGet(vmk_uint64 cookie, void *keyVal);
 static VMK_ReturnStatus NVMEPCIEKeyHelpSet(vmk_uint64 cookie, void *keyVal);
 
-// Global key ops
-static VMK_ReturnStatus
-NVMEPCIEKeyDebugMaskGet(vmk_uint64 cookie, void *keyVal);
-static VMK_ReturnStatus
-NVMEPCIEKeyDebugMaskSet(vmk_uint64 cookie, void *keyVal);
-static VMK_ReturnStatus
-NVMEPCIEKeyLogLevelGet(vmk_uint64 cookie, void *keyVal);
+// Global key ops
+static VMK_ReturnStatus
+NVMEPCIEKeyDebugMaskGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyDebugMaskSet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyLogLevelGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus
+NVMEPCIEKeyLogLevelSet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus NVMEPCIEGlobalKeyHelpGet(vmk_uint64 cookie, void *keyVal);
+static VMK_ReturnStatus NVMEPCIEGlobalKeyHelpSet(vmk_uint64 cookie, void *keyVal);
+
+// Controller keys
+static NVMEPCIEKVMgmtData nvmePCIEKVMgmtData[] = {
+#if NVME_PCIE_STORAGE_POLL
+   {
+      "pollAct",
+      VMK_MGMT_KEY_TYPE_LONG,
+      NVMEPCIEKeyPollActGet,
+      "Display hybrid poll activation info of the device.",
+      NVMEPCIEKeyPollActSet,
+      "Set pollAct, non-zero for activation, 0 for deactivation",
+   },
+   {
+      "pollOIOThr",
+      VMK_MGMT_KEY_TYPE_LONG,
+      NVMEPCIEKeyPollOIOThrGet,
+      "Display hybrid poll OIO activation threshold per queue of the device."
+      " Valid if poll activated.",
+      NVMEPCIEKeyPollOIOThrSet,
+      "Set pollOIOThr",
+   },
+   {
+      "pollOIOExitThr",
+      VMK_MGMT_KEY_TYPE_LONG,
+      NVMEPCIEKeyPollOIOExitThrGet,
+      "Display hybrid poll OIO threshold per queue below which poll may"
+      " switch back to interrupt. Valid if poll activated.",
+      NVMEPCIEKeyPollOIOExitThrSet,
+      "Set pollOIOExitThr, must not exceed pollOIOThr",
+   },
+   {
+      "pollDwell",
+      VMK_MGMT_KEY_TYPE_LONG,
+      NVMEPCIEKeyPollDwellGet,
+      "Display minimum time (us) a queue stays in interrupt or poll mode."
+      " Valid if poll activated.",
+      NVMEPCIEKeyPollDwellSet,
+      "Set pollDwell",
+   },
+   {
+      "pollAutoTune",
+      VMK_MGMT_KEY_TYPE_LONG,
+      NVMEPCIEKeyPollAutoTuneGet,
+      "Display hybrid poll OIO threshold auto tune activation info of the"
+      " device. Valid if poll and latency model activated.",
+      NVMEPCIEKeyPollAutoTuneSet,
+      "Set pollAutoTune, non-zero for activation, 0 for deactivation",
+   },
+   {
+      "pollTune",
+      VMK_MGMT_KEY_TYPE_STRING,
+      NVMEPCIEKeyPollTuneGet,
+      "Display auto tuned OIO threshold and its objective per queue.",
+      NVMEPCIEKeyPollTuneSet,
+      "Restart auto tune from pollOIOThr.",
+   },
+   {
+      "iopsWindow",
+      VMK_MGMT_KEY_TYPE_LONG,
+      NVMEPCIEKeyIopsWindowGet,
+      "Display window (us) of IOPs estimation for poll mode switching.",
+      NVMEPCIEKeyIopsWindowSet,
+      "Set iopsWindow, valid range [1000, 1000000]",
+   },
+   {
+      "pollMode",
+      VMK_MGMT_KEY_TYPE_STRING,
+      NVMEPCIEKeyPollModeGet,
+      "Display interrupt/poll mode and transition counters per queue.",
+      NVMEPCIEKeyPollModeSet,
+      "Reset transition counters.",
+   },
+   {
+      "pollInterval",
+      VMK_MGMT_KEY_TYPE_LONG,
+      NVMEPCIEKeyPollIntervalGet,
+      "Display hybrid poll interval (us) per queue of the device."
+      " Valid if poll activated.",
+      NVMEPCIEKeyPollIntervalSet,
+      "Set pollInterval",
+   },
+   {
+      "pollLatModel",
+      VMK_MGMT_KEY_TYPE_LONG,
+      NVMEPCIEKeyPollLatModelGet,
+      "Display hybrid poll latency model activation info of the device."
+      " Valid if poll activated.",
+      NVMEPCIEKeyPollLatModelSet,
+      "Set pollLatModel, non-zero for activation, 0 for deactivation",
+   },
+   {
+      "pollSleepPct",
+      VMK_MGMT_KEY_TYPE_LONG,
+      NVMEPCIEKeyPollSleepPctGet,
+      "Display hybrid poll sleep percent of predicted remaining latency."
+      " Valid if latency model activated.",
+      NVMEPCIEKeyPollSleepPctSet,
+      "Set pollSleepPct, valid range [0, 100]",
+   },
+   {
+      "pollLatency",
+      VMK_MGMT_KEY_TYPE_STRING,
+      NVMEPCIEKeyPollLatencyGet,
+      "Display device latency (us) predicted by hybrid poll latency model"
+      " per queue and command class.",
+      NVMEPCIEKeyPollLatencySet,
+      "Reset hybrid poll latency model.",
+   },
+   {
+      "pollBusy",
+      VMK_MGMT_KEY_TYPE_LONG,
+      NVMEPCIEKeyPollBusyGet,
+      "Display busy poll activation info of the device. Valid if poll"
+      " activated.",
+      NVMEPCIEKeyPollBusySet,
+      "Set pollBusy, non-zero for activation, 0 for deactivation",
+   },
+   {
+      "pollSpinBudget",
+      VMK_MGMT_KEY_TYPE_LONG,
+      NVMEPCIEKeyPollSpinBudgetGet,
+      "Display busy poll spin budget (us) per poll round.",
+      NVMEPCIEKeyPollSpinBudgetSet,
+      "Set pollSpinBudget, valid range [1, 10000]",
+   },
+   {
+      "pollCpuBudget",
+      VMK_MGMT_KEY_TYPE_LONG,
+      NVMEPCIEKeyPollCpuBudgetGet,
+      "Display CPU budget of polling in percent of one PCPU, 0 for"
+      " unlimited.",
+      NVMEPCIEKeyPollCpuBudgetSet,
+      "Set pollCpuBudget, valid range [0, 6400]",
+   },
+   {
+      "pollGovernor",
+      VMK_MGMT_KEY_TYPE_STRING,
+      NVMEPCIEKeyPollGovernorGet,
+      "Display poll CPU usage, CPU budget governor decisions and demoted"
+      " queues.",
+      NVMEPCIEKeyPollGovernorSet,
+      "Reset governor counters and release demoted queues.",
+   },
+   {
+      "pollGroups",
+      VMK_MGMT_KEY_TYPE_STRING,
+      NVMEPCIEKeyPollGroupsGet,
+      "Display poll groups, their member queues and phase bit peeks.",
+      NVMEPCIEKeyPollGroupsSet,
+      "Reset poll group counters.",
+   },
+   {
+      "busyPoll",
+      VMK_MGMT_KEY_TYPE_STRING,
+      NVMEPCIEKeyBusyPollGet,
+      "Display busy poll rounds, spin time and completions found per queue.",
+      NVMEPCIEKeyBusyPollSet,
+      "Reset busy poll counters.",
+   },
+   {
+      "calibrate",
+      VMK_MGMT_KEY_TYPE_STRING,
+      NVMEPCIEKeyCalibrateGet,
+      "Display read latency and poll parameters recommended by last"
+      " calibration.",
+      NVMEPCIEKeyCalibrateSet,
+      "Calibrate poll parameters by reads of a namespace, format"
+      " '<nsid> [apply]'. Parameters are only reported without 'apply'.",
+   },
+#endif
+#if NVME_PCIE_BLOCKSIZE_AWARE
+   {
+      "blkSizeAwarePollAct",
+      VMK_MGMT_KEY_TYPE_LONG,
+      NVMEPCIEKeyBlkSizeAwarePollActGet,
+      "Display hybrid poll block size aware activation info of the device."
+      " Valid if poll activated.",
+      NVMEPCIEKeyBlkSizeAwarePollActSet,
+      "Set blkSizeAwarePollAct, non-zero for activation, 0 for deactivation",
+   },
+   {
+      "pollCostModel",
+      VMK_MGMT_KEY_TYPE_LONG,
+      NVMEPCIEKeyPollCostModelGet,
+      "Display hybrid poll cost model activation info of the device."
+      " Valid if poll activated.",
+      NVMEPCIEKeyPollCostModelSet,
+      "Set pollCostModel, non-zero for activation, 0 for deactivation",
+   },
+   {
+      "pollIntrCost",
+      VMK_MGMT_KEY_TYPE_LONG,
+      NVMEPCIEKeyPollIntrCostGet,
+      "Display cost (us) of an interrupt in hybrid poll cost model.",
+      NVMEPCIEKeyPollIntrCostSet,
+      "Set pollIntrCost, valid range [0, 1000]",
+   },
+   {
+      "pollModel",
+      VMK_MGMT_KEY_TYPE_STRING,
+      NVMEPCIEKeyPollModelGet,
+      "Display in-flight IO histogram and expected completion gap of hybrid"
+      " poll cost model per queue.",
+      NVMEPCIEKeyPollModelSet,
+      NULL,
+   },
+   {
+      "smallIoBytes",
+      VMK_MGMT_KEY_TYPE_LONG,
+      NVMEPCIEKeySmallIoBytesGet,
+      "Display transfer size boundary (bytes) of small block size IO"
+      " commands.",
+      NVMEPCIEKeySmallIoBytesSet,
+      "Set smallIoBytes, must be non-zero",
+   },
+#endif
+   {
+      "lbaCache",
+      VMK_MGMT_KEY_TYPE_STRING,
+      NVMEPCIEKeyLbaCacheGet,
+      "Display cached LBA data size (bytes) per namespace.",
+      NVMEPCIEKeyLbaCacheSet,
+      "Refresh cached LBA data size from Identify Namespace.",
+   },
+   {
+      "syncPool",
+      VMK_MGMT_KEY_TYPE_STRING,
+      NVMEPCIEKeySyncPoolGet,
+      "Display sync command slot pool usage and contention per queue.",
+      NVMEPCIEKeySyncPoolSet,
+      "Reset contention counters of sync command slot pools.",
+   },
+   {
+      "queueStats",
+      VMK_MGMT_KEY_TYPE_STRING,
+      NVMEPCIEKeyQueueStatsGet,
+      "Display submission, completion, doorbell, interrupt and poll counters,"
+      " completion batch sizes and time in each mode per queue.",
+      NVMEPCIEKeyQueueStatsSet,
+      "Reset queue counters.",
+   },
+   {
+      "occupancy",
+      VMK_MGMT_KEY_TYPE_STRING,
+      NVMEPCIEKeyOccupancyGet,
+      "Display SQ depth, outstanding commands and IOPs sampled every second,"
+      " summary of all IO queues or samples of the selected queue.",
+      NVMEPCIEKeyOccupancySet,
+      "Select IO queue to display samples of, 0 for summary.",
+   },
+   {
+      "stallThr",
+      VMK_MGMT_KEY_TYPE_LONG,
+      NVMEPCIEKeyStallThrGet,
+      "Display threshold (s) to report an outstanding IO command as stalled.",
+      NVMEPCIEKeyStallThrSet,
+      "Set stallThr, valid range [0, 62], 0 to disable stall detection",
+   },
+   {
+      "stalls",
+      VMK_MGMT_KEY_TYPE_STRING,
+      NVMEPCIEKeyStallsGet,
+      "Display outstanding and stalled IO commands per queue and recent"
+      " stalled commands.",
+      NVMEPCIEKeyStallsSet,
+      "Reset stall counters and records.",
+   },
+   {
+      "traceRate",
+      VMK_MGMT_KEY_TYPE_LONG,
+      NVMEPCIEKeyTraceRateGet,
+      "Display command trace sampling rate, 1 in traceRate commands.",
+      NVMEPCIEKeyTraceRateSet,
+      "Set traceRate, valid range [0, 65536], 0 to disable command trace",
+   },
+   {
+      "trace",
+      VMK_MGMT_KEY_TYPE_STRING,
+      NVMEPCIEKeyTraceGet,
+      "Drain command lifecycle trace events per queue, oldest first."
+      " Read repeatedly until empty.",
+      NVMEPCIEKeyTraceSet,
+      "Discard pending command trace events.",
+   },
+   {
+      "bringup",
+      VMK_MGMT_KEY_TYPE_STRING,
+      NVMEPCIEKeyBringupGet,
+      "Display phase timing (us) of controller attach and recent resets,"
+      " newest first, and create latency (us) of each IO queue.",
+      NVMEPCIEKeyBringupSet,
+      "Reset history of controller resets.",
+   },
+#if NVME_PCIE_LOCK_STATS
+   {
+      "lockStats",
+      VMK_MGMT_KEY_TYPE_STRING,
+      NVMEPCIEKeyLockStatsGet,
+      "Display acquisitions, contended acquisitions, spin time (ns) and max"
+      " hold time (ns) of sq, cq and command list locks per queue.",
+      NVMEPCIEKeyLockStatsSet,
+      "Reset lock contention profiles.",
+   },
+#endif
+#ifdef NVME_STATS
+   {
+      "latHist",
+      VMK_MGMT_KEY_TYPE_STRING,
+      NVMEPCIEKeyLatHistGet,
+      "Display device latency percentiles (ns) by opcode and size class,"
+      " merged over IO queues. Valid if statistics enabled.",
+      NVMEPCIEKeyLatHistSet,
+      "Reset device latency histograms.",
+   },
+   {
+      "outlierThr",
+      VMK_MGMT_KEY_TYPE_LONG,
+      NVMEPCIEKeyOutlierThrGet,
+      "Display device latency threshold (us) to capture an IO command as"
+      " outlier.",
+      NVMEPCIEKeyOutlierThrSet,
+      "Set outlierThr, valid range [0, 10000000], 0 to disable outlier"
+      " capture",
+   },
+   {
+      "outliers",
+      VMK_MGMT_KEY_TYPE_STRING,
+      NVMEPCIEKeyOutliersGet,
+      "Display recent outlier IO commands with SQE and CQE, newest first."
+      " Valid if statistics enabled.",
+      NVMEPCIEKeyOutliersSet,
+      "Reset outlier records.",
+   },
+   {
+      "phaseStamp",
+      VMK_MGMT_KEY_TYPE_LONG,
+      NVMEPCIEKeyPhaseStampGet,
+      "Display whether host side phases of IO commands are stamped.",
+      NVMEPCIEKeyPhaseStampSet,
+      "Set phaseStamp, 1 to stamp phases of IO commands if statistics"
+      " enabled, 0 to stop",
+   },
+   {
+      "phaseHist",
+      VMK_MGMT_KEY_TYPE_STRING,
+      NVMEPCIEKeyPhaseHistGet,
+      "Display IO command phase percentiles (ns): sq lock wait, submit,"
+      " device and completion dispatch, merged over IO queues and per"
+      " queue. Valid if phaseStamp set.",
+      NVMEPCIEKeyPhaseHistSet,
+      "Reset IO command phase histograms.",
+   },
+   {
+      "cpuStats",
+      VMK_MGMT_KEY_TYPE_STRING,
+      NVMEPCIEKeyCpuStatsGet,
+      "Display per IO queue submissions, share of submissions by PCPU and"
+      " share of completions processed on a PCPU other than the submitter."
+      " Valid if statistics enabled.",
+      NVMEPCIEKeyCpuStatsSet,
+      "Reset submitter PCPU statistics.",
+   },
+   {
+      "statsSampleRate",
+      VMK_MGMT_KEY_TYPE_LONG,
+      NVMEPCIEKeyStatsSampleRateGet,
+      "Display statistics sampling rate, 1 in statsSampleRate commands is"
+      " time stamped and counted with weight statsSampleRate.",
+      NVMEPCIEKeyStatsSampleRateSet,
+      "Set statsSampleRate, valid range [1, 1024], rounded down to a power"
+      " of 2",
+   },
+#endif
+   // Should be always at the end
+   {
+      "help",
+      VMK_MGMT_KEY_TYPE_STRING,
+      NVMEPCIEKeyHelpGet,
+      "Display the help page.",
+      NVMEPCIEKeyHelpSet,
+      NULL,
+   }
+};
+
+// Global keys
+static NVMEPCIEKVMgmtData nvmePCIEGlobalKVMgmtData[] = {
+   {
+      "logLevel",
+      VMK_MGMT_KEY_TYPE_LONG,
+      NVMEPCIEKeyLogLevelGet,
+      "Display driver log level.",
+      NVMEPCIEKeyLogLevelSet,
+      "Set driver log level.\n"
+      "\t\t\t1: Error\n"
+      "\t\t\t2: Warning\n"
+      "\t\t\t3: Info\n"
+      "\t\t\t4: Verbose\n"
+      "\t\t\t5: Debug",
+   },
+   {
+      "debugMask",
+      VMK_MGMT_KEY_TYPE_STRING,
+      NVMEPCIEKeyDebugMaskGet,
+      "Display driver debug level.",
+      NVMEPCIEKeyDebugMaskSet,
+      "Set driver debug level. Hexadecimal(started with \"0x\" or \"0X\") and decimal are both accepted.\n"
+      "\t\t\tBIT_0: Print ctrlr level log.\n"
+      "\t\t\tBIT_2: Print queue level log.\n"
+      "\t\t\tBIT_3: Print command level log.\n"
+      "\t\t\tBIT_18: Dump submission queue entry.\n"
+      "\t\t\tBIT_19: Dump completion queue entry.",
+   },
+   // Should be always at the end
+   {
+      "help",
+      VMK_MGMT_KEY_TYPE_STRING,
+      NVMEPCIEGlobalKeyHelpGet,
+      "Display the help page.",
+      NVMEPCIEGlobalKeyHelpSet,
+      NULL,
+   }
+};
+
+
+#if NVME_PCIE_STORAGE_POLL
+static VMK_ReturnStatus
+NVMEPCIEKeyPollActGet(vmk_uint64 cookie, void *keyVal)
+{
+   vmk_uint64 *kv = (vmk_uint64 *) keyVal;
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+
+   *kv = vmk_AtomicRead8(&ctrlr->pollAct);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollActSet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   vmk_Bool pollAct = vmk_AtomicRead8(&ctrlr->pollAct);
+   vmk_Bool val = (vmk_Strtoul((char *) keyVal, NULL, 10) != 0);
+
+   if (pollAct != val) {
+      if (val == VMK_FALSE) {
+         vmk_AtomicWrite8(&ctrlr->pollAct, VMK_FALSE);
+
+         IPRINT(ctrlr, "pollAct is set as 0.");
+      } else {
+         if (nvmePCIEMsiEnbaled) {
+            IPRINT(ctrlr, "To activate polling, interrupt type should"
+                          " be MSIX.");
+         } else {
+            vmk_AtomicWrite8(&ctrlr->pollAct, VMK_TRUE);
+            IPRINT(ctrlr, "pollAct is set as 1.");
+         }
+      }
+   }
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollOIOThrGet(vmk_uint64 cookie, void *keyVal)
+{
+   vmk_uint64 *kv = (vmk_uint64 *) keyVal;
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+
+   *kv = vmk_AtomicRead32(&ctrlr->pollOIOThr);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollOIOThrSet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   vmk_uint32 pollOIOThr = vmk_Strtoul((char *) keyVal, NULL, 10);
+
+   vmk_AtomicWrite32(&ctrlr->pollOIOThr, pollOIOThr);
+
+   IPRINT(ctrlr, "pollOIOThr is set as %d.", pollOIOThr);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollOIOExitThrGet(vmk_uint64 cookie, void *keyVal)
+{
+   vmk_uint64 *kv = (vmk_uint64 *) keyVal;
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+
+   *kv = vmk_AtomicRead32(&ctrlr->pollOIOExitThr);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollOIOExitThrSet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   vmk_uint32 pollOIOExitThr = vmk_Strtoul((char *) keyVal, NULL, 10);
+
+   if (pollOIOExitThr > vmk_AtomicRead32(&ctrlr->pollOIOThr)) {
+      IPRINT(ctrlr, "pollOIOExitThr %d exceeds pollOIOThr.", pollOIOExitThr);
+      return VMK_BAD_PARAM;
+   }
+   vmk_AtomicWrite32(&ctrlr->pollOIOExitThr, pollOIOExitThr);
+
+   IPRINT(ctrlr, "pollOIOExitThr is set as %d.", pollOIOExitThr);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollDwellGet(vmk_uint64 cookie, void *keyVal)
+{
+   vmk_uint64 *kv = (vmk_uint64 *) keyVal;
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+
+   *kv = vmk_AtomicRead64(&ctrlr->pollDwell);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollDwellSet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   vmk_uint64 pollDwell = vmk_Strtoul((char *) keyVal, NULL, 10);
+
+   vmk_AtomicWrite64(&ctrlr->pollDwell, pollDwell);
+
+   IPRINT(ctrlr, "pollDwell is set as %lu.", pollDwell);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollAutoTuneGet(vmk_uint64 cookie, void *keyVal)
+{
+   vmk_uint64 *kv = (vmk_uint64 *) keyVal;
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+
+   *kv = vmk_AtomicRead8(&ctrlr->pollAutoTune);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollAutoTuneSet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   vmk_Bool pollAutoTune = VMK_TRUE;
+
+   if ((vmk_Strtoul((char *) keyVal, NULL, 10)) == 0) {
+      pollAutoTune = VMK_FALSE;
+   }
+
+   if (pollAutoTune && !vmk_AtomicRead8(&ctrlr->pollAutoTune)) {
+      NVMEPCIEPollTuneReset(ctrlr);
+   }
+   vmk_AtomicWrite8(&ctrlr->pollAutoTune, pollAutoTune);
+
+   IPRINT(ctrlr, "pollAutoTune is set as %d.", pollAutoTune);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollTuneGet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   NVMEPCIEQueueInfo *qinfo;
+   NVMEPCIEQueueRef *ref;
+   NVMEPCIEPollTuner *tuner;
+   VMK_ReturnStatus status;
+   vmk_uint8 *buf = NULL;
+   vmk_ByteCount len = 0;
+   vmk_ByteCount out_len = 0;
+   vmk_uint32 i;
+
+   buf = NVMEPCIEAlloc(NVMEPCIE_KVMGMT_BUF_SIZE, 0);
+   if (buf == NULL) {
+      IPRINT(ctrlr, "Failed to allocate buffer.");
+      return VMK_NO_MEMORY;
+   }
+
+   status = vmk_StringFormat(buf, NVMEPCIE_KVMGMT_BUF_SIZE, &out_len,
+                             "\nqid\tthr\tobjUs\tcpuNs\tbestThr\tbestObjUs"
+                             "\tepochs\n");
+   if (status != VMK_OK) {
+      goto out_poll_tune_get;
+   }
+   len += out_len;
+
+   for (i = 1; i <= ctrlr->numIoQueues; i++) {
+      qinfo = &ctrlr->queueList[i];
+      ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_SUSPENDED);
+      if (ref == NULL) {
+         continue;
+      }
+      tuner = &qinfo->pollTuner;
+      status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                &out_len, "%u\t%u\t%lu\t%lu\t%u\t%lu\t%lu\n",
+                                qinfo->id, vmk_AtomicRead32(&tuner->thr),
+                                tuner->lastObj, tuner->lastCpuNs,
+                                tuner->bestThr, tuner->bestObj,
+                                tuner->epochs);
+      NVMEPCIEQueueRefPut(ref);
+      if (status != VMK_OK) {
+         break;
+      }
+      len += out_len;
+   }
+
+out_poll_tune_get:
+   vmk_StringCopy(keyVal, buf, len + 1);
+   NVMEPCIEFree(buf);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollTuneSet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+
+   NVMEPCIEPollTuneReset(ctrlr);
+
+   IPRINT(ctrlr, "OIO threshold auto tune is restarted.");
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyIopsWindowGet(vmk_uint64 cookie, void *keyVal)
+{
+   vmk_uint64 *kv = (vmk_uint64 *) keyVal;
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+
+   *kv = vmk_AtomicRead64(&ctrlr->iopsWindow);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyIopsWindowSet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   vmk_uint64 iopsWindow = vmk_Strtoul((char *) keyVal, NULL, 10);
+
+   if (iopsWindow < NVME_PCIE_IOPS_WINDOW_MIN ||
+       iopsWindow > NVME_PCIE_IOPS_WINDOW_MAX) {
+      IPRINT(ctrlr, "Invalid iopsWindow %lu.", iopsWindow);
+      return VMK_BAD_PARAM;
+   }
+   vmk_AtomicWrite64(&ctrlr->iopsWindow, iopsWindow);
+
+   IPRINT(ctrlr, "iopsWindow is set as %lu.", iopsWindow);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollModeGet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   NVMEPCIEQueueInfo *qinfo;
+   NVMEPCIEQueueRef *ref;
+   VMK_ReturnStatus status;
+   vmk_uint8 *buf = NULL;
+   vmk_ByteCount len = 0;
+   vmk_ByteCount out_len = 0;
+   vmk_uint64 now = NVMEPCIEGetTimerUs();
+   vmk_uint32 i;
+
+   buf = NVMEPCIEAlloc(NVMEPCIE_KVMGMT_BUF_SIZE, 0);
+   if (buf == NULL) {
+      IPRINT(ctrlr, "Failed to allocate buffer.");
+      return VMK_NO_MEMORY;
+   }
+
+   status = vmk_StringFormat(buf, NVMEPCIE_KVMGMT_BUF_SIZE, &out_len,
+                             "\nqid\tmode\tdwellUs\tiops\tenters\texits"
+                             "\tentersDeferred\texitsDeferred\n");
+   if (status != VMK_OK) {
+      goto out_poll_mode_get;
+   }
+   len += out_len;
+
+   for (i = 1; i <= ctrlr->numIoQueues; i++) {
+      qinfo = &ctrlr->queueList[i];
+      ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_SUSPENDED);
+      if (ref == NULL) {
+         continue;
+      }
+      status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                &out_len,
+                                "%u\t%s\t%lu\t%u\t%lu\t%lu\t%lu\t%lu\n",
+                                qinfo->id,
+                                vmk_AtomicRead32(&qinfo->pollMode) ==
+                                NVME_PCIE_POLL_MODE_POLL ? "poll" : "intr",
+                                now - qinfo->pollModeTs,
+                                NVMEPCIEIopsEstimate(qinfo),
+                                vmk_AtomicRead64(&qinfo->pollEnters),
+                                vmk_AtomicRead64(&qinfo->pollExits),
+                                vmk_AtomicRead64(&qinfo->pollEntersDeferred),
+                                vmk_AtomicRead64(&qinfo->pollExitsDeferred));
+      NVMEPCIEQueueRefPut(ref);
+      if (status != VMK_OK) {
+         break;
+      }
+      len += out_len;
+   }
+
+out_poll_mode_get:
+   vmk_StringCopy(keyVal, buf, len + 1);
+   NVMEPCIEFree(buf);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollModeSet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   NVMEPCIEQueueInfo *qinfo;
+   NVMEPCIEQueueRef *ref;
+   vmk_uint32 i;
+
+   for (i = 1; i <= ctrlr->numIoQueues; i++) {
+      qinfo = &ctrlr->queueList[i];
+      ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_SUSPENDED);
+      if (ref == NULL) {
+         continue;
+      }
+      vmk_AtomicWrite64(&qinfo->pollEnters, 0);
+      vmk_AtomicWrite64(&qinfo->pollExits, 0);
+      vmk_AtomicWrite64(&qinfo->pollEntersDeferred, 0);
+      vmk_AtomicWrite64(&qinfo->pollExitsDeferred, 0);
+      NVMEPCIEQueueRefPut(ref);
+   }
+
+   IPRINT(ctrlr, "Poll mode transition counters are reset.");
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollIntervalGet(vmk_uint64 cookie, void *keyVal)
+{
+   vmk_uint64 *kv = (vmk_uint64 *) keyVal;
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+
+   *kv = vmk_AtomicRead64(&ctrlr->pollInterval);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollIntervalSet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   vmk_uint64 pollInterval = vmk_Strtoul((char *) keyVal, NULL, 10);
+
+   vmk_AtomicWrite64(&ctrlr->pollInterval, pollInterval);
+
+   IPRINT(ctrlr, "pollInterval is set as %lu.", pollInterval);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollLatModelGet(vmk_uint64 cookie, void *keyVal)
+{
+   vmk_uint64 *kv = (vmk_uint64 *) keyVal;
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+
+   *kv = vmk_AtomicRead8(&ctrlr->pollLatModel);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollLatModelSet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   vmk_Bool pollLatModel = VMK_TRUE;
+
+   if ((vmk_Strtoul((char *) keyVal, NULL, 10)) == 0) {
+      pollLatModel = VMK_FALSE;
+   }
+
+   vmk_AtomicWrite8(&ctrlr->pollLatModel, pollLatModel);
+   NVMEPCIESelectHotPath(ctrlr);
+
+   IPRINT(ctrlr, "pollLatModel is set as %d.", pollLatModel);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollSleepPctGet(vmk_uint64 cookie, void *keyVal)
+{
+   vmk_uint64 *kv = (vmk_uint64 *) keyVal;
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+
+   *kv = vmk_AtomicRead32(&ctrlr->pollSleepPct);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollSleepPctSet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   vmk_uint32 pollSleepPct = vmk_Strtoul((char *) keyVal, NULL, 10);
+
+   if (pollSleepPct > 100) {
+      IPRINT(ctrlr, "Invalid pollSleepPct %d.", pollSleepPct);
+      return VMK_BAD_PARAM;
+   }
+   vmk_AtomicWrite32(&ctrlr->pollSleepPct, pollSleepPct);
+
+   IPRINT(ctrlr, "pollSleepPct is set as %d.", pollSleepPct);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollLatencyGet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   NVMEPCIEQueueInfo *qinfo;
+   NVMEPCIEQueueRef *ref;
+   NVMEPCIELatModel *model;
+   VMK_ReturnStatus status;
+   vmk_uint8 *buf = NULL;
+   vmk_ByteCount len = 0;
+   vmk_ByteCount out_len = 0;
+   vmk_uint32 i, c;
+   static const char *className[NVME_PCIE_LAT_CLASS_NUM] = {
+      "readSmall", "readLarge", "writeSmall", "writeLarge",
+      "otherSmall", "otherLarge",
+   };
+
+   buf = NVMEPCIEAlloc(NVMEPCIE_KVMGMT_BUF_SIZE, 0);
+   if (buf == NULL) {
+      IPRINT(ctrlr, "Failed to allocate buffer.");
+      return VMK_NO_MEMORY;
+   }
+
+   status = vmk_StringFormat(buf, NVMEPCIE_KVMGMT_BUF_SIZE, &out_len,
+                             "\nqid\tclass\t\tewmaUs\tsamples\n");
+   if (status != VMK_OK) {
+      goto out_poll_latency_get;
+   }
+   len += out_len;
+
+   for (i = 1; i <= ctrlr->numIoQueues; i++) {
+      qinfo = &ctrlr->queueList[i];
+      ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_SUSPENDED);
+      if (ref == NULL) {
+         continue;
+      }
+      model = &qinfo->latModel;
+      for (c = 0; c < NVME_PCIE_LAT_CLASS_NUM; c++) {
+         if (model->samples[c] == 0) {
+            continue;
+         }
+         status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                   &out_len, "%u\t%s\t%lu\t%lu\n",
+                                   qinfo->id, className[c],
+                                   vmk_TimerUnsignedTCToUS(model->ewma[c]),
+                                   model->samples[c]);
+         if (status != VMK_OK) {
+            break;
+         }
+         len += out_len;
+      }
+      NVMEPCIEQueueRefPut(ref);
+      if (status != VMK_OK) {
+         break;
+      }
+   }
+
+out_poll_latency_get:
+   vmk_StringCopy(keyVal, buf, len + 1);
+   NVMEPCIEFree(buf);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollLatencySet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   NVMEPCIEQueueInfo *qinfo;
+   NVMEPCIEQueueRef *ref;
+   vmk_uint32 i;
+
+   for (i = 1; i <= ctrlr->numIoQueues; i++) {
+      qinfo = &ctrlr->queueList[i];
+      ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_SUSPENDED);
+      if (ref == NULL) {
+         continue;
+      }
+      NVME_PCIE_QUEUE_LOCK(qinfo->cqInfo);
+      vmk_Memset(&qinfo->latModel, 0, sizeof(qinfo->latModel));
+      NVME_PCIE_QUEUE_UNLOCK(qinfo->cqInfo);
+      NVMEPCIEQueueRefPut(ref);
+   }
+
+   IPRINT(ctrlr, "Hybrid poll latency model is reset.");
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollBusyGet(vmk_uint64 cookie, void *keyVal)
+{
+   vmk_uint64 *kv = (vmk_uint64 *) keyVal;
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+
+   *kv = vmk_AtomicRead8(&ctrlr->pollBusy);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollBusySet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   vmk_Bool pollBusy = VMK_TRUE;
+
+   if ((vmk_Strtoul((char *) keyVal, NULL, 10)) == 0) {
+      pollBusy = VMK_FALSE;
+   }
+
+   vmk_AtomicWrite8(&ctrlr->pollBusy, pollBusy);
+
+   IPRINT(ctrlr, "pollBusy is set as %d.", pollBusy);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollSpinBudgetGet(vmk_uint64 cookie, void *keyVal)
+{
+   vmk_uint64 *kv = (vmk_uint64 *) keyVal;
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+
+   *kv = vmk_AtomicRead32(&ctrlr->pollSpinBudget);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollSpinBudgetSet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   vmk_uint32 pollSpinBudget = vmk_Strtoul((char *) keyVal, NULL, 10);
+
+   if (pollSpinBudget == 0 ||
+       pollSpinBudget > NVME_PCIE_POLL_SPIN_BUDGET_MAX) {
+      IPRINT(ctrlr, "Invalid pollSpinBudget %d.", pollSpinBudget);
+      return VMK_BAD_PARAM;
+   }
+   vmk_AtomicWrite32(&ctrlr->pollSpinBudget, pollSpinBudget);
+
+   IPRINT(ctrlr, "pollSpinBudget is set as %d.", pollSpinBudget);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollCpuBudgetGet(vmk_uint64 cookie, void *keyVal)
+{
+   vmk_uint64 *kv = (vmk_uint64 *) keyVal;
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+
+   *kv = vmk_AtomicRead32(&ctrlr->pollCpuBudget);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollCpuBudgetSet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   vmk_uint32 pollCpuBudget = vmk_Strtoul((char *) keyVal, NULL, 10);
+
+   if (pollCpuBudget > NVME_PCIE_POLL_CPU_BUDGET_MAX) {
+      IPRINT(ctrlr, "Invalid pollCpuBudget %d.", pollCpuBudget);
+      return VMK_BAD_PARAM;
+   }
+   vmk_AtomicWrite32(&ctrlr->pollCpuBudget, pollCpuBudget);
+
+   IPRINT(ctrlr, "pollCpuBudget is set as %d.", pollCpuBudget);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollGovernorGet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   NVMEPCIEPollGovernor *gov = &ctrlr->pollGov;
+   NVMEPCIEQueueInfo *qinfo;
+   NVMEPCIEQueueRef *ref;
+   VMK_ReturnStatus status;
+   vmk_uint8 *buf = NULL;
+   vmk_ByteCount len = 0;
+   vmk_ByteCount out_len = 0;
+   vmk_uint32 i;
+
+   buf = NVMEPCIEAlloc(NVMEPCIE_KVMGMT_BUF_SIZE, 0);
+   if (buf == NULL) {
+      IPRINT(ctrlr, "Failed to allocate buffer.");
+      return VMK_NO_MEMORY;
+   }
+
+   status = vmk_StringFormat(buf, NVMEPCIE_KVMGMT_BUF_SIZE, &out_len,
+                             "\nbudgetPct: %u\ncpuPct: %u\nticks: %lu\n"
+                             "overBudget: %lu\ndemotions: %lu\n"
+                             "releases: %lu\n"
+                             "\nqid\tcpuPct\tnsPerCompl\tdemoted\n",
+                             vmk_AtomicRead32(&ctrlr->pollCpuBudget),
+                             gov->cpuPct, gov->ticks, gov->overBudget,
+                             gov->demotions, gov->releases);
+   if (status != VMK_OK) {
+      goto out_poll_governor_get;
+   }
+   len += out_len;
+
+   for (i = 1; i <= ctrlr->numIoQueues; i++) {
+      qinfo = &ctrlr->queueList[i];
+      ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_SUSPENDED);
+      if (ref == NULL) {
+         continue;
+      }
+      status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                &out_len, "%u\t%u\t%lu\t\t%u\n",
+                                qinfo->id, qinfo->govCpuPct,
+                                qinfo->govNsPerCompl,
+                                vmk_AtomicRead8(&qinfo->govDemoted));
+      NVMEPCIEQueueRefPut(ref);
+      if (status != VMK_OK) {
+         break;
+      }
+      len += out_len;
+   }
+
+out_poll_governor_get:
+   vmk_StringCopy(keyVal, buf, len + 1);
+   NVMEPCIEFree(buf);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollGovernorSet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   NVMEPCIEPollGovernor *gov = &ctrlr->pollGov;
+   vmk_uint32 i;
+
+   gov->overBudget = 0;
+   gov->demotions = 0;
+   gov->releases = 0;
+   for (i = 1; i <= NVME_PCIE_MAX_IO_QUEUES; i++) {
+      vmk_AtomicWrite8(&ctrlr->queueList[i].govDemoted, VMK_FALSE);
+   }
+
+   IPRINT(ctrlr, "Poll governor is reset.");
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollGroupsGet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   NVMEPCIEPollGroup *group;
+   VMK_ReturnStatus status;
+   vmk_uint8 *buf = NULL;
+   vmk_ByteCount len = 0;
+   vmk_ByteCount out_len = 0;
+   vmk_uint32 i, qid;
+
+   buf = NVMEPCIEAlloc(NVMEPCIE_KVMGMT_BUF_SIZE, 0);
+   if (buf == NULL) {
+      IPRINT(ctrlr, "Failed to allocate buffer.");
+      return VMK_NO_MEMORY;
+   }
+
+   status = vmk_StringFormat(buf, NVMEPCIE_KVMGMT_BUF_SIZE, &out_len,
+                             "\ngroups: %u\n"
+                             "\ngroup\trounds\tpeeks\thits\tqueues\n",
+                             ctrlr->numPollGroups);
+   if (status != VMK_OK) {
+      goto out_poll_groups_get;
+   }
+   len += out_len;
+
+   for (i = 0; i < ctrlr->numPollGroups; i++) {
+      group = &ctrlr->pollGroups[i];
+      if (group->handler == NULL) {
+         continue;
+      }
+      status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                &out_len, "%u\t%lu\t%lu\t%lu\t",
+                                group->id,
+                                vmk_AtomicRead64(&group->rounds),
+                                vmk_AtomicRead64(&group->peeks),
+                                vmk_AtomicRead64(&group->hits));
+      for (qid = 1; status == VMK_OK && qid <= ctrlr->numIoQueues; qid++) {
+         if (ctrlr->queueList[qid].pollGroup != group) {
+            continue;
+         }
+         len += out_len;
+         status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                   &out_len, " %u", qid);
+      }
+      if (status != VMK_OK) {
+         break;
+      }
+      len += out_len;
+      status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                &out_len, "\n");
+      if (status != VMK_OK) {
+         break;
+      }
+      len += out_len;
+   }
+
+out_poll_groups_get:
+   vmk_StringCopy(keyVal, buf, len + 1);
+   NVMEPCIEFree(buf);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollGroupsSet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   NVMEPCIEPollGroup *group;
+   vmk_uint32 i;
+
+   for (i = 0; i < NVME_PCIE_POLL_GROUP_MAX; i++) {
+      group = &ctrlr->pollGroups[i];
+      vmk_AtomicWrite64(&group->rounds, 0);
+      vmk_AtomicWrite64(&group->peeks, 0);
+      vmk_AtomicWrite64(&group->hits, 0);
+   }
+
+   IPRINT(ctrlr, "Poll group counters are reset.");
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyBusyPollGet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   NVMEPCIEQueueInfo *qinfo;
+   NVMEPCIEQueueRef *ref;
+   VMK_ReturnStatus status;
+   vmk_uint8 *buf = NULL;
+   vmk_ByteCount len = 0;
+   vmk_ByteCount out_len = 0;
+   vmk_uint64 spinUs, compl;
+   vmk_uint32 i;
+
+   buf = NVMEPCIEAlloc(NVMEPCIE_KVMGMT_BUF_SIZE, 0);
+   if (buf == NULL) {
+      IPRINT(ctrlr, "Failed to allocate buffer.");
+      return VMK_NO_MEMORY;
+   }
+
+   status = vmk_StringFormat(buf, NVMEPCIE_KVMGMT_BUF_SIZE, &out_len,
+                             "\nqid\trounds\texpired\tspinUs\tcompl"
+                             "\tspinNsPerCompl\n");
+   if (status != VMK_OK) {
+      goto out_busy_poll_get;
+   }
+   len += out_len;
+
+   for (i = 1; i <= ctrlr->numIoQueues; i++) {
+      qinfo = &ctrlr->queueList[i];
+      ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_SUSPENDED);
+      if (ref == NULL) {
+         continue;
+      }
+      spinUs = vmk_TimerUnsignedTCToUS(
+                  vmk_AtomicRead64(&qinfo->busySpinCycles));
+      compl = vmk_AtomicRead64(&qinfo->busyCompl);
+      status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                &out_len, "%u\t%lu\t%lu\t%lu\t%lu\t%lu\n",
+                                qinfo->id,
+                                vmk_AtomicRead64(&qinfo->busyRounds),
+                                vmk_AtomicRead64(&qinfo->busyExpired),
+                                spinUs, compl,
+                                compl ? spinUs * 1000 / compl : 0);
+      NVMEPCIEQueueRefPut(ref);
+      if (status != VMK_OK) {
+         break;
+      }
+      len += out_len;
+   }
+
+out_busy_poll_get:
+   vmk_StringCopy(keyVal, buf, len + 1);
+   NVMEPCIEFree(buf);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyBusyPollSet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   NVMEPCIEQueueInfo *qinfo;
+   NVMEPCIEQueueRef *ref;
+   vmk_uint32 i;
+
+   for (i = 1; i <= ctrlr->numIoQueues; i++) {
+      qinfo = &ctrlr->queueList[i];
+      ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_SUSPENDED);
+      if (ref == NULL) {
+         continue;
+      }
+      vmk_AtomicWrite64(&qinfo->busyRounds, 0);
+      vmk_AtomicWrite64(&qinfo->busyExpired, 0);
+      vmk_AtomicWrite64(&qinfo->busySpinCycles, 0);
+      vmk_AtomicWrite64(&qinfo->busyCompl, 0);
+      NVMEPCIEQueueRefPut(ref);
+   }
+
+   IPRINT(ctrlr, "Busy poll counters are reset.");
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyCalibrateGet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   NVMEPCIECalibResult *result = &ctrlr->pollCalib;
+   VMK_ReturnStatus status;
+   vmk_uint8 *buf = NULL;
+   vmk_ByteCount len = 0;
+   vmk_ByteCount out_len = 0;
+   vmk_uint32 i;
+
+   buf = NVMEPCIEAlloc(NVMEPCIE_KVMGMT_BUF_SIZE, 0);
+   if (buf == NULL) {
+      IPRINT(ctrlr, "Failed to allocate buffer.");
+      return VMK_NO_MEMORY;
+   }
+
+   if (result->nsid == 0) {
+      status = vmk_StringFormat(buf, NVMEPCIE_KVMGMT_BUF_SIZE, &out_len,
+                                "\nNo calibration run.\n");
+      if (status == VMK_OK) {
+         len += out_len;
+      }
+      goto out_calibrate_get;
+   }
+
+   status = vmk_StringFormat(buf, NVMEPCIE_KVMGMT_BUF_SIZE, &out_len,
+                             "\nnsid %u qid %u status %s applied %u"
+                             "\nbytes\tminNs\tmeanNs\tp99Ns\n",
+                             result->nsid, result->qid,
+                             vmk_StatusToString(result->status),
+                             result->applied);
+   if (status != VMK_OK) {
+      goto out_calibrate_get;
+   }
+   len += out_len;
+
+   for (i = 0; i < result->numSizes; i++) {
+      status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                &out_len, "%u\t%lu\t%lu\t%lu\n",
+                                result->bytes[i], result->minNs[i],
+                                result->meanNs[i], result->p99Ns[i]);
+      if (status != VMK_OK) {
+         goto out_calibrate_get;
+      }
+      len += out_len;
+   }
+
+   if (result->status == VMK_OK) {
+      status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                &out_len, "pollInterval %lu\npollOIOThr %u"
+                                " (extrapolated from QD1)\npollOIOExitThr %u"
+                                "\nsmallIoBytes %u%s\n",
+                                result->pollInterval, result->pollOIOThr,
+                                result->pollOIOExitThr, result->smallIoBytes,
+                                result->smallIoDerived ? "" :
+                                " (not derived, current value)");
+      if (status == VMK_OK) {
+         len += out_len;
+      }
+   }
+
+out_calibrate_get:
+   vmk_StringCopy(keyVal, buf, len + 1);
+   NVMEPCIEFree(buf);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyCalibrateSet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   VMK_ReturnStatus status;
+   char *end = NULL;
+   vmk_uint32 nsid;
+   vmk_Bool apply = VMK_FALSE;
+
+   nsid = vmk_Strtoul((char *) keyVal, &end, 10);
+   if (nsid == 0 || end == (char *) keyVal) {
+      EPRINT(ctrlr, "Invalid calibration namespace, format '<nsid> [apply]'.");
+      return VMK_BAD_PARAM;
+   }
+   while (*end == ' ') {
+      end++;
+   }
+   if (vmk_Strncmp(end, "apply", 5) == 0) {
+      apply = VMK_TRUE;
+   } else if (*end != '\0') {
+      EPRINT(ctrlr, "Invalid calibration option %s.", end);
+      return VMK_BAD_PARAM;
+   }
+
+   status = NVMEPCIEPollCalibrate(ctrlr, nsid, apply);
+   if (status != VMK_OK) {
+      EPRINT(ctrlr, "Calibration of namespace %u failed, %s.", nsid,
+             vmk_StatusToString(status));
+      return status;
+   }
+
+   IPRINT(ctrlr, "Calibration of namespace %u is done%s.", nsid,
+          apply ? ", parameters applied" : "");
+
+   return VMK_OK;
+}
+#endif
+
+
+#if NVME_PCIE_BLOCKSIZE_AWARE
+static VMK_ReturnStatus
+NVMEPCIEKeyBlkSizeAwarePollActGet(vmk_uint64 cookie, void *keyVal)
+{
+   vmk_uint64 *kv = (vmk_uint64 *) keyVal;
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+
+   *kv = vmk_AtomicRead8(&ctrlr->blkSizeAwarePollAct);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyBlkSizeAwarePollActSet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   vmk_Bool blkSizeAwarePollAct = VMK_TRUE;
+
+   if ((vmk_Strtoul((char *) keyVal, NULL, 10)) == 0) {
+      blkSizeAwarePollAct = VMK_FALSE;
+   }
+
+   vmk_AtomicWrite8(&ctrlr->blkSizeAwarePollAct, blkSizeAwarePollAct);
+   NVMEPCIESelectHotPath(ctrlr);
+
+   IPRINT(ctrlr, "blkSizeAwarePollAct is set as %d.", blkSizeAwarePollAct);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollCostModelGet(vmk_uint64 cookie, void *keyVal)
+{
+   vmk_uint64 *kv = (vmk_uint64 *) keyVal;
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+
+   *kv = vmk_AtomicRead8(&ctrlr->pollCostModel);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollCostModelSet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   vmk_Bool pollCostModel = VMK_TRUE;
+
+   if ((vmk_Strtoul((char *) keyVal, NULL, 10)) == 0) {
+      pollCostModel = VMK_FALSE;
+   }
+
+   vmk_AtomicWrite8(&ctrlr->pollCostModel, pollCostModel);
+   NVMEPCIESelectHotPath(ctrlr);
+
+   IPRINT(ctrlr, "pollCostModel is set as %d.", pollCostModel);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollIntrCostGet(vmk_uint64 cookie, void *keyVal)
+{
+   vmk_uint64 *kv = (vmk_uint64 *) keyVal;
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+
+   *kv = vmk_AtomicRead32(&ctrlr->pollIntrCost);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollIntrCostSet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   vmk_uint32 pollIntrCost;
+
+   pollIntrCost = vmk_Strtoul((char *) keyVal, NULL, 10);
+   if (pollIntrCost > NVME_PCIE_POLL_INTR_COST_MAX) {
+      EPRINT(ctrlr, "Invalid pollIntrCost %u.", pollIntrCost);
+      return VMK_BAD_PARAM;
+   }
+
+   vmk_AtomicWrite32(&ctrlr->pollIntrCost, pollIntrCost);
+
+   IPRINT(ctrlr, "pollIntrCost is set as %u.", pollIntrCost);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollModelGet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   NVMEPCIEQueueInfo *qinfo;
+   NVMEPCIEQueueRef *ref;
+   VMK_ReturnStatus status;
+   vmk_uint8 *buf = NULL;
+   vmk_ByteCount len = 0;
+   vmk_ByteCount out_len = 0;
+   vmk_uint64 gap, intrCostNs;
+   vmk_uint32 i, numAct, count;
+   int opc, size;
+   static const char *opcName[NVME_PCIE_LAT_OPC_NUM] = {
+      "read", "write", "other",
+   };
+
+   buf = NVMEPCIEAlloc(NVMEPCIE_KVMGMT_BUF_SIZE, 0);
+   if (buf == NULL) {
+      IPRINT(ctrlr, "Failed to allocate buffer.");
+      return VMK_NO_MEMORY;
+   }
+
+   intrCostNs = vmk_AtomicRead32(&ctrlr->pollIntrCost) * 1000ULL;
+   status = vmk_StringFormat(buf, NVMEPCIE_KVMGMT_BUF_SIZE, &out_len,
+                             "\nqid\tinflight\tgapNs\tintrNs\tpoll\n"
+                             "\topc\tmaxKB\tcount\n");
+   if (status != VMK_OK) {
+      goto out_poll_model_get;
+   }
+   len += out_len;
+
+   for (i = 1; i <= ctrlr->numIoQueues; i++) {
+      qinfo = &ctrlr->queueList[i];
+      ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_SUSPENDED);
+      if (ref == NULL) {
+         continue;
+      }
+      gap = NVMEPCIEPollCostGap(qinfo, &numAct);
+      status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                &out_len, "%u\t%u\t\t%lu\t%lu\t%s\n",
+                                qinfo->id, numAct, gap, intrCostNs,
+                                (numAct > 0 && gap <= intrCostNs) ?
+                                "yes" : "no");
+      for (opc = 0; status == VMK_OK && opc < NVME_PCIE_LAT_OPC_NUM; opc++) {
+         for (size = 0; size < NVME_PCIE_COST_SIZE_NUM; size++) {
+            count = vmk_AtomicRead32(&qinfo->inflightHist.count[opc][size]);
+            if (count == 0) {
+               continue;
+            }
+            len += out_len;
+            status = vmk_StringFormat(buf + len,
+                                      NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                      &out_len, "\t%s\t%u%s\t%u\n",
+                                      opcName[opc], 4 << size,
+                                      size == NVME_PCIE_COST_SIZE_NUM - 1 ?
+                                      "+" : "", count);
+            if (status != VMK_OK) {
+               break;
+            }
+         }
+      }
+      NVMEPCIEQueueRefPut(ref);
+      if (status != VMK_OK) {
+         break;
+      }
+      len += out_len;
+   }
+
+out_poll_model_get:
+   vmk_StringCopy(keyVal, buf, len + 1);
+   NVMEPCIEFree(buf);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyPollModelSet(vmk_uint64 cookie, void *keyVal)
+{
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeySmallIoBytesGet(vmk_uint64 cookie, void *keyVal)
+{
+   vmk_uint64 *kv = (vmk_uint64 *) keyVal;
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+
+   *kv = vmk_AtomicRead32(&ctrlr->smallIoBytes);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeySmallIoBytesSet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   vmk_uint32 smallIoBytes;
+
+   smallIoBytes = vmk_Strtoul((char *) keyVal, NULL, 10);
+   if (smallIoBytes == 0) {
+      EPRINT(ctrlr, "Invalid smallIoBytes %u.", smallIoBytes);
+      return VMK_BAD_PARAM;
+   }
+
+   vmk_AtomicWrite32(&ctrlr->smallIoBytes, smallIoBytes);
+
+   IPRINT(ctrlr, "smallIoBytes is set as %u.", smallIoBytes);
+
+   return VMK_OK;
+}
+#endif
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyLbaCacheGet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   VMK_ReturnStatus status;
+   vmk_uint8 *buf = NULL;
+   vmk_ByteCount len = 0;
+   vmk_ByteCount out_len = 0;
+   vmk_uint32 nsid;
+
+   buf = NVMEPCIEAlloc(NVMEPCIE_KVMGMT_BUF_SIZE, 0);
+   if (buf == NULL) {
+      IPRINT(ctrlr, "Failed to allocate buffer.");
+      return VMK_NO_MEMORY;
+   }
+
+   status = vmk_StringFormat(buf, NVMEPCIE_KVMGMT_BUF_SIZE, &out_len,
+                             "\nnsid\tlbaSize\n");
+   if (status != VMK_OK) {
+      goto out_lba_cache_get;
+   }
+   len += out_len;
+
+   for (nsid = 1; nsid <= NVME_PCIE_LBA_CACHE_NS; nsid++) {
+      if (ctrlr->lbaShift[nsid] == 0) {
+         continue;
+      }
+      status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                &out_len, "%u\t%u\n", nsid,
+                                1 << ctrlr->lbaShift[nsid]);
+      if (status != VMK_OK) {
+         break;
+      }
+      len += out_len;
+   }
+
+out_lba_cache_get:
+   vmk_StringCopy(keyVal, buf, len + 1);
+   NVMEPCIEFree(buf);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyLbaCacheSet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+
+   NVMEPCIELbaCacheRefresh(ctrlr);
+
+   IPRINT(ctrlr, "LBA data size cache is refreshed.");
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeySyncPoolGet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   NVMEPCIEQueueInfo *qinfo;
+   NVMEPCIEQueueRef *ref;
+   NVMEPCIESyncCmdPool *pool;
+   VMK_ReturnStatus status;
+   vmk_uint8 *buf = NULL;
+   vmk_ByteCount len = 0;
+   vmk_ByteCount out_len = 0;
+   vmk_uint32 i;
+
+   buf = NVMEPCIEAlloc(NVMEPCIE_KVMGMT_BUF_SIZE, 0);
+   if (buf == NULL) {
+      IPRINT(ctrlr, "Failed to allocate buffer.");
+      return VMK_NO_MEMORY;
+   }
+
+   status = vmk_StringFormat(buf, NVMEPCIE_KVMGMT_BUF_SIZE, &out_len,
+                             "\nqid\tsize\tfree\twaiters\tmaxWaiters"
+                             "\tallocs\twaits\ttimeouts\n");
+   if (status != VMK_OK) {
+      goto out_sync_pool_get;
+   }
+   len += out_len;
+
+   for (i = 0; i <= ctrlr->numIoQueues; i++) {
+      qinfo = &ctrlr->queueList[i];
+      ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_SUSPENDED);
+      if (ref == NULL) {
+         continue;
+      }
+      pool = &qinfo->cmdList->syncPool;
+      vmk_SpinlockLock(pool->lock);
+      status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                &out_len, "%u\t%u\t%u\t%u\t%u\t%lu\t%lu\t%lu\n",
+                                qinfo->id, pool->size, pool->numFree,
+                                pool->numWaiters, pool->maxWaiters,
+                                pool->allocs, pool->waits, pool->timeouts);
+      vmk_SpinlockUnlock(pool->lock);
+      NVMEPCIEQueueRefPut(ref);
+      if (status != VMK_OK) {
+         break;
+      }
+      len += out_len;
+   }
+
+out_sync_pool_get:
+   vmk_StringCopy(keyVal, buf, len + 1);
+   NVMEPCIEFree(buf);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeySyncPoolSet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   NVMEPCIEQueueInfo *qinfo;
+   NVMEPCIEQueueRef *ref;
+   NVMEPCIESyncCmdPool *pool;
+   vmk_uint32 i;
+
+   for (i = 0; i <= ctrlr->numIoQueues; i++) {
+      qinfo = &ctrlr->queueList[i];
+      ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_SUSPENDED);
+      if (ref == NULL) {
+         continue;
+      }
+      pool = &qinfo->cmdList->syncPool;
+      vmk_SpinlockLock(pool->lock);
+      pool->allocs = 0;
+      pool->waits = 0;
+      pool->timeouts = 0;
+      pool->maxWaiters = pool->numWaiters;
+      vmk_SpinlockUnlock(pool->lock);
+      NVMEPCIEQueueRefPut(ref);
+   }
+
+   IPRINT(ctrlr, "Sync command pool counters are reset.");
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyQueueStatsGet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   NVMEPCIEQueueInfo *qinfo;
+   NVMEPCIEQueueRef *ref;
+   NVMEPCIEQueueCounters *counters;
+   VMK_ReturnStatus status;
+   vmk_uint8 *buf = NULL;
+   vmk_ByteCount len = 0;
+   vmk_ByteCount out_len = 0;
+#if NVME_PCIE_STORAGE_POLL
+   vmk_uint64 now = NVMEPCIEGetTimerUs();
+   vmk_uint64 intrUs, pollUs, curUs;
+#endif
+   vmk_uint32 i, j;
+
+   buf = NVMEPCIEAlloc(NVMEPCIE_KVMGMT_BUF_SIZE, 0);
+   if (buf == NULL) {
+      IPRINT(ctrlr, "Failed to allocate buffer.");
+      return VMK_NO_MEMORY;
+   }
+
+   status = vmk_StringFormat(buf, NVMEPCIE_KVMGMT_BUF_SIZE, &out_len,
+                             "\nqid\tsubmits\tcompl\tsqFull\tcmdFull"
+                             "\tsqDb\tcqDb\tintrs"
+#if NVME_PCIE_STORAGE_POLL
+                             "\tpolls\temptyPolls\tenters\texits"
+                             "\tintrUs\tpollUs"
+#endif
+                             "\n");
+   if (status != VMK_OK) {
+      goto out_queue_stats_get;
+   }
+   len += out_len;
+
+   for (i = 0; i <= ctrlr->numIoQueues; i++) {
+      qinfo = &ctrlr->queueList[i];
+      ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_SUSPENDED);
+      if (ref == NULL) {
+         continue;
+      }
+      counters = &qinfo->counters;
+      status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                &out_len,
+                                "%u\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu",
+                                qinfo->id, counters->sq.submits,
+                                counters->cq.completions, counters->sq.sqFull,
+                                vmk_AtomicRead64(&counters->event.cmdFull),
+                                counters->sq.sqDoorbells,
+                                counters->cq.cqDoorbells,
+                                counters->event.intrs);
+      if (status == VMK_OK) {
+         len += out_len;
+#if NVME_PCIE_STORAGE_POLL
+         intrUs = counters->event.intrModeUs;
+         pollUs = counters->event.pollModeUs;
+         curUs = now > counters->event.modeTs ?
+                 now - counters->event.modeTs : 0;
+         if (vmk_AtomicRead32(&qinfo->pollMode) == NVME_PCIE_POLL_MODE_POLL) {
+            pollUs += curUs;
+         } else {
+            intrUs += curUs;
+         }
+         status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                   &out_len,
+                                   "\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu",
+                                   counters->event.polls,
+                                   counters->event.emptyPolls,
+                                   vmk_AtomicRead64(&qinfo->pollEnters),
+                                   vmk_AtomicRead64(&qinfo->pollExits),
+                                   intrUs, pollUs);
+         if (status == VMK_OK) {
+            len += out_len;
+         }
+#endif
+      }
+      NVMEPCIEQueueRefPut(ref);
+      if (status != VMK_OK) {
+         goto out_queue_stats_get;
+      }
+      status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                &out_len, "\n");
+      if (status != VMK_OK) {
+         goto out_queue_stats_get;
+      }
+      len += out_len;
+   }
+
+   status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                             &out_len,
+                             "\nCQEs per completion round\n"
+                             "qid\t0\t1\t2-3\t4-7\t8-15\t16-31\t32-63"
+                             "\t64+\n");
+   if (status != VMK_OK) {
+      goto out_queue_stats_get;
+   }
+   len += out_len;
+
+   for (i = 0; i <= ctrlr->numIoQueues; i++) {
+      qinfo = &ctrlr->queueList[i];
+      ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_SUSPENDED);
+      if (ref == NULL) {
+         continue;
+      }
+      counters = &qinfo->counters;
+      status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                &out_len, "%u", qinfo->id);
+      for (j = 0; status == VMK_OK && j < NVME_PCIE_CQE_BATCH_NUM; j++) {
+         len += out_len;
+         status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                   &out_len, "\t%lu", counters->cq.batch[j]);
+      }
+      if (status == VMK_OK) {
+         len += out_len;
+         status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                   &out_len, "\n");
+      }
+      NVMEPCIEQueueRefPut(ref);
+      if (status != VMK_OK) {
+         break;
+      }
+      len += out_len;
+   }
+
+out_queue_stats_get:
+   vmk_StringCopy(keyVal, buf, len + 1);
+   NVMEPCIEFree(buf);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyQueueStatsSet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   NVMEPCIEQueueInfo *qinfo;
+   NVMEPCIEQueueRef *ref;
+   vmk_uint32 i;
+
+   for (i = 0; i <= ctrlr->numIoQueues; i++) {
+      qinfo = &ctrlr->queueList[i];
+      ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_SUSPENDED);
+      if (ref == NULL) {
+         continue;
+      }
+      NVMEPCIEQueueCountersReset(qinfo);
+      NVMEPCIEQueueRefPut(ref);
+   }
+
+   IPRINT(ctrlr, "Queue counters are reset.");
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyOccupancyGet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   NVMEPCIEQueueInfo *qinfo;
+   NVMEPCIEQueueRef *ref;
+   NVMEPCIEOccupancyRing *ring;
+   NVMEPCIEOccupancySample *sample;
+   VMK_ReturnStatus status;
+   vmk_uint8 *buf = NULL;
+   vmk_ByteCount len = 0;
+   vmk_ByteCount out_len = 0;
+   vmk_uint64 now = NVMEPCIEGetTimerUs();
+   vmk_uint64 sumSq, sumOut, sumIops;
+   vmk_uint32 maxSq, maxOut, maxIops;
+   vmk_uint32 qid = ctrlr->occupancyQid;
+   vmk_uint32 i, q, idx, num;
+
+   buf = NVMEPCIEAlloc(NVMEPCIE_KVMGMT_BUF_SIZE, 0);
+   if (buf == NULL) {
+      IPRINT(ctrlr, "Failed to allocate buffer.");
+      return VMK_NO_MEMORY;
+   }
+
+   if (qid == 0) {
+      status = vmk_StringFormat(buf, NVMEPCIE_KVMGMT_BUF_SIZE, &out_len,
+                                "\nqid\tsamples\tsqAvg\tsqMax\toutAvg"
+                                "\toutMax\tiopsAvg\tiopsMax\n");
+   } else {
+      status = vmk_StringFormat(buf, NVMEPCIE_KVMGMT_BUF_SIZE, &out_len,
+                                "\nqid: %u\n\nageMs\tsqDepth\toutstanding"
+                                "\tiops\n", qid);
+   }
+   if (status != VMK_OK) {
+      goto out_occupancy_get;
+   }
+   len += out_len;
+
+   for (q = 1; q <= ctrlr->numIoQueues; q++) {
+      if (qid != 0 && q != qid) {
+         continue;
+      }
+      qinfo = &ctrlr->queueList[q];
+      ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_SUSPENDED);
+      if (ref == NULL) {
+         continue;
+      }
+      ring = &qinfo->occupancy;
+      idx = ring->idx;
+      vmk_CPUMemFenceRead();
+      num = idx < NVME_PCIE_OCCUPANCY_SAMPLES ?
+            idx : NVME_PCIE_OCCUPANCY_SAMPLES;
+      sumSq = sumOut = sumIops = 0;
+      maxSq = maxOut = maxIops = 0;
+      // Newest first
+      for (i = 1; i <= num; i++) {
+         sample = &ring->samples[(idx - i) % NVME_PCIE_OCCUPANCY_SAMPLES];
+         if (qid != 0) {
+            status = vmk_StringFormat(buf + len,
+                                      NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                      &out_len, "%lu\t%u\t%u\t%u\n",
+                                      now > sample->timeUs ?
+                                      (now - sample->timeUs) / 1000 : 0,
+                                      sample->sqDepth, sample->outstanding,
+                                      sample->iops);
+            if (status != VMK_OK) {
+               break;
+            }
+            len += out_len;
+            continue;
+         }
+         sumSq += sample->sqDepth;
+         sumOut += sample->outstanding;
+         sumIops += sample->iops;
+         maxSq = sample->sqDepth > maxSq ? sample->sqDepth : maxSq;
+         maxOut = sample->outstanding > maxOut ? sample->outstanding : maxOut;
+         maxIops = sample->iops > maxIops ? sample->iops : maxIops;
+      }
+      if (qid == 0 && num != 0) {
+         status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                   &out_len,
+                                   "%u\t%u\t%lu\t%u\t%lu\t%u\t%lu\t%u\n",
+                                   qinfo->id, num, sumSq / num, maxSq,
+                                   sumOut / num, maxOut, sumIops / num,
+                                   maxIops);
+         if (status == VMK_OK) {
+            len += out_len;
+         }
+      }
+      NVMEPCIEQueueRefPut(ref);
+      if (status != VMK_OK) {
+         break;
+      }
+   }
+
+out_occupancy_get:
+   vmk_StringCopy(keyVal, buf, len + 1);
+   NVMEPCIEFree(buf);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyOccupancySet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   char *end = NULL;
+   vmk_uint32 qid;
+
+   qid = vmk_Strtoul((char *) keyVal, &end, 10);
+   if (end == (char *) keyVal || qid > ctrlr->numIoQueues) {
+      EPRINT(ctrlr, "Invalid IO queue, valid range [0, %u].",
+             ctrlr->numIoQueues);
+      return VMK_BAD_PARAM;
+   }
+   ctrlr->occupancyQid = qid;
+
+   IPRINT(ctrlr, "occupancy queue is set as %u.", qid);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyStallThrGet(vmk_uint64 cookie, void *keyVal)
+{
+   vmk_uint64 *kv = (vmk_uint64 *) keyVal;
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+
+   *kv = vmk_AtomicRead32(&ctrlr->stallThr);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyStallThrSet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   vmk_uint32 stallThr = vmk_Strtoul((char *) keyVal, NULL, 10);
+
+   if (stallThr > NVME_PCIE_STALL_THR_MAX) {
+      stallThr = NVME_PCIE_STALL_THR_MAX;
+   }
+   vmk_AtomicWrite32(&ctrlr->stallThr, stallThr);
+   NVMEPCIESelectHotPath(ctrlr);
+
+   IPRINT(ctrlr, "stallThr is set as %d.", stallThr);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyStallsGet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   NVMEPCIEQueueInfo *qinfo;
+   NVMEPCIEQueueRef *ref;
+   NVMEPCIEStallRecord *record;
+   VMK_ReturnStatus status;
+   vmk_uint8 *buf = NULL;
+   vmk_ByteCount len = 0;
+   vmk_ByteCount out_len = 0;
+   vmk_uint32 thr = vmk_AtomicRead32(&ctrlr->stallThr);
+   vmk_uint32 i, idx, num;
+
+   buf = NVMEPCIEAlloc(NVMEPCIE_KVMGMT_BUF_SIZE, 0);
+   if (buf == NULL) {
+      IPRINT(ctrlr, "Failed to allocate buffer.");
+      return VMK_NO_MEMORY;
+   }
+
+   status = vmk_StringFormat(buf, NVMEPCIE_KVMGMT_BUF_SIZE, &out_len,
+                             "\nstallThr: %u s\n"
+                             "\nqid\toutstanding\tstalled\tstallEvents\n",
+                             thr);
+   if (status != VMK_OK) {
+      goto out_stalls_get;
+   }
+   len += out_len;
+
+   for (i = 1; i <= ctrlr->numIoQueues; i++) {
+      qinfo = &ctrlr->queueList[i];
+      ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_SUSPENDED);
+      if (ref == NULL) {
+         continue;
+      }
+      status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                &out_len, "%u\t%u\t%u\t%lu\n", qinfo->id,
+                                NVMEPCIEStallWheelCount(qinfo, 0),
+                                thr == 0 ? 0 :
+                                NVMEPCIEStallWheelCount(qinfo, thr + 1),
+                                vmk_AtomicRead64(&qinfo->stallWheel.stallEvents));
+      NVMEPCIEQueueRefPut(ref);
+      if (status != VMK_OK) {
+         goto out_stalls_get;
+      }
+      len += out_len;
+   }
+
+   status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                             &out_len, "\ntimeUs\tage\tqid\tcid\topc\n");
+   if (status != VMK_OK) {
+      goto out_stalls_get;
+   }
+   len += out_len;
+
+   vmk_SpinlockLock(ctrlr->stallLock);
+   num = ctrlr->stallRecordIdx < NVME_PCIE_STALL_RECORD_NUM ?
+         ctrlr->stallRecordIdx : NVME_PCIE_STALL_RECORD_NUM;
+   for (i = 0; i < num; i++) {
+      idx = (ctrlr->stallRecordIdx - num + i) % NVME_PCIE_STALL_RECORD_NUM;
+      record = &ctrlr->stallRecords[idx];
+      status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                &out_len, "%lu\t%u\t%u\t%u\t0x%x\n",
+                                record->timeUs, record->ageSec, record->qid,
+                                record->cid, record->opc);
+      if (status != VMK_OK) {
+         break;
+      }
+      len += out_len;
+   }
+   vmk_SpinlockUnlock(ctrlr->stallLock);
+
+out_stalls_get:
+   vmk_StringCopy(keyVal, buf, len + 1);
+   NVMEPCIEFree(buf);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyStallsSet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   NVMEPCIEQueueInfo *qinfo;
+   NVMEPCIEQueueRef *ref;
+   vmk_uint32 i;
+
+   for (i = 1; i <= ctrlr->numIoQueues; i++) {
+      qinfo = &ctrlr->queueList[i];
+      ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_SUSPENDED);
+      if (ref == NULL) {
+         continue;
+      }
+      vmk_AtomicWrite64(&qinfo->stallWheel.stallEvents, 0);
+      NVMEPCIEQueueRefPut(ref);
+   }
+
+   vmk_SpinlockLock(ctrlr->stallLock);
+   vmk_Memset(ctrlr->stallRecords, 0, sizeof(ctrlr->stallRecords));
+   ctrlr->stallRecordIdx = 0;
+   vmk_SpinlockUnlock(ctrlr->stallLock);
+
+   IPRINT(ctrlr, "Stall counters and records are reset.");
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyTraceRateGet(vmk_uint64 cookie, void *keyVal)
+{
+   vmk_uint64 *kv = (vmk_uint64 *) keyVal;
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+
+   *kv = vmk_AtomicRead32(&ctrlr->traceRate);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyTraceRateSet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   vmk_uint32 traceRate = vmk_Strtoul((char *) keyVal, NULL, 10);
+
+   if (traceRate > NVME_PCIE_TRACE_RATE_MAX) {
+      traceRate = NVME_PCIE_TRACE_RATE_MAX;
+   }
+   vmk_AtomicWrite32(&ctrlr->traceRate, traceRate);
+   NVMEPCIESelectHotPath(ctrlr);
+
+   IPRINT(ctrlr, "traceRate is set as %d.", traceRate);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyTraceGet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   NVMEPCIEQueueInfo *qinfo;
+   NVMEPCIEQueueRef *ref;
+   NVMEPCIETraceRing *ring;
+   NVMEPCIETraceEvent *slot;
+   NVMEPCIETraceEvent ev;
+   VMK_ReturnStatus status;
+   vmk_uint8 *buf = NULL;
+   vmk_ByteCount len = 0;
+   vmk_ByteCount out_len = 0;
+   vmk_uint32 i, head, pos, seq;
+
+   buf = NVMEPCIEAlloc(NVMEPCIE_KVMGMT_BUF_SIZE, 0);
+   if (buf == NULL) {
+      IPRINT(ctrlr, "Failed to allocate buffer.");
+      return VMK_NO_MEMORY;
+   }
+
+   status = vmk_StringFormat(buf, NVMEPCIE_KVMGMT_BUF_SIZE, &out_len,
+                             "\ntraceRate: %u\ncyclesPerSec: %lu\n"
+                             "\nqid\tseq\tts\ttype\tcid\topc\tnsid\tslba"
+                             "\tnlb\taux\n",
+                             vmk_AtomicRead32(&ctrlr->traceRate),
+                             vmk_TimerCyclesPerSecond());
+   if (status != VMK_OK) {
+      goto out_trace_get;
+   }
+   len += out_len;
+
+   for (i = 0; i <= ctrlr->numIoQueues && status == VMK_OK; i++) {
+      qinfo = &ctrlr->queueList[i];
+      ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_SUSPENDED);
+      if (ref == NULL) {
+         continue;
+      }
+      ring = &qinfo->trace;
+      head = vmk_AtomicRead32(&ring->head);
+      if (head - ring->tail > NVME_PCIE_TRACE_RING_SIZE) {
+         status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                   &out_len, "%u\tlost %u\n", qinfo->id,
+                                   head - ring->tail -
+                                   NVME_PCIE_TRACE_RING_SIZE);
+         if (status == VMK_OK) {
+            len += out_len;
+            ring->tail = head - NVME_PCIE_TRACE_RING_SIZE;
+         }
+      }
+      for (pos = ring->tail; status == VMK_OK && pos != head; pos++) {
+         slot = &ring->events[pos & (NVME_PCIE_TRACE_RING_SIZE - 1)];
+         seq = slot->seq;
+         vmk_CPUMemFenceRead();
+         ev = *slot;
+         vmk_CPUMemFenceRead();
+         if (seq == 0 || slot->seq != seq) {
+            // Still being written, pick it up on next read
+            break;
+         }
+         if (seq != pos + 1) {
+            // Overwritten by a later event
+            continue;
+         }
+         status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                   &out_len,
+                                   "%u\t%u\t%lu\t%s\t%u\t0x%x\t%u\t%lu"
+                                   "\t%u\t%u\n",
+                                   qinfo->id, pos, ev.ts,
+                                   NVMEPCIETraceTypeName(ev.type), ev.cid,
+                                   ev.opc, ev.nsid, ev.slba, ev.nlb, ev.aux);
+         if (status != VMK_OK) {
+            break;
+         }
+         len += out_len;
+      }
+      ring->tail = pos;
+      NVMEPCIEQueueRefPut(ref);
+   }
+
+out_trace_get:
+   vmk_StringCopy(keyVal, buf, len + 1);
+   NVMEPCIEFree(buf);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyTraceSet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   NVMEPCIEQueueInfo *qinfo;
+   NVMEPCIEQueueRef *ref;
+   vmk_uint32 i;
+
+   for (i = 0; i <= ctrlr->numIoQueues; i++) {
+      qinfo = &ctrlr->queueList[i];
+      ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_SUSPENDED);
+      if (ref == NULL) {
+         continue;
+      }
+      qinfo->trace.tail = vmk_AtomicRead32(&qinfo->trace.head);
+      NVMEPCIEQueueRefPut(ref);
+   }
+
+   IPRINT(ctrlr, "Command trace events are discarded.");
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyBringupGet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   NVMEPCIEBringup *bringup = &ctrlr->bringup;
+   vmk_uint8 *buf = NULL;
+   vmk_ByteCount len = 0;
+   vmk_ByteCount out_len = 0;
+   vmk_uint32 i, idx;
+   char name[16];
+
+   buf = NVMEPCIEAlloc(NVMEPCIE_KVMGMT_BUF_SIZE, 0);
+   if (buf == NULL) {
+      IPRINT(ctrlr, "Failed to allocate buffer.");
+      return VMK_NO_MEMORY;
+   }
+
+   len += NVMEPCIEKeyBringupRecordFormat(buf, NVMEPCIE_KVMGMT_BUF_SIZE,
+                                         "attach", &bringup->attach);
+
+   for (i = 0; i < NVME_PCIE_BRINGUP_RECORD_NUM && i < bringup->resetIdx;
+        i++) {
+      idx = bringup->resetIdx - 1 - i;
+      vmk_StringFormat(name, sizeof(name), NULL, "reset %u", idx);
+      out_len = NVMEPCIEKeyBringupRecordFormat(
+                   buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len, name,
+                   &bringup->resets[idx % NVME_PCIE_BRINGUP_RECORD_NUM]);
+      if (out_len == 0) {
+         break;
+      }
+      len += out_len;
+   }
+
+   vmk_StringCopy(keyVal, buf, len + 1);
+   NVMEPCIEFree(buf);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyBringupSet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   NVMEPCIEBringup *bringup = &ctrlr->bringup;
+
+   if (bringup->cur != NULL && bringup->cur != &bringup->attach) {
+      WPRINT(ctrlr, "Controller reset in progress.");
+      return VMK_BUSY;
+   }
+
+   vmk_Memset(bringup->resets, 0, sizeof(bringup->resets));
+   bringup->resetIdx = 0;
+
+   IPRINT(ctrlr, "Controller reset history is reset.");
+
+   return VMK_OK;
+}
+
+
+#if NVME_PCIE_LOCK_STATS
+static VMK_ReturnStatus
+NVMEPCIEKeyLockStatsGet(vmk_uint64 cookie, void *keyVal)
+{
+   static const char *lockNames[] = {"sq", "cq", "cmd"};
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   NVMEPCIEQueueInfo *qinfo;
+   NVMEPCIEQueueRef *ref;
+   NVMEPCIELockStats *stats[3];
+   VMK_ReturnStatus status;
+   vmk_uint64 spinNs, holdNs;
+   vmk_uint8 *buf = NULL;
+   vmk_ByteCount len = 0;
+   vmk_ByteCount out_len = 0;
+   vmk_uint32 i, j;
+
+   buf = NVMEPCIEAlloc(NVMEPCIE_KVMGMT_BUF_SIZE, 0);
+   if (buf == NULL) {
+      IPRINT(ctrlr, "Failed to allocate buffer.");
+      return VMK_NO_MEMORY;
+   }
+
+   status = vmk_StringFormat(buf, NVMEPCIE_KVMGMT_BUF_SIZE, &out_len,
+                             "\nqid\tlock\tacquires\tcontended\tspinNs"
+                             "\tmaxHoldNs\n");
+   if (status != VMK_OK) {
+      goto out_lock_stats_get;
+   }
+   len += out_len;
+
+   for (i = 0; i <= ctrlr->numIoQueues && status == VMK_OK; i++) {
+      qinfo = &ctrlr->queueList[i];
+      ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_SUSPENDED);
+      if (ref == NULL) {
+         continue;
+      }
+      stats[0] = &qinfo->sqInfo->lockStats;
+      stats[1] = &qinfo->cqInfo->lockStats;
+      stats[2] = &qinfo->cmdList->lockStats;
+      for (j = 0; j < 3; j++) {
+         spinNs = vmk_TimerUnsignedTCToUS(stats[j]->spinCycles * 1000);
+         holdNs = vmk_TimerUnsignedTCToUS(stats[j]->maxHoldCycles * 1000);
+         status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                   &out_len, "%u\t%s\t%lu\t%lu\t%lu\t%lu\n",
+                                   qinfo->id, lockNames[j], stats[j]->acquires,
+                                   stats[j]->contended, spinNs, holdNs);
+         if (status != VMK_OK) {
+            break;
+         }
+         len += out_len;
+      }
+      NVMEPCIEQueueRefPut(ref);
+   }
+
+out_lock_stats_get:
+   vmk_StringCopy(keyVal, buf, len + 1);
+   NVMEPCIEFree(buf);
+
+   return VMK_OK;
+}
+
+
+/**
+ * Clear a lock contention profile, called with the lock held
+ */
+static void
+NVMEPCIELockStatsClear(NVMEPCIELockStats *stats)
+{
+   stats->acquires = 0;
+   stats->contended = 0;
+   stats->spinCycles = 0;
+   stats->maxHoldCycles = 0;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyLockStatsSet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   NVMEPCIEQueueInfo *qinfo;
+   NVMEPCIEQueueRef *ref;
+   vmk_uint32 i;
+
+   for (i = 0; i <= ctrlr->numIoQueues; i++) {
+      qinfo = &ctrlr->queueList[i];
+      ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_SUSPENDED);
+      if (ref == NULL) {
+         continue;
+      }
+      // Bypass the profiling wrapper to keep 'holdTs' of the holder
+      vmk_SpinlockLock(qinfo->sqInfo->lock);
+      NVMEPCIELockStatsClear(&qinfo->sqInfo->lockStats);
+      vmk_SpinlockUnlock(qinfo->sqInfo->lock);
+      vmk_SpinlockLock(qinfo->cqInfo->lock);
+      NVMEPCIELockStatsClear(&qinfo->cqInfo->lockStats);
+      vmk_SpinlockUnlock(qinfo->cqInfo->lock);
+      vmk_SpinlockLock(qinfo->cmdList->lock);
+      NVMEPCIELockStatsClear(&qinfo->cmdList->lockStats);
+      vmk_SpinlockUnlock(qinfo->cmdList->lock);
+      NVMEPCIEQueueRefPut(ref);
+   }
+
+   IPRINT(ctrlr, "Lock contention profiles are reset.");
+
+   return VMK_OK;
+}
+#endif
+
+
+#ifdef NVME_STATS
+static VMK_ReturnStatus
+NVMEPCIEKeyLatHistGet(vmk_uint64 cookie, void *keyVal)
+{
+   static const char *opcNames[NVME_PCIE_LAT_HIST_OPC_NUM] = {
+      "read", "write", "flush", "other",
+   };
+   static const char *sizeNames[NVME_PCIE_LAT_HIST_SIZE_NUM] = {
+      "<=4K", "<=16K", "<=64K", ">64K",
+   };
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   NVMEPCIELatHist *merged;
+   VMK_ReturnStatus status;
+   vmk_uint8 *buf = NULL;
+   vmk_ByteCount len = 0;
+   vmk_ByteCount out_len = 0;
+   vmk_uint64 *count, total, max;
+   vmk_uint32 opc, size, i;
+
+   buf = NVMEPCIEAlloc(NVMEPCIE_KVMGMT_BUF_SIZE, 0);
+   if (buf == NULL) {
+      IPRINT(ctrlr, "Failed to allocate buffer.");
+      return VMK_NO_MEMORY;
+   }
+   merged = NVMEPCIEAlloc(sizeof(*merged), 0);
+   if (merged == NULL) {
+      IPRINT(ctrlr, "Failed to allocate buffer.");
+      NVMEPCIEFree(buf);
+      return VMK_NO_MEMORY;
+   }
+
+   NVMEPCIELatHistMerge(ctrlr, merged);
+
+   status = vmk_StringFormat(buf, NVMEPCIE_KVMGMT_BUF_SIZE, &out_len,
+                             "\nopc\tsize\tcount\tp50\tp90\tp99"
+                             "\tp99.9\tmax\n");
+   if (status != VMK_OK) {
+      goto out_lat_hist_get;
+   }
+   len += out_len;
+
+   for (opc = 0; opc < NVME_PCIE_LAT_HIST_OPC_NUM; opc++) {
+      for (size = 0; size < NVME_PCIE_LAT_HIST_SIZE_NUM; size++) {
+         count = merged->count[opc][size];
+         total = 0;
+         max = 0;
+         for (i = 0; i < NVME_PCIE_LAT_HIST_BUCKETS; i++) {
+            if (count[i] != 0) {
+               total += count[i];
+               max = NVMEPCIELatHistBucketNs(i + 1);
+            }
+         }
+         if (total == 0) {
+            continue;
+         }
+         status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                   &out_len,
+                                   "%s\t%s\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu\n",
+                                   opcNames[opc], sizeNames[size], total,
+                                   NVMEPCIELatHistPercentile(count, total, 500),
+                                   NVMEPCIELatHistPercentile(count, total, 900),
+                                   NVMEPCIELatHistPercentile(count, total, 990),
+                                   NVMEPCIELatHistPercentile(count, total, 999),
+                                   max);
+         if (status != VMK_OK) {
+            goto out_lat_hist_get;
+         }
+         len += out_len;
+      }
+   }
+
+out_lat_hist_get:
+   vmk_StringCopy(keyVal, buf, len + 1);
+   NVMEPCIEFree(merged);
+   NVMEPCIEFree(buf);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyLatHistSet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+
+   NVMEPCIELatHistReset(ctrlr);
+
+   IPRINT(ctrlr, "Latency histograms are reset.");
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyOutlierThrGet(vmk_uint64 cookie, void *keyVal)
+{
+   vmk_uint64 *kv = (vmk_uint64 *) keyVal;
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+
+   *kv = vmk_AtomicRead32(&ctrlr->outlierThr);
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyOutlierThrSet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   vmk_uint32 outlierThr = vmk_Strtoul((char *) keyVal, NULL, 10);
+
+   NVMEPCIEOutlierThrSet(ctrlr, outlierThr);
+
+   IPRINT(ctrlr, "outlierThr is set as %d.",
+          vmk_AtomicRead32(&ctrlr->outlierThr));
+
+   return VMK_OK;
+}
+
+
+static VMK_ReturnStatus
+NVMEPCIEKeyOutliersGet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   NVMEPCIEOutlierRecord *record;
+   VMK_ReturnStatus status;
+   vmk_uint8 *buf = NULL;
+   vmk_ByteCount len = 0;
+   vmk_ByteCount out_len = 0;
+   vmk_uint32 *dw;
+   vmk_uint32 i, idx, num;
+
+   buf = NVMEPCIEAlloc(NVMEPCIE_KVMGMT_BUF_SIZE, 0);
+   if (buf == NULL) {
+      IPRINT(ctrlr, "Failed to allocate buffer.");
+      return VMK_NO_MEMORY;
+   }
+
+   status = vmk_StringFormat(buf, NVMEPCIE_KVMGMT_BUF_SIZE, &out_len,
+                             "\noutlierThr: %u us\n"
+                             "\ntimeUs\tlatUs\tqid\tcpu\tdepth\n",
+                             vmk_AtomicRead32(&ctrlr->outlierThr));
+   if (status != VMK_OK) {
+      goto out_outliers_get;
+   }
+   len += out_len;
+
+   vmk_SpinlockLock(ctrlr->outlierLock);
+   num = ctrlr->outlierRecordIdx < NVME_PCIE_OUTLIER_RECORD_NUM ?
+         ctrlr->outlierRecordIdx : NVME_PCIE_OUTLIER_RECORD_NUM;
+   for (i = 1; i <= num; i++) {
+      idx = (ctrlr->outlierRecordIdx - i) % NVME_PCIE_OUTLIER_RECORD_NUM;
+      record = &ctrlr->outlierRecords[idx];
+      dw = (vmk_uint32 *)&record->sqe;
+      status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                &out_len, "%lu\t%lu\t%u\t%u\t%u\n"
+                                "  sqe: %08x %08x %08x %08x %08x %08x %08x"
+                                " %08x\n"
+                                "       %08x %08x %08x %08x %08x %08x %08x"
+                                " %08x\n",
+                                record->timeUs, record->latencyUs,
+                                record->qid, record->cpu, record->depth,
+                                dw[0], dw[1], dw[2], dw[3], dw[4], dw[5],
+                                dw[6], dw[7], dw[8], dw[9], dw[10], dw[11],
+                                dw[12], dw[13], dw[14], dw[15]);
+      if (status != VMK_OK) {
+         break;
+      }
+      len += out_len;
+      dw = (vmk_uint32 *)&record->cqe;
+      status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                &out_len, "  cqe: %08x %08x %08x %08x\n",
+                                dw[0], dw[1], dw[2], dw[3]);
+      if (status != VMK_OK) {
+         break;
+      }
+      len += out_len;
+   }
+   vmk_SpinlockUnlock(ctrlr->outlierLock);
+
+out_outliers_get:
+   vmk_StringCopy(keyVal, buf, len + 1);
+   NVMEPCIEFree(buf);
+
+   return VMK_OK;
+}
+
+
 static VMK_ReturnStatus
-NVMEPCIEKeyLogLevelSet(vmk_uint64 cookie, void *keyVal);
-static VMK_ReturnStatus NVMEPCIEGlobalKeyHelpGet(vmk_uint64 cookie, void *keyVal);
-static VMK_ReturnStatus NVMEPCIEGlobalKeyHelpSet(vmk_uint64 cookie, void *keyVal);
+NVMEPCIEKeyOutliersSet(vmk_uint64 cookie, void *keyVal)
+{
+   NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
 
-// Controller keys
-static NVMEPCIEKVMgmtData nvmePCIEKVMgmtData[] = {
-#if NVME_PCIE_STORAGE_POLL
-   {
-      "pollAct",
-      VMK_MGMT_KEY_TYPE_LONG,
-      NVMEPCIEKeyPollActGet,
-      "Display hybrid poll activation info of the device.",
-      NVMEPCIEKeyPollActSet,
-      "Set pollAct, non-zero for activation, 0 for deactivation",
-   },
-   {
-      "pollOIOThr",
-      VMK_MGMT_KEY_TYPE_LONG,
-      NVMEPCIEKeyPollOIOThrGet,
-      "Display hybrid poll OIO activation threshold per queue of the device."
-      " Valid if poll activated.",
-      NVMEPCIEKeyPollOIOThrSet,
-      "Set pollOIOThr",
-   },
-   {
-      "pollInterval",
-      VMK_MGMT_KEY_TYPE_LONG,
-      NVMEPCIEKeyPollIntervalGet,
-      "Display hybrid poll interval (us) per queue of the device."
-      " Valid if poll activated.",
-      NVMEPCIEKeyPollIntervalSet,
-      "Set pollInterval",
-   },
-#endif
-#if NVME_PCIE_BLOCKSIZE_AWARE
-   {
-      "blkSizeAwarePollAct",
-      VMK_MGMT_KEY_TYPE_LONG,
-      NVMEPCIEKeyBlkSizeAwarePollActGet,
-      "Display hybrid poll block size aware activation info of the device."
-      " Valid if poll activated.",
-      NVMEPCIEKeyBlkSizeAwarePollActSet,
-      "Set blkSizeAwarePollAct, non-zero for activation, 0 for deactivation",
-   },
-#endif
-   // Should be always at the end
-   {
-      "help",
-      VMK_MGMT_KEY_TYPE_STRING,
-      NVMEPCIEKeyHelpGet,
-      "Display the help page.",
-      NVMEPCIEKeyHelpSet,
-      NULL,
-   }
-};
+   vmk_SpinlockLock(ctrlr->outlierLock);
+   vmk_Memset(ctrlr->outlierRecords, 0, sizeof(ctrlr->outlierRecords));
+   ctrlr->outlierRecordIdx = 0;
+   vmk_SpinlockUnlock(ctrlr->outlierLock);
 
-// Global keys
-static NVMEPCIEKVMgmtData nvmePCIEGlobalKVMgmtData[] = {
-   {
-      "logLevel",
-      VMK_MGMT_KEY_TYPE_LONG,
-      NVMEPCIEKeyLogLevelGet,
-      "Display driver log level.",
-      NVMEPCIEKeyLogLevelSet,
-      "Set driver log level.\n"
-      "\t\t\t1: Error\n"
-      "\t\t\t2: Warning\n"
-      "\t\t\t3: Info\n"
-      "\t\t\t4: Verbose\n"
-      "\t\t\t5: Debug",
-   },
-   {
-      "debugMask",
-      VMK_MGMT_KEY_TYPE_STRING,
-      NVMEPCIEKeyDebugMaskGet,
-      "Display driver debug level.",
-      NVMEPCIEKeyDebugMaskSet,
-      "Set driver debug level. Hexadecimal(started with \"0x\" or \"0X\") and decimal are both accepted.\n"
-      "\t\t\tBIT_0: Print ctrlr level log.\n"
-      "\t\t\tBIT_2: Print queue level log.\n"
-      "\t\t\tBIT_3: Print command level log.\n"
-      "\t\t\tBIT_18: Dump submission queue entry.\n"
-      "\t\t\tBIT_19: Dump completion queue entry.",
-   },
-   // Should be always at the end
-   {
-      "help",
-      VMK_MGMT_KEY_TYPE_STRING,
-      NVMEPCIEGlobalKeyHelpGet,
-      "Display the help page.",
-      NVMEPCIEGlobalKeyHelpSet,
-      NULL,
-   }
-};
+   IPRINT(ctrlr, "Outlier records are reset.");
+
+   return VMK_OK;
+}
 
 
-#if NVME_PCIE_STORAGE_POLL
 static VMK_ReturnStatus
-NVMEPCIEKeyPollActGet(vmk_uint64 cookie, void *keyVal)
+NVMEPCIEKeyPhaseStampGet(vmk_uint64 cookie, void *keyVal)
 {
    vmk_uint64 *kv = (vmk_uint64 *) keyVal;
    NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
 
-   *kv = vmk_AtomicRead8(&ctrlr->pollAct);
+   *kv = vmk_AtomicRead8(&ctrlr->phaseStamp);
 
    return VMK_OK;
 }
 
 
 static VMK_ReturnStatus
-NVMEPCIEKeyPollActSet(vmk_uint64 cookie, void *keyVal)
+NVMEPCIEKeyPhaseStampSet(vmk_uint64 cookie, void *keyVal)
 {
    NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
-   vmk_Bool pollAct = vmk_AtomicRead8(&ctrlr->pollAct);
    vmk_Bool val = (vmk_Strtoul((char *) keyVal, NULL, 10) != 0);
 
-   if (pollAct != val) {
-      if (val == VMK_FALSE) {
-         vmk_AtomicWrite8(&ctrlr->pollAct, VMK_FALSE);
+   vmk_AtomicWrite8(&ctrlr->phaseStamp, val);
+   NVMEPCIESelectHotPath(ctrlr);
 
-         IPRINT(ctrlr, "pollAct is set as 0.");
-      } else {
-         if (nvmePCIEMsiEnbaled) {
-            IPRINT(ctrlr, "To activate polling, interrupt type should"
-                          " be MSIX.");
-         } else {
-            vmk_AtomicWrite8(&ctrlr->pollAct, VMK_TRUE);
-            IPRINT(ctrlr, "pollAct is set as 1.");
-         }
-      }
-   }
+   IPRINT(ctrlr, "phaseStamp is set as %d.", val);
 
    return VMK_OK;
 }
 
 
 static VMK_ReturnStatus
-NVMEPCIEKeyPollOIOThrGet(vmk_uint64 cookie, void *keyVal)
+NVMEPCIEKeyPhaseHistGet(vmk_uint64 cookie, void *keyVal)
 {
-   vmk_uint64 *kv = (vmk_uint64 *) keyVal;
+   static const char *phaseNames[NVME_PCIE_PHASE_NUM] = {
+      "lock", "submit", "device", "dispatch",
+   };
    NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   NVMEPCIEPhaseHist *merged;
+   NVMEPCIEPhaseHist *hist;
+   NVMEPCIEQueueInfo *qinfo;
+   NVMEPCIEQueueRef *ref;
+   VMK_ReturnStatus status;
+   vmk_uint8 *buf = NULL;
+   vmk_ByteCount len = 0;
+   vmk_ByteCount out_len = 0;
+   vmk_uint64 *count, total, max;
+   vmk_uint32 phase, i, q;
 
-   *kv = vmk_AtomicRead32(&ctrlr->pollOIOThr);
+   buf = NVMEPCIEAlloc(NVMEPCIE_KVMGMT_BUF_SIZE, 0);
+   if (buf == NULL) {
+      IPRINT(ctrlr, "Failed to allocate buffer.");
+      return VMK_NO_MEMORY;
+   }
+   merged = NVMEPCIEAlloc(sizeof(*merged), 0);
+   if (merged == NULL) {
+      IPRINT(ctrlr, "Failed to allocate buffer.");
+      NVMEPCIEFree(buf);
+      return VMK_NO_MEMORY;
+   }
+
+   NVMEPCIEPhaseHistMerge(ctrlr, merged);
+
+   status = vmk_StringFormat(buf, NVMEPCIE_KVMGMT_BUF_SIZE, &out_len,
+                             "\nphaseStamp: %u\n"
+                             "\nphase\tcount\tp50\tp90\tp99\tp99.9"
+                             "\tmax\n",
+                             vmk_AtomicRead8(&ctrlr->phaseStamp));
+   if (status != VMK_OK) {
+      goto out_phase_hist_get;
+   }
+   len += out_len;
+
+   for (phase = 0; phase < NVME_PCIE_PHASE_NUM; phase++) {
+      count = merged->count[phase];
+      total = 0;
+      max = 0;
+      for (i = 0; i < NVME_PCIE_LAT_HIST_BUCKETS; i++) {
+         if (count[i] != 0) {
+            total += count[i];
+            max = NVMEPCIELatHistBucketNs(i + 1);
+         }
+      }
+      if (total == 0) {
+         continue;
+      }
+      status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                &out_len,
+                                "%s\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu\n",
+                                phaseNames[phase], total,
+                                NVMEPCIELatHistPercentile(count, total, 500),
+                                NVMEPCIELatHistPercentile(count, total, 900),
+                                NVMEPCIELatHistPercentile(count, total, 990),
+                                NVMEPCIELatHistPercentile(count, total, 999),
+                                max);
+      if (status != VMK_OK) {
+         goto out_phase_hist_get;
+      }
+      len += out_len;
+   }
+
+   status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                             &out_len,
+                             "\np50/p99 per queue\nqid\tlock\tsubmit"
+                             "\tdevice\tdispatch\n");
+   if (status != VMK_OK) {
+      goto out_phase_hist_get;
+   }
+   len += out_len;
+
+   for (q = 1; q <= ctrlr->numIoQueues; q++) {
+      qinfo = &ctrlr->queueList[q];
+      ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_SUSPENDED);
+      if (ref == NULL) {
+         continue;
+      }
+      if (qinfo->stats == NULL ||
+          vmk_AtomicRead8(&qinfo->stats->phaseHist.resetReq)) {
+         NVMEPCIEQueueRefPut(ref);
+         continue;
+      }
+      hist = &qinfo->stats->phaseHist;
+      status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                &out_len, "%u", qinfo->id);
+      for (phase = 0; status == VMK_OK && phase < NVME_PCIE_PHASE_NUM;
+           phase++) {
+         len += out_len;
+         count = hist->count[phase];
+         total = 0;
+         for (i = 0; i < NVME_PCIE_LAT_HIST_BUCKETS; i++) {
+            total += count[i];
+         }
+         status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                   &out_len, "\t%lu/%lu",
+                                   total == 0 ? 0 :
+                                   NVMEPCIELatHistPercentile(count, total, 500),
+                                   total == 0 ? 0 :
+                                   NVMEPCIELatHistPercentile(count, total, 990));
+      }
+      if (status == VMK_OK) {
+         len += out_len;
+         status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                   &out_len, "\n");
+      }
+      NVMEPCIEQueueRefPut(ref);
+      if (status != VMK_OK) {
+         break;
+      }
+      len += out_len;
+   }
+
+out_phase_hist_get:
+   vmk_StringCopy(keyVal, buf, len + 1);
+   NVMEPCIEFree(merged);
+   NVMEPCIEFree(buf);
 
    return VMK_OK;
 }
 
 
 static VMK_ReturnStatus
-NVMEPCIEKeyPollOIOThrSet(vmk_uint64 cookie, void *keyVal)
+NVMEPCIEKeyPhaseHistSet(vmk_uint64 cookie, void *keyVal)
 {
    NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
-   vmk_uint32 pollOIOThr = vmk_Strtoul((char *) keyVal, NULL, 10);
 
-   vmk_AtomicWrite32(&ctrlr->pollOIOThr, pollOIOThr);
+   NVMEPCIEPhaseHistReset(ctrlr);
 
-   IPRINT(ctrlr, "pollOIOThr is set as %d.", pollOIOThr);
+   IPRINT(ctrlr, "Phase histograms are reset.");
 
    return VMK_OK;
 }
 
 
 static VMK_ReturnStatus
-NVMEPCIEKeyPollIntervalGet(vmk_uint64 cookie, void *keyVal)
+NVMEPCIEKeyCpuStatsGet(vmk_uint64 cookie, void *keyVal)
 {
-   vmk_uint64 *kv = (vmk_uint64 *) keyVal;
    NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
+   NVMEPCIECpuStats *cpuStats;
+   NVMEPCIEQueueInfo *qinfo;
+   NVMEPCIEQueueRef *ref;
+   VMK_ReturnStatus status;
+   vmk_uint8 *buf = NULL;
+   vmk_ByteCount len = 0;
+   vmk_ByteCount out_len = 0;
+   vmk_uint64 total, permil;
+   vmk_uint32 cpu, q;
 
-   *kv = vmk_AtomicRead64(&ctrlr->pollInterval);
+   buf = NVMEPCIEAlloc(NVMEPCIE_KVMGMT_BUF_SIZE, 0);
+   if (buf == NULL) {
+      IPRINT(ctrlr, "Failed to allocate buffer.");
+      return VMK_NO_MEMORY;
+   }
+
+   status = vmk_StringFormat(buf, NVMEPCIE_KVMGMT_BUF_SIZE, &out_len,
+                             "\nqid\tsubmits\tcompl\tcrossCpu%%"
+                             "\tsubmitters (pcpu:share%%)\n");
+   if (status != VMK_OK) {
+      goto out_cpu_stats_get;
+   }
+   len += out_len;
+
+   for (q = 1; q <= ctrlr->numIoQueues; q++) {
+      qinfo = &ctrlr->queueList[q];
+      ref = NVMEPCIEQueueRefGet(qinfo, NVME_PCIE_QUEUE_SUSPENDED);
+      if (ref == NULL) {
+         continue;
+      }
+      if (qinfo->stats == NULL) {
+         NVMEPCIEQueueRefPut(ref);
+         continue;
+      }
+      cpuStats = &qinfo->stats->cpuStats;
+      total = 0;
+      for (cpu = 0; cpu < cpuStats->numCpus; cpu++) {
+         total += cpuStats->submits[cpu];
+      }
+      permil = cpuStats->completions == 0 ? 0 :
+               cpuStats->crossCpu * 1000 / cpuStats->completions;
+      status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                &out_len, "%u\t%lu\t%lu\t%lu.%lu\t",
+                                qinfo->id, total, cpuStats->completions,
+                                permil / 10, permil % 10);
+      for (cpu = 0; status == VMK_OK && cpu < cpuStats->numCpus; cpu++) {
+         if (cpuStats->submits[cpu] == 0) {
+            continue;
+         }
+         len += out_len;
+         permil = cpuStats->submits[cpu] * 1000 / total;
+         status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                   &out_len, " %u:%lu.%lu", cpu,
+                                   permil / 10, permil % 10);
+      }
+      if (status == VMK_OK) {
+         len += out_len;
+         status = vmk_StringFormat(buf + len, NVMEPCIE_KVMGMT_BUF_SIZE - len,
+                                   &out_len, "\n");
+      }
+      NVMEPCIEQueueRefPut(ref);
+      if (status != VMK_OK) {
+         break;
+      }
+      len += out_len;
+   }
+
+out_cpu_stats_get:
+   vmk_StringCopy(keyVal, buf, len + 1);
+   NVMEPCIEFree(buf);
 
    return VMK_OK;
 }
 
 
 static VMK_ReturnStatus
-NVMEPCIEKeyPollIntervalSet(vmk_uint64 cookie, void *keyVal)
+NVMEPCIEKeyCpuStatsSet(vmk_uint64 cookie, void *keyVal)
 {
    NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
-   vmk_uint64 pollInterval = vmk_Strtoul((char *) keyVal, NULL, 10);
 
-   vmk_AtomicWrite64(&ctrlr->pollInterval, pollInterval);
+   NVMEPCIECpuStatsReset(ctrlr);
 
-   IPRINT(ctrlr, "pollInterval is set as %lu.", pollInterval);
+   IPRINT(ctrlr, "Submitter PCPU statistics are reset.");
 
    return VMK_OK;
 }
-#endif
 
 
-#if NVME_PCIE_BLOCKSIZE_AWARE
 static VMK_ReturnStatus
-NVMEPCIEKeyBlkSizeAwarePollActGet(vmk_uint64 cookie, void *keyVal)
+NVMEPCIEKeyStatsSampleRateGet(vmk_uint64 cookie, void *keyVal)
 {
    vmk_uint64 *kv = (vmk_uint64 *) keyVal;
    NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
 
-   *kv = vmk_AtomicRead8(&ctrlr->blkSizeAwarePollAct);
+   *kv = ctrlr->statsSampleMask + 1;
 
    return VMK_OK;
 }
 
 
 static VMK_ReturnStatus
-NVMEPCIEKeyBlkSizeAwarePollActSet(vmk_uint64 cookie, void *keyVal)
+NVMEPCIEKeyStatsSampleRateSet(vmk_uint64 cookie, void *keyVal)
 {
    NVMEPCIEController *ctrlr = (NVMEPCIEController *) cookie;
-   vmk_Bool blkSizeAwarePollAct = VMK_TRUE;
-
-   if ((vmk_Strtoul((char *) keyVal, NULL, 10)) == 0) {
-      blkSizeAwarePollAct = VMK_FALSE;
-   }
+   vmk_uint32 rate = vmk_Strtoul((char *) keyVal, NULL, 10);
 
-   vmk_AtomicWrite8(&ctrlr->blkSizeAwarePollAct, blkSizeAwarePollAct);
+   NVMEPCIEStatsSampleRateSet(ctrlr, rate);
 
-   IPRINT(ctrlr, "blkSizeAwarePollAct is set as %d.", blkSizeAwarePollAct);
+   IPRINT(ctrlr, "statsSampleRate is set as %d.",
+          ctrlr->statsSampleMask + 1);
 
    return VMK_OK;
 }
 #endif
 
 
+/**
+ * Format a bring-up record, return 0 if it does not fit in the buffer
+ */
+static vmk_uint32
+NVMEPCIEKeyBringupRecordFormat(vmk_uint8 *buf,
+                               vmk_uint32 buf_len,
+                               const char *name,
+                               NVMEPCIEBringupRecord *rec)
+{
+   static const char *phaseNames[NVME_PCIE_BRINGUP_PHASE_NUM] = {
+      "attach", "start", "disable", "adminq", "enable",
+      "identify", "setQueues", "createQ", "deleteQ", "quiesce",
+   };
+   VMK_ReturnStatus status;
+   vmk_ByteCount len = 0;
+   vmk_ByteCount out_len = 0;
+   vmk_uint32 i;
+
+   if (rec->endUs != 0) {
+      status = vmk_StringFormat(buf, buf_len, &out_len,
+                                "\n%s: start %lu us, total %lu us,"
+                                " identifies %u, queues %u\n",
+                                name, rec->startUs, rec->endUs - rec->startUs,
+                                rec->identifies, rec->queues);
+   } else {
+      status = vmk_StringFormat(buf, buf_len, &out_len,
+                                "\n%s: start %lu us, in progress,"
+                                " identifies %u, queues %u\n",
+                                name, rec->startUs, rec->identifies,
+                                rec->queues);
+   }
+   if (status != VMK_OK) {
+      return 0;
+   }
+   len += out_len;
+
+   for (i = 0; i < NVME_PCIE_BRINGUP_PHASE_NUM; i++) {
+      status = vmk_StringFormat(buf + len, buf_len - len, &out_len,
+                                "%s%s %u", (i % 5) == 0 ? "\t" : "  ",
+                                phaseNames[i], rec->phaseUs[i]);
+      if (status != VMK_OK) {
+         return 0;
+      }
+      len += out_len;
+      if ((i % 5) == 4) {
+         status = vmk_StringFormat(buf + len, buf_len - len, &out_len, "\n");
+         if (status != VMK_OK) {
+            return 0;
+         }
+         len += out_len;
+      }
+   }
+
+   if (rec->queues == 0) {
+      return len;
+   }
+   status = vmk_StringFormat(buf + len, buf_len - len, &out_len,
+                             "\tqueue create:");
+   for (i = 1; status == VMK_OK && i <= NVME_PCIE_MAX_IO_QUEUES; i++) {
+      if (rec->queueUs[i] == 0) {
+         continue;
+      }
+      len += out_len;
+      status = vmk_StringFormat(buf + len, buf_len - len, &out_len,
+                                " %u:%u", i, rec->queueUs[i]);
+   }
+   if (status == VMK_OK) {
+      len += out_len;
+      status = vmk_StringFormat(buf + len, buf_len - len, &out_len, "\n");
+   }
+   if (status != VMK_OK) {
+      return 0;
+   }
+   return len + out_len;
+}
+
+
 static vmk_uint32
 NVMEPCIEKeyGetHelpPage(vmk_uint8 *buf, vmk_uint32 buf_len, NVMEPCIEKVMgmtData *keyList, vmk_uint32 keyNum)
 {
@@ -483,8 +3470,18 @@ NVMEPCIEKeyDebugMaskGet(vmk_uint64 cookie, void *keyVal)
 static VMK_ReturnStatus
 NVMEPCIEKeyDebugMaskSet(vmk_uint64 cookie, void *keyVal)
 {
+   vmk_ListLinks *itemPtr;
+   NVMEPCIEController *ctrlr;
+
    nvmePCIEDebugMask = vmk_Strtoul(keyVal, NULL, 0);
    MOD_IPRINT("Set driver debug mask to 0x%x.", nvmePCIEDebugMask);
+
+   vmk_SpinlockLock(NVME_PCIE_DRIVER_RES_LOCK);
+   vmk_ListForEach(&NVME_PCIE_DRIVER_RES_CONTROLLER_LIST, itemPtr) {
+      ctrlr = VMK_LIST_ENTRY(itemPtr, NVMEPCIEController, list);
+      NVMEPCIESelectHotPath(ctrlr);
+   }
+   vmk_SpinlockUnlock(NVME_PCIE_DRIVER_RES_LOCK);
    return VMK_OK;
 }
 
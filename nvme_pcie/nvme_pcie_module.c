@@ -26,6 +26,37 @@ VMK_MODPARAM(nvmePCIEMsiEnbaled, int, "NVMe PCIe MSI interrupt enable");
 vmk_uint32 nvmePCIEFakeAdminQSize = 0;
 VMK_MODPARAM(nvmePCIEFakeAdminQSize, uint, "NVMe PCIe fake ADMIN queue size. 0's based");
 
+vmk_uint32 nvmePCIESyncCmdNum = NVME_PCIE_SYNC_CMD_NUM;
+VMK_MODPARAM(nvmePCIESyncCmdNum, uint, "NVMe PCIe number of command slots"
+                                       " reserved for internal sync commands"
+                                       " per queue. Valid range [1, 64]."
+                                       " Default 10.");
+
+vmk_uint32 nvmePCIEStallThr = NVME_PCIE_STALL_THR_DEFAULT;
+VMK_MODPARAM(nvmePCIEStallThr, uint, "NVMe PCIe threshold in seconds to report"
+                                     " an outstanding IO command as stalled."
+                                     " Valid range [0, 62], 0 to disable."
+                                     " Default 0.");
+
+vmk_uint32 nvmePCIETraceRate = 0;
+VMK_MODPARAM(nvmePCIETraceRate, uint, "NVMe PCIe trace 1 in N commands into"
+                                      " per queue trace rings. Valid range"
+                                      " [0, 65536], 0 to disable. Default 0.");
+
+vmk_uint32 nvmePCIEOutlierThr = 0;
+VMK_MODPARAM(nvmePCIEOutlierThr, uint, "NVMe PCIe device latency threshold in"
+                                       " microseconds to capture an IO command"
+                                       " as outlier, requires statistics."
+                                       " Valid range [0, 10000000], 0 to"
+                                       " disable. Default 0.");
+
+vmk_uint32 nvmePCIEStatsSampleRate = 1;
+VMK_MODPARAM(nvmePCIEStatsSampleRate, uint, "NVMe PCIe collect statistics of"
+                                            " 1 in N commands, rounded down to"
+                                            " a power of 2. Commands not"
+                                            " sampled report no device latency."
+                                            " Valid range [1, 1024]. Default 1.");
+
 #if NVME_PCIE_STORAGE_POLL
 int nvmePCIEPollAct = 1;
 VMK_MODPARAM(nvmePCIEPollAct, int, "NVMe PCIe hybrid poll activate,"
@@ -38,17 +69,98 @@ VMK_MODPARAM(nvmePCIEPollOIOThr, uint, "NVMe PCIe hybrid poll OIO threshold of"
                                        " poll. Valid if poll activated. Default"
                                        " 30 OIO commands per IO queue.");
 
+vmk_uint32 nvmePCIEPollOIOExitThr = 15;
+VMK_MODPARAM(nvmePCIEPollOIOExitThr, uint, "NVMe PCIe hybrid poll OIO threshold"
+                                           " below which poll may switch back"
+                                           " to interrupt. Valid if poll"
+                                           " activated. Must not exceed"
+                                           " nvmePCIEPollOIOThr. Default 15 OIO"
+                                           " commands per IO queue.");
+
+vmk_uint64 nvmePCIEPollDwell = 1000;
+VMK_MODPARAM(nvmePCIEPollDwell, uint, "NVMe PCIe minimum time in microseconds"
+                                      " an IO queue stays in interrupt or poll"
+                                      " mode before switching. Valid if poll"
+                                      " activated. Default 1000us.");
+
+vmk_uint32 nvmePCIESmallIoBytes = NVME_PCIE_SMALL_IO_BYTES_DEFAULT;
+VMK_MODPARAM(nvmePCIESmallIoBytes, uint, "NVMe PCIe transfer size boundary in"
+                                         " bytes of small block size IO"
+                                         " commands for block size aware poll."
+                                         " Default 32768.");
+
+int nvmePCIEPollAutoTune = 0;
+VMK_MODPARAM(nvmePCIEPollAutoTune, int, "NVMe PCIe hybrid poll OIO threshold"
+                                        " auto tune per IO queue, requires"
+                                        " latency model. Valid if poll"
+                                        " activated. Default deactivated.");
+
+vmk_uint64 nvmePCIEIopsWindow = NVME_PCIE_IOPS_WINDOW_DEFAULT;
+VMK_MODPARAM(nvmePCIEIopsWindow, uint, "NVMe PCIe window in microseconds of"
+                                       " IOPs estimation for poll mode"
+                                       " switching. Valid range"
+                                       " [1000, 1000000]. Default 10000us.");
+
 vmk_uint64 nvmePCIEPollInterval = 50;
 VMK_MODPARAM(nvmePCIEPollInterval, uint, "NVMe PCIe hybrid poll interval"
                                          " between each poll in microseconds."
                                          " Valid if poll activated. Default"
                                          " 50us.");
 
+int nvmePCIEPollLatModel = 1;
+VMK_MODPARAM(nvmePCIEPollLatModel, int, "NVMe PCIe hybrid poll latency model"
+                                        " activate, sleep by predicted latency"
+                                        " instead of fixed poll interval."
+                                        " Valid if poll activated. Default"
+                                        " activated.");
+
+vmk_uint32 nvmePCIEPollSleepPct = NVME_PCIE_POLL_SLEEP_PCT_DEFAULT;
+VMK_MODPARAM(nvmePCIEPollSleepPct, uint, "NVMe PCIe hybrid poll sleep percent"
+                                         " of predicted remaining latency."
+                                         " Valid if latency model activated."
+                                         " Valid range [0, 100]. Default 50.");
+
+int nvmePCIEPollBusy = 0;
+VMK_MODPARAM(nvmePCIEPollBusy, int, "NVMe PCIe busy poll activate, spin on"
+                                    " completion queue without sleeping while"
+                                    " IO is outstanding. Valid if poll"
+                                    " activated. Default deactivated.");
+
+vmk_uint32 nvmePCIEPollCpuBudget = 0;
+VMK_MODPARAM(nvmePCIEPollCpuBudget, uint, "NVMe PCIe CPU budget of polling"
+                                          " per controller in percent of one"
+                                          " PCPU, 0 for unlimited. Valid"
+                                          " range [0, 6400]. Default 0.");
+
+vmk_uint32 nvmePCIEPollGroups = 0;
+VMK_MODPARAM(nvmePCIEPollGroups, uint, "NVMe PCIe poll groups per controller,"
+                                       " each servicing a range of IO queues"
+                                       " by one poll handler, 0 for one poll"
+                                       " handler per IO queue. Valid range"
+                                       " [0, 16]. Default 0.");
+
+vmk_uint32 nvmePCIEPollSpinBudget = NVME_PCIE_POLL_SPIN_BUDGET_DEFAULT;
+VMK_MODPARAM(nvmePCIEPollSpinBudget, uint, "NVMe PCIe busy poll spin budget"
+                                           " (us) per poll round. Valid range"
+                                           " [1, 10000]. Default 100.");
+
 #if NVME_PCIE_BLOCKSIZE_AWARE
 int nvmePCIEBlkSizeAwarePollAct = 1;
 VMK_MODPARAM(nvmePCIEBlkSizeAwarePollAct, int, "NVMe PCIe block size aware"
                                                " poll activate. Valid if poll"
                                                " activated. Default activated.");
+
+int nvmePCIEPollCostModel = 0;
+VMK_MODPARAM(nvmePCIEPollCostModel, int, "NVMe PCIe hybrid poll cost model"
+                                         " activate, replaces the block size"
+                                         " aware ratio. Valid if poll"
+                                         " activated. Default deactivated.");
+
+vmk_uint32 nvmePCIEPollIntrCost = NVME_PCIE_POLL_INTR_COST_DEFAULT;
+VMK_MODPARAM(nvmePCIEPollIntrCost, uint, "NVMe PCIe cost (us) of an"
+                                         " interrupt in hybrid poll cost"
+                                         " model. Valid range [0, 1000]."
+                                         " Default 5.");
 #endif
 #endif
 
@@ -79,6 +191,78 @@ static void NVMEPCIEValidateModuleParameter()
       NVMEPCIELogNoHandle("change nvmePCIEFakeAdminQSize to 0x%x",
          nvmePCIEFakeAdminQSize);
    }
+   if (nvmePCIESyncCmdNum == 0 ||
+       nvmePCIESyncCmdNum > NVME_PCIE_SYNC_CMD_NUM_MAX) {
+      nvmePCIESyncCmdNum = NVME_PCIE_SYNC_CMD_NUM;
+      NVMEPCIELogNoHandle("change nvmePCIESyncCmdNum to %u",
+         nvmePCIESyncCmdNum);
+   }
+#if NVME_PCIE_STORAGE_POLL
+   if (nvmePCIEPollOIOExitThr > nvmePCIEPollOIOThr) {
+      nvmePCIEPollOIOExitThr = nvmePCIEPollOIOThr / 2;
+      NVMEPCIELogNoHandle("change nvmePCIEPollOIOExitThr to %u",
+         nvmePCIEPollOIOExitThr);
+   }
+   if (nvmePCIEIopsWindow < NVME_PCIE_IOPS_WINDOW_MIN ||
+       nvmePCIEIopsWindow > NVME_PCIE_IOPS_WINDOW_MAX) {
+      nvmePCIEIopsWindow = NVME_PCIE_IOPS_WINDOW_DEFAULT;
+      NVMEPCIELogNoHandle("change nvmePCIEIopsWindow to %lu",
+         nvmePCIEIopsWindow);
+   }
+#if NVME_PCIE_BLOCKSIZE_AWARE
+   if (nvmePCIEPollIntrCost > NVME_PCIE_POLL_INTR_COST_MAX) {
+      nvmePCIEPollIntrCost = NVME_PCIE_POLL_INTR_COST_DEFAULT;
+      NVMEPCIELogNoHandle("change nvmePCIEPollIntrCost to %u",
+         nvmePCIEPollIntrCost);
+   }
+#endif
+   if (nvmePCIESmallIoBytes == 0) {
+      nvmePCIESmallIoBytes = NVME_PCIE_SMALL_IO_BYTES_DEFAULT;
+      NVMEPCIELogNoHandle("change nvmePCIESmallIoBytes to %u",
+         nvmePCIESmallIoBytes);
+   }
+   if (nvmePCIEPollCpuBudget > NVME_PCIE_POLL_CPU_BUDGET_MAX) {
+      nvmePCIEPollCpuBudget = 0;
+      NVMEPCIELogNoHandle("change nvmePCIEPollCpuBudget to %u",
+         nvmePCIEPollCpuBudget);
+   }
+   if (nvmePCIEPollGroups > NVME_PCIE_POLL_GROUP_MAX) {
+      nvmePCIEPollGroups = NVME_PCIE_POLL_GROUP_MAX;
+      NVMEPCIELogNoHandle("change nvmePCIEPollGroups to %u",
+         nvmePCIEPollGroups);
+   }
+   if (nvmePCIEPollSpinBudget == 0 ||
+       nvmePCIEPollSpinBudget > NVME_PCIE_POLL_SPIN_BUDGET_MAX) {
+      nvmePCIEPollSpinBudget = NVME_PCIE_POLL_SPIN_BUDGET_DEFAULT;
+      NVMEPCIELogNoHandle("change nvmePCIEPollSpinBudget to %u",
+         nvmePCIEPollSpinBudget);
+   }
+   if (nvmePCIEPollSleepPct > 100) {
+      nvmePCIEPollSleepPct = NVME_PCIE_POLL_SLEEP_PCT_DEFAULT;
+      NVMEPCIELogNoHandle("change nvmePCIEPollSleepPct to %u",
+         nvmePCIEPollSleepPct);
+   }
+#endif
+   if (nvmePCIEStallThr > NVME_PCIE_STALL_THR_MAX) {
+      nvmePCIEStallThr = NVME_PCIE_STALL_THR_MAX;
+      NVMEPCIELogNoHandle("change nvmePCIEStallThr to %u",
+         nvmePCIEStallThr);
+   }
+   if (nvmePCIETraceRate > NVME_PCIE_TRACE_RATE_MAX) {
+      nvmePCIETraceRate = NVME_PCIE_TRACE_RATE_MAX;
+      NVMEPCIELogNoHandle("change nvmePCIETraceRate to %u",
+         nvmePCIETraceRate);
+   }
+   if (nvmePCIEOutlierThr > NVME_PCIE_OUTLIER_THR_MAX) {
+      nvmePCIEOutlierThr = NVME_PCIE_OUTLIER_THR_MAX;
+      NVMEPCIELogNoHandle("change nvmePCIEOutlierThr to %u",
+         nvmePCIEOutlierThr);
+   }
+   if (nvmePCIEStatsSampleRate > NVME_PCIE_STATS_SAMPLE_RATE_MAX) {
+      nvmePCIEStatsSampleRate = NVME_PCIE_STATS_SAMPLE_RATE_MAX;
+      NVMEPCIELogNoHandle("change nvmePCIEStatsSampleRate to %u",
+         nvmePCIEStatsSampleRate);
+   }
 }
 /**
  * Module entry point
@@ -204,6 +388,8 @@ HeapCreate()
    VMK_ReturnStatus vmkStatus;
    vmk_HeapCreateProps props;
    vmk_ByteCount maxSize;
+   vmk_ByteCount worldAlign = 0;
+   vmk_ByteCount worldSize = vmk_WorldCreateAllocSize(&worldAlign);
 
    vmk_HeapAllocationDescriptor heapAllocDesc[] = {
 
@@ -237,6 +423,16 @@ HeapCreate()
          .alignment = 0,
          .count = NVME_PCIE_MAX_CONTROLLERS
       },
+      {
+         .size = vmk_SpinlockAllocSize(VMK_SPINLOCK),
+         .alignment = 0,
+         .count = NVME_PCIE_MAX_CONTROLLERS
+      },
+      {
+         .size = vmk_SpinlockAllocSize(VMK_SPINLOCK),
+         .alignment = 0,
+         .count = NVME_PCIE_MAX_CONTROLLERS
+      },
       {
          .size = sizeof(vmk_IntrCookie) * (NVME_PCIE_MAX_IO_QUEUES + 1),
          .alignment = 0,
@@ -247,6 +443,17 @@ HeapCreate()
          .alignment = 0,
          .count = NVME_PCIE_MAX_CONTROLLERS
       },
+      {
+         .size = worldSize,
+         .alignment = worldAlign,
+         .count = NVME_PCIE_MAX_CONTROLLERS
+      },
+      {
+         .size = sizeof(NVMEPCIEQueueRef) * NVME_PCIE_QUEUE_REF_SLOTS *
+                 (NVME_PCIE_MAX_IO_QUEUES + 1),
+         .alignment = VMK_L1_CACHELINE_SIZE,
+         .count = NVME_PCIE_MAX_CONTROLLERS
+      },
    };
 
    /* Ensures that this function is not called twice. */
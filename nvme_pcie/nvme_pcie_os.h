@@ -79,6 +79,7 @@ enum NVMEPCIELockRank {
    NVME_LOCK_RANK_LOW,
    NVME_LOCK_RANK_MEDIUM,
    NVME_LOCK_RANK_HIGH,
+   NVME_LOCK_RANK_HIGHEST,
 };
 
 /**
@@ -183,6 +184,19 @@ NVMEPCIEGetTimerUs()
    return vmk_TimerUnsignedTCToUS(vmk_GetTimerCycles());
 }
 
+/**
+ * Hint the CPU that the caller is spinning
+ */
+static inline void
+NVMEPCIECpuRelax(void)
+{
+#if defined(__x86_64__)
+   __asm__ __volatile__("pause" ::: "memory");
+#elif defined(__aarch64__)
+   __asm__ __volatile__("yield" ::: "memory");
+#endif
+}
+
 VMK_ReturnStatus NVMEPCIELockCreateNoRank(const char *name, vmk_Lock *lock);
 VMK_ReturnStatus NVMEPCIELockCreate(vmk_LockDomainID domain,
                                     vmk_LockRank rank,
@@ -0,0 +1,126 @@
+/*****************************************************************************
+ * Copyright (c) 2023 VMware, Inc. All rights reserved.
+ *****************************************************************************/
+
+/*
+ * @file: nvme_pcie_poll_policy.h --
+ *
+ *    Interrupt/poll mode switching policy of nvme_pcie driver.
+ *
+ *    Pure functions of queue load and configuration, shared by the driver
+ *    and the host side trace replay simulator nvme_pcie_poll_sim.c. The
+ *    includer defines vmk_uint32, vmk_uint64, vmk_Bool, VMK_TRUE and
+ *    VMK_FALSE first.
+ */
+
+#ifndef _NVME_PCIE_POLL_POLICY_H_
+#define _NVME_PCIE_POLL_POLICY_H_
+
+// IOPs threshold to enable polling per queue, currently 100k
+#define NVME_PCIE_POLL_IOPS_THRES_PER_QUEUE (100 * 1024)
+// IOPs threshold below which polling may be left per queue
+#define NVME_PCIE_POLL_IOPS_EXIT_THRES_PER_QUEUE \
+   (NVME_PCIE_POLL_IOPS_THRES_PER_QUEUE / 2)
+
+/**
+ * Thresholds of a queue, snapshot of controller or auto tuned values
+ */
+typedef struct NVMEPCIEPollPolicy {
+   // OIO to enter polling
+   vmk_uint32 oioThr;
+   // OIO below which polling may be left
+   vmk_uint32 oioExitThr;
+   // Minimum time in us in a mode before leaving it
+   vmk_uint64 dwellUs;
+   // Busy poll, keep polling while anything is outstanding
+   vmk_Bool busy;
+} NVMEPCIEPollPolicy;
+
+// Results of NVMEPCIEPollPolicyEnter()
+#define NVME_PCIE_POLL_ENTER_NO       0
+#define NVME_PCIE_POLL_ENTER_YES      1
+// Load is high enough but the queue is still within 'dwellUs'
+#define NVME_PCIE_POLL_ENTER_DEFERRED 2
+
+/**
+ * Whether a queue in interrupt mode should enter polling by its load
+ *
+ * Polling is entered when OIO reaches 'oioThr' or IOPs reaches
+ * NVME_PCIE_POLL_IOPS_THRES_PER_QUEUE, but not before the queue has been in
+ * interrupt mode for 'dwellUs'.
+ *
+ * @param[in]  policy     Thresholds of the queue
+ * @param[in]  oio        Outstanding commands
+ * @param[in]  iops       Estimated IOPs
+ * @param[in]  modeAgeUs  Time in us since the last mode transition
+ *
+ * @return NVME_PCIE_POLL_ENTER_*
+ */
+static inline vmk_uint32
+NVMEPCIEPollPolicyEnter(const NVMEPCIEPollPolicy *policy,
+                        vmk_uint32 oio,
+                        vmk_uint32 iops,
+                        vmk_uint64 modeAgeUs)
+{
+   if (oio < policy->oioThr && iops < NVME_PCIE_POLL_IOPS_THRES_PER_QUEUE) {
+      return NVME_PCIE_POLL_ENTER_NO;
+   }
+   if (modeAgeUs < policy->dwellUs) {
+      return NVME_PCIE_POLL_ENTER_DEFERRED;
+   }
+   return NVME_PCIE_POLL_ENTER_YES;
+}
+
+/**
+ * Whether a queue in poll mode should stay in polling by its load
+ *
+ * Polling is kept while OIO is at least 'oioExitThr', IOPs is at least
+ * NVME_PCIE_POLL_IOPS_EXIT_THRES_PER_QUEUE, the queue has been polled for
+ * less than 'dwellUs', or in busy poll mode, as long as any command is
+ * outstanding.
+ *
+ * @param[in]  policy     Thresholds of the queue
+ * @param[in]  oio        Outstanding commands
+ * @param[in]  iops       Estimated IOPs
+ * @param[in]  modeAgeUs  Time in us since the last mode transition
+ *
+ * @return Whether to stay in polling mode
+ */
+static inline vmk_Bool
+NVMEPCIEPollPolicyStay(const NVMEPCIEPollPolicy *policy,
+                       vmk_uint32 oio,
+                       vmk_uint32 iops,
+                       vmk_uint64 modeAgeUs)
+{
+   // Nothing outstanding, nothing to poll for
+   if (oio == 0) {
+      return VMK_FALSE;
+   }
+   return oio >= policy->oioExitThr ||
+          iops >= NVME_PCIE_POLL_IOPS_EXIT_THRES_PER_QUEUE ||
+          modeAgeUs < policy->dwellUs ||
+          policy->busy;
+}
+
+/**
+ * Whether leaving polling is held back by the dwell time only
+ *
+ * @param[in]  policy     Thresholds of the queue
+ * @param[in]  oio        Outstanding commands
+ * @param[in]  iops       Estimated IOPs
+ * @param[in]  modeAgeUs  Time in us since the last mode transition
+ *
+ * @return Whether load is below both exit thresholds within 'dwellUs'
+ */
+static inline vmk_Bool
+NVMEPCIEPollPolicyExitDeferred(const NVMEPCIEPollPolicy *policy,
+                               vmk_uint32 oio,
+                               vmk_uint32 iops,
+                               vmk_uint64 modeAgeUs)
+{
+   return oio < policy->oioExitThr &&
+          iops < NVME_PCIE_POLL_IOPS_EXIT_THRES_PER_QUEUE &&
+          modeAgeUs < policy->dwellUs;
+}
+
+#endif // ifndef _NVME_PCIE_POLL_POLICY_H_
@@ -0,0 +1,298 @@
+/*****************************************************************************
+ * Copyright (c) 2023 VMware, Inc. All rights reserved.
+ *****************************************************************************/
+
+/*
+ * @file: nvme_pcie_poll_sim.c --
+ *
+ *    Host side trace replay simulator of interrupt/poll mode switching.
+ *
+ *    Replays a recorded OIO and IOPs trace of one IO queue through the
+ *    same NVMEPCIEPollPolicyEnter/Stay() the driver uses, and reports mode
+ *    transitions and an estimate of the host latency added per IO. Not
+ *    part of the driver, build and run on Linux:
+ *
+ *       cc -O2 -o nvme_pcie_poll_sim nvme_pcie_poll_sim.c
+ *       nvme_pcie_poll_sim [options] trace.txt
+ *
+ *    A trace line is either
+ *       <timeUs> <oio> <iops>
+ *    in increasing time, or a row of the per queue 'occupancy' management
+ *    key output
+ *       <ageMs> <sqDepth> <outstanding> <iops>
+ *    newest first, as dumped by the driver. Other lines are ignored.
+ *
+ *    The policy is evaluated once per sample, the driver evaluates it per
+ *    interrupt or poll round, so the replay is as fine as the trace. Only
+ *    the load based decision is replayed: block size aware polling, cost
+ *    model and CPU budget governor vetoes need per command data the trace
+ *    does not have.
+ *
+ *    Latency model: in interrupt mode every IO pays the interrupt cost, in
+ *    poll mode half of the poll interval (nothing with busy poll), and a
+ *    transition delays the IOs outstanding at that time by the transition
+ *    cost.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef unsigned int vmk_uint32;
+typedef unsigned long long vmk_uint64;
+typedef unsigned char vmk_Bool;
+#define VMK_TRUE 1
+#define VMK_FALSE 0
+
+#include "nvme_pcie_poll_policy.h"
+
+// Driver defaults of module parameters
+#define SIM_OIO_THR_DEFAULT         30
+#define SIM_OIO_EXIT_THR_DEFAULT    15
+#define SIM_DWELL_US_DEFAULT        1000
+#define SIM_POLL_INTERVAL_US        50
+#define SIM_INTR_COST_US            5
+#define SIM_TRANSITION_US           10
+
+typedef struct SimSample {
+   double timeUs;
+   vmk_uint32 oio;
+   vmk_uint32 iops;
+} SimSample;
+
+typedef struct SimResult {
+   vmk_uint64 enters;
+   vmk_uint64 exits;
+   vmk_uint64 entersDeferred;
+   vmk_uint64 exitsDeferred;
+   double intrUs;
+   double pollUs;
+   double ios;
+   double addedUs;
+} SimResult;
+
+static void
+Usage(const char *prog)
+{
+   fprintf(stderr,
+           "usage: %s [-e oioThr] [-x oioExitThr] [-d dwellUs] [-b]\n"
+           "          [-p pollIntervalUs] [-c intrCostUs] [-t transitionUs]"
+           " trace\n"
+           "defaults: -e %u -x %u -d %u -p %u -c %u -t %u\n",
+           prog, SIM_OIO_THR_DEFAULT, SIM_OIO_EXIT_THR_DEFAULT,
+           SIM_DWELL_US_DEFAULT, SIM_POLL_INTERVAL_US, SIM_INTR_COST_US,
+           SIM_TRANSITION_US);
+   exit(2);
+}
+
+/**
+ * Load samples of a trace file
+ *
+ * @param[in]  path     Trace file
+ * @param[out] num      Number of samples
+ *
+ * @return Samples in increasing time, NULL on error
+ */
+static SimSample *
+LoadTrace(const char *path, size_t *num)
+{
+   FILE *f = fopen(path, "r");
+   SimSample *samples = NULL, *s;
+   size_t n = 0, cap = 0, i;
+   char line[256];
+   double a;
+   unsigned int b, c, d;
+   int fields, occupancy = -1;
+
+   if (f == NULL) {
+      perror(path);
+      return NULL;
+   }
+   while (fgets(line, sizeof(line), f) != NULL) {
+      fields = sscanf(line, "%lf %u %u %u", &a, &b, &c, &d);
+      if (fields < 3) {
+         continue;
+      }
+      if (occupancy < 0) {
+         occupancy = fields == 4;
+      }
+      if (n == cap) {
+         cap = cap ? cap * 2 : 1024;
+         samples = realloc(samples, cap * sizeof(*samples));
+         if (samples == NULL) {
+            fclose(f);
+            return NULL;
+         }
+      }
+      s = &samples[n++];
+      if (occupancy) {
+         s->timeUs = -a * 1000;
+         s->oio = c;
+         s->iops = d;
+      } else {
+         s->timeUs = a;
+         s->oio = b;
+         s->iops = c;
+      }
+   }
+   fclose(f);
+
+   // Occupancy rows are newest first
+   if (occupancy == 1) {
+      for (i = 0; i < n / 2; i++) {
+         SimSample t = samples[i];
+         samples[i] = samples[n - 1 - i];
+         samples[n - 1 - i] = t;
+      }
+   }
+   *num = n;
+   return samples;
+}
+
+/**
+ * Replay samples through the driver policy
+ *
+ * @param[in]  policy        Thresholds
+ * @param[in]  samples       Trace
+ * @param[in]  num           Number of samples
+ * @param[in]  pollUs        Poll interval in us
+ * @param[in]  intrCostUs    Interrupt cost in us
+ * @param[in]  transitionUs  Cost of a mode transition in us
+ * @param[out] res           Result
+ */
+static void
+Replay(const NVMEPCIEPollPolicy *policy,
+       const SimSample *samples,
+       size_t num,
+       double pollUs,
+       double intrCostUs,
+       double transitionUs,
+       SimResult *res)
+{
+   vmk_Bool polling = VMK_FALSE, transition;
+   double modeTs = samples[0].timeUs, dt, ios;
+   vmk_uint64 age;
+   size_t i;
+
+   memset(res, 0, sizeof(*res));
+   for (i = 0; i < num; i++) {
+      if (i + 1 < num) {
+         dt = samples[i + 1].timeUs - samples[i].timeUs;
+         dt = dt > 0 ? dt : 0;
+      } else {
+         dt = 0;
+      }
+      age = (vmk_uint64)(samples[i].timeUs - modeTs);
+
+      transition = VMK_FALSE;
+      if (!polling) {
+         switch (NVMEPCIEPollPolicyEnter(policy, samples[i].oio,
+                                         samples[i].iops, age)) {
+            case NVME_PCIE_POLL_ENTER_YES:
+               res->enters++;
+               transition = VMK_TRUE;
+               break;
+            case NVME_PCIE_POLL_ENTER_DEFERRED:
+               res->entersDeferred++;
+               break;
+            default:
+               break;
+         }
+      } else if (NVMEPCIEPollPolicyStay(policy, samples[i].oio,
+                                        samples[i].iops, age)) {
+         if (NVMEPCIEPollPolicyExitDeferred(policy, samples[i].oio,
+                                            samples[i].iops, age)) {
+            res->exitsDeferred++;
+         }
+      } else {
+         res->exits++;
+         transition = VMK_TRUE;
+      }
+      if (transition) {
+         polling = !polling;
+         modeTs = samples[i].timeUs;
+         res->addedUs += samples[i].oio * transitionUs;
+      }
+
+      ios = samples[i].iops * dt / 1e6;
+      res->ios += ios;
+      if (polling) {
+         res->pollUs += dt;
+         res->addedUs += ios * (policy->busy ? 0 : pollUs / 2);
+      } else {
+         res->intrUs += dt;
+         res->addedUs += ios * intrCostUs;
+      }
+   }
+}
+
+int
+main(int argc, char **argv)
+{
+   NVMEPCIEPollPolicy policy;
+   double pollUs = SIM_POLL_INTERVAL_US;
+   double intrCostUs = SIM_INTR_COST_US;
+   double transitionUs = SIM_TRANSITION_US;
+   SimSample *samples;
+   SimResult res;
+   size_t num;
+   int opt;
+
+   policy.oioThr = SIM_OIO_THR_DEFAULT;
+   policy.oioExitThr = SIM_OIO_EXIT_THR_DEFAULT;
+   policy.dwellUs = SIM_DWELL_US_DEFAULT;
+   policy.busy = VMK_FALSE;
+
+   while ((opt = getopt(argc, argv, "e:x:d:bp:c:t:")) != -1) {
+      switch (opt) {
+         case 'e':
+            policy.oioThr = strtoul(optarg, NULL, 10);
+            break;
+         case 'x':
+            policy.oioExitThr = strtoul(optarg, NULL, 10);
+            break;
+         case 'd':
+            policy.dwellUs = strtoull(optarg, NULL, 10);
+            break;
+         case 'b':
+            policy.busy = VMK_TRUE;
+            break;
+         case 'p':
+            pollUs = atof(optarg);
+            break;
+         case 'c':
+            intrCostUs = atof(optarg);
+            break;
+         case 't':
+            transitionUs = atof(optarg);
+            break;
+         default:
+            Usage(argv[0]);
+      }
+   }
+   if (optind + 1 != argc) {
+      Usage(argv[0]);
+   }
+
+   samples = LoadTrace(argv[optind], &num);
+   if (samples == NULL || num == 0) {
+      fprintf(stderr, "No samples in %s.\n", argv[optind]);
+      return 1;
+   }
+
+   Replay(&policy, samples, num, pollUs, intrCostUs, transitionUs, &res);
+   printf("samples            %zu\n", num);
+   printf("duration us        %.0f\n", res.intrUs + res.pollUs);
+   printf("interrupt mode us  %.0f\n", res.intrUs);
+   printf("poll mode us       %.0f\n", res.pollUs);
+   printf("poll enters        %llu\n", res.enters);
+   printf("poll exits         %llu\n", res.exits);
+   printf("enters deferred    %llu\n", res.entersDeferred);
+   printf("exits deferred     %llu\n", res.exitsDeferred);
+   printf("IOs                %.0f\n", res.ios);
+   printf("added us per IO    %.3f\n",
+          res.ios > 0 ? res.addedUs / res.ios : 0.0);
+   free(samples);
+   return 0;
+}
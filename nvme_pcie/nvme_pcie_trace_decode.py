@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+"""
+********************************************************************************
+* Copyright (c) 2023 VMware, Inc. All rights reserved.
+********************************************************************************
+
+Decode command trace dumps of the nvme_pcie driver into per command timelines.
+
+Collect dumps by reading the 'trace' management key of the controller
+repeatedly into a file, then run
+
+   nvme_pcie_trace_decode.py trace.txt
+
+Events of a command are grouped by (qid, cid), a new timeline starts at each
+submit event. Offsets are in microseconds from the first event of the
+timeline.
+"""
+
+import sys
+
+FIELDS = ("qid", "seq", "ts", "type", "cid", "opc", "nsid", "slba", "nlb",
+          "aux")
+
+
+def ParseDump(lines):
+   """Parse dump lines, return (cyclesPerSec, events, lost)."""
+   cyclesPerSec = 0
+   events = []
+   lost = {}
+   seen = set()
+   for line in lines:
+      line = line.strip()
+      if line.startswith("cyclesPerSec:"):
+         cyclesPerSec = int(line.split(":")[1])
+         continue
+      cols = line.split("\t")
+      if len(cols) == 2 and cols[1].startswith("lost "):
+         qid = int(cols[0])
+         lost[qid] = lost.get(qid, 0) + int(cols[1].split()[1])
+         continue
+      if len(cols) != len(FIELDS) or not cols[0].isdigit():
+         continue
+      ev = dict(zip(FIELDS, cols))
+      for key in ("qid", "seq", "ts", "cid", "nsid", "slba", "nlb", "aux"):
+         ev[key] = int(ev[key])
+      ev["opc"] = int(ev["opc"], 16)
+      # Repeated reads never return an event twice, but dumps may overlap
+      if (ev["qid"], ev["seq"]) in seen:
+         continue
+      seen.add((ev["qid"], ev["seq"]))
+      events.append(ev)
+   return cyclesPerSec, events, lost
+
+
+def BuildTimelines(events):
+   """Group events into per command timelines."""
+   timelines = []
+   active = {}
+   for ev in sorted(events, key=lambda e: (e["ts"], e["qid"], e["seq"])):
+      key = (ev["qid"], ev["cid"])
+      if ev["type"] == "submit" or key not in active:
+         active[key] = [ev]
+         timelines.append(active[key])
+      else:
+         active[key].append(ev)
+      if ev["type"] == "complete":
+         del active[key]
+   return timelines
+
+
+def FormatEvent(ev):
+   if ev["type"] == "hwdone":
+      return "hwdone(status 0x%x)" % ev["aux"]
+   if ev["type"] == "timeout" and ev["aux"]:
+      return "timeout(age %us)" % ev["aux"]
+   if ev["type"] == "abort":
+      return "abort(%s)" % ("reset" if ev["aux"] else "cmd")
+   return ev["type"]
+
+
+def Main(argv):
+   if len(argv) < 2:
+      print("Usage: %s <dump file>..." % argv[0])
+      return 1
+   lines = []
+   for path in argv[1:]:
+      with open(path) as f:
+         lines.extend(f.readlines())
+
+   cyclesPerSec, events, lost = ParseDump(lines)
+   if cyclesPerSec == 0:
+      print("No cyclesPerSec found in dump")
+      return 1
+
+   for qid in sorted(lost):
+      print("qid %u: %u events lost" % (qid, lost[qid]))
+
+   for tl in BuildTimelines(events):
+      first = tl[0]
+      head = "qid %u cid %u opc 0x%x nsid %u" % (first["qid"], first["cid"],
+                                                 first["opc"], first["nsid"])
+      if first["nlb"] or first["slba"]:
+         head += " slba %u nlb %u" % (first["slba"], first["nlb"] + 1)
+      steps = ["%s +%.1f" % (FormatEvent(ev),
+                             (ev["ts"] - first["ts"]) * 1e6 / cyclesPerSec)
+               for ev in tl]
+      print("%s: %s" % (head, ", ".join(steps)))
+   return 0
+
+
+if __name__ == "__main__":
+   sys.exit(Main(sys.argv))